@@ -0,0 +1,58 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// the clock benchmarks are timed with
+using BenchmarkClock = std::chrono::steady_clock;
+
+inline double millisecondsSince(BenchmarkClock::time_point start) {
+  std::chrono::duration<double, std::milli> elapsed =
+      BenchmarkClock::now() - start;
+  return elapsed.count();
+}
+
+// Collects named measurements and writes them out as a flat JSON document so
+// runs can be diffed or plotted.
+class Benchmark {
+public:
+  struct Entry {
+    std::string name;
+    double value;
+    std::string unit;
+  };
+
+  std::string name;
+  std::vector<Entry> entries;
+
+  explicit Benchmark(const std::string &benchmarkName) : name(benchmarkName) {}
+
+  void record(const std::string &entry, double value, const char *unit) {
+    entries.push_back({entry, value, unit});
+    std::cout << name << ": " << entry << " = " << value << " " << unit
+              << std::endl;
+  }
+
+  bool write(const char *path) const {
+    std::ofstream file(path);
+    if (!file) {
+      std::cout << "ERROR::BENCHMARK::COULD_NOT_WRITE: " << path << std::endl;
+      return false;
+    }
+    file << "{\n  \"benchmark\": \"" << name << "\",\n  \"results\": [\n";
+    for (size_t i = 0; i < entries.size(); i++) {
+      const Entry &e = entries[i];
+      file << "    {\"name\": \"" << e.name << "\", \"value\": " << e.value
+           << ", \"unit\": \"" << e.unit << "\"}"
+           << (i + 1 < entries.size() ? ",\n" : "\n");
+    }
+    file << "  ]\n}\n";
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,262 @@
+#ifndef BINDLESS_H
+#define BINDLESS_H
+
+#include "../glm/glm.hpp"
+#include "../stb_image.h"
+#include "memory_tracker.hpp"
+#include "texture_streaming.hpp"
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+// GL_ARB_bindless_texture entry points, glad is generated without extensions
+typedef GLuint64(APIENTRYP PFNGLGETTEXTUREHANDLEARBPROC)(GLuint texture);
+typedef void(APIENTRYP PFNGLMAKETEXTUREHANDLERESIDENTARBPROC)(GLuint64 handle);
+typedef void(APIENTRYP PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC)(
+    GLuint64 handle);
+
+// Textures sampled through 64-bit handles stored in the material buffer, so
+// drawing needs no texture binds at all. Handles only stay resident while
+// they are used: `touch` them every frame they are drawn and `update` makes
+// the ones that went unused for EVICT_AFTER_FRAMES frames non-resident.
+// Handles are passed around as uvec2 (low, high), which is how GLSL builds a
+// sampler from them.
+//
+// A texture can not change once it has a handle, so streamed mip levels
+// come in through `replace`, which swaps the texture for a new one.
+class BindlessTextures {
+public:
+  static const unsigned int EVICT_AFTER_FRAMES = 120;
+  // replaced textures are deleted this many frames later, once the GPU is
+  // done with the frames that still sample them
+  static const unsigned int RETIRE_AFTER_FRAMES = 3;
+
+  bool available = false;
+
+  // handles made resident / non-resident during the last update
+  unsigned int madeResident = 0;
+  unsigned int madeNonResident = 0;
+
+  // Looks for the extension and loads its entry points.
+  bool init(GLADloadproc load) {
+    available = false;
+    if (!hasExtension("GL_ARB_bindless_texture"))
+      return false;
+    getTextureHandle = (PFNGLGETTEXTUREHANDLEARBPROC)load(
+        "glGetTextureHandleARB");
+    makeResident = (PFNGLMAKETEXTUREHANDLERESIDENTARBPROC)load(
+        "glMakeTextureHandleResidentARB");
+    makeNonResident = (PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC)load(
+        "glMakeTextureHandleNonResidentARB");
+    available = getTextureHandle && makeResident && makeNonResident;
+    return available;
+  }
+
+  // Loads an image into its own mipmapped texture and returns its handle,
+  // (0, 0) on failure.
+  glm::uvec2 load(const char *path) {
+    MemoryTagScope tag(MemoryTag::Textures);
+    stbi_set_flip_vertically_on_load(true);
+    int width, height, channels;
+    unsigned char *data = stbi_load(path, &width, &height, &channels, 4);
+    if (!data) {
+      std::cout << "ERROR::TEXTURE::LOAD_FAILED: " << path << std::endl;
+      return glm::uvec2(0u);
+    }
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, data);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    stbi_image_free(data);
+
+    // the texture's state is frozen once a handle exists
+    GLuint64 handle = getTextureHandle(texture);
+    size_t bytes = MemoryTracker::textureBytes(width, height, 1, 4, true);
+    MemoryTracker::gpuAllocate(MemoryTag::Textures, bytes);
+    entries[handle] = {texture, false, 0, bytes, width, height,
+                       levelCount(width, height)};
+    return split(handle);
+  }
+
+  // Replaces the texture behind `packed`, or makes a new one if it is
+  // (0, 0), by a `width`x`height` texture with a full mip chain and returns
+  // its handle, resident if the old one was. The first `count` levels come
+  // from `mips`, the others from the old texture, whose level 0 is level
+  // `offset` of the new one.
+  glm::uvec2 replace(glm::uvec2 packed, int width, int height, int offset,
+                     const TextureMip *mips, int count) {
+    MemoryTagScope tag(MemoryTag::Textures);
+    int levels = levelCount(width, height);
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexStorage2D(GL_TEXTURE_2D, levels, GL_RGBA8, width, height);
+    for (int level = 0; level < count && level < levels; level++)
+      glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, mips[level].width,
+                      mips[level].height, GL_RGBA, GL_UNSIGNED_BYTE,
+                      mips[level].pixels.data());
+
+    Entry entry = {texture, false, frame,
+                   MemoryTracker::textureBytes(width, height, 1, 4, true),
+                   width, height, levels};
+    // the old texture's map node is reused for the new handle, so swapping
+    // levels in and out does not allocate once `retired` has grown
+    auto node = entries.extract(join(packed));
+    if (!node.empty()) {
+      const Entry &old = node.mapped();
+      for (int level = count; level < levels; level++) {
+        int source = level - offset;
+        if (source < 0 || source >= old.levels)
+          continue;
+        glCopyImageSubData(old.texture, GL_TEXTURE_2D, source, 0, 0, 0,
+                           texture, GL_TEXTURE_2D, level, 0, 0, 0,
+                           std::max(width >> level, 1),
+                           std::max(height >> level, 1), 1);
+      }
+      entry.resident = old.resident;
+      entry.lastUsed = old.lastUsed;
+      retired.push_back({node.key(), old, frame});
+    }
+    GLuint64 handle = getTextureHandle(texture);
+    if (entry.resident)
+      makeResident(handle);
+    MemoryTracker::gpuAllocate(MemoryTag::Textures, entry.bytes);
+    if (node.empty()) {
+      entries[handle] = entry;
+    } else {
+      node.key() = handle;
+      node.mapped() = entry;
+      entries.insert(std::move(node));
+    }
+    return split(handle);
+  }
+
+  // marks a handle as used this frame, making it resident if it is not
+  void touch(glm::uvec2 packed) {
+    auto it = entries.find(join(packed));
+    if (it == entries.end())
+      return;
+    Entry &entry = it->second;
+    entry.lastUsed = frame;
+    if (!entry.resident) {
+      makeResident(it->first);
+      entry.resident = true;
+      madeResident++;
+    }
+  }
+
+  // Call once per frame before any touch: evicts stale handles and starts a
+  // new frame.
+  void update() {
+    madeResident = 0;
+    madeNonResident = 0;
+    frame++;
+    for (auto &it : entries) {
+      Entry &entry = it.second;
+      if (entry.resident && frame - entry.lastUsed > EVICT_AFTER_FRAMES) {
+        makeNonResident(it.first);
+        entry.resident = false;
+        madeNonResident++;
+      }
+    }
+    retired.erase(std::remove_if(retired.begin(), retired.end(),
+                                 [&](const Retired &r) {
+                                   if (frame - r.frame <= RETIRE_AFTER_FRAMES)
+                                     return false;
+                                   release(r.handle, r.entry);
+                                   return true;
+                                 }),
+                  retired.end());
+  }
+
+  unsigned int residentCount() const {
+    unsigned int count = 0;
+    for (const auto &it : entries)
+      count += it.second.resident;
+    return count;
+  }
+  unsigned int textureCount() const { return entries.size(); }
+
+  void destroy() {
+    for (auto &it : entries)
+      release(it.first, it.second);
+    entries.clear();
+    for (const Retired &r : retired)
+      release(r.handle, r.entry);
+    retired.clear();
+  }
+
+private:
+  struct Entry {
+    unsigned int texture;
+    bool resident;
+    unsigned int lastUsed;
+    size_t bytes;
+    int width;
+    int height;
+    int levels;
+  };
+  struct Retired {
+    GLuint64 handle;
+    Entry entry;
+    unsigned int frame;
+  };
+  std::unordered_map<GLuint64, Entry> entries;
+  std::vector<Retired> retired;
+  unsigned int frame = 0;
+
+  PFNGLGETTEXTUREHANDLEARBPROC getTextureHandle = nullptr;
+  PFNGLMAKETEXTUREHANDLERESIDENTARBPROC makeResident = nullptr;
+  PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC makeNonResident = nullptr;
+
+  static bool hasExtension(const char *name) {
+    int count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (int i = 0; i < count; i++) {
+      const char *extension = (const char *)glGetStringi(GL_EXTENSIONS, i);
+      if (extension && std::strcmp(extension, name) == 0)
+        return true;
+    }
+    return false;
+  }
+
+  void release(GLuint64 handle, const Entry &entry) {
+    if (entry.resident)
+      makeNonResident(handle);
+    glDeleteTextures(1, &entry.texture);
+    MemoryTracker::gpuRelease(MemoryTag::Textures, entry.bytes);
+  }
+
+  static int levelCount(int width, int height) {
+    int levels = 1;
+    while ((std::max(width, height) >> levels) > 0)
+      levels++;
+    return levels;
+  }
+
+  static glm::uvec2 split(GLuint64 handle) {
+    return glm::uvec2((unsigned int)(handle & 0xffffffffu),
+                      (unsigned int)(handle >> 32));
+  }
+  static GLuint64 join(glm::uvec2 packed) {
+    return ((GLuint64)packed.y << 32) | packed.x;
+  }
+};
+
+#endif
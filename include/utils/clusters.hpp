@@ -0,0 +1,286 @@
+#ifndef CLUSTERS_H
+#define CLUSTERS_H
+
+#include "../glm/glm.hpp"
+#include "lights.hpp"
+#include "memory_tracker.hpp"
+#include "shader.hpp"
+#include <glad/glad.h>
+
+#include <cmath>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Froxel grid for clustered forward shading. The view frustum is split into
+// DIM_X * DIM_Y screen tiles and DIM_Z exponential depth slices; every frame
+// each cluster gets the list of lights whose range sphere touches it, either
+// by the clusters.comp compute shader or by the SSE CPU fallback below.
+class ClusterGrid {
+public:
+  static const unsigned int DIM_X = 16;
+  static const unsigned int DIM_Y = 9;
+  static const unsigned int DIM_Z = 24;
+  static const unsigned int COUNT = DIM_X * DIM_Y * DIM_Z;
+  static const unsigned int MAX_LIGHTS_PER_CLUSTER = 128;
+  // local size of clusters.comp, one invocation per cluster
+  static const unsigned int WORKGROUP_SIZE = 128;
+
+  // shader storage bindings (0 is the light buffer, see LightManager)
+  static const unsigned int BOUNDS_BINDING = 1;
+  static const unsigned int GRID_BINDING = 2;
+  static const unsigned int INDEX_BINDING = 3;
+
+  bool useCompute = true;
+  bool computeAvailable = false;
+
+  // stats from the last CPU build (the compute path never reads back)
+  unsigned int maxLightsInCluster = 0;
+  float averageLightsPerCluster = 0.0f;
+
+  // `computeShader` is the clusters.comp program, or null to always cull on
+  // the CPU
+  void init(Shader *computeShader) {
+    MemoryTagScope tag(MemoryTag::Lighting);
+    cullShader = computeShader;
+    computeAvailable = cullShader != nullptr;
+    useCompute = computeAvailable;
+
+    glGenBuffers(1, &boundsBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundsBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, COUNT * 2 * sizeof(glm::vec4),
+                 NULL, GL_STATIC_DRAW);
+    glGenBuffers(1, &gridBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gridBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, COUNT * sizeof(glm::uvec2), NULL,
+                 GL_DYNAMIC_DRAW);
+    glGenBuffers(1, &indexBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, indexBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER,
+                 COUNT * MAX_LIGHTS_PER_CLUSTER * sizeof(unsigned int), NULL,
+                 GL_DYNAMIC_DRAW);
+    MemoryTracker::gpuAllocate(MemoryTag::Lighting, gpuBytes());
+    bind();
+
+    bounds.resize(COUNT * 2);
+    grid.resize(COUNT);
+    indices.reserve(COUNT * 8);
+  }
+
+  void destroy() {
+    glDeleteBuffers(1, &boundsBuffer);
+    glDeleteBuffers(1, &gridBuffer);
+    glDeleteBuffers(1, &indexBuffer);
+    MemoryTracker::gpuRelease(MemoryTag::Lighting, gpuBytes());
+  }
+
+  void bind() const {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BOUNDS_BINDING, boundsBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GRID_BINDING, gridBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INDEX_BINDING, indexBuffer);
+  }
+
+  // Recomputes the view space cluster AABBs; only does work when the
+  // projection actually changed (fov zoom, resize).
+  void setProjection(const glm::mat4 &projection, float near, float far,
+                     glm::vec2 screen) {
+    if (projection == lastProjection && screen == screenSize)
+      return;
+    lastProjection = projection;
+    zNear = near;
+    zFar = far;
+    screenSize = screen;
+
+    glm::mat4 inverse = glm::inverse(projection);
+    for (unsigned int z = 0; z < DIM_Z; z++) {
+      float sliceNear = sliceDepth(z);
+      float sliceFar = sliceDepth(z + 1);
+      for (unsigned int y = 0; y < DIM_Y; y++) {
+        for (unsigned int x = 0; x < DIM_X; x++) {
+          glm::vec2 ndcMin(-1.0f + 2.0f * x / DIM_X, -1.0f + 2.0f * y / DIM_Y);
+          glm::vec2 ndcMax(-1.0f + 2.0f * (x + 1) / DIM_X,
+                           -1.0f + 2.0f * (y + 1) / DIM_Y);
+          glm::vec3 a = nearPlanePoint(inverse, ndcMin);
+          glm::vec3 b = nearPlanePoint(inverse, ndcMax);
+
+          // scale the near plane corners out to the slice depths
+          glm::vec3 p0 = a * (sliceNear / -a.z), p1 = a * (sliceFar / -a.z);
+          glm::vec3 p2 = b * (sliceNear / -b.z), p3 = b * (sliceFar / -b.z);
+          glm::vec3 mn = glm::min(glm::min(p0, p1), glm::min(p2, p3));
+          glm::vec3 mx = glm::max(glm::max(p0, p1), glm::max(p2, p3));
+
+          unsigned int i = index(x, y, z);
+          bounds[i * 2] = glm::vec4(mn, 0.0f);
+          bounds[i * 2 + 1] = glm::vec4(mx, 0.0f);
+        }
+      }
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundsBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                    bounds.size() * sizeof(glm::vec4), bounds.data());
+  }
+
+  // Assigns lights to clusters for this frame's view matrix.
+  void cull(const glm::mat4 &view, const LightManager &lights) {
+    bind();
+    if (useCompute && computeAvailable) {
+      cullShader->use();
+      cullShader->setMat4("view", view);
+      cullShader->setUInt("lightCount", lights.count());
+      cullShader->setUInt("clusterCount", COUNT);
+      glDispatchCompute((COUNT + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+      glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+      return;
+    }
+    cullCpu(view, lights.packedLights());
+  }
+
+  // uniforms every shader that walks the grid needs
+  void setUniforms(const Shader &shader) const {
+    float logRatio = std::log(zFar / zNear);
+    shader.setUVec3("clusterDims", glm::uvec3(DIM_X, DIM_Y, DIM_Z));
+    shader.setVec2("screenSize", screenSize);
+    shader.setFloat("zNear", zNear);
+    shader.setFloat("zFar", zFar);
+    shader.setFloat("sliceScale", DIM_Z / logRatio);
+    shader.setFloat("sliceBias", -(DIM_Z * std::log(zNear)) / logRatio);
+  }
+
+private:
+  Shader *cullShader = nullptr;
+  unsigned int boundsBuffer = 0;
+  unsigned int gridBuffer = 0;
+  unsigned int indexBuffer = 0;
+
+  glm::mat4 lastProjection = glm::mat4(0.0f);
+  glm::vec2 screenSize = glm::vec2(0.0f);
+  float zNear = 0.1f;
+  float zFar = 100.0f;
+
+  std::vector<glm::vec4> bounds;
+  std::vector<glm::uvec2> grid;
+  std::vector<unsigned int> indices;
+
+  // view space lights, then the per slice subset in SoA form padded to a
+  // multiple of 4 for SSE
+  std::vector<glm::vec4> viewLights;
+  std::vector<float> lx, ly, lz, lr;
+  std::vector<unsigned int> sliceLights;
+
+  static unsigned int index(unsigned int x, unsigned int y, unsigned int z) {
+    return x + DIM_X * (y + DIM_Y * z);
+  }
+
+  float sliceDepth(unsigned int slice) const {
+    return zNear * std::pow(zFar / zNear, (float)slice / DIM_Z);
+  }
+
+  static glm::vec3 nearPlanePoint(const glm::mat4 &inverse, glm::vec2 ndc) {
+    glm::vec4 p = inverse * glm::vec4(ndc, -1.0f, 1.0f);
+    return glm::vec3(p) / p.w;
+  }
+
+  static size_t gpuBytes() {
+    return COUNT * (2 * sizeof(glm::vec4) + sizeof(glm::uvec2) +
+                    MAX_LIGHTS_PER_CLUSTER * sizeof(unsigned int));
+  }
+
+  void cullCpu(const glm::mat4 &view, const std::vector<GpuLight> &lights) {
+    MemoryTagScope tag(MemoryTag::Lighting);
+    indices.clear();
+    maxLightsInCluster = 0;
+
+    viewLights.clear();
+    for (const GpuLight &light : lights) {
+      glm::vec4 pr = light.positionRange;
+      viewLights.push_back(
+          glm::vec4(glm::vec3(view * glm::vec4(glm::vec3(pr), 1.0f)), pr.w));
+    }
+
+    for (unsigned int z = 0; z < DIM_Z; z++) {
+      float sliceNear = sliceDepth(z);
+      float sliceFar = sliceDepth(z + 1);
+
+      // gather the lights overlapping this depth slice
+      lx.clear(), ly.clear(), lz.clear(), lr.clear(), sliceLights.clear();
+      for (unsigned int i = 0; i < viewLights.size(); i++) {
+        glm::vec4 v = viewLights[i];
+        if (-v.z + v.w < sliceNear || -v.z - v.w > sliceFar)
+          continue;
+        lx.push_back(v.x), ly.push_back(v.y), lz.push_back(v.z);
+        lr.push_back(v.w * v.w);
+        sliceLights.push_back(i);
+      }
+      while (lx.size() % 4 != 0) {
+        // padding lights can never pass the distance test
+        lx.push_back(0.0f), ly.push_back(0.0f), lz.push_back(0.0f);
+        lr.push_back(-1.0f);
+      }
+
+      for (unsigned int y = 0; y < DIM_Y; y++) {
+        for (unsigned int x = 0; x < DIM_X; x++) {
+          unsigned int c = index(x, y, z);
+          unsigned int offset = indices.size();
+          cullCluster(bounds[c * 2], bounds[c * 2 + 1]);
+          unsigned int count = indices.size() - offset;
+          grid[c] = glm::uvec2(offset, count);
+          if (count > maxLightsInCluster)
+            maxLightsInCluster = count;
+        }
+      }
+    }
+    averageLightsPerCluster = (float)indices.size() / COUNT;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gridBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, grid.size() * sizeof(grid[0]),
+                    grid.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, indexBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                    indices.size() * sizeof(unsigned int), indices.data());
+  }
+
+  // sphere vs AABB for four lights at a time
+  void cullCluster(glm::vec4 mn, glm::vec4 mx) {
+    unsigned int found = 0;
+#if defined(__SSE2__)
+    __m128 zero = _mm_setzero_ps();
+    __m128 minX = _mm_set1_ps(mn.x), maxX = _mm_set1_ps(mx.x);
+    __m128 minY = _mm_set1_ps(mn.y), maxY = _mm_set1_ps(mx.y);
+    __m128 minZ = _mm_set1_ps(mn.z), maxZ = _mm_set1_ps(mx.z);
+    for (unsigned int i = 0; i < lx.size(); i += 4) {
+      __m128 x = _mm_loadu_ps(&lx[i]);
+      __m128 y = _mm_loadu_ps(&ly[i]);
+      __m128 z = _mm_loadu_ps(&lz[i]);
+      __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minX, x), zero),
+                             _mm_sub_ps(x, maxX));
+      __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minY, y), zero),
+                             _mm_sub_ps(y, maxY));
+      __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minZ, z), zero),
+                             _mm_sub_ps(z, maxZ));
+      __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                             _mm_mul_ps(dz, dz));
+      int mask = _mm_movemask_ps(_mm_cmple_ps(d2, _mm_loadu_ps(&lr[i])));
+      while (mask && found < MAX_LIGHTS_PER_CLUSTER) {
+        int bit = __builtin_ctz(mask);
+        indices.push_back(sliceLights[i + bit]);
+        found++;
+        mask &= mask - 1;
+      }
+    }
+#else
+    for (unsigned int i = 0; i < sliceLights.size(); i++) {
+      float dx = glm::max(glm::max(mn.x - lx[i], 0.0f), lx[i] - mx.x);
+      float dy = glm::max(glm::max(mn.y - ly[i], 0.0f), ly[i] - mx.y);
+      float dz = glm::max(glm::max(mn.z - lz[i], 0.0f), lz[i] - mx.z);
+      if (dx * dx + dy * dy + dz * dz <= lr[i] &&
+          found < MAX_LIGHTS_PER_CLUSTER) {
+        indices.push_back(sliceLights[i]);
+        found++;
+      }
+    }
+#endif
+  }
+};
+
+#endif
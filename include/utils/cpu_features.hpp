@@ -0,0 +1,53 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CPU_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define CPU_X86 0
+#endif
+
+// MSVC compiles AVX intrinsics without per-function target attributes
+#if CPU_X86 && (defined(__GNUC__) || defined(__clang__))
+#define CPU_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define CPU_TARGET_AVX2
+#endif
+
+// What the CPU the program runs on supports, for kernels that are picked at
+// runtime. x86-64 always has SSE2; AVX2 is detected once, on first use.
+class CpuFeatures {
+public:
+  static bool avx2() {
+#if CPU_X86
+    static const bool supported = detectAvx2();
+    return supported;
+#else
+    return false;
+#endif
+  }
+
+private:
+#if CPU_X86
+  static bool detectAvx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    // the OS must save the ymm registers (OSXSAVE + AVX, then XCR0)
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 ||
+        (_xgetbv(0) & 6) != 6)
+      return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+  }
+#endif
+};
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef ENTITIES_H
+#define ENTITIES_H
+
+#include "../glm/glm.hpp"
+#include "lights.hpp"
+#include "memory_tracker.hpp"
+#include "transforms.hpp"
+
+#include <vector>
+
+// Handle to an entity. Slots are reused once an entity is destroyed, the
+// generation tells a stale handle apart from the slot's new owner.
+struct Entity {
+  unsigned int index = 0xffffffffu;
+  unsigned int generation = 0;
+
+  bool operator==(const Entity &other) const {
+    return index == other.index && generation == other.generation;
+  }
+  bool operator!=(const Entity &other) const { return !(*this == other); }
+};
+
+// component bits, an archetype holds every entity with the same set
+enum Component : unsigned int {
+  HasTransform = 1 << 0,
+  HasBounds = 1 << 1,
+  HasMesh = 1 << 2,
+  HasMaterial = 1 << 3,
+  HasLight = 1 << 4,
+  HasLod = 1 << 5,
+};
+
+// bounding sphere in the entity's local space
+struct Bounds {
+  glm::vec3 center = glm::vec3(0.0f);
+  float radius = 0.0f;
+};
+
+// index range of the shared scene element buffer, the indices are relative
+// to baseVertex; meshletCount entries of the renderer's meshlet table from
+// firstMeshlet on split the range (none if 0)
+struct Mesh {
+  int first = 0;
+  int count = 0;
+  int baseVertex = 0;
+  unsigned int firstMeshlet = 0;
+  unsigned int meshletCount = 0;
+};
+
+// levels of detail of the entity's mesh, `count` entries of the renderer's
+// LOD table from `first` on, and the level drawn last frame
+struct Lod {
+  unsigned int first = 0;
+  unsigned int count = 0;
+  unsigned int level = 0;
+};
+
+// Entities with the same components, one contiguous array per component.
+// Row i of every array belongs to entities[i]; arrays of components the
+// archetype does not have stay empty.
+struct Archetype {
+  unsigned int components;
+  std::vector<Entity> entities;
+  TransformArray transforms;
+  std::vector<Bounds> bounds;
+  std::vector<Mesh> meshes;
+  std::vector<unsigned int> materials;
+  std::vector<Light> lights;
+  std::vector<Lod> lods;
+
+  unsigned int size() const { return entities.size(); }
+  bool has(unsigned int wanted) const {
+    return (components & wanted) == wanted;
+  }
+};
+
+// Scene objects stored by archetype. Destroying an entity moves the last row
+// of its archetype into the hole, so the arrays never have gaps and systems
+// walk them front to back with `each`. Handles stay valid through that move,
+// they go through a slot table holding every entity's archetype and row.
+class EntityStore {
+public:
+  Entity create(unsigned int components) {
+    MemoryTagScope tag(MemoryTag::Scene);
+    unsigned int archetypeIndex = findArchetype(components);
+    Archetype &archetype = archetypes[archetypeIndex];
+    unsigned int index;
+    if (!freeSlots.empty()) {
+      index = freeSlots.back();
+      freeSlots.pop_back();
+    } else {
+      index = slots.size();
+      slots.push_back({0, 0, 0});
+      // every slot can end up free, destroy must not allocate
+      freeSlots.reserve(slots.capacity());
+    }
+    Slot &slot = slots[index];
+    slot.archetype = archetypeIndex;
+    slot.row = archetype.size();
+    Entity entity = {index, slot.generation};
+
+    archetype.entities.push_back(entity);
+    if (components & HasTransform)
+      // glm::quat takes w first
+      archetype.transforms.add(glm::vec3(0.0f),
+                               glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+    if (components & HasBounds)
+      archetype.bounds.push_back(Bounds());
+    if (components & HasMesh)
+      archetype.meshes.push_back(Mesh());
+    if (components & HasMaterial)
+      archetype.materials.push_back(0);
+    if (components & HasLight)
+      archetype.lights.push_back(Light());
+    if (components & HasLod)
+      archetype.lods.push_back(Lod());
+    alive++;
+    return entity;
+  }
+
+  // does nothing for handles that are already stale
+  void destroy(Entity entity) {
+    if (!valid(entity))
+      return;
+    Slot &slot = slots[entity.index];
+    Archetype &archetype = archetypes[slot.archetype];
+    unsigned int row = slot.row;
+    Entity moved = archetype.entities.back();
+    archetype.entities[row] = moved;
+    archetype.entities.pop_back();
+    if (archetype.components & HasTransform)
+      archetype.transforms.swapRemove(row);
+    swapRemove(archetype.bounds, row);
+    swapRemove(archetype.meshes, row);
+    swapRemove(archetype.materials, row);
+    swapRemove(archetype.lights, row);
+    swapRemove(archetype.lods, row);
+    slots[moved.index].row = row;
+
+    slot.generation++;
+    freeSlots.push_back(entity.index);
+    alive--;
+  }
+
+  bool valid(Entity entity) const {
+    return entity.index < slots.size() &&
+           slots[entity.index].generation == entity.generation;
+  }
+
+  unsigned int size() const { return alive; }
+
+  // entities having all of `components`
+  unsigned int count(unsigned int components) const {
+    unsigned int total = 0;
+    for (const Archetype &archetype : archetypes)
+      if (archetype.has(components))
+        total += archetype.size();
+    return total;
+  }
+
+  void reserve(unsigned int components, unsigned int n) {
+    MemoryTagScope tag(MemoryTag::Scene);
+    Archetype &archetype = archetypes[findArchetype(components)];
+    archetype.entities.reserve(n);
+    if (components & HasTransform)
+      archetype.transforms.reserve(n);
+    if (components & HasBounds)
+      archetype.bounds.reserve(n);
+    if (components & HasMesh)
+      archetype.meshes.reserve(n);
+    if (components & HasMaterial)
+      archetype.materials.reserve(n);
+    if (components & HasLight)
+      archetype.lights.reserve(n);
+    if (components & HasLod)
+      archetype.lods.reserve(n);
+    slots.reserve(slots.size() + n);
+    freeSlots.reserve(slots.capacity());
+  }
+
+  // Calls fn(archetype) for every archetype having all of `components`.
+  // Entities must not be created or destroyed from inside fn.
+  template <typename Fn> void each(unsigned int components, Fn fn) {
+    for (Archetype &archetype : archetypes)
+      if (archetype.has(components) && archetype.size())
+        fn(archetype);
+  }
+
+  // component access, the entity must be valid and have the component
+  void setTransform(Entity entity, glm::vec3 position, glm::quat rotation,
+                    glm::vec3 scale = glm::vec3(1.0f)) {
+    const Slot &slot = slots[entity.index];
+    TransformArray &transforms = archetypes[slot.archetype].transforms;
+    transforms.setPosition(slot.row, position);
+    transforms.setRotation(slot.row, rotation);
+    transforms.setScale(slot.row, scale);
+  }
+  glm::vec3 position(Entity entity) const {
+    const Slot &slot = slots[entity.index];
+    return archetypes[slot.archetype].transforms.position(slot.row);
+  }
+  Bounds &bounds(Entity entity) { return row(entity, &Archetype::bounds); }
+  Mesh &mesh(Entity entity) { return row(entity, &Archetype::meshes); }
+  unsigned int &material(Entity entity) {
+    return row(entity, &Archetype::materials);
+  }
+  Light &light(Entity entity) { return row(entity, &Archetype::lights); }
+  Lod &lod(Entity entity) { return row(entity, &Archetype::lods); }
+
+private:
+  struct Slot {
+    unsigned int generation;
+    unsigned int archetype;
+    unsigned int row;
+  };
+  std::vector<Archetype> archetypes;
+  std::vector<Slot> slots;
+  std::vector<unsigned int> freeSlots;
+  unsigned int alive = 0;
+
+  unsigned int findArchetype(unsigned int components) {
+    for (unsigned int i = 0; i < archetypes.size(); i++)
+      if (archetypes[i].components == components)
+        return i;
+    archetypes.push_back(Archetype());
+    archetypes.back().components = components;
+    return archetypes.size() - 1;
+  }
+
+  template <typename T>
+  T &row(Entity entity, std::vector<T> Archetype::*column) {
+    const Slot &slot = slots[entity.index];
+    return (archetypes[slot.archetype].*column)[slot.row];
+  }
+
+  template <typename T>
+  static void swapRemove(std::vector<T> &column, unsigned int row) {
+    if (column.empty())
+      return;
+    column[row] = column.back();
+    column.pop_back();
+  }
+};
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+// Bump allocator over one fixed block. Deallocation is a no-op for arena
+// memory, everything is released at once by `reset` (or back to a mark by
+// `rewind`). Requests that do not fit go to the upstream resource and are
+// counted in `overflows`, so a too small arena shows up in the profiler
+// instead of failing.
+class LinearArena : public std::pmr::memory_resource {
+public:
+  // bytes handed out that did not fit, since the last reset
+  size_t overflowBytes = 0;
+  unsigned int overflows = 0;
+
+  explicit LinearArena(size_t capacity) : block(capacity) {}
+
+  void reset() {
+    offset = 0;
+    overflowBytes = 0;
+    overflows = 0;
+  }
+
+  size_t used() const { return offset; }
+  size_t capacity() const { return block.size(); }
+  // high water mark over the arena's lifetime
+  size_t peak() const { return peakOffset; }
+
+  size_t mark() const { return offset; }
+  void rewind(size_t marker) { offset = marker; }
+
+private:
+  std::vector<unsigned char> block;
+  size_t offset = 0;
+  size_t peakOffset = 0;
+
+  void *do_allocate(size_t bytes, size_t alignment) override {
+    uintptr_t base = (uintptr_t)block.data();
+    uintptr_t aligned = (base + offset + alignment - 1) & ~(alignment - 1);
+    if (aligned + bytes > base + block.size()) {
+      overflowBytes += bytes;
+      overflows++;
+      return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    offset = aligned + bytes - base;
+    if (offset > peakOffset)
+      peakOffset = offset;
+    return (void *)aligned;
+  }
+
+  void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+    uintptr_t base = (uintptr_t)block.data();
+    uintptr_t address = (uintptr_t)p;
+    if (address < base || address >= base + block.size())
+      std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource &other) const
+      noexcept override {
+    return this == &other;
+  }
+};
+
+// Two linear arenas used on alternate frames. Everything allocated during a
+// frame stays valid until the end of the next one, so data built in frame N
+// (draw lists, culling results) can still be read while frame N+1 is built.
+// Call `beginFrame` once at the top of the frame loop.
+class FrameArena {
+public:
+  static const size_t DEFAULT_CAPACITY = 4 * 1024 * 1024;
+
+  explicit FrameArena(size_t capacity = DEFAULT_CAPACITY)
+      : arenas{LinearArena(capacity), LinearArena(capacity)} {}
+
+  void beginFrame() {
+    current ^= 1;
+    arenas[current].reset();
+  }
+
+  LinearArena &arena() { return arenas[current]; }
+  std::pmr::memory_resource *resource() { return &arenas[current]; }
+
+  // uninitialized storage for `count` objects, valid until the arena resets
+  template <typename T> T *allocate(size_t count) {
+    return (T *)arenas[current].allocate(count * sizeof(T), alignof(T));
+  }
+
+private:
+  LinearArena arenas[2];
+  int current = 0;
+};
+
+// Scratch allocations for the duration of a scope: everything allocated from
+// the arena inside the scope is released when it ends, e.g.
+//   ScratchScope scratch(frameArena.arena());
+//   FrameVector<int> visible(&scratch.arena);
+class ScratchScope {
+public:
+  LinearArena &arena;
+
+  explicit ScratchScope(LinearArena &linearArena)
+      : arena(linearArena), marker(linearArena.mark()) {}
+  ~ScratchScope() { arena.rewind(marker); }
+
+  ScratchScope(const ScratchScope &) = delete;
+  ScratchScope &operator=(const ScratchScope &) = delete;
+
+private:
+  size_t marker;
+};
+
+// containers allocating from a FrameArena / LinearArena
+template <typename T> using FrameVector = std::pmr::vector<T>;
+using FrameString = std::pmr::string;
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include "../glm/glm.hpp"
+
+// The six clip planes of a view projection matrix (Gribb/Hartmann), pointing
+// inwards and normalized so plane distances are world units.
+class Frustum {
+public:
+  glm::vec4 planes[6];
+
+  explicit Frustum(const glm::mat4 &viewProjection) {
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++)
+      rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i],
+                          viewProjection[2][i], viewProjection[3][i]);
+    for (int i = 0; i < 3; i++) {
+      planes[i * 2] = rows[3] + rows[i];
+      planes[i * 2 + 1] = rows[3] - rows[i];
+    }
+    for (glm::vec4 &plane : planes)
+      plane /= glm::length(glm::vec3(plane));
+  }
+
+  bool sphereVisible(glm::vec3 center, float radius) const {
+    for (const glm::vec4 &plane : planes)
+      if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+        return false;
+    return true;
+  }
+};
+
+#endif
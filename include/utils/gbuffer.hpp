@@ -0,0 +1,91 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include "memory_tracker.hpp"
+#include <glad/glad.h>
+
+#include <iostream>
+
+// Compact G-buffer for the deferred path, 8 bytes of color per pixel:
+//   normal   GL_RGB10_A2  octahedron encoded normal in rg, shininess in b
+//   albedo   GL_RGBA8     diffuse albedo in rgb, specular intensity in a
+//   depth    GL_DEPTH_COMPONENT32F, world position is rebuilt from it
+class GBuffer {
+public:
+  unsigned int fbo = 0;
+  unsigned int normal = 0;
+  unsigned int albedo = 0;
+  unsigned int depth = 0;
+  int width = 0;
+  int height = 0;
+
+  void resize(int w, int h) {
+    if (w == width && h == height)
+      return;
+    destroy();
+    width = w;
+    height = h;
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    normal = attach(GL_COLOR_ATTACHMENT0, GL_RGB10_A2, GL_RGBA,
+                    GL_UNSIGNED_INT_2_10_10_10_REV);
+    albedo = attach(GL_COLOR_ATTACHMENT1, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+    depth = attach(GL_DEPTH_ATTACHMENT, GL_DEPTH_COMPONENT32F,
+                   GL_DEPTH_COMPONENT, GL_FLOAT);
+
+    unsigned int attachments[2] = {GL_COLOR_ATTACHMENT0,
+                                   GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, attachments);
+    MemoryTracker::gpuAllocate(MemoryTag::Renderer, gpuBytes());
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+      std::cout << "ERROR::GBUFFER::FRAMEBUFFER_NOT_COMPLETE" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+
+  // bind the G-buffer targets to texture units 0 (normal), 1 (albedo) and
+  // 2 (depth) for the lighting pass
+  void bindTextures() const {
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, normal);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, albedo);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, depth);
+  }
+
+  void destroy() {
+    if (!fbo)
+      return;
+    glDeleteFramebuffers(1, &fbo);
+    unsigned int textures[3] = {normal, albedo, depth};
+    glDeleteTextures(3, textures);
+    MemoryTracker::gpuRelease(MemoryTag::Renderer, gpuBytes());
+    fbo = normal = albedo = depth = 0;
+    width = height = 0;
+  }
+
+private:
+  // 4 bytes each for normal, albedo and depth
+  size_t gpuBytes() const {
+    return MemoryTracker::textureBytes(width, height, 3, 4, false);
+  }
+
+  unsigned int attach(GLenum attachment, GLenum internalFormat, GLenum format,
+                      GLenum type) {
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format,
+                 type, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, texture,
+                           0);
+    return texture;
+  }
+};
+
+#endif
@@ -0,0 +1,309 @@
+#ifndef HIZ_H
+#define HIZ_H
+
+#include "../glm/glm.hpp"
+#include "memory_tracker.hpp"
+#include "shader.hpp"
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <iostream>
+
+// Two-phase GPU occlusion culling against a hierarchical depth buffer. The
+// CPU hands over the draws in the frustum, one per instance, and a bit per
+// object in a shader storage buffer remembers which were visible last frame:
+//   1. hiz_cull.comp writes an indirect command per draw that only draws the
+//      objects whose bit is set, and those are rendered depth-only into the
+//      Hi-Z depth target.
+//   2. hiz_pyramid.comp reduces that depth into a mip chain where every
+//      texel holds the farthest depth of the pixels under it.
+//   3. hiz_cull.comp tests the bounding sphere of every draw against the
+//      pyramid, stores the result as the object's new bit and writes a
+//      second command list with the objects that were not in the first.
+// The shading passes then draw both lists. Nothing is read back, so the
+// CPU never waits for the GPU; the cost is that an object coming out from
+// behind an occluder is found in the second phase instead of the first.
+//
+// The default framebuffer's depth cannot be sampled, which is why the first
+// phase renders into a depth texture of its own and is not the forward or
+// G-buffer pass.
+class HiZCulling {
+public:
+  // local size of both compute shaders
+  static const unsigned int WORKGROUP_SIZE = 64;
+  static const unsigned int PYRAMID_TILE = 8;
+
+  // shader storage bindings (0-4 are lights, clusters and materials)
+  static const unsigned int DRAW_BINDING = 5;
+  static const unsigned int VISIBILITY_BINDING = 6;
+  static const unsigned int COMMAND_BINDING = 7;
+  // the pyramid's source is sampled from this unit, past the texture arrays
+  static const int SOURCE_UNIT = 9;
+
+  // Matches `struct Draw` in hiz_cull.comp: a world bounding sphere and the
+  // element range of one instance, `object` picks its visibility bit. The
+  // draw's instance is its index in the list.
+  struct Draw {
+    glm::vec4 sphere;
+    unsigned int count;
+    unsigned int firstIndex;
+    int baseVertex;
+    unsigned int object;
+  };
+
+  bool computeAvailable = false;
+  // draws handed to the GPU this frame
+  unsigned int candidates = 0;
+
+  // `cullShader` and `pyramidShader` are hiz_cull.comp and hiz_pyramid.comp,
+  // null when compute shaders are not available
+  void init(Shader *cullShader, Shader *pyramidShader) {
+    this->cullShader = cullShader;
+    this->pyramidShader = pyramidShader;
+    computeAvailable = cullShader && pyramidShader;
+    glGenBuffers(1, &drawBuffer);
+    glGenBuffers(1, &visibilityBuffer);
+    glGenBuffers(1, &commandBuffer);
+  }
+
+  void destroy() {
+    destroyTargets();
+    glDeleteBuffers(1, &drawBuffer);
+    glDeleteBuffers(1, &visibilityBuffer);
+    glDeleteBuffers(1, &commandBuffer);
+    MemoryTracker::gpuRelease(MemoryTag::Renderer, bufferBytes);
+    bufferBytes = 0;
+  }
+
+  // Sizes the depth target and the pyramid to the framebuffer.
+  void resize(int w, int h) {
+    if (w == width && h == height)
+      return;
+    destroyTargets();
+    width = w;
+    height = h;
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glGenTextures(1, &depth);
+    glBindTexture(GL_TEXTURE_2D, depth);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+    setSampling(GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+                           depth, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+      std::cout << "ERROR::HIZ::FRAMEBUFFER_NOT_COMPLETE" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // level 0 is half the framebuffer rounded up, the odd texel left over
+    // by a smaller level is folded into the last one by hiz_pyramid.comp
+    pyramidWidth = (width + 1) / 2;
+    pyramidHeight = (height + 1) / 2;
+    levels = 1;
+    while ((pyramidWidth >> levels) > 0 || (pyramidHeight >> levels) > 0)
+      levels++;
+    glGenTextures(1, &pyramid);
+    glBindTexture(GL_TEXTURE_2D, pyramid);
+    glTexStorage2D(GL_TEXTURE_2D, levels, GL_R32F, pyramidWidth, pyramidHeight);
+    // texelFetch only reaches past level 0 with a mipmapped filter
+    setSampling(GL_NEAREST_MIPMAP_NEAREST);
+    MemoryTracker::gpuAllocate(MemoryTag::Renderer, targetBytes());
+  }
+
+  // Hands this frame's draws to the GPU. Object ids index the visibility
+  // bits, which are kept across frames and start out clear.
+  void upload(const Draw *draws, unsigned int count, unsigned int objectCount) {
+    candidates = count;
+    if (objectCount > objectCapacity) {
+      // cleared bits only cost the objects a frame in the second phase
+      objectCapacity = std::max(objectCount, objectCapacity * 2);
+      glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibilityBuffer);
+      glBufferData(GL_SHADER_STORAGE_BUFFER, visibilityBytes(), NULL,
+                   GL_DYNAMIC_DRAW);
+      unsigned int zero = 0;
+      glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER,
+                        GL_UNSIGNED_INT, &zero);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, count * sizeof(Draw), draws,
+                 GL_STREAM_DRAW);
+    if (count > commandCapacity) {
+      commandCapacity = std::max(count, commandCapacity * 2);
+      glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+      glBufferData(GL_SHADER_STORAGE_BUFFER,
+                   2 * commandCapacity * COMMAND_BYTES, NULL,
+                   GL_DYNAMIC_DRAW);
+    }
+    MemoryTracker::gpuRelease(MemoryTag::Renderer, bufferBytes);
+    bufferBytes = count * sizeof(Draw) + visibilityBytes() +
+                  2 * commandCapacity * COMMAND_BYTES;
+    MemoryTracker::gpuAllocate(MemoryTag::Renderer, bufferBytes);
+  }
+
+  // Clears the bit of `object` for an entity that takes its slot over,
+  // along with the others in its word, which only costs them a frame in the
+  // second phase.
+  void reset(unsigned int object) {
+    unsigned int word = object / 32;
+    if (object >= objectCapacity || word == clearedWord)
+      return;
+    clearedWord = word;
+    unsigned int zero = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibilityBuffer);
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI,
+                         word * sizeof(unsigned int), sizeof(unsigned int),
+                         GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+  }
+
+  // Runs both phases for the uploaded draws. The bound vertex array must
+  // hold the scene's vertices and per instance data in draw order;
+  // `depthShader` transforms them by its view and projection uniforms.
+  void cull(Shader &depthShader, const glm::mat4 &view,
+            const glm::mat4 &projection) {
+    // the second phase sets bits again
+    clearedWord = NONE;
+    if (!candidates)
+      return;
+    bind();
+    dispatchCull(0, view, projection);
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, width, height);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    depthShader.use();
+    depthShader.setMat4("view", view);
+    depthShader.setMat4("projection", projection);
+    drawPhase(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    buildPyramid();
+    dispatchCull(1, view, projection);
+  }
+
+  // Draws the objects of both phases with the bound shader.
+  void draw() const {
+    if (!candidates)
+      return;
+    drawPhase(0);
+    drawPhase(1);
+  }
+
+private:
+  // glMultiDrawElementsIndirect's command, five uints
+  static const size_t COMMAND_BYTES = 5 * sizeof(unsigned int);
+  static const unsigned int NONE = 0xffffffffu;
+
+  Shader *cullShader = nullptr;
+  Shader *pyramidShader = nullptr;
+  unsigned int drawBuffer = 0;
+  unsigned int visibilityBuffer = 0;
+  unsigned int commandBuffer = 0;
+  unsigned int objectCapacity = 0;
+  unsigned int commandCapacity = 0;
+  // the word `reset` cleared last since the bits were written
+  unsigned int clearedWord = NONE;
+  size_t bufferBytes = 0;
+
+  unsigned int fbo = 0;
+  unsigned int depth = 0;
+  unsigned int pyramid = 0;
+  int width = 0;
+  int height = 0;
+  int pyramidWidth = 0;
+  int pyramidHeight = 0;
+  int levels = 0;
+
+  void bind() const {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_BINDING, drawBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VISIBILITY_BINDING,
+                     visibilityBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMMAND_BINDING,
+                     commandBuffer);
+  }
+
+  // phase 0 writes the commands of last frame's visible objects, phase 1
+  // tests every draw against the pyramid and writes the rest
+  void dispatchCull(unsigned int phase, const glm::mat4 &view,
+                    const glm::mat4 &projection) {
+    cullShader->use();
+    cullShader->setUInt("phase", phase);
+    cullShader->setUInt("drawCount", candidates);
+    cullShader->setMat4("view", view);
+    cullShader->setMat4("projection", projection);
+    if (phase == 1) {
+      glActiveTexture(GL_TEXTURE0 + SOURCE_UNIT);
+      glBindTexture(GL_TEXTURE_2D, pyramid);
+      cullShader->setInt("pyramid", SOURCE_UNIT);
+      cullShader->setInt("pyramidLevels", levels);
+    }
+    glDispatchCompute((candidates + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+  }
+
+  void drawPhase(unsigned int phase) const {
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    glMultiDrawElementsIndirect(
+        GL_TRIANGLES, GL_UNSIGNED_INT,
+        (void *)(phase * candidates * COMMAND_BYTES), candidates, 0);
+  }
+
+  // level 0 from the depth target, then every level from the one above
+  void buildPyramid() {
+    pyramidShader->use();
+    pyramidShader->setInt("source", SOURCE_UNIT);
+    glActiveTexture(GL_TEXTURE0 + SOURCE_UNIT);
+    int sourceWidth = width, sourceHeight = height;
+    for (int level = 0; level < levels; level++) {
+      glBindTexture(GL_TEXTURE_2D, level == 0 ? depth : pyramid);
+      int w = std::max(pyramidWidth >> level, 1);
+      int h = std::max(pyramidHeight >> level, 1);
+      pyramidShader->setInt("sourceLevel", std::max(level - 1, 0));
+      pyramidShader->setInt("sourceWidth", sourceWidth);
+      pyramidShader->setInt("sourceHeight", sourceHeight);
+      pyramidShader->setInt("width", w);
+      pyramidShader->setInt("height", h);
+      glBindImageTexture(0, pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY,
+                         GL_R32F);
+      glDispatchCompute((w + PYRAMID_TILE - 1) / PYRAMID_TILE,
+                        (h + PYRAMID_TILE - 1) / PYRAMID_TILE, 1);
+      glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+      sourceWidth = w;
+      sourceHeight = h;
+    }
+  }
+
+  static void setSampling(GLint minFilter) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  }
+
+  size_t visibilityBytes() const {
+    return (objectCapacity + 31) / 32 * sizeof(unsigned int);
+  }
+
+  size_t targetBytes() const {
+    return MemoryTracker::textureBytes(width, height, 1, 4, false) +
+           MemoryTracker::textureBytes(pyramidWidth, pyramidHeight, 1, 4,
+                                       true);
+  }
+
+  void destroyTargets() {
+    if (!fbo)
+      return;
+    glDeleteFramebuffers(1, &fbo);
+    unsigned int textures[2] = {depth, pyramid};
+    glDeleteTextures(2, textures);
+    MemoryTracker::gpuRelease(MemoryTag::Renderer, targetBytes());
+    fbo = depth = pyramid = 0;
+    width = height = 0;
+  }
+};
+
+#endif
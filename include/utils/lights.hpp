@@ -0,0 +1,173 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include "../glm/glm.hpp"
+#include "memory_tracker.hpp"
+#include <glad/glad.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+enum LightType {
+  Point = 0,
+  Spot = 1,
+};
+
+// Matches `struct Light` in cube.frag and clusters.comp (std430, vec4 only so
+// the C++ and GLSL layouts can never drift apart).
+struct GpuLight {
+  glm::vec4 positionRange;      // xyz position, w range
+  glm::vec4 directionType;      // xyz spot direction, w LightType
+  glm::vec4 ambientCutOff;      // xyz ambient, w cos(inner cone)
+  glm::vec4 diffuseOuterCutOff; // xyz diffuse, w cos(outer cone)
+  glm::vec4 specular;           // xyz specular, w shadow map index or -1
+  glm::vec4 attenuation;        // x constant, y linear, z quadratic
+};
+static_assert(sizeof(GpuLight) == 6 * 16, "GpuLight must match std430");
+
+struct Light {
+  LightType type = Point;
+  glm::vec3 position = glm::vec3(0.0f);
+  glm::vec3 direction = glm::vec3(0.0f, -1.0f, 0.0f);
+  glm::vec3 ambient = glm::vec3(0.0f);
+  glm::vec3 diffuse = glm::vec3(1.0f);
+  glm::vec3 specular = glm::vec3(1.0f);
+  float constant = 1.0f;
+  float linear = 0.09f;
+  float quadratic = 0.032f;
+  float cutOff = glm::cos(glm::radians(12.5f));
+  float outerCutOff = glm::cos(glm::radians(17.5f));
+  bool castShadows = false;
+  // assigned by ShadowMaps every frame, -1 when the light has no shadow map
+  int shadowIndex = -1;
+
+  // distance at which the attenuated light drops below 5/256 of its peak,
+  // used as the culling radius for the cluster grid
+  float range() const {
+    glm::vec3 brightest = glm::max(diffuse, specular);
+    float peak = glm::max(glm::max(brightest.x, brightest.y), brightest.z);
+    float threshold = (256.0f / 5.0f) * glm::max(peak, 1e-3f);
+    if (threshold <= constant)
+      return 0.0f;
+    if (quadratic > 0.0f) {
+      float c = constant - threshold;
+      return (-linear + std::sqrt(linear * linear - 4.0f * quadratic * c)) /
+             (2.0f * quadratic);
+    }
+    if (linear > 0.0f)
+      return (threshold - constant) / linear;
+    return 1000.0f;
+  }
+
+  GpuLight pack() const {
+    GpuLight g;
+    g.positionRange = glm::vec4(position, range());
+    g.directionType = glm::vec4(glm::normalize(direction), (float)type);
+    g.ambientCutOff = glm::vec4(ambient, cutOff);
+    g.diffuseOuterCutOff = glm::vec4(diffuse, outerCutOff);
+    g.specular = glm::vec4(specular, (float)shadowIndex);
+    g.attenuation = glm::vec4(constant, linear, quadratic, 0.0f);
+    return g;
+  }
+};
+
+// Mirrors the frame's lights into a shader storage buffer. `lights` is
+// refilled every frame from the lights of the scene's entities.
+class LightManager {
+public:
+  static const unsigned int MAX_LIGHTS = 4096;
+  static const unsigned int BINDING = 0;
+
+  std::vector<Light> lights;
+
+  void init() {
+    glGenBuffers(1, &ssbo);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, MAX_LIGHTS * sizeof(GpuLight),
+                 NULL, GL_DYNAMIC_DRAW);
+    MemoryTracker::gpuAllocate(MemoryTag::Lighting,
+                               MAX_LIGHTS * sizeof(GpuLight));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING, ssbo);
+    MemoryTagScope tag(MemoryTag::Lighting);
+    packed.reserve(MAX_LIGHTS);
+  }
+
+  void destroy() {
+    glDeleteBuffers(1, &ssbo);
+    MemoryTracker::gpuRelease(MemoryTag::Lighting,
+                              MAX_LIGHTS * sizeof(GpuLight));
+    ssbo = 0;
+  }
+
+  unsigned int count() const {
+    return lights.size() < MAX_LIGHTS ? lights.size() : MAX_LIGHTS;
+  }
+
+  const std::vector<GpuLight> &packedLights() const { return packed; }
+
+  // True when every light has the same attenuation and every spotlight the
+  // same cone, i.e. the shaders may treat them as constants.
+  bool sharedParameters() const {
+    const Light *spot = nullptr;
+    for (unsigned int i = 0; i < count(); i++) {
+      const Light &l = lights[i];
+      if (l.constant != lights[0].constant || l.linear != lights[0].linear ||
+          l.quadratic != lights[0].quadratic)
+        return false;
+      if (l.type != Spot)
+        continue;
+      if (!spot)
+        spot = &l;
+      else if (l.cutOff != spot->cutOff || l.outerCutOff != spot->outerCutOff)
+        return false;
+    }
+    return true;
+  }
+
+  void upload() {
+    packed.clear();
+    for (unsigned int i = 0; i < count(); i++)
+      packed.push_back(lights[i].pack());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                    packed.size() * sizeof(GpuLight), packed.data());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING, ssbo);
+  }
+
+  // `n` randomly placed point and spot lights inside the given box, the same
+  // ones on every call.
+  static std::vector<Light> scatter(unsigned int n, glm::vec3 min,
+                                    glm::vec3 max) {
+    MemoryTagScope tag(MemoryTag::Lighting);
+    std::vector<Light> lights;
+    lights.reserve(n);
+    std::srand(1337);
+    for (unsigned int i = 0; i < n; i++) {
+      Light l;
+      l.type = (i % 4 == 0) ? Spot : Point;
+      l.position = glm::mix(min, max, glm::vec3(rand01(), rand01(), rand01()));
+      l.direction = glm::vec3(rand01() - 0.5f, -1.0f, rand01() - 0.5f);
+      glm::vec3 color =
+          glm::normalize(glm::vec3(rand01(), rand01(), rand01()) + 0.1f);
+      l.diffuse = color * 0.8f;
+      l.specular = color * 0.5f;
+      l.ambient = glm::vec3(0.0f);
+      // short range lights so each one touches only a few clusters
+      l.linear = 0.7f;
+      l.quadratic = 1.8f;
+      l.cutOff = glm::cos(glm::radians(25.0f));
+      l.outerCutOff = glm::cos(glm::radians(35.0f));
+      lights.push_back(l);
+    }
+    return lights;
+  }
+
+private:
+  unsigned int ssbo = 0;
+  std::vector<GpuLight> packed;
+
+  static float rand01() { return (float)std::rand() / (float)RAND_MAX; }
+};
+
+#endif
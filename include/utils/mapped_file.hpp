@@ -0,0 +1,109 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <iostream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A read-only mapping of a whole file. Pages are read from disk the first
+// time they are touched, so opening a file costs the same whatever its size.
+class MappedFile {
+public:
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile() { close(); }
+
+  bool open(const char *path) {
+    close();
+#ifdef _WIN32
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER fileSize;
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize)) {
+      std::cout << "ERROR::FILE::OPEN_FAILED: " << path << std::endl;
+      if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+      file = INVALID_HANDLE_VALUE;
+      return false;
+    }
+    length = (size_t)fileSize.QuadPart;
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping)
+      bytes = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0,
+                                                   0, 0);
+    if (!bytes) {
+      std::cout << "ERROR::FILE::MAP_FAILED: " << path << std::endl;
+      if (mapping)
+        CloseHandle(mapping);
+      CloseHandle(file);
+      mapping = NULL;
+      file = INVALID_HANDLE_VALUE;
+      length = 0;
+      return false;
+    }
+#else
+    int fd = ::open(path, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+      std::cout << "ERROR::FILE::OPEN_FAILED: " << path << std::endl;
+      if (fd >= 0)
+        ::close(fd);
+      return false;
+    }
+    length = (size_t)info.st_size;
+    void *view = length ? mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0)
+                        : MAP_FAILED;
+    // the mapping keeps the file alive
+    ::close(fd);
+    if (view == MAP_FAILED) {
+      std::cout << "ERROR::FILE::MAP_FAILED: " << path << std::endl;
+      length = 0;
+      return false;
+    }
+    bytes = (const unsigned char *)view;
+#endif
+    return true;
+  }
+
+  void close() {
+    if (!bytes)
+      return;
+#ifdef _WIN32
+    UnmapViewOfFile(bytes);
+    CloseHandle(mapping);
+    CloseHandle(file);
+    mapping = NULL;
+    file = INVALID_HANDLE_VALUE;
+#else
+    munmap((void *)bytes, length);
+#endif
+    bytes = nullptr;
+    length = 0;
+  }
+
+  bool isOpen() const { return bytes != nullptr; }
+  const unsigned char *data() const { return bytes; }
+  size_t size() const { return length; }
+
+private:
+  const unsigned char *bytes = nullptr;
+  size_t length = 0;
+#ifdef _WIN32
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = NULL;
+#endif
+};
+
+#endif
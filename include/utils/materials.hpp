@@ -0,0 +1,104 @@
+#ifndef MATERIALS_H
+#define MATERIALS_H
+
+#include "../glm/glm.hpp"
+#include "memory_tracker.hpp"
+#include <glad/glad.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Matches `struct Material` in src/shaders/include/material.glsl (std430)
+struct GpuMaterial {
+  glm::vec4 diffuseShininess; // rgb diffuse tint, a shininess
+  glm::vec4 specular;         // rgb specular tint
+  glm::uvec4 textures;        // xy diffuse, zw specular, see MaterialTable::add
+};
+static_assert(sizeof(GpuMaterial) == 3 * 16, "GpuMaterial must match std430");
+
+// Every material of the scene in one shader storage buffer. Draws carry a
+// material index (per instance or per draw) instead of re-uploading material
+// uniforms, so objects with different materials can share one draw call.
+// Edits only re-upload the records that changed.
+class MaterialTable {
+public:
+  static const unsigned int MAX_MATERIALS = 256;
+  static const unsigned int BINDING = 4;
+
+  // records written by the last upload, for the profiler
+  unsigned int uploadedLastFrame = 0;
+
+  void init() {
+    glGenBuffers(1, &ssbo);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, MAX_MATERIALS * sizeof(GpuMaterial),
+                 NULL, GL_DYNAMIC_DRAW);
+    MemoryTracker::gpuAllocate(MemoryTag::Materials,
+                               MAX_MATERIALS * sizeof(GpuMaterial));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING, ssbo);
+  }
+
+  void destroy() {
+    glDeleteBuffers(1, &ssbo);
+    MemoryTracker::gpuRelease(MemoryTag::Materials,
+                              MAX_MATERIALS * sizeof(GpuMaterial));
+    ssbo = 0;
+  }
+
+  // Textures are either bindless handles (BindlessTextures::load) or
+  // TextureArrays layers in x with y unused, depending on the BINDLESS
+  // shader define.
+  unsigned int add(const std::string &name, glm::uvec2 diffuseTexture,
+                   glm::uvec2 specularTexture, glm::vec3 diffuse,
+                   glm::vec3 specular, float shininess) {
+    MemoryTagScope tag(MemoryTag::Materials);
+    if (records.size() == MAX_MATERIALS) {
+      std::cout << "ERROR::MATERIALS::TABLE_FULL: " << name << std::endl;
+      return 0;
+    }
+    names.push_back(name);
+    records.push_back(
+        {glm::vec4(diffuse, shininess), glm::vec4(specular, 0.0f),
+         glm::uvec4(diffuseTexture, specularTexture)});
+    markDirty(records.size() - 1);
+    return records.size() - 1;
+  }
+
+  unsigned int count() const { return records.size(); }
+  const std::string &name(unsigned int id) const { return names[id]; }
+
+  const GpuMaterial &get(unsigned int id) const { return records[id]; }
+
+  // edit a record in place, then call markDirty(id)
+  GpuMaterial &edit(unsigned int id) { return records[id]; }
+
+  void markDirty(unsigned int id) {
+    dirtyBegin = glm::min(dirtyBegin, id);
+    dirtyEnd = glm::max(dirtyEnd, id + 1);
+  }
+
+  // uploads the dirty range, if any, and binds the table
+  void upload() {
+    uploadedLastFrame = 0;
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING, ssbo);
+    if (dirtyBegin >= dirtyEnd)
+      return;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, dirtyBegin * sizeof(GpuMaterial),
+                    (dirtyEnd - dirtyBegin) * sizeof(GpuMaterial),
+                    &records[dirtyBegin]);
+    uploadedLastFrame = dirtyEnd - dirtyBegin;
+    dirtyBegin = MAX_MATERIALS;
+    dirtyEnd = 0;
+  }
+
+private:
+  unsigned int ssbo = 0;
+  std::vector<GpuMaterial> records;
+  std::vector<std::string> names;
+  unsigned int dirtyBegin = MAX_MATERIALS;
+  unsigned int dirtyEnd = 0;
+};
+
+#endif
@@ -0,0 +1,226 @@
+#ifndef MEMORY_TRACKER_H
+#define MEMORY_TRACKER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// subsystems memory is attributed to
+enum class MemoryTag : unsigned int {
+  General,
+  Shaders,
+  Textures,
+  Materials,
+  Geometry,
+  Scene,
+  Lighting,
+  Shadows,
+  Renderer,
+  Frame,
+  UI,
+  Streaming,
+  Count,
+};
+
+// Live/peak bytes and allocation counts per MemoryTag, for CPU heap memory
+// and for estimated GPU memory. CPU allocations are attributed to the tag of
+// the innermost MemoryTagScope on the allocating thread. Every tracked heap
+// block carries a small header holding its size and tag, so frees are
+// attributed correctly no matter where they happen.
+//
+// The global operator new/delete replacements live behind
+// MEMORY_TRACKER_IMPLEMENTATION, define it in exactly one translation unit
+// before including this header (like STB_IMAGE_IMPLEMENTATION).
+class MemoryTracker {
+public:
+  static const unsigned int TAG_COUNT = (unsigned int)MemoryTag::Count;
+
+  // only used for the static tables below, which start out zeroed
+  struct Stats {
+    std::atomic<size_t> live;
+    std::atomic<size_t> peak;
+    std::atomic<size_t> allocations;
+    std::atomic<size_t> allocatedBytes;
+  };
+
+  // per second rates, refreshed by `update`
+  struct Rate {
+    float allocations;
+    float bytes;
+  };
+
+  static inline Stats cpu[TAG_COUNT];
+  static inline Stats gpu[TAG_COUNT];
+  static inline Rate cpuRate[TAG_COUNT];
+  static inline thread_local MemoryTag currentTag = MemoryTag::General;
+  static inline thread_local size_t threadAllocations = 0;
+
+  static const char *tagName(MemoryTag tag) {
+    static const char *names[TAG_COUNT] = {
+        "General", "Shaders",  "Textures", "Materials", "Geometry",
+        "Scene",   "Lighting", "Shadows",  "Renderer",  "Frame",
+        "UI",      "Streaming"};
+    return names[(unsigned int)tag];
+  }
+
+  // heap allocations of all tags since startup
+  static size_t allocationCount() {
+    size_t total = 0;
+    for (unsigned int i = 0; i < TAG_COUNT; i++)
+      total += cpu[i].allocations.load(std::memory_order_relaxed);
+    return total;
+  }
+
+  // heap allocations made by the calling thread, so a frame's count leaves
+  // out what streaming workers allocate meanwhile
+  static size_t threadAllocationCount() { return threadAllocations; }
+
+  // Tagged malloc/realloc/free, used by operator new and stb_image.
+  static void *allocate(size_t size, MemoryTag tag) {
+    Header *header = (Header *)std::malloc(sizeof(Header) + size);
+    if (!header)
+      return nullptr;
+    header->size = size;
+    header->tag = tag;
+    add(cpu[(unsigned int)tag], size);
+    threadAllocations++;
+    return header + 1;
+  }
+
+  static void *allocate(size_t size) { return allocate(size, currentTag); }
+
+  static void *reallocate(void *p, size_t size) {
+    if (!p)
+      return allocate(size);
+    Header *header = (Header *)p - 1;
+    MemoryTag tag = header->tag;
+    size_t oldSize = header->size;
+    Header *moved = (Header *)std::realloc(header, sizeof(Header) + size);
+    if (!moved)
+      return nullptr;
+    moved->size = size;
+    remove(cpu[(unsigned int)tag], oldSize);
+    add(cpu[(unsigned int)tag], size);
+    threadAllocations++;
+    return moved + 1;
+  }
+
+  static void release(void *p) {
+    if (!p)
+      return;
+    // through an integer, GCC otherwise warns about indexing -1 of whatever
+    // the caller allocated once this is inlined into it
+    Header *header = (Header *)((uintptr_t)p - sizeof(Header));
+    remove(cpu[(unsigned int)header->tag], header->size);
+    std::free(header);
+  }
+
+  // GPU memory is an estimate from the sizes passed to glBufferData /
+  // glTexStorage and friends; drivers add padding and metadata on top.
+  static void gpuAllocate(MemoryTag tag, size_t bytes) {
+    add(gpu[(unsigned int)tag], bytes);
+  }
+  static void gpuRelease(MemoryTag tag, size_t bytes) {
+    remove(gpu[(unsigned int)tag], bytes);
+  }
+
+  // bytes of a texture with `layers` layers, including the mip chain
+  static size_t textureBytes(int width, int height, int layers,
+                             int bytesPerTexel, bool mipmapped) {
+    size_t bytes = (size_t)width * height * layers * bytesPerTexel;
+    return mipmapped ? bytes * 4 / 3 : bytes;
+  }
+
+  // Call once per frame, recomputes the allocation rates about once a second.
+  static void update(float deltaTime) {
+    static float elapsed = 0.0f;
+    static size_t lastAllocations[TAG_COUNT] = {};
+    static size_t lastBytes[TAG_COUNT] = {};
+    elapsed += deltaTime;
+    if (elapsed < 1.0f)
+      return;
+    for (unsigned int i = 0; i < TAG_COUNT; i++) {
+      size_t allocations = cpu[i].allocations.load();
+      size_t bytes = cpu[i].allocatedBytes.load();
+      cpuRate[i].allocations = (allocations - lastAllocations[i]) / elapsed;
+      cpuRate[i].bytes = (bytes - lastBytes[i]) / elapsed;
+      lastAllocations[i] = allocations;
+      lastBytes[i] = bytes;
+    }
+    elapsed = 0.0f;
+  }
+
+private:
+  // 16 bytes keep the returned block aligned like malloc's
+  struct alignas(16) Header {
+    size_t size;
+    MemoryTag tag;
+  };
+
+  static void add(Stats &stats, size_t bytes) {
+    size_t live =
+        stats.live.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    size_t peak = stats.peak.load(std::memory_order_relaxed);
+    while (live > peak &&
+           !stats.peak.compare_exchange_weak(peak, live,
+                                             std::memory_order_relaxed))
+      ;
+    stats.allocations.fetch_add(1, std::memory_order_relaxed);
+    stats.allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  static void remove(Stats &stats, size_t bytes) {
+    stats.live.fetch_sub(bytes, std::memory_order_relaxed);
+  }
+};
+
+// Attributes allocations on this thread to `tag` until the scope ends.
+class MemoryTagScope {
+public:
+  explicit MemoryTagScope(MemoryTag tag) : previous(MemoryTracker::currentTag) {
+    MemoryTracker::currentTag = tag;
+  }
+  ~MemoryTagScope() { MemoryTracker::currentTag = previous; }
+
+  MemoryTagScope(const MemoryTagScope &) = delete;
+  MemoryTagScope &operator=(const MemoryTagScope &) = delete;
+
+private:
+  MemoryTag previous;
+};
+
+#endif
+
+// outside the include guard, so the translation unit that defines
+// MEMORY_TRACKER_IMPLEMENTATION gets it even if another header included
+// this one first
+#if defined(MEMORY_TRACKER_IMPLEMENTATION) &&                                  \
+    !defined(MEMORY_TRACKER_IMPLEMENTED)
+#define MEMORY_TRACKER_IMPLEMENTED
+// GCC flags free() inside a replaced operator delete once it is inlined into
+// a new/delete pair, which is exactly what the replacement is for
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void *operator new(std::size_t size) {
+  if (void *p = MemoryTracker::allocate(size))
+    return p;
+  throw std::bad_alloc();
+}
+void *operator new[](std::size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { MemoryTracker::release(p); }
+void operator delete[](void *p) noexcept { MemoryTracker::release(p); }
+void operator delete(void *p, std::size_t) noexcept {
+  MemoryTracker::release(p);
+}
+void operator delete[](void *p, std::size_t) noexcept {
+  MemoryTracker::release(p);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
@@ -0,0 +1,1173 @@
+#ifndef MESH_IMPORT_H
+#define MESH_IMPORT_H
+
+#include "../glm/glm.hpp"
+#include "mapped_file.hpp"
+#include "memory_tracker.hpp"
+#include "scene_file.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Number and JSON parsing for the importers below.
+namespace mesh_import {
+
+// true if all 8 bytes of `chunk` are ASCII digits
+inline bool eightDigits(uint64_t chunk) {
+  return !(((chunk + 0x4646464646464646ull) |
+            (chunk - 0x3030303030303030ull)) &
+           0x8080808080808080ull);
+}
+
+// Value of 8 ASCII digits loaded little endian into one word. Pairs, then
+// quadruples, then the two halves are combined, each step working on all
+// lanes of the word at once instead of one digit per iteration.
+inline uint32_t parseEightDigits(uint64_t chunk) {
+  chunk -= 0x3030303030303030ull;
+  chunk = chunk * 10 + (chunk >> 8);
+  chunk = ((chunk & 0x000000ff000000ffull) * (100 + (1000000ull << 32)) +
+           ((chunk >> 16) & 0x000000ff000000ffull) * (1 + (10000ull << 32))) >>
+          32;
+  return (uint32_t)chunk;
+}
+
+// Appends the digits at `p` to `mantissa`, keeping at most 19 of them;
+// digits past that only count into `dropped`. Returns the digits read.
+inline int parseDigits(const char *&p, const char *end, uint64_t &mantissa,
+                       int &kept, int &dropped) {
+  const char *start = p;
+  while (end - p >= 8 && kept <= 11) {
+    uint64_t chunk;
+    std::memcpy(&chunk, p, 8);
+    if (!eightDigits(chunk))
+      break;
+    mantissa = mantissa * 100000000 + parseEightDigits(chunk);
+    kept += 8;
+    p += 8;
+  }
+  for (; p < end && *p >= '0' && *p <= '9'; p++) {
+    if (kept < 19) {
+      mantissa = mantissa * 10 + (*p - '0');
+      kept++;
+    } else {
+      dropped++;
+    }
+  }
+  return p - start;
+}
+
+// Parses a decimal number like strtod and moves `p` past it. Up to 15
+// significant digits and exponents within 10^±22 take the exact fast path
+// (one multiply or divide by a power of ten); anything else goes to strtod.
+inline bool parseNumber(const char *&p, const char *end, double &value) {
+  static const double powers[23] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  const char *s = p;
+  bool negative = s < end && *s == '-';
+  if (s < end && (*s == '-' || *s == '+'))
+    s++;
+  while (s < end && *s == '0' && s + 1 < end && s[1] >= '0' && s[1] <= '9')
+    s++;
+  uint64_t mantissa = 0;
+  int kept = 0, dropped = 0;
+  int digits = parseDigits(s, end, mantissa, kept, dropped);
+  int exponent = dropped;
+  if (s < end && *s == '.') {
+    s++;
+    int integerKept = kept;
+    // zeros right after the point only move the exponent
+    if (mantissa == 0)
+      for (; s < end && *s == '0'; s++, digits++)
+        exponent--;
+    int fractionDropped = 0;
+    digits += parseDigits(s, end, mantissa, kept, fractionDropped);
+    exponent -= kept - integerKept;
+  }
+  if (digits == 0)
+    return false;
+  if (s < end && (*s == 'e' || *s == 'E')) {
+    const char *e = s + 1;
+    bool negativeExponent = e < end && *e == '-';
+    if (e < end && (*e == '-' || *e == '+'))
+      e++;
+    int power = 0;
+    const char *first = e;
+    for (; e < end && *e >= '0' && *e <= '9'; e++)
+      power = std::min(power * 10 + (*e - '0'), 100000);
+    if (e == first)
+      return false;
+    exponent += negativeExponent ? -power : power;
+    s = e;
+  }
+  if (mantissa == 0) {
+    value = negative ? -0.0 : 0.0;
+  } else if (kept <= 15 && exponent >= -22 && exponent <= 22) {
+    value = (double)mantissa;
+    value = exponent < 0 ? value / powers[-exponent] : value * powers[exponent];
+    if (negative)
+      value = -value;
+  } else {
+    char text[64];
+    size_t length = std::min<size_t>(s - p, sizeof(text) - 1);
+    std::memcpy(text, p, length);
+    text[length] = '\0';
+    value = std::strtod(text, nullptr);
+  }
+  p = s;
+  return true;
+}
+
+inline bool parseFloat(const char *&p, const char *end, float &value) {
+  double number;
+  if (!parseNumber(p, end, number))
+    return false;
+  value = (float)number;
+  return true;
+}
+
+inline bool parseInt(const char *&p, const char *end, int &value) {
+  const char *s = p;
+  bool negative = s < end && *s == '-';
+  if (negative)
+    s++;
+  long long number = 0;
+  const char *first = s;
+  for (; s < end && *s >= '0' && *s <= '9'; s++)
+    number = std::min(number * 10 + (*s - '0'), 0x7fffffffll);
+  if (s == first)
+    return false;
+  value = (int)(negative ? -number : number);
+  p = s;
+  return true;
+}
+
+// A parsed JSON document, just enough for glTF. Missing keys and indices
+// read as a null value so lookups can be chained.
+struct Json {
+  enum Type { Null, Bool, Number, String, Array, Object };
+  Type type = Null;
+  bool boolean = false;
+  double number = 0.0;
+  std::string text;
+  std::vector<Json> items;
+  std::vector<std::string> keys; // of items, for objects
+
+  const Json &operator[](const char *key) const {
+    if (type == Object)
+      for (size_t i = 0; i < keys.size(); i++)
+        if (keys[i] == key)
+          return items[i];
+    return null();
+  }
+  const Json &operator[](size_t index) const {
+    return type == Array && index < items.size() ? items[index] : null();
+  }
+  size_t size() const { return type == Array ? items.size() : 0; }
+  bool has(const char *key) const { return (*this)[key].type != Null; }
+  double numberOr(double fallback) const {
+    return type == Number ? number : fallback;
+  }
+
+  static const Json &null() {
+    static const Json value;
+    return value;
+  }
+};
+
+class JsonParser {
+public:
+  JsonParser(const char *begin, const char *end) : p(begin), end(end) {}
+
+  bool parse(Json &document) {
+    return value(document, 0) && (skip(), p == end);
+  }
+
+private:
+  static const int MAX_DEPTH = 64;
+  const char *p;
+  const char *end;
+
+  void skip() {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+      p++;
+  }
+
+  bool literal(const char *word) {
+    size_t length = std::strlen(word);
+    if ((size_t)(end - p) < length || std::memcmp(p, word, length) != 0)
+      return false;
+    p += length;
+    return true;
+  }
+
+  bool string(std::string &out) {
+    if (p == end || *p != '"')
+      return false;
+    p++;
+    while (p < end && *p != '"') {
+      if (*p != '\\') {
+        out.push_back(*p++);
+        continue;
+      }
+      if (++p == end)
+        return false;
+      char escape = *p++;
+      switch (escape) {
+      case 'b': out.push_back('\b'); break;
+      case 'f': out.push_back('\f'); break;
+      case 'n': out.push_back('\n'); break;
+      case 'r': out.push_back('\r'); break;
+      case 't': out.push_back('\t'); break;
+      case 'u': {
+        if (end - p < 4)
+          return false;
+        unsigned int code = std::strtoul(std::string(p, 4).c_str(), nullptr,
+                                         16);
+        p += 4;
+        // UTF-8, surrogate pairs are not combined
+        if (code < 0x80) {
+          out.push_back((char)code);
+        } else if (code < 0x800) {
+          out.push_back((char)(0xc0 | code >> 6));
+          out.push_back((char)(0x80 | (code & 0x3f)));
+        } else {
+          out.push_back((char)(0xe0 | code >> 12));
+          out.push_back((char)(0x80 | (code >> 6 & 0x3f)));
+          out.push_back((char)(0x80 | (code & 0x3f)));
+        }
+        break;
+      }
+      default: out.push_back(escape); break;
+      }
+    }
+    if (p == end)
+      return false;
+    p++;
+    return true;
+  }
+
+  bool value(Json &out, int depth) {
+    skip();
+    if (p == end || depth > MAX_DEPTH)
+      return false;
+    if (*p == '{' || *p == '[') {
+      bool object = *p == '{';
+      char close = object ? '}' : ']';
+      out.type = object ? Json::Object : Json::Array;
+      p++;
+      skip();
+      if (p < end && *p == close) {
+        p++;
+        return true;
+      }
+      for (;;) {
+        skip();
+        if (object) {
+          out.keys.emplace_back();
+          if (!string(out.keys.back()))
+            return false;
+          skip();
+          if (p == end || *p++ != ':')
+            return false;
+        }
+        out.items.emplace_back();
+        if (!value(out.items.back(), depth + 1))
+          return false;
+        skip();
+        if (p == end)
+          return false;
+        if (*p == ',') {
+          p++;
+          continue;
+        }
+        if (*p++ != close)
+          return false;
+        return true;
+      }
+    }
+    if (*p == '"') {
+      out.type = Json::String;
+      return string(out.text);
+    }
+    if (literal("true")) {
+      out.type = Json::Bool;
+      out.boolean = true;
+      return true;
+    }
+    if (literal("false")) {
+      out.type = Json::Bool;
+      return true;
+    }
+    if (literal("null"))
+      return true;
+    out.type = Json::Number;
+    return parseNumber(p, end, out.number);
+  }
+};
+
+// Open addressing table from a key to a vertex index, for welding.
+// `Equal(vertex)` compares the key being inserted with an existing vertex's.
+class WeldTable {
+public:
+  explicit WeldTable(size_t expected) {
+    size_t capacity = 64;
+    while (capacity < expected * 2)
+      capacity *= 2;
+    slots.assign(capacity, 0);
+  }
+
+  // the vertex equal to the key with this hash, or `next` which is then
+  // inserted as a new vertex
+  template <typename Equal>
+  uint32_t insert(uint64_t hash, uint32_t next, Equal equal) {
+    if ((size_t)next * 2 >= slots.size())
+      grow();
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      if (slots[i] == 0) {
+        slots[i] = next + 1;
+        hashes.push_back(hash);
+        return next;
+      }
+      uint32_t vertex = slots[i] - 1;
+      if (hashes[vertex] == hash && equal(vertex))
+        return vertex;
+    }
+  }
+
+private:
+  std::vector<uint32_t> slots;  // vertex + 1, 0 when empty
+  std::vector<uint64_t> hashes; // per vertex
+
+  void grow() {
+    std::vector<uint32_t> bigger(slots.size() * 2, 0);
+    size_t mask = bigger.size() - 1;
+    for (uint32_t vertex = 0; vertex < hashes.size(); vertex++) {
+      size_t i = hashes[vertex] & mask;
+      while (bigger[i] != 0)
+        i = (i + 1) & mask;
+      bigger[i] = vertex + 1;
+    }
+    slots.swap(bigger);
+  }
+};
+
+inline uint64_t mixHash(uint64_t hash) {
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ull;
+  return hash ^ (hash >> 33);
+}
+
+} // namespace mesh_import
+
+// an indexed triangle list in the engine's vertex format
+struct ImportedMesh {
+  std::vector<SceneVertex> vertices;
+  std::vector<uint32_t> indices;
+};
+
+// what the last import read and how long each stage took
+struct ImportStats {
+  size_t bytes = 0;          // of the source files
+  size_t inputVertices = 0;  // face corners (OBJ) or vertices (glTF)
+  size_t triangles = 0;
+  float acmrBefore = 0.0f; // average cache miss ratio, see `MeshImporter::acmr`
+  float acmrAfter = 0.0f;
+  double parseMs = 0.0;
+  double weldMs = 0.0;
+  double tangentMs = 0.0;
+  double optimizeMs = 0.0;
+};
+
+// Loads OBJ and glTF 2.0 (.gltf with .bin buffers, or .glb) meshes into the
+// engine's vertex format as one indexed triangle list per file. Every mesh
+// goes through the same pipeline:
+//
+//   parse  OBJ text is split at line boundaries into chunks parsed on the
+//          thread pool straight from the mapped file, glTF buffers are
+//          decoded in parallel ranges of vertices
+//   weld   equal vertices become one (OBJ: equal position/uv/normal
+//          references, glTF: equal bytes)
+//   shade  normals are generated where the file has none and tangents
+//          where it has none, from the triangles' uv gradients
+//   order  triangles are reordered for the post-transform vertex cache
+//          (Tipsify, Sander et al. 2007) and vertices into the order the
+//          triangles first use them
+//
+// glTF node transforms are not applied and all primitives of all meshes are
+// merged. OBJ groups and materials are ignored, the scene description picks
+// the material.
+class MeshImporter {
+public:
+  static const unsigned int CACHE_SIZE = 16;
+  static const size_t CHUNK_BYTES = 1 << 20;
+
+  ImportStats stats;
+
+  explicit MeshImporter(ThreadPool *pool = nullptr) : pool(pool) {}
+
+  // by extension: .obj, .gltf or .glb
+  bool load(const std::string &path, ImportedMesh &mesh) {
+    std::string extension = path.substr(path.find_last_of('.') + 1);
+    for (char &c : extension)
+      c = (char)std::tolower((unsigned char)c);
+    if (extension == "obj")
+      return loadObj(path, mesh);
+    if (extension == "gltf" || extension == "glb")
+      return loadGltf(path, mesh);
+    std::cout << "ERROR::MESH_IMPORT::UNKNOWN_FORMAT: " << path << std::endl;
+    return false;
+  }
+
+  bool loadObj(const std::string &path, ImportedMesh &mesh) {
+    MemoryTagScope tag(MemoryTag::Geometry);
+    stats = ImportStats();
+    MappedFile file;
+    if (!file.open(path.c_str()))
+      return false;
+    stats.bytes = file.size();
+    const char *text = (const char *)file.data();
+    const char *end = text + file.size();
+
+    auto start = Clock::now();
+    // chunks end after a newline so no line is split
+    std::vector<ObjChunk> chunks;
+    for (const char *p = text; p < end;) {
+      const char *stop =
+          end - p > (ptrdiff_t)CHUNK_BYTES ? p + CHUNK_BYTES : end;
+      if (stop < end) {
+        const void *newline = std::memchr(stop, '\n', end - stop);
+        stop = newline ? (const char *)newline + 1 : end;
+      }
+      chunks.emplace_back();
+      chunks.back().begin = p;
+      chunks.back().end = stop;
+      p = stop;
+    }
+    parallel(chunks.size(), 1, [&](unsigned int first, unsigned int last) {
+      MemoryTagScope tag(MemoryTag::Geometry);
+      for (unsigned int i = first; i < last; i++)
+        parseObjChunk(chunks[i]);
+    });
+    for (const ObjChunk &chunk : chunks) {
+      if (chunk.error) {
+        size_t line = 1 + std::count(text, chunk.error, '\n');
+        std::cout << "ERROR::MESH_IMPORT::OBJ_LINE_" << line << ": " << path
+                  << std::endl;
+        return false;
+      }
+    }
+    stats.parseMs = millisecondsSince(start);
+
+    // relative references are resolved against the counts before each chunk
+    start = Clock::now();
+    size_t counts[3] = {0, 0, 0};
+    size_t corners = 0;
+    for (ObjChunk &chunk : chunks) {
+      for (uint32_t i : chunk.relative)
+        chunk.corners[i] += (int)counts[i % 3];
+      counts[0] += chunk.positions.size() / 3;
+      counts[1] += chunk.uvs.size() / 2;
+      counts[2] += chunk.normals.size() / 3;
+      corners += chunk.corners.size() / 3;
+    }
+    stats.inputVertices = corners;
+    stats.triangles = corners / 3;
+    std::vector<float> positions, uvs, normals;
+    positions.reserve(counts[0] * 3);
+    uvs.reserve(counts[1] * 2);
+    normals.reserve(counts[2] * 3);
+    for (const ObjChunk &chunk : chunks) {
+      positions.insert(positions.end(), chunk.positions.begin(),
+                       chunk.positions.end());
+      uvs.insert(uvs.end(), chunk.uvs.begin(), chunk.uvs.end());
+      normals.insert(normals.end(), chunk.normals.begin(),
+                     chunk.normals.end());
+    }
+
+    // every distinct position/uv/normal triple becomes a vertex
+    bool hasNormals = true;
+    std::vector<int> keys; // 3 per vertex
+    mesh.vertices.clear();
+    mesh.indices.clear();
+    mesh.indices.reserve(corners);
+    mesh_import::WeldTable table(counts[0] + counts[0] / 4);
+    for (const ObjChunk &chunk : chunks) {
+      for (size_t c = 0; c < chunk.corners.size(); c += 3) {
+        const int *key = &chunk.corners[c];
+        bool inRange = key[0] >= 0 && (size_t)key[0] < counts[0];
+        for (int k = 1; k < 3; k++)
+          inRange = inRange && (key[k] == NO_INDEX ||
+                                (key[k] >= 0 && (size_t)key[k] < counts[k]));
+        if (!inRange) {
+          std::cout << "ERROR::MESH_IMPORT::OBJ_BAD_INDEX: " << path
+                    << std::endl;
+          return false;
+        }
+        uint64_t hash = mesh_import::mixHash(
+            (uint64_t)(uint32_t)key[0] * 0x9e3779b97f4a7c15ull ^
+            (uint64_t)(uint32_t)key[1] << 21 ^ (uint64_t)(uint32_t)key[2]);
+        uint32_t next = keys.size() / 3;
+        uint32_t vertex = table.insert(hash, next, [&](uint32_t existing) {
+          return std::memcmp(&keys[existing * 3], key, 3 * sizeof(int)) == 0;
+        });
+        if (vertex == next) {
+          keys.insert(keys.end(), key, key + 3);
+          hasNormals = hasNormals && key[2] != NO_INDEX;
+        }
+        mesh.indices.push_back(vertex);
+      }
+    }
+    mesh.vertices.resize(keys.size() / 3);
+    parallel(mesh.vertices.size(), 1 << 16,
+             [&](unsigned int first, unsigned int last) {
+               for (unsigned int v = first; v < last; v++) {
+                 const int *key = &keys[v * 3];
+                 SceneVertex &vertex = mesh.vertices[v];
+                 vertex = SceneVertex();
+                 std::memcpy(vertex.position, &positions[key[0] * 3],
+                             3 * sizeof(float));
+                 if (key[1] != NO_INDEX)
+                   std::memcpy(vertex.uv, &uvs[key[1] * 2], 2 * sizeof(float));
+                 if (key[2] != NO_INDEX)
+                   std::memcpy(vertex.normal, &normals[key[2] * 3],
+                               3 * sizeof(float));
+               }
+             });
+    stats.weldMs = millisecondsSince(start);
+    shadeAndOrder(mesh, hasNormals, false);
+    return true;
+  }
+
+  bool loadGltf(const std::string &path, ImportedMesh &mesh) {
+    MemoryTagScope tag(MemoryTag::Geometry);
+    stats = ImportStats();
+    MappedFile file;
+    if (!file.open(path.c_str()))
+      return false;
+    stats.bytes = file.size();
+
+    auto start = Clock::now();
+    const unsigned char *bytes = file.data();
+    const char *json = (const char *)bytes;
+    const char *jsonEnd = json + file.size();
+    // a .glb is a header and chunks, a JSON one and an optional binary one
+    const unsigned char *binary = nullptr;
+    size_t binarySize = 0;
+    if (file.size() >= 12 && std::memcmp(bytes, "glTF", 4) == 0) {
+      uint32_t header[3];
+      std::memcpy(header, bytes, sizeof(header));
+      size_t offset = 12;
+      for (int chunk = 0; offset + 8 <= file.size() && chunk < 2; chunk++) {
+        uint32_t chunkHeader[2];
+        std::memcpy(chunkHeader, bytes + offset, sizeof(chunkHeader));
+        if (chunkHeader[0] > file.size() - offset - 8)
+          break;
+        const unsigned char *data = bytes + offset + 8;
+        if (chunkHeader[1] == 0x4e4f534a) { // "JSON"
+          json = (const char *)data;
+          jsonEnd = json + chunkHeader[0];
+        } else if (chunkHeader[1] == 0x004e4942) { // "BIN\0"
+          binary = data;
+          binarySize = chunkHeader[0];
+        }
+        offset += 8 + ((chunkHeader[0] + 3) & ~3u);
+      }
+      if (header[1] != 2 || json == (const char *)bytes) {
+        std::cout << "ERROR::MESH_IMPORT::GLB_HEADER: " << path << std::endl;
+        return false;
+      }
+    }
+    mesh_import::Json document;
+    mesh_import::JsonParser parser(json, jsonEnd);
+    if (!parser.parse(document)) {
+      std::cout << "ERROR::MESH_IMPORT::GLTF_JSON: " << path << std::endl;
+      return false;
+    }
+
+    // buffers are mapped like the .gltf itself, relative to its directory
+    std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+    const mesh_import::Json &bufferList = document["buffers"];
+    std::vector<MappedFile> bufferFiles(bufferList.size());
+    std::vector<Buffer> buffers(bufferList.size());
+    for (size_t i = 0; i < bufferList.size(); i++) {
+      const mesh_import::Json &uri = bufferList[i]["uri"];
+      if (uri.type == mesh_import::Json::Null && i == 0 && binary) {
+        buffers[i] = {binary, binarySize};
+      } else if (uri.type == mesh_import::Json::String &&
+                 uri.text.compare(0, 5, "data:") != 0) {
+        if (!bufferFiles[i].open((directory + uri.text).c_str()))
+          return false;
+        buffers[i] = {bufferFiles[i].data(), bufferFiles[i].size()};
+        stats.bytes += bufferFiles[i].size();
+      } else {
+        std::cout << "ERROR::MESH_IMPORT::GLTF_BUFFER_URI: " << path
+                  << std::endl;
+        return false;
+      }
+      if ((size_t)bufferList[i]["byteLength"].numberOr(0) > buffers[i].size) {
+        std::cout << "ERROR::MESH_IMPORT::GLTF_BUFFER_SIZE: " << path
+                  << std::endl;
+        return false;
+      }
+    }
+
+    std::vector<SceneVertex> vertices;
+    std::vector<uint32_t> indices;
+    bool hasNormals = true, hasTangents = true;
+    const mesh_import::Json &meshes = document["meshes"];
+    for (size_t m = 0; m < meshes.size(); m++) {
+      const mesh_import::Json &primitives = meshes[m]["primitives"];
+      for (size_t p = 0; p < primitives.size(); p++) {
+        const mesh_import::Json &primitive = primitives[p];
+        // 4 is TRIANGLES
+        if (primitive["mode"].numberOr(4) != 4) {
+          std::cout << "ERROR::MESH_IMPORT::GLTF_PRIMITIVE_MODE: " << path
+                    << std::endl;
+          return false;
+        }
+        const mesh_import::Json &attributes = primitive["attributes"];
+        Accessor position, normal, uv, tangent, index;
+        if (!accessor(document, buffers, attributes["POSITION"], "VEC3",
+                      position) ||
+            !accessor(document, buffers, attributes["NORMAL"], "VEC3",
+                      normal) ||
+            !accessor(document, buffers, attributes["TEXCOORD_0"], "VEC2",
+                      uv) ||
+            !accessor(document, buffers, attributes["TANGENT"], "VEC4",
+                      tangent) ||
+            !accessor(document, buffers, primitive["indices"], "SCALAR",
+                      index) ||
+            !position.data || position.componentType != FLOAT ||
+            (normal.data && normal.componentType != FLOAT) ||
+            (uv.data && uv.componentType != FLOAT) ||
+            (tangent.data && tangent.componentType != FLOAT) ||
+            (index.data && index.componentType == FLOAT)) {
+          std::cout << "ERROR::MESH_IMPORT::GLTF_ACCESSOR: " << path
+                    << std::endl;
+          return false;
+        }
+        size_t count = position.count;
+        if ((normal.data && normal.count != count) ||
+            (uv.data && uv.count != count) ||
+            (tangent.data && tangent.count != count)) {
+          std::cout << "ERROR::MESH_IMPORT::GLTF_ACCESSOR: " << path
+                    << std::endl;
+          return false;
+        }
+        hasNormals = hasNormals && normal.data;
+        hasTangents = hasTangents && tangent.data && uv.data;
+
+        size_t base = vertices.size();
+        vertices.resize(base + count);
+        parallel(count, 1 << 16, [&](unsigned int first, unsigned int last) {
+          for (unsigned int i = first; i < last; i++) {
+            SceneVertex &vertex = vertices[base + i];
+            vertex = SceneVertex();
+            std::memcpy(vertex.position, position.element(i),
+                        3 * sizeof(float));
+            if (normal.data)
+              std::memcpy(vertex.normal, normal.element(i), 3 * sizeof(float));
+            if (uv.data)
+              std::memcpy(vertex.uv, uv.element(i), 2 * sizeof(float));
+            if (tangent.data)
+              std::memcpy(vertex.tangent, tangent.element(i),
+                          4 * sizeof(float));
+          }
+        });
+
+        size_t indexCount = index.data ? index.count : count;
+        size_t firstIndex = indices.size();
+        indices.resize(firstIndex + indexCount / 3 * 3);
+        bool inRange = true;
+        for (size_t i = 0; i < indexCount / 3 * 3; i++) {
+          uint32_t value = index.data ? index.index(i) : (uint32_t)i;
+          inRange = inRange && value < count;
+          indices[firstIndex + i] = (uint32_t)base + value;
+        }
+        if (!inRange) {
+          std::cout << "ERROR::MESH_IMPORT::GLTF_BAD_INDEX: " << path
+                    << std::endl;
+          return false;
+        }
+      }
+    }
+    stats.inputVertices = vertices.size();
+    stats.triangles = indices.size() / 3;
+    stats.parseMs = millisecondsSince(start);
+
+    start = Clock::now();
+    weld(vertices, indices, mesh);
+    stats.weldMs = millisecondsSince(start);
+    shadeAndOrder(mesh, hasNormals, hasTangents);
+    return true;
+  }
+
+  // Runs the weld, shade and order stages on a mesh built elsewhere (like
+  // the scene description's inline meshes), triangles as a plain vertex list.
+  void finish(const std::vector<SceneVertex> &triangles, ImportedMesh &mesh,
+              bool hasNormals) {
+    MemoryTagScope tag(MemoryTag::Geometry);
+    stats = ImportStats();
+    stats.inputVertices = triangles.size();
+    stats.triangles = triangles.size() / 3;
+    std::vector<uint32_t> indices(triangles.size() / 3 * 3);
+    for (uint32_t i = 0; i < indices.size(); i++)
+      indices[i] = i;
+    auto start = Clock::now();
+    weld(triangles, indices, mesh);
+    stats.weldMs = millisecondsSince(start);
+    shadeAndOrder(mesh, hasNormals, false);
+  }
+
+  // Average cache miss ratio: vertex shader runs per triangle with a FIFO
+  // post-transform cache of `cacheSize` vertices. 3 is no reuse at all, 0.5
+  // is about the best a regular grid can do.
+  static float acmr(const std::vector<uint32_t> &indices, size_t vertexCount,
+                    unsigned int cacheSize = CACHE_SIZE) {
+    if (indices.size() < 3)
+      return 0.0f;
+    // a vertex is cached while fewer than cacheSize misses happened since
+    // it was loaded
+    std::vector<size_t> loadedAt(vertexCount, 0);
+    size_t misses = 0;
+    for (uint32_t v : indices) {
+      if (loadedAt[v] == 0 || misses + 1 - loadedAt[v] >= cacheSize) {
+        misses++;
+        loadedAt[v] = misses;
+      }
+    }
+    return (float)misses / (indices.size() / 3);
+  }
+
+  // Tipsify: emits all triangles around a fanning vertex, then continues
+  // with the candidate vertex that was loaded longest ago but will still be
+  // cached after its own fan, falling back to recently used vertices and
+  // finally to input order when the fan runs into a dead end.
+  static void tipsify(std::vector<uint32_t> &indices, size_t vertexCount,
+                      unsigned int cacheSize) {
+    const uint32_t NO_VERTEX = 0xffffffffu;
+    size_t triangleCount = indices.size() / 3;
+    // triangles around vertex v are around[offsets[v] .. offsets[v + 1])
+    std::vector<uint32_t> live(vertexCount, 0);
+    for (uint32_t v : indices)
+      live[v]++;
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++)
+      offsets[v + 1] = offsets[v] + live[v];
+    std::vector<uint32_t> around(indices.size());
+    std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++)
+      around[cursor[indices[i]]++] = i / 3;
+
+    std::vector<uint32_t> loadedAt(vertexCount, 0);
+    std::vector<unsigned char> emitted(triangleCount, 0);
+    std::vector<uint32_t> deadEnds, candidates, output;
+    output.reserve(indices.size());
+    uint32_t time = cacheSize + 1;
+    size_t next = 0;
+    uint32_t fanning = vertexCount ? 0 : NO_VERTEX;
+    while (fanning != NO_VERTEX) {
+      candidates.clear();
+      for (uint32_t k = offsets[fanning]; k < offsets[fanning + 1]; k++) {
+        uint32_t triangle = around[k];
+        if (emitted[triangle])
+          continue;
+        emitted[triangle] = 1;
+        for (int c = 0; c < 3; c++) {
+          uint32_t v = indices[triangle * 3 + c];
+          output.push_back(v);
+          deadEnds.push_back(v);
+          candidates.push_back(v);
+          live[v]--;
+          if (time - loadedAt[v] > cacheSize)
+            loadedAt[v] = time++;
+        }
+      }
+      fanning = NO_VERTEX;
+      long best = -1;
+      for (uint32_t v : candidates) {
+        if (live[v] == 0)
+          continue;
+        long priority = 0;
+        if (time - loadedAt[v] + 2 * live[v] <= cacheSize)
+          priority = time - loadedAt[v];
+        if (priority > best) {
+          best = priority;
+          fanning = v;
+        }
+      }
+      while (fanning == NO_VERTEX && !deadEnds.empty()) {
+        uint32_t v = deadEnds.back();
+        deadEnds.pop_back();
+        if (live[v] > 0)
+          fanning = v;
+      }
+      while (fanning == NO_VERTEX && next < vertexCount) {
+        if (live[next] > 0)
+          fanning = next;
+        next++;
+      }
+    }
+    indices.swap(output);
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+  static const int NO_INDEX = -1;
+  static const int FLOAT = 5126;
+
+  ThreadPool *pool;
+
+  struct ObjChunk {
+    const char *begin = nullptr;
+    const char *end = nullptr;
+    const char *error = nullptr; // start of the first bad line
+    std::vector<float> positions; // 3 per position
+    std::vector<float> uvs;       // 2 per uv
+    std::vector<float> normals;   // 3 per normal
+    // position/uv/normal per triangle corner, 0 based, NO_INDEX if missing;
+    // negative references are counted from the end of this chunk's lists
+    // until `relative` (their positions in `corners`) are resolved
+    std::vector<int> corners;
+    std::vector<uint32_t> relative;
+  };
+
+  struct Buffer {
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+  };
+
+  struct Accessor {
+    const unsigned char *data = nullptr;
+    size_t count = 0;
+    size_t stride = 0;
+    int componentType = 0;
+
+    const unsigned char *element(size_t i) const { return data + i * stride; }
+    uint32_t index(size_t i) const {
+      const unsigned char *p = data + i * stride;
+      if (componentType == 5121) // UNSIGNED_BYTE
+        return *p;
+      uint32_t value = 0;
+      std::memcpy(&value, p, componentType == 5123 ? 2 : 4);
+      return value;
+    }
+  };
+
+  template <typename Fn>
+  void parallel(size_t count, unsigned int chunk, Fn fn) {
+    if (pool)
+      pool->parallelFor(count, chunk, fn);
+    else
+      fn(0u, (unsigned int)count);
+  }
+
+  static double millisecondsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start)
+        .count();
+  }
+
+  static void parseObjChunk(ObjChunk &chunk) {
+    size_t bytes = chunk.end - chunk.begin;
+    // rough guesses from typical line lengths, saves most regrowing
+    chunk.positions.reserve(bytes / 24);
+    chunk.corners.reserve(bytes / 6);
+    const char *end = chunk.end;
+    std::vector<int> face;
+    for (const char *line = chunk.begin; line < end;) {
+      const void *newline = std::memchr(line, '\n', end - line);
+      const char *lineEnd = newline ? (const char *)newline : end;
+      const char *p = line;
+      auto space = [&] {
+        while (p < lineEnd && (*p == ' ' || *p == '\t'))
+          p++;
+      };
+      auto floats = [&](std::vector<float> &out, int count) {
+        for (int i = 0; i < count; i++) {
+          float value;
+          space();
+          if (!mesh_import::parseFloat(p, lineEnd, value))
+            return false;
+          out.push_back(value);
+        }
+        return true;
+      };
+      space();
+      bool ok = true;
+      if (lineEnd - p > 1 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+        p++;
+        ok = floats(chunk.positions, 3);
+      } else if (lineEnd - p > 2 && p[0] == 'v' && p[1] == 't' &&
+                 (p[2] == ' ' || p[2] == '\t')) {
+        p += 2;
+        // the optional third coordinate is ignored with the rest of the line
+        ok = floats(chunk.uvs, 1);
+        space();
+        float v = 0.0f;
+        if (p < lineEnd && *p != '\r')
+          ok = ok && mesh_import::parseFloat(p, lineEnd, v);
+        chunk.uvs.push_back(v);
+      } else if (lineEnd - p > 2 && p[0] == 'v' && p[1] == 'n' &&
+                 (p[2] == ' ' || p[2] == '\t')) {
+        p += 2;
+        ok = floats(chunk.normals, 3);
+      } else if (lineEnd - p > 1 && p[0] == 'f' &&
+                 (p[1] == ' ' || p[1] == '\t')) {
+        p++;
+        face.clear();
+        for (;;) {
+          space();
+          if (p == lineEnd || *p == '\r' || *p == '#')
+            break;
+          int corner[3] = {0, 0, 0};
+          ok = mesh_import::parseInt(p, lineEnd, corner[0]);
+          for (int k = 1; k < 3 && ok && p < lineEnd && *p == '/'; k++) {
+            p++;
+            if (p < lineEnd && *p != '/' && *p != ' ' && *p != '\t' &&
+                *p != '\r')
+              ok = mesh_import::parseInt(p, lineEnd, corner[k]);
+          }
+          ok = ok && corner[0] != 0;
+          if (!ok)
+            break;
+          const size_t counts[3] = {chunk.positions.size() / 3,
+                                    chunk.uvs.size() / 2,
+                                    chunk.normals.size() / 3};
+          int negative = 0;
+          for (int k = 0; k < 3; k++) {
+            if (corner[k] > 0) {
+              corner[k]--;
+            } else if (corner[k] < 0) {
+              corner[k] += (int)counts[k];
+              negative |= 1 << k;
+            } else {
+              corner[k] = NO_INDEX;
+            }
+            face.push_back(corner[k]);
+          }
+          face.push_back(negative);
+        }
+        ok = ok && face.size() >= 12;
+        // triangle fan around the first corner, 4 ints per face corner
+        for (size_t c = 2; ok && c * 4 < face.size(); c++) {
+          const size_t triangle[3] = {0, (c - 1) * 4, c * 4};
+          for (size_t t : triangle) {
+            for (int k = 0; k < 3; k++) {
+              if (face[t + 3] & (1 << k))
+                chunk.relative.push_back(chunk.corners.size());
+              chunk.corners.push_back(face[t + k]);
+            }
+          }
+        }
+      }
+      if (!ok) {
+        chunk.error = line;
+        return;
+      }
+      line = lineEnd + 1;
+    }
+  }
+
+  // Points `out` at the accessor `reference` names, which must have the
+  // given type; leaves it empty if there is no reference.
+  static bool accessor(const mesh_import::Json &document,
+                       const std::vector<Buffer> &buffers,
+                       const mesh_import::Json &reference, const char *type,
+                       Accessor &out) {
+    if (reference.type == mesh_import::Json::Null)
+      return true;
+    const mesh_import::Json &description =
+        document["accessors"][indexOf(reference)];
+    if (description.has("sparse") || description["type"].text != type)
+      return false;
+    const mesh_import::Json &view =
+        document["bufferViews"][indexOf(description["bufferView"])];
+    size_t buffer = indexOf(view["buffer"]);
+    if (buffer >= buffers.size())
+      return false;
+    out.componentType = (int)description["componentType"].numberOr(0);
+    size_t componentSize;
+    switch (out.componentType) {
+    case 5120: // BYTE
+    case 5121: // UNSIGNED_BYTE
+      componentSize = 1;
+      break;
+    case 5122: // SHORT
+    case 5123: // UNSIGNED_SHORT
+      componentSize = 2;
+      break;
+    case 5125: // UNSIGNED_INT
+    case FLOAT:
+      componentSize = 4;
+      break;
+    default:
+      return false;
+    }
+    size_t components = std::strcmp(type, "SCALAR") == 0 ? 1 : type[3] - '0';
+    size_t elementSize = componentSize * components;
+    size_t viewOffset = indexOf(view["byteOffset"], 0);
+    size_t viewLength = indexOf(view["byteLength"]);
+    size_t offset = indexOf(description["byteOffset"], 0);
+    out.count = indexOf(description["count"]);
+    out.stride = indexOf(view["byteStride"], elementSize);
+    if (out.count == 0 || out.stride < elementSize)
+      return false;
+    size_t last = offset + out.stride * (out.count - 1) + elementSize;
+    if (viewLength > buffers[buffer].size ||
+        viewOffset > buffers[buffer].size - viewLength || last > viewLength)
+      return false;
+    out.data = buffers[buffer].data + viewOffset + offset;
+    return true;
+  }
+
+  // a glTF index or size, `fallback` if it is missing or not one
+  static size_t indexOf(const mesh_import::Json &value,
+                        size_t fallback = (size_t)-1) {
+    double number = value.numberOr(-1.0);
+    return number >= 0.0 && number < 1e15 ? (size_t)number : fallback;
+  }
+
+  // merges vertices with equal bytes, `indices` index `vertices`
+  void weld(const std::vector<SceneVertex> &vertices,
+            const std::vector<uint32_t> &indices, ImportedMesh &mesh) {
+    std::vector<uint32_t> remap(vertices.size());
+    mesh.vertices.clear();
+    mesh.vertices.reserve(vertices.size());
+    mesh_import::WeldTable table(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+      uint64_t words[sizeof(SceneVertex) / 8];
+      std::memcpy(words, &vertices[i], sizeof(SceneVertex));
+      uint64_t hash = 0;
+      for (uint64_t word : words)
+        hash = mesh_import::mixHash(hash ^ word);
+      uint32_t next = mesh.vertices.size();
+      remap[i] = table.insert(hash, next, [&](uint32_t existing) {
+        return std::memcmp(&mesh.vertices[existing], &vertices[i],
+                           sizeof(SceneVertex)) == 0;
+      });
+      if (remap[i] == next)
+        mesh.vertices.push_back(vertices[i]);
+    }
+    mesh.indices.resize(indices.size());
+    parallel(indices.size(), 1 << 16,
+             [&](unsigned int first, unsigned int last) {
+               for (unsigned int i = first; i < last; i++)
+                 mesh.indices[i] = remap[indices[i]];
+             });
+  }
+
+  void shadeAndOrder(ImportedMesh &mesh, bool hasNormals, bool hasTangents) {
+    auto start = Clock::now();
+    generateShading(mesh, !hasNormals, !hasTangents);
+    stats.tangentMs = millisecondsSince(start);
+
+    stats.acmrBefore = acmr(mesh.indices, mesh.vertices.size());
+    start = Clock::now();
+    tipsify(mesh.indices, mesh.vertices.size(), CACHE_SIZE);
+    reorderVertices(mesh);
+    stats.optimizeMs = millisecondsSince(start);
+    stats.acmrAfter = acmr(mesh.indices, mesh.vertices.size());
+  }
+
+  // Area weighted face normals and per triangle uv gradients summed per
+  // vertex (Lengyel), then normalized and made orthogonal on the pool.
+  void generateShading(ImportedMesh &mesh, bool normals, bool tangents) {
+    if (!normals && !tangents)
+      return;
+    std::vector<SceneVertex> &vertices = mesh.vertices;
+    size_t count = vertices.size();
+    std::vector<glm::vec3> faceNormals(normals ? count : 0);
+    std::vector<glm::vec3> uTangents(tangents ? count : 0);
+    std::vector<glm::vec3> vTangents(tangents ? count : 0);
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+      const uint32_t *corner = &mesh.indices[i];
+      const SceneVertex &a = vertices[corner[0]];
+      const SceneVertex &b = vertices[corner[1]];
+      const SceneVertex &c = vertices[corner[2]];
+      glm::vec3 origin(a.position[0], a.position[1], a.position[2]);
+      glm::vec3 edge1 =
+          glm::vec3(b.position[0], b.position[1], b.position[2]) - origin;
+      glm::vec3 edge2 =
+          glm::vec3(c.position[0], c.position[1], c.position[2]) - origin;
+      if (normals) {
+        glm::vec3 face = glm::cross(edge1, edge2);
+        for (int k = 0; k < 3; k++)
+          faceNormals[corner[k]] += face;
+      }
+      if (!tangents)
+        continue;
+      glm::vec2 uv1(b.uv[0] - a.uv[0], b.uv[1] - a.uv[1]);
+      glm::vec2 uv2(c.uv[0] - a.uv[0], c.uv[1] - a.uv[1]);
+      float determinant = uv1.x * uv2.y - uv2.x * uv1.y;
+      if (determinant == 0.0f)
+        continue;
+      glm::vec3 u = (edge1 * uv2.y - edge2 * uv1.y) / determinant;
+      glm::vec3 v = (edge2 * uv1.x - edge1 * uv2.x) / determinant;
+      for (int k = 0; k < 3; k++) {
+        uTangents[corner[k]] += u;
+        vTangents[corner[k]] += v;
+      }
+    }
+    parallel(count, 1 << 16, [&](unsigned int first, unsigned int last) {
+      for (unsigned int i = first; i < last; i++) {
+        SceneVertex &vertex = vertices[i];
+        if (normals) {
+          glm::vec3 normal = faceNormals[i];
+          float length = glm::length(normal);
+          normal = length > 0.0f ? normal / length : glm::vec3(0, 1, 0);
+          std::memcpy(vertex.normal, &normal[0], 3 * sizeof(float));
+        }
+        if (!tangents)
+          continue;
+        glm::vec3 normal(vertex.normal[0], vertex.normal[1], vertex.normal[2]);
+        glm::vec3 tangent =
+            uTangents[i] - normal * glm::dot(normal, uTangents[i]);
+        float length = glm::length(tangent);
+        if (length > 1e-6f) {
+          tangent /= length;
+        } else {
+          // no usable uv gradient, any direction along the surface
+          glm::vec3 axis = std::fabs(normal.x) < 0.9f ? glm::vec3(1, 0, 0)
+                                                       : glm::vec3(0, 1, 0);
+          tangent = glm::normalize(glm::cross(normal, axis));
+        }
+        float sign =
+            glm::dot(glm::cross(normal, tangent), vTangents[i]) < 0.0f ? -1.0f
+                                                                        : 1.0f;
+        std::memcpy(vertex.tangent, &tangent[0], 3 * sizeof(float));
+        vertex.tangent[3] = sign;
+      }
+    });
+  }
+
+  // vertices in the order the triangles first use them, unused ones dropped
+  static void reorderVertices(ImportedMesh &mesh) {
+    const uint32_t UNUSED = 0xffffffffu;
+    std::vector<uint32_t> remap(mesh.vertices.size(), UNUSED);
+    uint32_t used = 0;
+    for (uint32_t &v : mesh.indices) {
+      if (remap[v] == UNUSED)
+        remap[v] = used++;
+      v = remap[v];
+    }
+    std::vector<SceneVertex> reordered(used);
+    for (size_t v = 0; v < mesh.vertices.size(); v++)
+      if (remap[v] != UNUSED)
+        reordered[remap[v]] = mesh.vertices[v];
+    mesh.vertices.swap(reordered);
+  }
+};
+
+#endif
@@ -0,0 +1,275 @@
+#ifndef MESH_LOD_H
+#define MESH_LOD_H
+
+#include "../glm/glm.hpp"
+#include "memory_tracker.hpp"
+#include "mesh_import.hpp"
+#include "scene_file.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Builds levels of detail for a mesh by quadric error metric simplification
+// (Garland and Heckbert 1997). Every level is an index list over the same
+// vertices, so the levels of a mesh share its vertex range and only add
+// indices to the shared element buffer.
+//
+// Each pass collapses the cheapest edges, moving one vertex onto its
+// neighbour, until the next level's triangle budget is reached. Quadrics
+// accumulate across passes, so errors are measured against the original
+// surface: a level's error is the largest RMS distance (object units) of a
+// collapsed vertex from the planes it merged. Vertices on open edges, which
+// includes uv and normal seams of the welded mesh, never move, so borders
+// and texture mapping hold while the interior simplifies.
+class MeshLodBuilder {
+public:
+  static const unsigned int MAX_LODS = 5;
+  // each level aims for this fraction of the previous one's triangles, and
+  // a level saving less than MIN_REDUCTION is not worth keeping
+  static constexpr float LEVEL_RATIO = 0.5f;
+  static constexpr float MIN_REDUCTION = 0.25f;
+  // no collapse may move the surface by more than this fraction of the
+  // mesh's bounding box diagonal, coarser levels are not built
+  static constexpr float MAX_ERROR = 0.05f;
+
+  // level 0 is the source mesh
+  std::vector<uint32_t> levels[MAX_LODS];
+  float errors[MAX_LODS] = {};
+  unsigned int levelCount = 0;
+
+  void build(const SceneVertex *vertices, size_t vertexCount,
+             const uint32_t *indices, size_t indexCount) {
+    MemoryTagScope tag(MemoryTag::Geometry);
+    for (std::vector<uint32_t> &level : levels)
+      level.clear();
+    levels[0].assign(indices, indices + indexCount / 3 * 3);
+    errors[0] = 0.0f;
+    levelCount = 1;
+    if (levels[0].empty())
+      return;
+
+    std::vector<glm::vec3> positions(vertexCount);
+    glm::vec3 lo(1e30f), hi(-1e30f);
+    for (size_t v = 0; v < vertexCount; v++) {
+      positions[v] = glm::vec3(vertices[v].position[0],
+                               vertices[v].position[1],
+                               vertices[v].position[2]);
+      lo = glm::min(lo, positions[v]);
+      hi = glm::max(hi, positions[v]);
+    }
+    double maxError = glm::length(hi - lo) * MAX_ERROR;
+    std::vector<Quadric> quadrics(vertexCount);
+    for (size_t i = 0; i < levels[0].size(); i += 3) {
+      const uint32_t *corner = &levels[0][i];
+      glm::dvec3 p0 = positions[corner[0]], p1 = positions[corner[1]],
+                 p2 = positions[corner[2]];
+      glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+      double length = glm::length(normal);
+      if (length == 0.0)
+        continue;
+      // area weighted plane
+      Quadric plane(normal / length, -glm::dot(normal / length, p0),
+                    length * 0.5);
+      for (int k = 0; k < 3; k++)
+        quadrics[corner[k]] += plane;
+    }
+
+    std::vector<uint32_t> current = levels[0];
+    float error = 0.0f;
+    while (levelCount < MAX_LODS) {
+      size_t previous = levels[levelCount - 1].size();
+      size_t target = (size_t)(previous / 3 * LEVEL_RATIO) * 3;
+      while (current.size() > target &&
+             collapsePass(positions, quadrics, current, target, maxError,
+                          error))
+        ;
+      if (current.size() > previous * (1.0f - MIN_REDUCTION))
+        break;
+      MeshImporter::tipsify(current, vertexCount, MeshImporter::CACHE_SIZE);
+      levels[levelCount] = current;
+      errors[levelCount] = error;
+      levelCount++;
+    }
+  }
+
+private:
+  // sum of squared distances to weighted planes, as a symmetric 4x4 matrix
+  struct Quadric {
+    double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0,
+           cd = 0, d2 = 0;
+    double weight = 0;
+
+    Quadric() = default;
+    Quadric(glm::dvec3 n, double d, double w)
+        : a2(w * n.x * n.x), ab(w * n.x * n.y), ac(w * n.x * n.z),
+          ad(w * n.x * d), b2(w * n.y * n.y), bc(w * n.y * n.z),
+          bd(w * n.y * d), c2(w * n.z * n.z), cd(w * n.z * d), d2(w * d * d),
+          weight(w) {}
+
+    Quadric &operator+=(const Quadric &q) {
+      a2 += q.a2, ab += q.ab, ac += q.ac, ad += q.ad, b2 += q.b2;
+      bc += q.bc, bd += q.bd, c2 += q.c2, cd += q.cd, d2 += q.d2;
+      weight += q.weight;
+      return *this;
+    }
+
+    // weighted mean squared distance of p to the planes
+    double error(glm::dvec3 p) const {
+      double sum = a2 * p.x * p.x + b2 * p.y * p.y + c2 * p.z * p.z +
+                   2.0 * (ab * p.x * p.y + ac * p.x * p.z + bc * p.y * p.z +
+                          ad * p.x + bd * p.y + cd * p.z) +
+                   d2;
+      return weight > 0.0 ? std::max(sum, 0.0) / weight : 0.0;
+    }
+  };
+
+  struct Collapse {
+    double cost;
+    uint32_t from;
+    uint32_t to;
+  };
+
+  // One round of non-overlapping collapses, cheapest first, stopping at
+  // `target` indices or at collapses costing more than `maxError`. Returns
+  // false if no edge could collapse.
+  static bool collapsePass(const std::vector<glm::vec3> &positions,
+                           std::vector<Quadric> &quadrics,
+                           std::vector<uint32_t> &indices, size_t target,
+                           double maxError, float &error) {
+    size_t vertexCount = positions.size();
+    // directed edges without their opposite lie on a border or seam
+    std::vector<uint64_t> edges;
+    edges.reserve(indices.size());
+    for (size_t i = 0; i < indices.size(); i += 3)
+      for (int k = 0; k < 3; k++)
+        edges.push_back((uint64_t)indices[i + k] << 32 |
+                        indices[i + (k + 1) % 3]);
+    std::sort(edges.begin(), edges.end());
+    std::vector<unsigned char> locked(vertexCount, 0);
+    for (uint64_t edge : edges) {
+      uint64_t opposite = edge << 32 | edge >> 32;
+      if (!std::binary_search(edges.begin(), edges.end(), opposite)) {
+        locked[edge >> 32] = 1;
+        locked[(uint32_t)edge] = 1;
+      }
+    }
+
+    // triangles around vertex v are around[offsets[v] .. offsets[v + 1])
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (uint32_t v : indices)
+      offsets[v + 1]++;
+    for (size_t v = 0; v < vertexCount; v++)
+      offsets[v + 1] += offsets[v];
+    std::vector<uint32_t> around(indices.size());
+    std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++)
+      around[cursor[indices[i]]++] = i / 3;
+
+    std::vector<Collapse> collapses;
+    collapses.reserve(edges.size());
+    for (uint64_t edge : edges) {
+      uint32_t from = edge >> 32, to = (uint32_t)edge;
+      if (locked[from] || from == to)
+        continue;
+      Quadric merged = quadrics[from];
+      merged += quadrics[to];
+      collapses.push_back({merged.error(positions[to]), from, to});
+    }
+    std::sort(collapses.begin(), collapses.end(),
+              [](const Collapse &a, const Collapse &b) {
+                return a.cost < b.cost;
+              });
+
+    // a collapse changes the triangles around `from`, so no vertex of
+    // those may take part in another collapse of this pass
+    std::vector<unsigned char> touched(vertexCount, 0);
+    std::vector<uint32_t> remap(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+      remap[v] = v;
+    // each collapse of an interior edge removes two triangles
+    size_t wanted = (indices.size() - target) / 6 + 1;
+    size_t done = 0;
+    for (const Collapse &collapse : collapses) {
+      if (done == wanted || collapse.cost > maxError * maxError)
+        break;
+      if (touched[collapse.from] || touched[collapse.to])
+        continue;
+      if (flips(positions, indices, around, offsets, collapse))
+        continue;
+      for (uint32_t k = offsets[collapse.from]; k < offsets[collapse.from + 1];
+           k++)
+        for (int c = 0; c < 3; c++)
+          touched[indices[around[k] * 3 + c]] = 1;
+      remap[collapse.from] = collapse.to;
+      quadrics[collapse.to] += quadrics[collapse.from];
+      error = std::max(error, (float)std::sqrt(collapse.cost));
+      done++;
+    }
+    if (done == 0)
+      return false;
+
+    size_t kept = 0;
+    for (size_t i = 0; i < indices.size(); i += 3) {
+      uint32_t a = remap[indices[i]], b = remap[indices[i + 1]],
+               c = remap[indices[i + 2]];
+      if (a == b || b == c || c == a)
+        continue;
+      indices[kept++] = a;
+      indices[kept++] = b;
+      indices[kept++] = c;
+    }
+    indices.resize(kept);
+    return true;
+  }
+
+  // true if moving `from` onto `to` turns a remaining triangle around
+  static bool flips(const std::vector<glm::vec3> &positions,
+                    const std::vector<uint32_t> &indices,
+                    const std::vector<uint32_t> &around,
+                    const std::vector<uint32_t> &offsets,
+                    const Collapse &collapse) {
+    for (uint32_t k = offsets[collapse.from]; k < offsets[collapse.from + 1];
+         k++) {
+      const uint32_t *corner = &indices[around[k] * 3];
+      if (corner[0] == collapse.to || corner[1] == collapse.to ||
+          corner[2] == collapse.to)
+        continue; // becomes degenerate and is dropped
+      glm::vec3 before[3], after[3];
+      for (int c = 0; c < 3; c++) {
+        before[c] = positions[corner[c]];
+        after[c] = corner[c] == collapse.from ? positions[collapse.to]
+                                              : before[c];
+      }
+      glm::vec3 normalBefore =
+          glm::cross(before[1] - before[0], before[2] - before[0]);
+      glm::vec3 normalAfter =
+          glm::cross(after[1] - after[0], after[2] - after[0]);
+      if (glm::dot(normalBefore, normalAfter) <= 0.0f)
+        return true;
+    }
+    return false;
+  }
+};
+
+// Picks the level of detail to draw. `pixelsPerUnit` is how many pixels one
+// object space unit covers at the object's distance; a level is good enough
+// while its error projects to at most `threshold` pixels. Going to a finer
+// level happens as soon as the current one is too coarse, going to a coarser
+// one only once it is `hysteresis` (a fraction of the threshold) below the
+// threshold, so objects near a switching distance do not flicker between
+// levels.
+inline unsigned int selectLod(const SceneLod *levels, unsigned int count,
+                              unsigned int current, float pixelsPerUnit,
+                              float threshold, float hysteresis) {
+  unsigned int level = std::min(current, count - 1);
+  while (level > 0 && levels[level].error * pixelsPerUnit > threshold)
+    level--;
+  while (level + 1 < count && levels[level + 1].error * pixelsPerUnit <=
+                                  threshold * (1.0f - hysteresis))
+    level++;
+  return level;
+}
+
+#endif
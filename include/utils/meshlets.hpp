@@ -0,0 +1,159 @@
+#ifndef MESHLETS_H
+#define MESHLETS_H
+
+#include "../glm/glm.hpp"
+#include "frustum.hpp"
+#include "memory_tracker.hpp"
+#include "scene_file.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Splits a mesh into meshlets: clusters of at most MAX_VERTICES vertices and
+// MAX_TRIANGLES triangles with a bounding sphere and a normal cone, so large
+// meshes can be culled piece by piece. A meshlet is a run of consecutive
+// triangles of the mesh's index list; the list is already in vertex cache
+// order, which keeps neighbouring triangles together, so building meshlets
+// moves no indices and they draw straight from the shared element buffer.
+class MeshletBuilder {
+public:
+  static const unsigned int MAX_VERTICES = 64;
+  static const unsigned int MAX_TRIANGLES = 124;
+  // cones whose normals spread further than acos(MIN_CONE_COS) from the
+  // axis are too wide to ever face away, they get a cutoff of 1
+  static constexpr float MIN_CONE_COS = 0.1f;
+
+  std::vector<SceneMeshlet> meshlets;
+
+  // `firstIndex` is where `indices` start in the scene's index table, the
+  // meshlets' ranges are absolute like those of the LOD table
+  void build(const SceneVertex *vertices, size_t vertexCount,
+             const uint32_t *indices, size_t indexCount, uint32_t firstIndex) {
+    MemoryTagScope tag(MemoryTag::Geometry);
+    meshlets.clear();
+    // owner[v] is the number of the last meshlet that used v, plus one
+    owner.assign(vertexCount, 0);
+    uint32_t current = 1;
+    unsigned int used = 0;
+    size_t begin = 0, end = indexCount / 3 * 3;
+    for (size_t i = 0; i < end; i += 3) {
+      unsigned int added = 0;
+      for (int k = 0; k < 3; k++)
+        added += owner[indices[i + k]] != current;
+      if (used + added > MAX_VERTICES || i - begin == MAX_TRIANGLES * 3) {
+        add(vertices, indices, begin, i, firstIndex);
+        begin = i;
+        used = 0;
+        current++;
+      }
+      for (int k = 0; k < 3; k++) {
+        if (owner[indices[i + k]] != current) {
+          owner[indices[i + k]] = current;
+          used++;
+        }
+      }
+    }
+    if (begin < end)
+      add(vertices, indices, begin, end, firstIndex);
+  }
+
+private:
+  std::vector<uint32_t> owner;
+
+  void add(const SceneVertex *vertices, const uint32_t *indices, size_t begin,
+           size_t end, uint32_t firstIndex) {
+    auto position = [&](uint32_t i) {
+      const float *p = vertices[indices[i]].position;
+      return glm::vec3(p[0], p[1], p[2]);
+    };
+    SceneMeshlet meshlet = {};
+    meshlet.firstIndex = firstIndex + begin;
+    meshlet.indexCount = end - begin;
+
+    glm::vec3 lo(1e30f), hi(-1e30f);
+    for (size_t i = begin; i < end; i++) {
+      lo = glm::min(lo, position(i));
+      hi = glm::max(hi, position(i));
+    }
+    glm::vec3 center = (lo + hi) * 0.5f;
+    float radius = 0.0f;
+    for (size_t i = begin; i < end; i++)
+      radius = std::max(radius, glm::length(position(i) - center));
+
+    // the axis is the area weighted mean normal, the cone opens as far as
+    // the normal furthest from it
+    glm::vec3 sum(0.0f);
+    for (size_t i = begin; i < end; i += 3)
+      sum += glm::cross(position(i + 1) - position(i),
+                        position(i + 2) - position(i));
+    float length = glm::length(sum);
+    glm::vec3 axis = length > 0.0f ? sum / length : glm::vec3(0.0f, 0.0f, 1.0f);
+    float minCos = length > 0.0f ? 1.0f : -1.0f;
+    for (size_t i = begin; i < end; i += 3) {
+      glm::vec3 normal = glm::cross(position(i + 1) - position(i),
+                                    position(i + 2) - position(i));
+      float area = glm::length(normal);
+      if (area > 0.0f)
+        minCos = std::min(minCos, glm::dot(normal / area, axis));
+    }
+
+    for (int c = 0; c < 3; c++) {
+      meshlet.center[c] = center[c];
+      meshlet.coneAxis[c] = axis[c];
+    }
+    meshlet.radius = radius;
+    // sine of the cone's half angle
+    meshlet.coneCutoff = minCos < MIN_CONE_COS
+                             ? 1.0f
+                             : std::sqrt(1.0f - minCos * minCos);
+    meshlets.push_back(meshlet);
+  }
+};
+
+// Culls the meshlets of one object drawn with `model`: visible[i] becomes 0
+// if meshlet i is outside the frustum or every triangle of it faces away
+// from `eye`, 1 otherwise. Returns the number of visible meshlets.
+//
+// The backface test is the bounding sphere form of the cone test, which
+// holds for any viewpoint the sphere does not contain. Cones only keep their
+// angles under rotation and uniform scale, so objects scaled unevenly are
+// culled against the frustum alone. Only closed meshes should use the cone
+// test, nothing else hides the back of an open one.
+inline unsigned int cullMeshlets(const SceneMeshlet *meshlets,
+                                 unsigned int count, const glm::mat4 &model,
+                                 const Frustum &frustum, glm::vec3 eye,
+                                 unsigned char *visible) {
+  glm::vec3 axes2(glm::dot(glm::vec3(model[0]), glm::vec3(model[0])),
+                  glm::dot(glm::vec3(model[1]), glm::vec3(model[1])),
+                  glm::dot(glm::vec3(model[2]), glm::vec3(model[2])));
+  float largest = std::max(std::max(axes2.x, axes2.y), axes2.z);
+  float smallest = std::min(std::min(axes2.x, axes2.y), axes2.z);
+  float scale = std::sqrt(largest);
+  bool cones = smallest > largest * 0.999f && scale > 0.0f;
+  glm::mat3 rotation = glm::mat3(model) / (scale > 0.0f ? scale : 1.0f);
+
+  unsigned int kept = 0;
+  for (unsigned int i = 0; i < count; i++) {
+    const SceneMeshlet &meshlet = meshlets[i];
+    glm::vec3 center =
+        glm::vec3(model * glm::vec4(meshlet.center[0], meshlet.center[1],
+                                    meshlet.center[2], 1.0f));
+    float radius = meshlet.radius * scale;
+    bool inside = frustum.sphereVisible(center, radius);
+    if (inside && cones) {
+      glm::vec3 axis =
+          rotation * glm::vec3(meshlet.coneAxis[0], meshlet.coneAxis[1],
+                               meshlet.coneAxis[2]);
+      glm::vec3 view = center - eye;
+      inside = glm::dot(view, axis) <
+               meshlet.coneCutoff * glm::length(view) + radius;
+    }
+    visible[i] = inside;
+    kept += inside;
+  }
+  return kept;
+}
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include "../glm/glm.hpp"
+#include "../glm/gtc/matrix_transform.hpp"
+#include "entities.hpp"
+#include "memory_tracker.hpp"
+#include "shader.hpp"
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <vector>
+
+// The [-1, 1] cube, counter-clockwise seen from outside: the corners' x, y
+// and z, then the corners of its 12 triangles.
+const float CUBE_CORNERS[8 * 3] = {-1, -1, -1, 1, -1, -1, 1, 1, -1, -1, 1, -1,
+                                   -1, -1, 1,  1, -1, 1,  1, 1, 1,  -1, 1, 1};
+const uint32_t CUBE_FACES[36] = {0, 2, 1, 0, 3, 2, 4, 5, 6, 4, 6, 7,
+                                 0, 1, 5, 0, 5, 4, 3, 6, 2, 3, 7, 6,
+                                 0, 4, 7, 0, 7, 3, 1, 2, 6, 1, 6, 5};
+
+// Hardware occlusion culling. After the scene is drawn, the boxes around the
+// bounding spheres of objects in the frustum are drawn with depth and color
+// writes off, each in a GL_ANY_SAMPLES_PASSED_CONSERVATIVE query. The next
+// frames read the results without waiting: an object whose box passed no
+// samples is skipped, one whose result is not back yet is drawn under
+// glBeginConditionalRender so the GPU skips it if the box was hidden.
+//
+// Objects are identified by their entity slot. Hidden objects are tested
+// every frame so they reappear one frame after they come into view, visible
+// ones every VISIBLE_INTERVAL frames only. A query is not issued again until
+// its result was read, so a busy GPU never makes the CPU wait.
+class OcclusionQueries {
+public:
+  static const unsigned int VISIBLE_INTERVAL = 4;
+
+  // queries issued and objects skipped this frame
+  unsigned int tested = 0;
+  unsigned int occluded = 0;
+
+  void init() {
+    // the cube is scaled to the bounding sphere per object
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+    glGenBuffers(1, &ebo);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(CUBE_CORNERS), CUBE_CORNERS,
+                 GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(CUBE_FACES), CUBE_FACES,
+                 GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float),
+                          (void *)0);
+    glEnableVertexAttribArray(0);
+    glBindVertexArray(0);
+    MemoryTracker::gpuAllocate(MemoryTag::Renderer, gpuBytes());
+  }
+
+  void destroy() {
+    for (const Object &object : objects)
+      if (object.query)
+        glDeleteQueries(1, &object.query);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &ebo);
+    MemoryTracker::gpuRelease(MemoryTag::Renderer, gpuBytes());
+    objects.clear();
+  }
+
+  void beginFrame() {
+    frame++;
+    tested = 0;
+    occluded = 0;
+    requests.clear();
+  }
+
+  // Whether to skip the object this frame, going by its last result (read
+  // now if it arrived), and queues its box for this frame's test if it is
+  // due. Call once per frame for every object in the frustum; `model` and
+  // `bounds` place the box, `sphere` is the world bounding sphere. Objects
+  // outside the frustum last frame, and those whose box may hold the camera
+  // (`eye` within the sphere's box plus `near`), are never skipped.
+  bool cull(unsigned int id, const glm::mat4 &model, const Bounds &bounds,
+            glm::vec4 sphere, glm::vec3 eye, float near) {
+    Object &object = get(id);
+    if (object.seen + 1 < frame)
+      object.hidden = false;
+    object.seen = frame;
+    if (object.pending) {
+      GLuint available = 0;
+      glGetQueryObjectuiv(object.query, GL_QUERY_RESULT_AVAILABLE, &available);
+      if (available) {
+        GLuint samples = 0;
+        glGetQueryObjectuiv(object.query, GL_QUERY_RESULT, &samples);
+        object.hidden = samples == 0;
+        object.pending = false;
+      }
+    }
+    // the box reaches sqrt(3) times the radius out in its corners
+    float reach = sphere.w * 1.7321f + near;
+    glm::vec3 offset = glm::vec3(sphere) - eye;
+    if (glm::dot(offset, offset) < reach * reach) {
+      object.hidden = false;
+      return false;
+    }
+    if (!object.pending &&
+        (object.hidden || (frame + id) % VISIBLE_INTERVAL == 0)) {
+      if (requests.size() == requests.capacity()) {
+        MemoryTagScope tag(MemoryTag::Renderer);
+        requests.reserve(requests.size() * 2 + 64);
+      }
+      glm::mat4 box = glm::translate(model, bounds.center);
+      requests.push_back({id, glm::scale(box, glm::vec3(bounds.radius))});
+    }
+    occluded += object.hidden;
+    return object.hidden;
+  }
+
+  // Forgets the last result of slot `id`, call when an entity takes the
+  // slot over. A query still in flight is left to finish and reused.
+  void reset(unsigned int id) {
+    Object &object = get(id);
+    object.pending = false;
+    object.hidden = false;
+    object.seen = 0;
+  }
+
+  // the query whose result the CPU has not read yet, 0 if there is none
+  GLuint pending(unsigned int id) const {
+    return id < objects.size() && objects[id].pending ? objects[id].query : 0;
+  }
+
+  // Draws the queued boxes against the bound framebuffer's depth. `shader`
+  // transforms aPos (location 0) by its view, projection and model
+  // uniforms.
+  void test(Shader &shader, const glm::mat4 &view,
+            const glm::mat4 &projection) {
+    if (requests.empty())
+      return;
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    shader.use();
+    shader.setMat4("view", view);
+    shader.setMat4("projection", projection);
+    glBindVertexArray(vao);
+    for (const Request &request : requests) {
+      Object &object = objects[request.id];
+      if (!object.query)
+        glGenQueries(1, &object.query);
+      shader.setMat4("model", request.box);
+      glBeginQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE, object.query);
+      glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+      glEndQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE);
+      object.pending = true;
+    }
+    tested = requests.size();
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  }
+
+private:
+  struct Object {
+    GLuint query = 0;
+    bool pending = false;
+    bool hidden = false;
+    unsigned int seen = 0;
+  };
+  struct Request {
+    unsigned int id;
+    glm::mat4 box;
+  };
+  std::vector<Object> objects;
+  std::vector<Request> requests;
+  unsigned int frame = 1;
+  unsigned int vao = 0;
+  unsigned int vbo = 0;
+  unsigned int ebo = 0;
+
+  Object &get(unsigned int id) {
+    if (id >= objects.size()) {
+      MemoryTagScope tag(MemoryTag::Renderer);
+      objects.resize(id + 1);
+    }
+    return objects[id];
+  }
+
+  static size_t gpuBytes() {
+    return sizeof(CUBE_CORNERS) + sizeof(CUBE_FACES);
+  }
+};
+
+#endif
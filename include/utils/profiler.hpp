@@ -0,0 +1,182 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <glad/glad.h>
+#include <imgui.h>
+
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+// Named CPU/GPU timing scopes for the debug window. GPU times come from
+// GL_TIMESTAMP queries that are read back a few frames late so the CPU never
+// waits on the GPU.
+class Profiler {
+public:
+  struct Result {
+    const char *name;
+    float cpuMs = 0.0f;
+    float gpuMs = 0.0f;
+  };
+
+  // number of frames a query is kept in flight before reading it back
+  static const int LATENCY = 3;
+  static const int MAX_SCOPES = 32;
+
+  bool enabled = true;
+
+  void init() { glGenQueries(LATENCY * MAX_SCOPES * 2, queries); }
+
+  void destroy() { glDeleteQueries(LATENCY * MAX_SCOPES * 2, queries); }
+
+  // Collects the results of the frame issued LATENCY frames ago. Scopes
+  // whose timestamps are not back yet keep their last time, so a GPU that
+  // is further behind never makes the CPU wait.
+  void beginFrame() {
+    frame = (frame + 1) % LATENCY;
+    Frame &f = frames[frame];
+    for (int i = 0; i < f.count; i++) {
+      // timestamps complete in order, the end one being back covers both
+      GLuint available = 0;
+      glGetQueryObjectuiv(query(frame, i, 1), GL_QUERY_RESULT_AVAILABLE,
+                          &available);
+      if (!available)
+        continue;
+      GLuint64 start = 0, end = 0;
+      glGetQueryObjectui64v(query(frame, i, 0), GL_QUERY_RESULT, &start);
+      glGetQueryObjectui64v(query(frame, i, 1), GL_QUERY_RESULT, &end);
+      Result &r = result(f.names[i]);
+      r.gpuMs = smooth(r.gpuMs, (end - start) / 1.0e6f);
+    }
+    f.count = 0;
+    depth = 0;
+  }
+
+  void begin(const char *name) {
+    Frame &f = frames[frame];
+    if (depth >= MAX_SCOPES)
+      return;
+    // scopes opened while disabled are still pushed so begin/end stay paired
+    int index = -1;
+    if (enabled && f.count < MAX_SCOPES) {
+      index = f.count++;
+      f.names[index] = name;
+      glQueryCounter(query(frame, index, 0), GL_TIMESTAMP);
+    }
+    stack[depth++] = {index, std::chrono::steady_clock::now()};
+  }
+
+  void end() {
+    if (depth == 0)
+      return;
+    Open open = stack[--depth];
+    if (open.index < 0)
+      return;
+    glQueryCounter(query(frame, open.index, 1), GL_TIMESTAMP);
+    std::chrono::duration<float, std::milli> elapsed =
+        std::chrono::steady_clock::now() - open.start;
+    Result &r = result(frames[frame].names[open.index]);
+    r.cpuMs = smooth(r.cpuMs, elapsed.count());
+  }
+
+  // plain per-frame numbers (draw counts, maps rendered, ...) shown next to
+  // the timings
+  void setCounter(const char *name, double value) {
+    for (Counter &c : counters)
+      if (std::strcmp(c.name, name) == 0) {
+        c.value = value;
+        return;
+      }
+    counters.push_back({name, value});
+  }
+
+  const std::vector<Result> &results() const { return history; }
+
+  void draw() {
+    ImGui::Checkbox("Enable Profiler", &enabled);
+    for (const Result &r : history)
+      ImGui::Text("%-20s cpu %6.3f ms  gpu %6.3f ms", r.name, r.cpuMs,
+                  r.gpuMs);
+    for (const Counter &c : counters)
+      ImGui::Text("%-20s %.0f", c.name, c.value);
+  }
+
+private:
+  struct Counter {
+    const char *name;
+    double value;
+  };
+  struct Frame {
+    const char *names[MAX_SCOPES];
+    int count = 0;
+  };
+  struct Open {
+    int index;
+    std::chrono::steady_clock::time_point start;
+  };
+
+  GLuint queries[LATENCY * MAX_SCOPES * 2];
+  Frame frames[LATENCY];
+  Open stack[MAX_SCOPES];
+  std::vector<Result> history;
+  std::vector<Counter> counters;
+  int frame = 0;
+  int depth = 0;
+
+  GLuint query(int f, int scope, int edge) const {
+    return queries[(f * MAX_SCOPES + scope) * 2 + edge];
+  }
+
+  Result &result(const char *name) {
+    for (Result &r : history)
+      if (std::strcmp(r.name, name) == 0)
+        return r;
+    history.push_back({name});
+    return history.back();
+  }
+
+  static float smooth(float previous, float sample) {
+    return previous == 0.0f ? sample : previous * 0.9f + sample * 0.1f;
+  }
+};
+
+// Ring of queries of one target (GL_FRAGMENT_SHADER_INVOCATIONS,
+// GL_PRIMITIVES_GENERATED, ...) read back Profiler::LATENCY frames later,
+// only once the result is available, so it never stalls the pipeline.
+class QueryCounter {
+public:
+  void init(GLenum queryTarget) {
+    target = queryTarget;
+    glGenQueries(Profiler::LATENCY, queries);
+  }
+
+  void destroy() { glDeleteQueries(Profiler::LATENCY, queries); }
+
+  void begin() {
+    current = (current + 1) % Profiler::LATENCY;
+    GLuint q = queries[current];
+    if (issued[current]) {
+      GLuint available = 0;
+      glGetQueryObjectuiv(q, GL_QUERY_RESULT_AVAILABLE, &available);
+      if (available)
+        glGetQueryObjectui64v(q, GL_QUERY_RESULT, &lastValue);
+    }
+    glBeginQuery(target, q);
+  }
+
+  void end() {
+    glEndQuery(target);
+    issued[current] = true;
+  }
+
+  GLuint64 value() const { return lastValue; }
+
+private:
+  GLenum target = 0;
+  GLuint queries[Profiler::LATENCY];
+  bool issued[Profiler::LATENCY] = {};
+  int current = 0;
+  GLuint64 lastValue = 0;
+};
+
+#endif
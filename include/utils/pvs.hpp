@@ -0,0 +1,458 @@
+#ifndef PVS_H
+#define PVS_H
+
+#include "../glm/glm.hpp"
+#include "../glm/gtc/matrix_transform.hpp"
+#include "../glm/gtc/quaternion.hpp"
+#include "memory_tracker.hpp"
+#include "scene_file.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Potentially visible sets: for a static scene, which instances can be seen
+// from anywhere inside each cell of a grid. PvsBaker computes them offline,
+// the renderer looks up the camera's cell instead of culling occlusion
+// every frame.
+//
+// A set is coded whichever way is shorter: as a bit per instance, or, for
+// the usual sparse sets, as the gaps between visible instances, each a
+// LEB128 varint. The first byte says which.
+
+// the model matrix of a scene instance, as the entity store builds it
+inline glm::mat4 instanceModel(const SceneInstance &instance) {
+  const float *r = instance.rotation;
+  glm::mat4 model = glm::translate(
+      glm::mat4(1.0f), glm::vec3(instance.position[0], instance.position[1],
+                                 instance.position[2]));
+  model *= glm::mat4_cast(glm::quat(r[3], r[0], r[1], r[2]));
+  return glm::scale(model, glm::vec3(instance.scale[0], instance.scale[1],
+                                     instance.scale[2]));
+}
+
+enum PvsCoding : uint8_t { PvsGaps, PvsBits };
+
+inline void encodeVisibility(const unsigned char *visible, uint32_t count,
+                             std::vector<uint8_t> &out) {
+  size_t start = out.size();
+  out.push_back(PvsGaps);
+  uint32_t next = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    if (!visible[i])
+      continue;
+    uint32_t gap = i - next;
+    do {
+      out.push_back((gap & 0x7f) | (gap > 0x7f ? 0x80 : 0));
+      gap >>= 7;
+    } while (gap);
+    next = i + 1;
+  }
+  if (out.size() - start <= 1 + (count + 7) / 8)
+    return;
+  out.resize(start);
+  out.push_back(PvsBits);
+  out.resize(start + 1 + (count + 7) / 8, 0);
+  for (uint32_t i = 0; i < count; i++)
+    out[start + 1 + i / 8] |= (visible[i] != 0) << (i % 8);
+}
+
+// Returns false if the data is not a set of `count` instances.
+inline bool decodeVisibility(const uint8_t *data, uint32_t size,
+                             unsigned char *visible, uint32_t count) {
+  if (size == 0)
+    return false;
+  if (data[0] == PvsBits) {
+    if (size != 1 + (count + 7) / 8)
+      return false;
+    for (uint32_t i = 0; i < count; i++)
+      visible[i] = data[1 + i / 8] >> (i % 8) & 1;
+    return true;
+  }
+  if (data[0] != PvsGaps)
+    return false;
+  std::fill(visible, visible + count, 0);
+  uint32_t next = 0, at = 1;
+  while (at < size) {
+    uint32_t gap = 0;
+    for (int shift = 0;; shift += 7) {
+      if (at == size || shift > 28)
+        return false;
+      uint8_t byte = data[at++];
+      gap |= (uint32_t)(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        break;
+    }
+    if (gap >= count - next)
+      return false;
+    next += gap;
+    visible[next++] = 1;
+  }
+  return true;
+}
+
+// A bounding volume hierarchy over world space triangles, each tagged with
+// the instance it belongs to, for the baker's ray casts.
+class TriangleBvh {
+public:
+  struct Triangle {
+    glm::vec3 p0, e1, e2; // a corner and the edges from it
+    uint32_t instance;
+  };
+
+  static const unsigned int LEAF_SIZE = 4;
+
+  void build(std::vector<Triangle> input) {
+    MemoryTagScope tag(MemoryTag::Scene);
+    triangles = std::move(input);
+    nodes.clear();
+    if (triangles.empty())
+      return;
+    nodes.reserve(triangles.size() * 2 / LEAF_SIZE + 1);
+    nodes.emplace_back();
+    split(0, 0, triangles.size());
+  }
+
+  // The instance of the nearest triangle the ray from `origin` along the
+  // unit vector `direction` hits, from either side; SCENE_NONE if it hits
+  // nothing.
+  uint32_t intersect(glm::vec3 origin, glm::vec3 direction) const {
+    if (nodes.empty())
+      return SCENE_NONE;
+    glm::vec3 inverse(1.0f / direction.x, 1.0f / direction.y,
+                      1.0f / direction.z);
+    float nearest = INFINITY;
+    uint32_t hit = SCENE_NONE;
+    // nodes to visit with the distance the ray enters them at
+    std::pair<uint32_t, float> stack[64];
+    int top = 0;
+    stack[top++] = {0, enter(nodes[0], origin, inverse)};
+    while (top > 0) {
+      std::pair<uint32_t, float> visit = stack[--top];
+      if (visit.second >= nearest)
+        continue;
+      const Node &node = nodes[visit.first];
+      if (node.count) {
+        for (uint32_t i = node.first; i < node.first + node.count; i++) {
+          float t = triangleHit(triangles[i], origin, direction);
+          if (t < nearest) {
+            nearest = t;
+            hit = triangles[i].instance;
+          }
+        }
+        continue;
+      }
+      // the nearer child is popped first
+      std::pair<uint32_t, float> left = {node.first,
+                                         enter(nodes[node.first], origin,
+                                               inverse)};
+      std::pair<uint32_t, float> right = {node.first + 1,
+                                          enter(nodes[node.first + 1], origin,
+                                                inverse)};
+      if (right.second < left.second)
+        std::swap(left, right);
+      // median splits keep the tree far shallower than the stack
+      if (top + 2 <= 64) {
+        stack[top++] = right;
+        stack[top++] = left;
+      }
+    }
+    return hit;
+  }
+
+private:
+  // leaves have count triangles from first, inner nodes their children at
+  // first and first + 1
+  struct Node {
+    glm::vec3 lo, hi;
+    uint32_t first = 0;
+    uint32_t count = 0;
+  };
+  std::vector<Triangle> triangles;
+  std::vector<Node> nodes;
+
+  void split(uint32_t index, size_t begin, size_t end) {
+    glm::vec3 lo(INFINITY), hi(-INFINITY), centerLo(INFINITY),
+        centerHi(-INFINITY);
+    for (size_t i = begin; i < end; i++) {
+      const Triangle &t = triangles[i];
+      glm::vec3 p1 = t.p0 + t.e1, p2 = t.p0 + t.e2;
+      lo = glm::min(lo, glm::min(t.p0, glm::min(p1, p2)));
+      hi = glm::max(hi, glm::max(t.p0, glm::max(p1, p2)));
+      glm::vec3 center = t.p0 + (t.e1 + t.e2) / 3.0f;
+      centerLo = glm::min(centerLo, center);
+      centerHi = glm::max(centerHi, center);
+    }
+    nodes[index].lo = lo;
+    nodes[index].hi = hi;
+    glm::vec3 extent = centerHi - centerLo;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2)
+                                   : (extent.y > extent.z ? 1 : 2);
+    if (end - begin <= LEAF_SIZE || extent[axis] == 0.0f) {
+      nodes[index].first = begin;
+      nodes[index].count = end - begin;
+      return;
+    }
+    // median split along the longest axis of the centers
+    size_t middle = (begin + end) / 2;
+    std::nth_element(triangles.begin() + begin, triangles.begin() + middle,
+                     triangles.begin() + end,
+                     [axis](const Triangle &a, const Triangle &b) {
+                       return (a.p0 + (a.e1 + a.e2) / 3.0f)[axis] <
+                              (b.p0 + (b.e1 + b.e2) / 3.0f)[axis];
+                     });
+    uint32_t children = nodes.size();
+    nodes[index].first = children;
+    nodes.emplace_back();
+    nodes.emplace_back();
+    split(children, begin, middle);
+    split(children + 1, middle, end);
+  }
+
+  // distance at which the ray enters the node's box, INFINITY if it misses
+  static float enter(const Node &node, glm::vec3 origin, glm::vec3 inverse) {
+    glm::vec3 t0 = (node.lo - origin) * inverse;
+    glm::vec3 t1 = (node.hi - origin) * inverse;
+    glm::vec3 low = glm::min(t0, t1), high = glm::max(t0, t1);
+    float entry = std::max(std::max(low.x, low.y), std::max(low.z, 0.0f));
+    float exit = std::min(std::min(high.x, high.y), high.z);
+    return entry <= exit ? entry : INFINITY;
+  }
+
+  // Moeller-Trumbore, INFINITY if the ray misses
+  static float triangleHit(const Triangle &t, glm::vec3 origin,
+                           glm::vec3 direction) {
+    glm::vec3 p = glm::cross(direction, t.e2);
+    float determinant = glm::dot(t.e1, p);
+    if (std::fabs(determinant) < 1e-12f)
+      return INFINITY;
+    float inverse = 1.0f / determinant;
+    glm::vec3 s = origin - t.p0;
+    float u = glm::dot(s, p) * inverse;
+    if (u < 0.0f || u > 1.0f)
+      return INFINITY;
+    glm::vec3 q = glm::cross(s, t.e1);
+    float v = glm::dot(direction, q) * inverse;
+    if (v < 0.0f || u + v > 1.0f)
+      return INFINITY;
+    float distance = glm::dot(t.e2, q) * inverse;
+    return distance > 0.0f ? distance : INFINITY;
+  }
+};
+
+// Bakes the potentially visible sets of a scene. The grid covers the
+// instances' bounding boxes plus a cell on every side. From each cell,
+// SAMPLES random points cast RAYS random directions each against the
+// scene's triangles, and every instance hit first is visible. Instances
+// whose box reaches into the cell are always visible, the camera may be
+// right next to them. Sampling can miss an instance seen only through a
+// small gap, more rays make that less likely. Cells are baked in parallel,
+// each with its own random sequence, so the result does not depend on the
+// thread count.
+class PvsBaker {
+public:
+  static const unsigned int SAMPLES = 64;
+  static const unsigned int RAYS = 128;
+  // the grid is at most this many cells along an axis
+  static const uint32_t MAX_CELLS = 128;
+
+  ScenePvsGrid grid = {};
+  std::vector<uint32_t> cells;
+  std::vector<ScenePvsSet> sets;
+  std::vector<uint8_t> data;
+  // every cell's visibility, cells.size() rows of grid.instanceCount
+  std::vector<unsigned char> visibility;
+  // the world space triangles the rays are cast against
+  TriangleBvh bvh;
+
+  void bake(const SceneVertex *vertices, const uint32_t *indices,
+            const SceneMesh *meshes, const SceneInstance *instances,
+            uint32_t instanceCount, float cellSize, ThreadPool &pool) {
+    MemoryTagScope tag(MemoryTag::Scene);
+    std::vector<TriangleBvh::Triangle> triangles;
+    std::vector<glm::vec3> lo(instanceCount), hi(instanceCount);
+    glm::vec3 sceneLo(INFINITY), sceneHi(-INFINITY);
+    for (uint32_t i = 0; i < instanceCount; i++) {
+      const SceneMesh &mesh = meshes[instances[i].mesh];
+      glm::mat4 model = instanceModel(instances[i]);
+      lo[i] = glm::vec3(INFINITY);
+      hi[i] = glm::vec3(-INFINITY);
+      for (uint32_t k = 0; k + 3 <= mesh.indexCount; k += 3) {
+        glm::vec3 p[3];
+        for (int c = 0; c < 3; c++) {
+          const float *v =
+              vertices[mesh.firstVertex + indices[mesh.firstIndex + k + c]]
+                  .position;
+          p[c] = glm::vec3(model * glm::vec4(v[0], v[1], v[2], 1.0f));
+          lo[i] = glm::min(lo[i], p[c]);
+          hi[i] = glm::max(hi[i], p[c]);
+        }
+        triangles.push_back({p[0], p[1] - p[0], p[2] - p[0], i});
+      }
+      sceneLo = glm::min(sceneLo, lo[i]);
+      sceneHi = glm::max(sceneHi, hi[i]);
+    }
+    bvh.build(std::move(triangles));
+
+    grid = {};
+    grid.instanceCount = instanceCount;
+    grid.cellSize = cellSize;
+    if (instanceCount == 0)
+      sceneLo = sceneHi = glm::vec3(0.0f);
+    for (int c = 0; c < 3; c++) {
+      grid.origin[c] = sceneLo[c] - cellSize;
+      float extent = sceneHi[c] - sceneLo[c] + 2.0f * cellSize;
+      grid.cells[c] = std::min((uint32_t)std::ceil(extent / cellSize),
+                               (uint32_t)MAX_CELLS);
+    }
+    uint32_t cellCount = grid.cells[0] * grid.cells[1] * grid.cells[2];
+    visibility.assign((size_t)cellCount * instanceCount, 0);
+
+    pool.parallelFor(cellCount, 1, [&](unsigned int begin, unsigned int end) {
+      for (uint32_t cell = begin; cell < end; cell++) {
+        unsigned char *visible = &visibility[(size_t)cell * instanceCount];
+        glm::vec3 cellLo = cellOrigin(cell);
+        glm::vec3 cellHi = cellLo + cellSize;
+        for (uint32_t i = 0; i < instanceCount; i++)
+          visible[i] = glm::all(glm::lessThanEqual(lo[i], cellHi)) &&
+                       glm::all(glm::lessThanEqual(cellLo, hi[i]));
+        std::mt19937 random(cell);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        for (unsigned int s = 0; s < SAMPLES; s++) {
+          glm::vec3 origin =
+              cellLo + cellSize * glm::vec3(unit(random), unit(random),
+                                            unit(random));
+          for (unsigned int r = 0; r < RAYS; r++) {
+            // uniform on the sphere
+            float z = 2.0f * unit(random) - 1.0f;
+            float phi = 6.28318530718f * unit(random);
+            float planar = std::sqrt(std::max(1.0f - z * z, 0.0f));
+            glm::vec3 direction(planar * std::cos(phi),
+                                planar * std::sin(phi), z);
+            uint32_t hit = bvh.intersect(origin, direction);
+            if (hit != SCENE_NONE)
+              visible[hit] = 1;
+          }
+        }
+      }
+    });
+
+    // equal sets are stored once
+    cells.assign(cellCount, 0);
+    sets.clear();
+    data.clear();
+    std::unordered_map<std::string, uint32_t> known;
+    std::vector<uint8_t> coded;
+    for (uint32_t cell = 0; cell < cellCount; cell++) {
+      const unsigned char *visible = &visibility[(size_t)cell * instanceCount];
+      coded.clear();
+      encodeVisibility(visible, instanceCount, coded);
+      std::string key(coded.begin(), coded.end());
+      auto found = known.find(key);
+      if (found != known.end()) {
+        cells[cell] = found->second;
+        continue;
+      }
+      ScenePvsSet set = {(uint32_t)data.size(), (uint32_t)coded.size(),
+                         (uint32_t)std::count(visible,
+                                              visible + instanceCount, 1)};
+      cells[cell] = known[key] = sets.size();
+      sets.push_back(set);
+      data.insert(data.end(), coded.begin(), coded.end());
+    }
+  }
+
+  glm::vec3 cellOrigin(uint32_t cell) const {
+    uint32_t x = cell % grid.cells[0], y = cell / grid.cells[0] % grid.cells[1],
+             z = cell / (grid.cells[0] * grid.cells[1]);
+    return glm::vec3(grid.origin[0], grid.origin[1], grid.origin[2]) +
+           glm::vec3(x, y, z) * grid.cellSize;
+  }
+};
+
+// The potentially visible sets of a mapped scene, decoded one cell at a time
+// as the camera moves.
+class PotentiallyVisibleSets {
+public:
+  // Checks the tables; a scene without sets, or with broken ones, has none.
+  bool load(const SceneFile &file) {
+    MemoryTagScope tag(MemoryTag::Scene);
+    grid = {};
+    current = -1;
+    SceneSpan<ScenePvsGrid> grids = file.pvsGrids();
+    if (grids.count == 0)
+      return true;
+    cells = file.pvsCells();
+    sets = file.pvsSets();
+    data = file.pvsData();
+    const ScenePvsGrid &g = grids[0];
+    bool valid = grids.count == 1 && g.cellSize > 0.0f &&
+                 g.instanceCount == file.instances().count &&
+                 (uint64_t)g.cells[0] * g.cells[1] * g.cells[2] == cells.count;
+    for (uint32_t i = 0; i < sets.count && valid; i++)
+      valid = sets[i].offset <= data.count &&
+              sets[i].size <= data.count - sets[i].offset;
+    for (uint32_t i = 0; i < cells.count && valid; i++)
+      valid = cells[i] < sets.count;
+    if (!valid) {
+      std::cout << "ERROR::SCENE::BAD_PVS" << std::endl;
+      return false;
+    }
+    grid = g;
+    visible.assign(grid.instanceCount, 1);
+    return true;
+  }
+
+  bool loaded() const { return grid.cellSize > 0.0f; }
+  uint32_t cellCount() const { return cells.count; }
+  uint32_t setCount() const { return sets.count; }
+  size_t bytes() const {
+    return cells.count * sizeof(uint32_t) + sets.count * sizeof(ScenePvsSet) +
+           data.count;
+  }
+
+  // the cell holding `position`, -1 outside the grid
+  int cellAt(glm::vec3 position) const {
+    if (!loaded())
+      return -1;
+    int cell = 0, stride = 1;
+    for (int c = 0; c < 3; c++) {
+      float at = std::floor((position[c] - grid.origin[c]) / grid.cellSize);
+      if (!(at >= 0.0f && at < (float)grid.cells[c]))
+        return -1;
+      cell += (int)at * stride;
+      stride *= grid.cells[c];
+    }
+    return cell;
+  }
+
+  // Per instance 1 if it may be seen from `cell`. A cell whose set does not
+  // decode sees everything.
+  const unsigned char *select(int cell) {
+    if (cell != current) {
+      current = cell;
+      const ScenePvsSet &set = sets[cells[cell]];
+      if (!decodeVisibility(data.data + set.offset, set.size, visible.data(),
+                            grid.instanceCount))
+        std::fill(visible.begin(), visible.end(), 1);
+    }
+    return visible.data();
+  }
+
+private:
+  ScenePvsGrid grid = {};
+  SceneSpan<uint32_t> cells;
+  SceneSpan<ScenePvsSet> sets;
+  SceneSpan<uint8_t> data;
+  std::vector<unsigned char> visible;
+  int current = -1;
+};
+
+#endif
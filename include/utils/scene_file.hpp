@@ -0,0 +1,389 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "mapped_file.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Binary scene files (.scene), written by `scene_converter` and mapped by
+// SceneFile. The file is a header followed by one table per section; tables
+// are arrays of the fixed size records below at 16 byte aligned offsets
+// from the start of the file, and records refer to each other by index and
+// to strings by offset into the string table, so nothing needs fixing up
+// after mapping. Everything is little endian. Records use plain floats,
+// not glm types, so GLM_FORCE_DEFAULT_ALIGNED_GENTYPES builds read the same
+// layout.
+enum SceneSection : uint32_t {
+  SceneVertices,
+  SceneIndices,
+  SceneMeshes,
+  SceneLods,
+  SceneMeshlets,
+  SceneInstances,
+  SceneMaterials,
+  SceneLights,
+  SceneTextures,
+  ScenePvsGrids,
+  ScenePvsCells,
+  ScenePvsSets,
+  ScenePvsData,
+  SceneStrings,
+  SceneSectionCount,
+};
+
+// index fields holding no reference
+const uint32_t SCENE_NONE = 0xffffffffu;
+
+// the engine's vertex format
+struct SceneVertex {
+  float position[3];
+  float normal[3];
+  float uv[2];
+  float tangent[4]; // w is the bitangent's sign
+};
+
+// Ranges of the vertex and index tables with their bounding sphere. Indices
+// are 32 bit and relative to firstVertex. The mesh's levels of detail are
+// lodCount entries of the LOD table from firstLod on (0 if it has none),
+// level 0 being the full index range, and its level 0 is split into the
+// meshletCount meshlets from firstMeshlet on.
+struct SceneMesh {
+  uint32_t firstVertex;
+  uint32_t vertexCount;
+  uint32_t firstIndex;
+  uint32_t indexCount;
+  float center[3];
+  float radius;
+  uint32_t firstLod;
+  uint32_t lodCount;
+  uint32_t firstMeshlet;
+  uint32_t meshletCount;
+};
+
+// an index range of one level of detail, its error in object space units
+struct SceneLod {
+  uint32_t firstIndex;
+  uint32_t indexCount;
+  float error;
+};
+
+// a cluster of a mesh's triangles with its bounding sphere and normal cone,
+// see MeshletBuilder; coneCutoff is the sine of the cone's half angle
+struct SceneMeshlet {
+  float center[3];
+  float radius;
+  float coneAxis[3];
+  float coneCutoff;
+  uint32_t firstIndex;
+  uint32_t indexCount;
+};
+
+struct SceneInstance {
+  float position[3];
+  float rotation[4]; // x, y, z, w
+  float scale[3];
+  uint32_t mesh;
+  uint32_t material;
+};
+
+struct SceneMaterial {
+  uint32_t name;            // string offset
+  uint32_t diffuseTexture;  // texture index or SCENE_NONE
+  uint32_t specularTexture; // texture index or SCENE_NONE
+  float diffuse[3];
+  float specular[3];
+  float shininess;
+};
+
+// fields as in `Light` from lights.hpp, cut offs are cosines
+struct SceneLight {
+  uint32_t type;
+  uint32_t castShadows;
+  float position[3];
+  float direction[3];
+  float ambient[3];
+  float diffuse[3];
+  float specular[3];
+  float attenuation[3];
+  float cutOff;
+  float outerCutOff;
+};
+
+struct SceneTexture {
+  uint32_t path; // string offset
+};
+
+// The potentially visible sets' grid, at most one: cells[0] x cells[1] x
+// cells[2] cubes of cellSize from origin, x varying fastest. The cells
+// table holds each cell's set index; sets were baked for instanceCount
+// instances.
+struct ScenePvsGrid {
+  float origin[3];
+  float cellSize;
+  uint32_t cells[3];
+  uint32_t instanceCount;
+};
+
+// a set's run-length coded bytes in the PVS data table, see pvs.hpp
+struct ScenePvsSet {
+  uint32_t offset;
+  uint32_t size;
+  uint32_t visibleCount;
+};
+
+struct SceneTable {
+  uint64_t offset;
+  uint32_t count;
+  uint32_t stride;
+};
+
+struct SceneHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t sectionCount;
+  uint64_t fileSize;
+  SceneTable tables[SceneSectionCount];
+};
+
+static_assert(sizeof(SceneVertex) == 48, "SceneVertex layout changed");
+static_assert(sizeof(SceneMesh) == 48, "SceneMesh layout changed");
+static_assert(sizeof(SceneLod) == 12, "SceneLod layout changed");
+static_assert(sizeof(SceneMeshlet) == 40, "SceneMeshlet layout changed");
+static_assert(sizeof(SceneInstance) == 48, "SceneInstance layout changed");
+static_assert(sizeof(SceneMaterial) == 40, "SceneMaterial layout changed");
+static_assert(sizeof(SceneLight) == 88, "SceneLight layout changed");
+static_assert(sizeof(ScenePvsGrid) == 32, "ScenePvsGrid layout changed");
+static_assert(sizeof(ScenePvsSet) == 12, "ScenePvsSet layout changed");
+static_assert(sizeof(SceneHeader) == 24 + 16 * SceneSectionCount,
+              "SceneHeader layout changed");
+
+const char SCENE_MAGIC[8] = {'L', 'O', 'G', 'L', 'S', 'C', 'N', '\0'};
+// bump whenever a record or the header changes
+const uint32_t SCENE_VERSION = 5;
+
+// one section of a mapped scene, used in place
+template <typename T> struct SceneSpan {
+  const T *data = nullptr;
+  uint32_t count = 0;
+
+  const T &operator[](uint32_t i) const { return data[i]; }
+  const T *begin() const { return data; }
+  const T *end() const { return data + count; }
+};
+
+// A read-only mapping of a .scene file. `open` only checks the header and
+// that every table lies inside the file, pages of a table are read from disk
+// the first time they are touched.
+class SceneFile {
+public:
+  SceneFile() = default;
+  SceneFile(const SceneFile &) = delete;
+  SceneFile &operator=(const SceneFile &) = delete;
+  ~SceneFile() { close(); }
+
+  bool open(const char *path) {
+    close();
+    if (!file.open(path))
+      return false;
+    bytes = file.data();
+    length = file.size();
+    if (!validate()) {
+      std::cout << "ERROR::SCENE::INVALID_FILE: " << path << std::endl;
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  void close() {
+    file.close();
+    bytes = nullptr;
+    length = 0;
+  }
+
+  bool isOpen() const { return bytes != nullptr; }
+  size_t size() const { return length; }
+
+  SceneSpan<SceneVertex> vertices() const {
+    return span<SceneVertex>(SceneVertices);
+  }
+  SceneSpan<uint32_t> indices() const { return span<uint32_t>(SceneIndices); }
+  SceneSpan<SceneMesh> meshes() const { return span<SceneMesh>(SceneMeshes); }
+  SceneSpan<SceneLod> lods() const { return span<SceneLod>(SceneLods); }
+  SceneSpan<SceneMeshlet> meshlets() const {
+    return span<SceneMeshlet>(SceneMeshlets);
+  }
+  SceneSpan<SceneInstance> instances() const {
+    return span<SceneInstance>(SceneInstances);
+  }
+  SceneSpan<SceneMaterial> materials() const {
+    return span<SceneMaterial>(SceneMaterials);
+  }
+  SceneSpan<SceneLight> lights() const {
+    return span<SceneLight>(SceneLights);
+  }
+  SceneSpan<SceneTexture> textures() const {
+    return span<SceneTexture>(SceneTextures);
+  }
+  SceneSpan<ScenePvsGrid> pvsGrids() const {
+    return span<ScenePvsGrid>(ScenePvsGrids);
+  }
+  SceneSpan<uint32_t> pvsCells() const { return span<uint32_t>(ScenePvsCells); }
+  SceneSpan<ScenePvsSet> pvsSets() const {
+    return span<ScenePvsSet>(ScenePvsSets);
+  }
+  SceneSpan<uint8_t> pvsData() const { return span<uint8_t>(ScenePvsData); }
+
+  // "" for offsets outside the string table
+  const char *string(uint32_t offset) const {
+    const SceneTable &strings = header()->tables[SceneStrings];
+    if (offset >= strings.count)
+      return "";
+    return (const char *)bytes + strings.offset + offset;
+  }
+
+  // index of the material called `name`, SCENE_NONE if there is none
+  uint32_t findMaterial(const char *name) const {
+    SceneSpan<SceneMaterial> all = materials();
+    for (uint32_t i = 0; i < all.count; i++)
+      if (std::strcmp(string(all[i].name), name) == 0)
+        return i;
+    return SCENE_NONE;
+  }
+
+private:
+  MappedFile file;
+  const unsigned char *bytes = nullptr;
+  size_t length = 0;
+
+  const SceneHeader *header() const { return (const SceneHeader *)bytes; }
+
+  template <typename T> SceneSpan<T> span(SceneSection section) const {
+    const SceneTable &table = header()->tables[section];
+    return {(const T *)(bytes + table.offset), table.count};
+  }
+
+  // touches the header page only
+  bool validate() const {
+    if (length < sizeof(SceneHeader))
+      return false;
+    const SceneHeader *h = header();
+    if (std::memcmp(h->magic, SCENE_MAGIC, sizeof(SCENE_MAGIC)) != 0 ||
+        h->version != SCENE_VERSION || h->sectionCount != SceneSectionCount ||
+        h->fileSize != length)
+      return false;
+    const uint32_t strides[SceneSectionCount] = {
+        sizeof(SceneVertex),   sizeof(uint32_t),     sizeof(SceneMesh),
+        sizeof(SceneLod),      sizeof(SceneMeshlet), sizeof(SceneInstance),
+        sizeof(SceneMaterial), sizeof(SceneLight),   sizeof(SceneTexture),
+        sizeof(ScenePvsGrid),  sizeof(uint32_t),     sizeof(ScenePvsSet),
+        1,                     1};
+    for (uint32_t i = 0; i < SceneSectionCount; i++) {
+      const SceneTable &table = h->tables[i];
+      if (table.stride != strides[i] || table.offset % 16 != 0 ||
+          table.offset > length ||
+          (uint64_t)table.count * table.stride > length - table.offset)
+        return false;
+    }
+    // strings must end in a terminator so `string` cannot run off the end
+    const SceneTable &strings = h->tables[SceneStrings];
+    return strings.count == 0 || bytes[strings.offset + strings.count - 1] == 0;
+  }
+};
+
+// Builds a scene in memory and writes it out as a .scene file.
+class SceneWriter {
+public:
+  std::vector<SceneVertex> vertices;
+  std::vector<uint32_t> indices;
+  std::vector<SceneMesh> meshes;
+  std::vector<SceneLod> lods;
+  std::vector<SceneMeshlet> meshlets;
+  std::vector<SceneInstance> instances;
+  std::vector<SceneMaterial> materials;
+  std::vector<SceneLight> lights;
+  std::vector<SceneTexture> textures;
+  std::vector<ScenePvsGrid> pvsGrids;
+  std::vector<uint32_t> pvsCells;
+  std::vector<ScenePvsSet> pvsSets;
+  std::vector<uint8_t> pvsData;
+
+  // offset of `text` in the string table, equal strings are stored once
+  uint32_t addString(const std::string &text) {
+    for (size_t i = 0; i < stringOffsets.size(); i++)
+      if (text == &strings[stringOffsets[i]])
+        return stringOffsets[i];
+    uint32_t offset = strings.size();
+    strings.insert(strings.end(), text.begin(), text.end());
+    strings.push_back('\0');
+    stringOffsets.push_back(offset);
+    return offset;
+  }
+
+  bool write(const char *path) const {
+    SceneHeader header = {};
+    std::memcpy(header.magic, SCENE_MAGIC, sizeof(SCENE_MAGIC));
+    header.version = SCENE_VERSION;
+    header.sectionCount = SceneSectionCount;
+    const void *data[SceneSectionCount] = {
+        vertices.data(),  indices.data(),   meshes.data(),
+        lods.data(),      meshlets.data(),  instances.data(),
+        materials.data(), lights.data(),    textures.data(),
+        pvsGrids.data(),  pvsCells.data(),  pvsSets.data(),
+        pvsData.data(),   strings.data()};
+    size_t counts[SceneSectionCount] = {
+        vertices.size(),  indices.size(),   meshes.size(),
+        lods.size(),      meshlets.size(),  instances.size(),
+        materials.size(), lights.size(),    textures.size(),
+        pvsGrids.size(),  pvsCells.size(),  pvsSets.size(),
+        pvsData.size(),   strings.size()};
+    const uint32_t strides[SceneSectionCount] = {
+        sizeof(SceneVertex),   sizeof(uint32_t),     sizeof(SceneMesh),
+        sizeof(SceneLod),      sizeof(SceneMeshlet), sizeof(SceneInstance),
+        sizeof(SceneMaterial), sizeof(SceneLight),   sizeof(SceneTexture),
+        sizeof(ScenePvsGrid),  sizeof(uint32_t),     sizeof(ScenePvsSet),
+        1,                     1};
+    uint64_t offset = sizeof(SceneHeader);
+    for (uint32_t i = 0; i < SceneSectionCount; i++) {
+      offset = align(offset);
+      header.tables[i] = {offset, (uint32_t)counts[i], strides[i]};
+      offset += (uint64_t)counts[i] * strides[i];
+    }
+    header.fileSize = offset;
+
+    FILE *file = std::fopen(path, "wb");
+    if (!file) {
+      std::cout << "ERROR::SCENE::WRITE_FAILED: " << path << std::endl;
+      return false;
+    }
+    bool written = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    uint64_t position = sizeof(SceneHeader);
+    const char padding[16] = {};
+    for (uint32_t i = 0; i < SceneSectionCount && written; i++) {
+      const SceneTable &table = header.tables[i];
+      size_t bytes = (size_t)table.count * table.stride;
+      written = std::fwrite(padding, 1, table.offset - position, file) ==
+                    table.offset - position &&
+                (bytes == 0 || std::fwrite(data[i], 1, bytes, file) == bytes);
+      position = table.offset + bytes;
+    }
+    written = std::fclose(file) == 0 && written;
+    if (!written)
+      std::cout << "ERROR::SCENE::WRITE_FAILED: " << path << std::endl;
+    return written;
+  }
+
+private:
+  std::vector<char> strings;
+  std::vector<uint32_t> stringOffsets;
+
+  static uint64_t align(uint64_t offset) { return (offset + 15) & ~15ull; }
+};
+
+#endif
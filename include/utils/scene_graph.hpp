@@ -0,0 +1,238 @@
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include "../glm/glm.hpp"
+#include "../glm/gtc/quaternion.hpp"
+#include "memory_tracker.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <vector>
+
+// Parent/child transforms stored breadth first: every parent comes before its
+// children and every depth of the tree is one contiguous range. `update`
+// computes world matrices in a single forward pass that starts at the first
+// dirty node and only recomputes dirty nodes, a dirty parent dirtying its
+// children as the pass reaches them. Nodes of one depth only depend on the
+// depth above, so depths with at least PARALLEL_LEVEL nodes are split across
+// the thread pool.
+//
+// Nodes are referred to by the id `add` returns. Adding or reparenting nodes
+// re-sorts the arrays at the next update, ids stay the same.
+class SceneGraph {
+public:
+  static const unsigned int NONE = 0xffffffffu;
+  static const unsigned int PARALLEL_LEVEL = 4096;
+  static const unsigned int CHUNK = 1024;
+
+  // nodes recomputed by the last update
+  unsigned int updatedNodes = 0;
+
+  unsigned int add(unsigned int parent, glm::vec3 position, glm::quat rotation,
+                   glm::vec3 scale = glm::vec3(1.0f)) {
+    MemoryTagScope tag(MemoryTag::Scene);
+    unsigned int id = indexOf.size();
+    // appending keeps parents before children, only the depths need sorting
+    indexOf.push_back(ids.size());
+    ids.push_back(id);
+    parents.push_back(parent != NONE ? indexOf[parent] : parent);
+    positions.push_back(position);
+    rotations.push_back(rotation);
+    scales.push_back(scale);
+    worlds.push_back(glm::mat4(1.0f));
+    dirty.push_back(0);
+    markDirty(indexOf[id]);
+    sorted = false;
+    return id;
+  }
+
+  // Moves `id` and its subtree under `parent` (NONE makes it a root), fails
+  // if `parent` is inside the subtree.
+  bool setParent(unsigned int id, unsigned int parent) {
+    unsigned int index = indexOf[id];
+    unsigned int parentIndex = parent != NONE ? indexOf[parent] : parent;
+    for (unsigned int i = parentIndex; i != NONE; i = parents[i]) {
+      if (i == index) {
+        std::cout << "ERROR::SCENE_GRAPH::CYCLE: " << id << " under " << parent
+                  << std::endl;
+        return false;
+      }
+    }
+    parents[index] = parentIndex;
+    markDirty(index);
+    sorted = false;
+    return true;
+  }
+
+  void setPosition(unsigned int id, glm::vec3 position) {
+    positions[indexOf[id]] = position;
+    markDirty(indexOf[id]);
+  }
+  void setRotation(unsigned int id, glm::quat rotation) {
+    rotations[indexOf[id]] = rotation;
+    markDirty(indexOf[id]);
+  }
+  void setScale(unsigned int id, glm::vec3 scale) {
+    scales[indexOf[id]] = scale;
+    markDirty(indexOf[id]);
+  }
+
+  glm::vec3 position(unsigned int id) const { return positions[indexOf[id]]; }
+  glm::quat rotation(unsigned int id) const { return rotations[indexOf[id]]; }
+  glm::vec3 scale(unsigned int id) const { return scales[indexOf[id]]; }
+  unsigned int parent(unsigned int id) const {
+    unsigned int index = parents[indexOf[id]];
+    return index != NONE ? ids[index] : index;
+  }
+  // as of the last update
+  const glm::mat4 &world(unsigned int id) const { return worlds[indexOf[id]]; }
+
+  unsigned int size() const { return ids.size(); }
+  unsigned int depth() const { return levels.empty() ? 0 : levels.size() - 1; }
+
+  // Recomputes the world matrices of dirty nodes and their subtrees, on
+  // `pool` if given.
+  void update(ThreadPool *pool = nullptr) {
+    if (!sorted)
+      sortBreadthFirst();
+    updatedNodes = 0;
+    if (firstDirty >= size())
+      return;
+
+    std::atomic<unsigned int> updated{0};
+    auto updateRange = [&](unsigned int begin, unsigned int end) {
+      unsigned int count = 0;
+      for (unsigned int i = begin; i < end; i++) {
+        unsigned int parent = parents[i];
+        if (parent != NONE && dirty[parent])
+          dirty[i] = 1;
+        if (!dirty[i])
+          continue;
+        glm::mat4 local = compose(positions[i], rotations[i], scales[i]);
+        worlds[i] = parent == NONE ? local : worlds[parent] * local;
+        count++;
+      }
+      updated += count;
+    };
+
+    // runs of narrow depths go in one serial pass, wide depths to the pool
+    unsigned int level =
+        std::upper_bound(levels.begin(), levels.end(), firstDirty) -
+        levels.begin() - 1;
+    unsigned int serialBegin = firstDirty;
+    for (; pool && level + 1 < levels.size(); level++) {
+      unsigned int begin = std::max(levels[level], firstDirty);
+      unsigned int end = levels[level + 1];
+      if (end - begin < PARALLEL_LEVEL)
+        continue;
+      updateRange(serialBegin, begin);
+      pool->parallelFor(end - begin, CHUNK,
+                        [&](unsigned int first, unsigned int last) {
+                          updateRange(begin + first, begin + last);
+                        });
+      serialBegin = end;
+    }
+    updateRange(serialBegin, size());
+
+    std::fill(dirty.begin() + firstDirty, dirty.end(), 0);
+    firstDirty = NONE;
+    updatedNodes = updated;
+  }
+
+  // translate * rotate * scale
+  static glm::mat4 compose(glm::vec3 position, glm::quat rotation,
+                           glm::vec3 scale) {
+    glm::mat3 r = glm::mat3_cast(rotation);
+    return glm::mat4(glm::vec4(r[0] * scale.x, 0.0f),
+                     glm::vec4(r[1] * scale.y, 0.0f),
+                     glm::vec4(r[2] * scale.z, 0.0f),
+                     glm::vec4(position, 1.0f));
+  }
+
+private:
+  // all in breadth first order except the id -> index table
+  std::vector<unsigned int> ids;
+  std::vector<unsigned int> indexOf;
+  std::vector<unsigned int> parents;
+  std::vector<glm::vec3> positions;
+  std::vector<glm::quat> rotations;
+  std::vector<glm::vec3> scales;
+  std::vector<glm::mat4> worlds;
+  std::vector<unsigned char> dirty;
+  // first index of every depth, then size()
+  std::vector<unsigned int> levels;
+  unsigned int firstDirty = NONE;
+  bool sorted = true;
+
+  void markDirty(unsigned int index) {
+    dirty[index] = 1;
+    firstDirty = std::min(firstDirty, index);
+  }
+
+  void sortBreadthFirst() {
+    MemoryTagScope tag(MemoryTag::Scene);
+    unsigned int n = size();
+    // children of node i are children[childStart[i] .. childStart[i + 1])
+    std::vector<unsigned int> childStart(n + 1, 0), children(n);
+    for (unsigned int i = 0; i < n; i++)
+      if (parents[i] != NONE)
+        childStart[parents[i] + 1]++;
+    for (unsigned int i = 0; i < n; i++)
+      childStart[i + 1] += childStart[i];
+    std::vector<unsigned int> cursor(childStart.begin(), childStart.end() - 1);
+    for (unsigned int i = 0; i < n; i++)
+      if (parents[i] != NONE)
+        children[cursor[parents[i]]++] = i;
+
+    std::vector<unsigned int> order;
+    order.reserve(n);
+    for (unsigned int i = 0; i < n; i++)
+      if (parents[i] == NONE)
+        order.push_back(i);
+    levels.clear();
+    for (unsigned int begin = 0; begin < order.size();) {
+      levels.push_back(begin);
+      unsigned int end = order.size();
+      for (unsigned int k = begin; k < end; k++)
+        for (unsigned int c = childStart[order[k]];
+             c < childStart[order[k] + 1]; c++)
+          order.push_back(children[c]);
+      begin = end;
+    }
+    levels.push_back(n);
+
+    std::vector<unsigned int> newIndex(n);
+    for (unsigned int k = 0; k < n; k++)
+      newIndex[order[k]] = k;
+    for (unsigned int &parent : parents)
+      if (parent != NONE)
+        parent = newIndex[parent];
+    permute(parents, order);
+    permute(ids, order);
+    permute(positions, order);
+    permute(rotations, order);
+    permute(scales, order);
+    permute(worlds, order);
+    permute(dirty, order);
+    for (unsigned int k = 0; k < n; k++)
+      indexOf[ids[k]] = k;
+    firstDirty = std::find(dirty.begin(), dirty.end(), 1) - dirty.begin();
+    if (firstDirty == n)
+      firstDirty = NONE;
+    sorted = true;
+  }
+
+  template <typename T>
+  static void permute(std::vector<T> &values,
+                      const std::vector<unsigned int> &order) {
+    std::vector<T> reordered;
+    reordered.reserve(order.size());
+    for (unsigned int i : order)
+      reordered.push_back(values[i]);
+    values.swap(reordered);
+  }
+};
+
+#endif
@@ -17,112 +17,145 @@ public:
 
   // constructor to read shader source code from file and build
   Shader(const char *vertexPath, const char *fragmentPath) {
-    std::string vertexCode;
-    std::string fragmentCode;
-    std::ifstream vShaderFile;
-    std::ifstream fShaderFile;
+    build(readFile(vertexPath), readFile(fragmentPath));
+  }
+
+  // constructor to read a compute shader from file and build (GL 4.3+)
+  explicit Shader(const char *computePath) { build(readFile(computePath)); }
 
+  // build from already loaded (e.g. preprocessed) source code
+  static Shader fromSource(const std::string &vertexCode,
+                           const std::string &fragmentCode) {
+    Shader shader;
+    shader.build(vertexCode, fragmentCode);
+    return shader;
+  }
+
+  static Shader fromSource(const std::string &computeCode) {
+    Shader shader;
+    shader.build(computeCode);
+    return shader;
+  }
+
+  static std::string readFile(const char *path) {
+    std::ifstream file;
     // ensure ifstream objects can throw exceptions
-    vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+    file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
 
     try {
-      // open files
-      vShaderFile.open(vertexPath);
-      fShaderFile.open(fragmentPath);
-      std::stringstream vShaderStream, fShaderStream;
-
-      // read file's buffer contents into streams
-      vShaderStream << vShaderFile.rdbuf();
-      fShaderStream << fShaderFile.rdbuf();
-
-      // close file handlers
-      vShaderFile.close();
-      fShaderFile.close();
-
-      // convert stream into string
-      vertexCode = vShaderStream.str();
-      fragmentCode = fShaderStream.str();
-    } catch (std::ifstream::failure e) {
-      std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ" << std::endl;
+      file.open(path);
+      std::stringstream stream;
+      stream << file.rdbuf();
+      file.close();
+      return stream.str();
+    } catch (std::ifstream::failure &e) {
+      std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << path
+                << std::endl;
     }
+    return "";
+  }
 
-    const char *vShaderCode = vertexCode.c_str();
-    const char *fShaderCode = fragmentCode.c_str();
+  // activate the shader
+  void use() { glUseProgram(ID); }
 
-    // compile shaders
-    unsigned int vertex, fragment;
-    int success;
-    char infoLog[512];
+  // utility functions to set uniform variables, names are plain C strings so
+  // setting a uniform never builds a std::string
+  void setBool(const char *name, bool value) const {
+    glUniform1i(glGetUniformLocation(ID, name), (int)value);
+  }
+  void setInt(const char *name, int value) const {
+    glUniform1i(glGetUniformLocation(ID, name), value);
+  }
+  void setUInt(const char *name, unsigned int value) const {
+    glUniform1ui(glGetUniformLocation(ID, name), value);
+  }
+  void setFloat(const char *name, float value) const {
+    glUniform1f(glGetUniformLocation(ID, name), value);
+  }
 
-    // vertex shader
-    vertex = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex, 1, &vShaderCode, NULL);
-    glCompileShader(vertex);
+  void setMat4(const char *name, glm::mat4 mat) const {
+    glUniformMatrix4fv(glGetUniformLocation(ID, name), 1, GL_FALSE,
+                       glm::value_ptr(mat));
+  }
 
-    glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
-    if (!success) {
-      glGetShaderInfoLog(vertex, 512, NULL, infoLog);
-      std::cout << "ERROR::SHADER:VERTEX::COMPILATION_FAILED\n"
-                << infoLog << std::endl;
-    }
+  void setVec2(const char *name, glm::vec2 vec) const {
+    glUniform2f(glGetUniformLocation(ID, name), vec.x, vec.y);
+  }
 
-    // fragment shader
-    fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment, 1, &fShaderCode, NULL);
-    glCompileShader(fragment);
+  void setVec3(const char *name, float f1, float f2, float f3) const {
+    glUniform3f(glGetUniformLocation(ID, name), f1, f2, f3);
+  }
 
-    glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
-    if (!success) {
-      glGetShaderInfoLog(fragment, 512, NULL, infoLog);
-      std::cout << "ERROR::SHADER:FRAGMENT::COMPILATION_FAILED\n"
-                << infoLog << std::endl;
-    }
+  void setVec3(const char *name, glm::vec3 vec) const {
+    glUniform3f(glGetUniformLocation(ID, name), vec.x, vec.y, vec.z);
+  };
+
+  void setUVec3(const char *name, glm::uvec3 vec) const {
+    glUniform3ui(glGetUniformLocation(ID, name), vec.x, vec.y, vec.z);
+  }
+
+private:
+  Shader() : ID(0) {}
+
+  void build(const std::string &vertexCode, const std::string &fragmentCode) {
+    // compile shaders
+    unsigned int vertex =
+        compileStage(GL_VERTEX_SHADER, vertexCode.c_str(), "VERTEX");
+    unsigned int fragment =
+        compileStage(GL_FRAGMENT_SHADER, fragmentCode.c_str(), "FRAGMENT");
 
     // shader program
     ID = glCreateProgram();
     glAttachShader(ID, vertex);
     glAttachShader(ID, fragment);
-    glLinkProgram(ID);
-
-    glGetProgramiv(ID, GL_LINK_STATUS, &success);
-    if (!success) {
-      glGetProgramInfoLog(ID, 512, NULL, infoLog);
-      std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
-                << infoLog << std::endl;
-    }
+    link();
 
     // delete shaders now that they have been linked
     glDeleteShader(vertex);
     glDeleteShader(fragment);
   }
 
-  // activate the shader
-  void use() { glUseProgram(ID); }
+  void build(const std::string &computeCode) {
+    unsigned int compute =
+        compileStage(GL_COMPUTE_SHADER, computeCode.c_str(), "COMPUTE");
 
-  // utility functions to set uniform variables
-  void setBool(const std::string &name, bool value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
-  }
-  void setInt(const std::string &name, int value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
-  }
-  void setFloat(const std::string &name, float value) const {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
-  }
+    ID = glCreateProgram();
+    glAttachShader(ID, compute);
+    link();
 
-  void setMat4(const std::string &name, glm::mat4 mat) const {
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE,
-                       glm::value_ptr(mat));
+    glDeleteShader(compute);
   }
 
-  void setVec3(const std::string &name, float f1, float f2, float f3) const {
-    glUniform3f(glGetUniformLocation(ID, name.c_str()), f1, f2, f3);
+  static unsigned int compileStage(GLenum type, const char *code,
+                                   const char *label) {
+    int success;
+    char infoLog[512];
+
+    unsigned int shader = glCreateShader(type);
+    glShaderSource(shader, 1, &code, NULL);
+    glCompileShader(shader);
+
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+      glGetShaderInfoLog(shader, 512, NULL, infoLog);
+      std::cout << "ERROR::SHADER:" << label << "::COMPILATION_FAILED\n"
+                << infoLog << std::endl;
+    }
+    return shader;
   }
 
-  void setVec3(const std::string &name, glm::vec3 vec) const {
-    glUniform3f(glGetUniformLocation(ID, name.c_str()), vec.x, vec.y, vec.z);
-  };
+  void link() {
+    int success;
+    char infoLog[512];
+
+    glLinkProgram(ID);
+    glGetProgramiv(ID, GL_LINK_STATUS, &success);
+    if (!success) {
+      glGetProgramInfoLog(ID, 512, NULL, infoLog);
+      std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
+                << infoLog << std::endl;
+    }
+  }
 };
 
 #endif
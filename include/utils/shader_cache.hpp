@@ -0,0 +1,306 @@
+#ifndef SHADER_CACHE_H
+#define SHADER_CACHE_H
+
+#include "memory_tracker.hpp"
+#include "shader.hpp"
+#include <glad/glad.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// NAME -> VALUE, ordered so equal sets always produce the same variant key
+typedef std::map<std::string, std::string> ShaderDefines;
+
+// Resolves `#include "file"` (relative to the including file, each file at
+// most once per program) and injects `#extension`s and `#define`s right after
+// `#version`, where GLSL requires extension directives to be.
+class ShaderPreprocessor {
+public:
+  std::string process(const std::string &path, const ShaderDefines &defines,
+                      const std::vector<std::string> &extensions =
+                          std::vector<std::string>()) const {
+    std::set<std::string> included;
+    std::string code = expand(path, included, 0);
+
+    std::string header;
+    for (const std::string &extension : extensions)
+      header += "#extension " + extension + " : require\n";
+    for (const auto &define : defines)
+      header += "#define " + define.first + " " + define.second + "\n";
+
+    // #version has to stay the first statement, so the defines go after it
+    size_t version = code.find("#version");
+    size_t insertAt =
+        version == std::string::npos ? 0 : code.find('\n', version) + 1;
+    return code.substr(0, insertAt) + header + "#line 2\n" +
+           code.substr(insertAt);
+  }
+
+private:
+  static std::string directoryOf(const std::string &path) {
+    size_t slash = path.find_last_of('/');
+    return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+  }
+
+  std::string expand(const std::string &path, std::set<std::string> &included,
+                     int depth) const {
+    if (depth > 16) {
+      std::cout << "ERROR::SHADER::INCLUDE_DEPTH_EXCEEDED: " << path
+                << std::endl;
+      return "";
+    }
+    included.insert(path);
+
+    std::istringstream source(Shader::readFile(path.c_str()));
+    std::string out;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(source, line)) {
+      lineNumber++;
+      size_t start = line.find_first_not_of(" \t");
+      if (start == std::string::npos ||
+          line.compare(start, 8, "#include") != 0) {
+        out += line + "\n";
+        continue;
+      }
+      size_t open = line.find('"', start);
+      size_t close = line.find('"', open + 1);
+      if (open == std::string::npos || close == std::string::npos) {
+        std::cout << "ERROR::SHADER::MALFORMED_INCLUDE: " << path << ":"
+                  << lineNumber << std::endl;
+        continue;
+      }
+      std::string includePath =
+          directoryOf(path) + line.substr(open + 1, close - open - 1);
+      if (!included.count(includePath))
+        out += "#line 1\n" + expand(includePath, included, depth + 1);
+      // keep compiler error line numbers pointing into the including file
+      out += "#line " + std::to_string(lineNumber + 1) + "\n";
+    }
+    return out;
+  }
+};
+
+// Compiled programs keyed by their sources plus permutation defines. Variants
+// compile lazily on first use; `prewarm` compiles everything listed in a
+// manifest up front so nothing has to compile in the middle of a frame.
+class ShaderCache {
+public:
+  std::string shaderDir = "../src/shaders/";
+
+  // merged into every variant (limits shared with the C++ side)
+  ShaderDefines globalDefines;
+  // required by every variant, set before the first get/prewarm
+  std::vector<std::string> extensions;
+
+  // programs compiled after prewarming, i.e. hitches in the frame loop
+  unsigned int lateCompiles = 0;
+
+  Shader &get(const std::string &vertex, const std::string &fragment,
+              const ShaderDefines &defines = ShaderDefines()) {
+    MemoryTagScope tag(MemoryTag::Shaders);
+    ShaderDefines all = merged(defines);
+    std::string key = variantKey(vertex + "|" + fragment, all);
+    auto it = programs.find(key);
+    if (it != programs.end())
+      return *it->second;
+
+    noteCompile(key);
+    std::string vertexCode =
+        preprocessor.process(shaderDir + vertex, all, extensions);
+    std::string fragmentCode =
+        preprocessor.process(shaderDir + fragment, all, extensions);
+    Shader *shader =
+        new Shader(Shader::fromSource(vertexCode, fragmentCode));
+    programs[key].reset(shader);
+    return *shader;
+  }
+
+  Shader &getCompute(const std::string &compute,
+                     const ShaderDefines &defines = ShaderDefines()) {
+    MemoryTagScope tag(MemoryTag::Shaders);
+    ShaderDefines all = merged(defines);
+    std::string key = variantKey(compute, all);
+    auto it = programs.find(key);
+    if (it != programs.end())
+      return *it->second;
+
+    noteCompile(key);
+    std::string code =
+        preprocessor.process(shaderDir + compute, all, extensions);
+    Shader *shader = new Shader(Shader::fromSource(code));
+    programs[key].reset(shader);
+    return *shader;
+  }
+
+  // Manifest lines look like `cube.vert cube.frag SHADOWS=1 INSTANCING=0` or
+  // `clusters.comp`; blank lines and lines starting with # are skipped. Lines
+  // tagged `@specialized` are compiled a second time with `specialization`
+  // added, so the baked variants are warm as well.
+  unsigned int prewarm(const std::string &manifest,
+                       const ShaderDefines &specialization = ShaderDefines()) {
+    MemoryTagScope tag(MemoryTag::Shaders);
+    std::ifstream file(shaderDir + manifest);
+    if (!file) {
+      std::cout << "ERROR::SHADER::MANIFEST_NOT_FOUND: " << manifest
+                << std::endl;
+      return 0;
+    }
+    unsigned int count = 0;
+    std::string line;
+    while (std::getline(file, line)) {
+      std::istringstream words(line);
+      std::string first;
+      if (!(words >> first) || first[0] == '#')
+        continue;
+      bool compute = first.size() > 5 &&
+                     first.compare(first.size() - 5, 5, ".comp") == 0;
+      std::string second;
+      if (!compute)
+        words >> second;
+      ShaderDefines defines;
+      bool specialized = false;
+      std::string define;
+      while (words >> define) {
+        if (define == "@specialized") {
+          specialized = true;
+          continue;
+        }
+        size_t eq = define.find('=');
+        if (eq == std::string::npos)
+          defines[define] = "1";
+        else
+          defines[define.substr(0, eq)] = define.substr(eq + 1);
+      }
+      for (int pass = 0; pass < (specialized ? 2 : 1); pass++) {
+        if (pass == 1)
+          defines.insert(specialization.begin(), specialization.end());
+        if (compute)
+          getCompute(first, defines);
+        else
+          get(first, second, defines);
+        count++;
+      }
+    }
+    prewarmed = true;
+    return count;
+  }
+
+  size_t size() const { return programs.size(); }
+
+  void destroy() {
+    for (auto &program : programs)
+      glDeleteProgram(program.second->ID);
+    programs.clear();
+  }
+
+  static std::string variantKey(const std::string &sources,
+                                const ShaderDefines &defines) {
+    std::string key = sources;
+    for (const auto &define : defines)
+      key += "|" + define.first + "=" + define.second;
+    return key;
+  }
+
+private:
+  ShaderPreprocessor preprocessor;
+  std::unordered_map<std::string, std::unique_ptr<Shader>> programs;
+  bool prewarmed = false;
+
+  ShaderDefines merged(const ShaderDefines &defines) const {
+    ShaderDefines all = globalDefines;
+    for (const auto &define : defines)
+      all[define.first] = define.second;
+    return all;
+  }
+
+  void noteCompile(const std::string &key) {
+    if (!prewarmed)
+      return;
+    lateCompiles++;
+    std::cout << "WARNING::SHADER::VARIANT_NOT_PREWARMED: " << key
+              << std::endl;
+  }
+};
+
+// Values that are uniforms in the shader source but in practice never change
+// (light attenuation, spot cones). `bake` captures the current values; while
+// every value still matches, `defines` returns them so the specialized
+// variant sees compile time constants the GLSL compiler can fold. Once
+// anything differs (e.g. edited from the debug UI) `defines` is empty and the
+// generic variant, which reads the real data, is used instead.
+class SpecializationConstants {
+public:
+  // number of generic <-> specialized transitions, for the profiler
+  unsigned int switches = 0;
+
+  // `allowed` false forces the generic variant this frame (e.g. when the
+  // values are not the same for every light)
+  void beginFrame(bool allowed = true) {
+    frameAllowed = allowed;
+    matching = true;
+  }
+
+  // no allocation once `name` has been set before
+  void set(const char *name, float value) {
+    auto it = baked.find(name);
+    if (it == baked.end() || it->second != value)
+      matching = false;
+    auto entry = current.find(name);
+    if (entry == current.end())
+      current.emplace(name, value);
+    else
+      entry->second = value;
+  }
+
+  void bake() {
+    baked = current;
+    bakedDefines.clear();
+    for (const auto &value : baked)
+      bakedDefines[value.first] = literal(value.second);
+  }
+
+  // call after all `set`s of the frame
+  bool specialized() {
+    bool now = frameAllowed && matching && !baked.empty();
+    if (now != wasSpecialized)
+      switches++;
+    wasSpecialized = now;
+    return now;
+  }
+
+  ShaderDefines defines() {
+    return specialized() ? bakedDefines : ShaderDefines();
+  }
+
+  const ShaderDefines &bakedValues() const { return bakedDefines; }
+
+private:
+  // std::less<> so lookups by const char * need no temporary std::string
+  std::map<std::string, float, std::less<>> baked;
+  std::map<std::string, float, std::less<>> current;
+  ShaderDefines bakedDefines;
+  bool frameAllowed = true;
+  bool matching = true;
+  bool wasSpecialized = false;
+
+  // GLSL float literal that reads back as exactly `value`
+  static std::string literal(float value) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+    std::string text = buffer;
+    if (text.find_first_of(".e") == std::string::npos)
+      text += ".0";
+    return text;
+  }
+};
+
+#endif
@@ -0,0 +1,259 @@
+#ifndef SHADOWS_H
+#define SHADOWS_H
+
+#include "../glm/glm.hpp"
+#include "../glm/gtc/matrix_transform.hpp"
+#include "lights.hpp"
+#include "memory_tracker.hpp"
+#include "shader.hpp"
+#include <glad/glad.h>
+
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+// Cascaded shadow maps for the directional light plus one perspective map per
+// shadow casting spotlight. Every map remembers the matrix and caster
+// revision it was rendered with and is only re-rendered when one of them
+// changes, so a static scene under a static light costs nothing per frame.
+class ShadowMaps {
+public:
+  static const int MAX_CASCADES = 4;
+  static const int MAX_SPOT_SHADOWS = 4;
+  static const int CASCADE_SIZE = 2048;
+  static const int SPOT_SIZE = 1024;
+
+  // texture units the shading shaders sample the maps from
+  static const int CASCADE_UNIT = 3;
+  static const int SPOT_UNIT = 4;
+
+  int cascadeCount = 3;
+  float shadowDistance = 40.0f;
+  // blend between uniform (0) and logarithmic (1) cascade splits
+  float splitLambda = 0.75f;
+  bool caching = true;
+
+  // bump whenever a shadow caster is added, removed or moved
+  unsigned int casterRevision = 0;
+
+  // maps actually rendered during the last update, for the profiler
+  int cascadesRendered = 0;
+  int spotsRendered = 0;
+
+  void init() {
+    cascadeArray = createArray(CASCADE_SIZE, MAX_CASCADES);
+    spotArray = createArray(SPOT_SIZE, MAX_SPOT_SHADOWS);
+    MemoryTracker::gpuAllocate(MemoryTag::Shadows, gpuBytes());
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+
+  void destroy() {
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteTextures(1, &cascadeArray);
+    glDeleteTextures(1, &spotArray);
+    MemoryTracker::gpuRelease(MemoryTag::Shadows, gpuBytes());
+  }
+
+  // Fits the cascades to the camera frustum, assigns shadow slots to the
+  // spotlights that cast shadows and re-renders whatever went stale.
+  // `depthShader` is a depth-only program taking view/projection uniforms and
+  // `drawCasters(shader)` must draw every shadow caster with it.
+  template <typename DrawFn>
+  void update(const glm::mat4 &view, float fovY, float aspect, float zNear,
+              glm::vec3 lightDir, std::vector<Light> &lights,
+              Shader &depthShader, DrawFn drawCasters) {
+    cascadesRendered = 0;
+    spotsRendered = 0;
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);
+    depthShader.use();
+
+    glm::vec3 dir = glm::normalize(lightDir);
+    glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), dir, upFor(dir));
+    glm::mat4 inverseView = glm::inverse(view);
+    float splitNear = zNear;
+    for (int i = 0; i < cascadeCount; i++) {
+      float splitFar = splitDistance(zNear, i + 1);
+      cascadeSplits[i] = splitFar;
+      glm::mat4 projection = fitCascade(inverseView, fovY, aspect, splitNear,
+                                        splitFar, lightView);
+      splitNear = splitFar;
+      if (render(cascadeArray, CASCADE_SIZE, i, cascadeCache[i], projection,
+                 lightView, depthShader, drawCasters))
+        cascadesRendered++;
+    }
+
+    int slot = 0;
+    for (Light &light : lights) {
+      light.shadowIndex = -1;
+      if (!light.castShadows || light.type != Spot ||
+          slot == MAX_SPOT_SHADOWS)
+        continue;
+      light.shadowIndex = slot;
+      glm::vec3 lightDirection = glm::normalize(light.direction);
+      glm::mat4 spotView =
+          glm::lookAt(light.position, light.position + lightDirection,
+                      upFor(lightDirection));
+      glm::mat4 spotProjection =
+          glm::perspective(2.0f * std::acos(light.outerCutOff), 1.0f, 0.1f,
+                           glm::max(light.range(), 0.2f));
+      if (render(spotArray, SPOT_SIZE, slot, spotCache[slot], spotProjection,
+                 spotView, depthShader, drawCasters))
+        spotsRendered++;
+      slot++;
+    }
+
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+  }
+
+  void bindTextures() const {
+    glActiveTexture(GL_TEXTURE0 + CASCADE_UNIT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, cascadeArray);
+    glActiveTexture(GL_TEXTURE0 + SPOT_UNIT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, spotArray);
+  }
+
+  void setUniforms(const Shader &shader) const {
+    char name[32];
+    shader.setInt("cascadeCount", cascadeCount);
+    glm::vec4 splits(0.0f);
+    for (int i = 0; i < cascadeCount; i++) {
+      splits[i] = cascadeSplits[i];
+      std::snprintf(name, sizeof(name), "cascadeMatrices[%d]", i);
+      shader.setMat4(name, cascadeCache[i].matrix);
+    }
+    glUniform4fv(glGetUniformLocation(shader.ID, "cascadeSplits"), 1,
+                 &splits[0]);
+    for (int i = 0; i < MAX_SPOT_SHADOWS; i++) {
+      std::snprintf(name, sizeof(name), "spotShadowMatrices[%d]", i);
+      shader.setMat4(name, spotCache[i].matrix);
+    }
+  }
+
+private:
+  struct CacheEntry {
+    glm::mat4 matrix = glm::mat4(0.0f);
+    unsigned int revision = 0;
+    bool valid = false;
+  };
+
+  unsigned int fbo = 0;
+  unsigned int cascadeArray = 0;
+  unsigned int spotArray = 0;
+  float cascadeSplits[MAX_CASCADES] = {};
+  CacheEntry cascadeCache[MAX_CASCADES];
+  CacheEntry spotCache[MAX_SPOT_SHADOWS];
+
+  // 32 bit depth, no mips
+  static size_t gpuBytes() {
+    return MemoryTracker::textureBytes(CASCADE_SIZE, CASCADE_SIZE,
+                                       MAX_CASCADES, 4, false) +
+           MemoryTracker::textureBytes(SPOT_SIZE, SPOT_SIZE, MAX_SPOT_SHADOWS,
+                                       4, false);
+  }
+
+  static unsigned int createArray(int size, int layers) {
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, size, size,
+                 layers, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S,
+                    GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T,
+                    GL_CLAMP_TO_BORDER);
+    float border[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+    // hardware depth comparison gives bilinear PCF for free
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE,
+                    GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    return texture;
+  }
+
+  static glm::vec3 upFor(glm::vec3 dir) {
+    return std::abs(dir.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f)
+                                   : glm::vec3(0.0f, 1.0f, 0.0f);
+  }
+
+  float splitDistance(float zNear, int i) const {
+    float t = (float)i / cascadeCount;
+    float uniform = zNear + (shadowDistance - zNear) * t;
+    float logarithmic = zNear * std::pow(shadowDistance / zNear, t);
+    return splitLambda * logarithmic + (1.0f - splitLambda) * uniform;
+  }
+
+  // Bounding sphere fit of one frustum slice. The sphere keeps the projection
+  // size constant while the camera rotates, and snapping its center to a
+  // coarse multiple of the texel size both stops shimmering and keeps the
+  // matrix (and so the cached map) unchanged while the camera moves a little.
+  glm::mat4 fitCascade(const glm::mat4 &inverseView, float fovY, float aspect,
+                       float sliceNear, float sliceFar,
+                       const glm::mat4 &lightView) const {
+    float ty = std::tan(fovY * 0.5f);
+    float tx = ty * aspect;
+    glm::vec3 corners[8];
+    glm::vec3 center(0.0f);
+    for (int i = 0; i < 8; i++) {
+      float d = (i < 4) ? sliceNear : sliceFar;
+      glm::vec4 p((i & 1 ? 1.0f : -1.0f) * d * tx,
+                  (i & 2 ? 1.0f : -1.0f) * d * ty, -d, 1.0f);
+      corners[i] = glm::vec3(inverseView * p);
+      center += corners[i] / 8.0f;
+    }
+    float radius = 0.0f;
+    for (int i = 0; i < 8; i++)
+      radius = glm::max(radius, glm::length(corners[i] - center));
+    radius = std::ceil(radius * 16.0f) / 16.0f;
+
+    // the margin lets the center lag behind the camera by a few steps
+    float extent = radius * 1.25f;
+    float texel = 2.0f * extent / CASCADE_SIZE;
+    float step = texel * glm::max(1.0f, std::floor(0.25f * radius / texel));
+    glm::vec3 c = glm::vec3(lightView * glm::vec4(center, 1.0f));
+    c = glm::floor(c / step) * step;
+
+    // pull the near plane towards the light so casters outside the slice
+    // still land in the map
+    float casterMargin = 50.0f;
+    return glm::ortho(c.x - extent, c.x + extent, c.y - extent, c.y + extent,
+                      -(c.z + extent + casterMargin), -(c.z - extent));
+  }
+
+  template <typename DrawFn>
+  bool render(unsigned int array, int size, int layer, CacheEntry &cache,
+              const glm::mat4 &projection, const glm::mat4 &view,
+              const Shader &depthShader, DrawFn &drawCasters) {
+    glm::mat4 matrix = projection * view;
+    if (caching && cache.valid && cache.matrix == matrix &&
+        cache.revision == casterRevision)
+      return false;
+    cache.matrix = matrix;
+    cache.revision = casterRevision;
+    cache.valid = true;
+
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, array, 0,
+                              layer);
+    glViewport(0, 0, size, size);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    depthShader.setMat4("view", view);
+    depthShader.setMat4("projection", projection);
+    drawCasters(depthShader);
+    return true;
+  }
+};
+
+#endif
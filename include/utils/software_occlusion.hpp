@@ -0,0 +1,373 @@
+#ifndef SOFTWARE_OCCLUSION_H
+#define SOFTWARE_OCCLUSION_H
+
+#include "../glm/glm.hpp"
+#include "cpu_features.hpp"
+#include "memory_tracker.hpp"
+#include "scene_file.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+enum class RasterKernel { Scalar, Avx2 };
+
+// Masked software occlusion culling (after Andersson et al., "Masked
+// Software Occlusion Culling", 2016) on a WIDTH x HEIGHT depth buffer.
+// Occluder triangles are rasterized into 8x4 pixel tiles that each keep a
+// coverage mask and two depths instead of a depth per pixel: `reference`,
+// which no occluder pixel of the tile is farther than, and `working`, the
+// farthest depth of the pixels in the mask so far. Once the mask is full the
+// working layer becomes the reference. Depth is 1/w, larger is nearer, and
+// every depth stored is rounded towards far, so the buffer only ever claims
+// less occlusion than the triangles give.
+//
+// Tile rows are split between the thread pool's workers, which walk the
+// whole triangle list and rasterize the parts in their rows. Coverage uses
+// integer edge functions at 1/8 pixel, evaluated for a row of 8 pixels at
+// once with AVX2 where the CPU has it; both kernels give the same masks.
+// Triangles crossing the near plane or reaching further than GUARD_BAND
+// pixels off screen are dropped, which loses occlusion but never adds any.
+class SoftwareOcclusion {
+public:
+  static const int WIDTH = 320;
+  static const int HEIGHT = 192;
+  static const int TILE_WIDTH = 8;
+  static const int TILE_HEIGHT = 4;
+  static const int TILES_X = WIDTH / TILE_WIDTH;
+  static const int TILES_Y = HEIGHT / TILE_HEIGHT;
+  static const int SUBPIXEL = 8;
+  static const int GUARD_BAND = 1024;
+
+  // kernel used by `rasterize`, the fastest supported one by default
+  RasterKernel kernel =
+      CpuFeatures::avx2() ? RasterKernel::Avx2 : RasterKernel::Scalar;
+  // occluder triangles set up since `clear`
+  unsigned int triangleCount() const { return triangles.size(); }
+
+  SoftwareOcclusion() {
+    MemoryTagScope tag(MemoryTag::Renderer);
+    reference.resize(TILES_X * TILES_Y);
+    working.resize(TILES_X * TILES_Y);
+    masks.resize(TILES_X * TILES_Y);
+    clear();
+  }
+
+  void clear() {
+    triangles.clear();
+    std::fill(reference.begin(), reference.end(), 0.0f);
+    std::fill(working.begin(), working.end(), FLT_MAX);
+    std::fill(masks.begin(), masks.end(), 0u);
+  }
+
+  // Sets up the triangles `indices[0 .. indexCount)` of `vertices`, drawn
+  // with `clip` (projection * view * model); counter-clockwise is front
+  // facing and back faces are dropped. `near` is the near plane distance.
+  void addOccluder(const glm::mat4 &clip, const SceneVertex *vertices,
+                   const uint32_t *indices, unsigned int indexCount,
+                   float near) {
+    if (triangles.size() + indexCount / 3 > triangles.capacity()) {
+      MemoryTagScope tag(MemoryTag::Renderer);
+      triangles.reserve(std::max(triangles.size() + indexCount / 3,
+                                 triangles.capacity() * 2));
+    }
+    for (unsigned int i = 0; i + 3 <= indexCount; i += 3) {
+      glm::vec4 corners[3];
+      for (int k = 0; k < 3; k++) {
+        const float *p = vertices[indices[i + k]].position;
+        corners[k] = clip * glm::vec4(p[0], p[1], p[2], 1.0f);
+      }
+      setup(corners, near);
+    }
+  }
+
+  void rasterize(ThreadPool *pool) {
+    auto band = [&](unsigned int begin, unsigned int end) {
+      for (const Triangle &triangle : triangles)
+        rasterize(triangle, begin, end);
+    };
+    if (pool)
+      pool->parallelFor(TILES_Y, 4, band);
+    else
+      band(0, TILES_Y);
+  }
+
+  // Whether any part of the box around the world space bounding `sphere`
+  // may be in front of the occluders. Boxes crossing the near plane are
+  // always visible.
+  bool visible(const glm::mat4 &viewProjection, glm::vec4 sphere,
+               float near) const {
+    Rect rect;
+    if (!project(viewProjection, sphere, near, rect))
+      return true;
+    if (rect.x0 > rect.x1 || rect.y0 > rect.y1)
+      return false;
+    for (int ty = rect.y0 / TILE_HEIGHT; ty <= rect.y1 / TILE_HEIGHT; ty++)
+      for (int tx = rect.x0 / TILE_WIDTH; tx <= rect.x1 / TILE_WIDTH; tx++)
+        if (rect.depth > reference[ty * TILES_X + tx])
+          return true;
+    return false;
+  }
+
+  // the reference layer, TILES_X * TILES_Y depths row by row
+  const std::vector<float> &tileDepths() const { return reference; }
+
+  // Rasterizes the same triangles into an ordinary depth buffer, the
+  // nearest depth per pixel, to check the tiles against.
+  void rasterizeReference(std::vector<float> &pixels) const {
+    pixels.assign(WIDTH * HEIGHT, 0.0f);
+    for (const Triangle &triangle : triangles) {
+      for (int y = triangle.y0; y <= triangle.y1; y++) {
+        for (int x = triangle.x0; x <= triangle.x1; x++) {
+          int sx = x * SUBPIXEL + SUBPIXEL / 2;
+          int sy = y * SUBPIXEL + SUBPIXEL / 2;
+          bool inside = true;
+          for (int k = 0; k < 3; k++)
+            inside = inside && triangle.a[k] * sx + triangle.b[k] * sy +
+                                       triangle.c[k] >=
+                                   0;
+          if (!inside)
+            continue;
+          float depth = (float)triangle.depthAt(x + 0.5, y + 0.5);
+          float &pixel = pixels[y * WIDTH + x];
+          pixel = std::max(pixel, depth);
+        }
+      }
+    }
+  }
+
+  // `visible` against a buffer from rasterizeReference
+  bool visibleReference(const std::vector<float> &pixels,
+                        const glm::mat4 &viewProjection, glm::vec4 sphere,
+                        float near) const {
+    Rect rect;
+    if (!project(viewProjection, sphere, near, rect))
+      return true;
+    for (int y = rect.y0; y <= rect.y1; y++)
+      for (int x = rect.x0; x <= rect.x1; x++)
+        if (rect.depth > pixels[y * WIDTH + x])
+          return true;
+    return false;
+  }
+
+private:
+  // Edge functions a * x + b * y + c in subpixels, >= 0 inside; ties on an
+  // edge shared by two triangles go to one of them. Depth is the plane
+  // depthX * x + depthY * y + depth0 in pixels. x0..y1 bound the pixels
+  // whose centers it may cover.
+  struct Triangle {
+    int32_t a[3], b[3], c[3];
+    double depthX, depthY, depth0;
+    float minDepth, maxDepth;
+    int x0, x1, y0, y1;
+
+    double depthAt(double x, double y) const {
+      return depthX * x + depthY * y + depth0;
+    }
+  };
+  // pixel range and nearest depth of a projected box
+  struct Rect {
+    int x0, x1, y0, y1;
+    float depth;
+  };
+
+  std::vector<Triangle> triangles;
+  std::vector<float> reference;
+  std::vector<float> working;
+  std::vector<uint32_t> masks;
+
+  void setup(const glm::vec4 *corners, float near) {
+    int64_t x[3], y[3];
+    double px[3], py[3], depth[3];
+    for (int k = 0; k < 3; k++) {
+      if (corners[k].w < near)
+        return;
+      double sx = (corners[k].x / corners[k].w * 0.5 + 0.5) * WIDTH;
+      double sy = (corners[k].y / corners[k].w * 0.5 + 0.5) * HEIGHT;
+      if (sx < -GUARD_BAND || sx > WIDTH + GUARD_BAND || sy < -GUARD_BAND ||
+          sy > HEIGHT + GUARD_BAND)
+        return;
+      x[k] = std::llround(sx * SUBPIXEL);
+      y[k] = std::llround(sy * SUBPIXEL);
+      px[k] = (double)x[k] / SUBPIXEL;
+      py[k] = (double)y[k] / SUBPIXEL;
+      depth[k] = 1.0 / corners[k].w;
+    }
+    int64_t area =
+        (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (area <= 0)
+      return;
+
+    Triangle triangle;
+    for (int k = 0; k < 3; k++) {
+      int next = (k + 1) % 3;
+      int64_t a = y[k] - y[next], b = x[next] - x[k];
+      int64_t c = x[k] * y[next] - x[next] * y[k];
+      // a pixel center exactly on the edge is inside for edges facing left,
+      // or up if horizontal, so the triangle across the edge skips it
+      bool owns = a > 0 || (a == 0 && b > 0);
+      triangle.a[k] = (int32_t)a;
+      triangle.b[k] = (int32_t)b;
+      triangle.c[k] = (int32_t)(c - (owns ? 0 : 1));
+    }
+    // the plane through the three depths
+    double ux = px[1] - px[0], uy = py[1] - py[0], uz = depth[1] - depth[0];
+    double vx = px[2] - px[0], vy = py[2] - py[0], vz = depth[2] - depth[0];
+    double nz = ux * vy - uy * vx;
+    triangle.depthX = (uz * vy - uy * vz) / nz;
+    triangle.depthY = (ux * vz - uz * vx) / nz;
+    triangle.depth0 =
+        depth[0] - triangle.depthX * px[0] - triangle.depthY * py[0];
+    triangle.minDepth =
+        (float)std::min(std::min(depth[0], depth[1]), depth[2]);
+    triangle.maxDepth =
+        (float)std::max(std::max(depth[0], depth[1]), depth[2]);
+
+    // the pixels whose centers, at i + 0.5, lie within the vertices' box
+    double lo[2] = {std::min(std::min(px[0], px[1]), px[2]),
+                    std::min(std::min(py[0], py[1]), py[2])};
+    double hi[2] = {std::max(std::max(px[0], px[1]), px[2]),
+                    std::max(std::max(py[0], py[1]), py[2])};
+    triangle.x0 = std::max((int)std::ceil(lo[0] - 0.5), 0);
+    triangle.x1 = std::min((int)std::floor(hi[0] - 0.5), WIDTH - 1);
+    triangle.y0 = std::max((int)std::ceil(lo[1] - 0.5), 0);
+    triangle.y1 = std::min((int)std::floor(hi[1] - 0.5), HEIGHT - 1);
+    if (triangle.x0 > triangle.x1 || triangle.y0 > triangle.y1)
+      return;
+    triangles.push_back(triangle);
+  }
+
+  void rasterize(const Triangle &triangle, unsigned int rowBegin,
+                 unsigned int rowEnd) {
+    int ty0 = std::max(triangle.y0 / TILE_HEIGHT, (int)rowBegin);
+    int ty1 = std::min(triangle.y1 / TILE_HEIGHT, (int)rowEnd - 1);
+    for (int ty = ty0; ty <= ty1; ty++) {
+      for (int tx = triangle.x0 / TILE_WIDTH; tx <= triangle.x1 / TILE_WIDTH;
+           tx++) {
+        int tile = ty * TILES_X + tx;
+        // nowhere nearer than the tile already is
+        if (triangle.maxDepth <= reference[tile])
+          continue;
+        uint32_t mask =
+#if CPU_X86
+            kernel == RasterKernel::Avx2 ? coverageAvx2(triangle, tx, ty) :
+#endif
+                                         coverageScalar(triangle, tx, ty);
+        if (mask)
+          update(tile, mask, tileDepth(triangle, tx, ty));
+      }
+    }
+  }
+
+  // the farthest depth of the triangle at the tile's pixel centers: the
+  // plane's smallest value is at a corner, and none is below the vertices'
+  static float tileDepth(const Triangle &triangle, int tx, int ty) {
+    double x0 = tx * TILE_WIDTH + 0.5, x1 = x0 + TILE_WIDTH - 1;
+    double y0 = ty * TILE_HEIGHT + 0.5, y1 = y0 + TILE_HEIGHT - 1;
+    double depth = std::min(
+        std::min(triangle.depthAt(x0, y0), triangle.depthAt(x1, y0)),
+        std::min(triangle.depthAt(x0, y1), triangle.depthAt(x1, y1)));
+    depth = std::max(depth, (double)triangle.minDepth);
+    // rounded towards far, with room for the reference's float rounding
+    return (float)(depth * (1.0 - 1e-5));
+  }
+
+  void update(int tile, uint32_t mask, float depth) {
+    // no nearer than what the tile already guarantees everywhere
+    if (depth <= reference[tile])
+      return;
+    working[tile] = std::min(working[tile], depth);
+    masks[tile] |= mask;
+    if (masks[tile] == 0xffffffffu) {
+      reference[tile] = working[tile];
+      working[tile] = FLT_MAX;
+      masks[tile] = 0;
+    }
+  }
+
+  // bit y * TILE_WIDTH + x for the covered pixel centers of the tile
+  static uint32_t coverageScalar(const Triangle &triangle, int tx, int ty) {
+    uint32_t mask = 0;
+    for (int y = 0; y < TILE_HEIGHT; y++) {
+      int sy = (ty * TILE_HEIGHT + y) * SUBPIXEL + SUBPIXEL / 2;
+      for (int x = 0; x < TILE_WIDTH; x++) {
+        int sx = (tx * TILE_WIDTH + x) * SUBPIXEL + SUBPIXEL / 2;
+        bool inside = true;
+        for (int k = 0; k < 3; k++)
+          inside = inside && triangle.a[k] * sx + triangle.b[k] * sy +
+                                     triangle.c[k] >=
+                                 0;
+        mask |= (uint32_t)inside << (y * TILE_WIDTH + x);
+      }
+    }
+    return mask;
+  }
+
+#if CPU_X86
+  // one row of the tile per iteration, a pixel per lane
+  CPU_TARGET_AVX2 static uint32_t
+  coverageAvx2(const Triangle &triangle, int tx, int ty) {
+    __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i sx = _mm256_add_epi32(
+        _mm256_set1_epi32(tx * TILE_WIDTH * SUBPIXEL + SUBPIXEL / 2),
+        _mm256_mullo_epi32(lanes, _mm256_set1_epi32(SUBPIXEL)));
+    int sy = ty * TILE_HEIGHT * SUBPIXEL + SUBPIXEL / 2;
+    __m256i edges[3], steps[3];
+    for (int k = 0; k < 3; k++) {
+      edges[k] = _mm256_add_epi32(
+          _mm256_mullo_epi32(_mm256_set1_epi32(triangle.a[k]), sx),
+          _mm256_set1_epi32(triangle.b[k] * sy + triangle.c[k]));
+      steps[k] = _mm256_set1_epi32(triangle.b[k] * SUBPIXEL);
+    }
+    uint32_t mask = 0;
+    for (int y = 0; y < TILE_HEIGHT; y++) {
+      // a lane is outside if any edge is negative
+      __m256i outside =
+          _mm256_or_si256(_mm256_or_si256(edges[0], edges[1]), edges[2]);
+      uint32_t row = ~_mm256_movemask_ps(_mm256_castsi256_ps(outside)) & 0xff;
+      mask |= row << (y * TILE_WIDTH);
+      for (int k = 0; k < 3; k++)
+        edges[k] = _mm256_add_epi32(edges[k], steps[k]);
+    }
+    return mask;
+  }
+#endif
+
+  // Screen rect and nearest depth of the box around `sphere`. Returns false
+  // if a corner is behind the near plane.
+  static bool project(const glm::mat4 &viewProjection, glm::vec4 sphere,
+                      float near, Rect &rect) {
+    float lo[2] = {FLT_MAX, FLT_MAX}, hi[2] = {-FLT_MAX, -FLT_MAX};
+    rect.depth = 0.0f;
+    for (int corner = 0; corner < 8; corner++) {
+      glm::vec3 offset((corner & 1) ? sphere.w : -sphere.w,
+                       (corner & 2) ? sphere.w : -sphere.w,
+                       (corner & 4) ? sphere.w : -sphere.w);
+      glm::vec4 clip =
+          viewProjection * glm::vec4(glm::vec3(sphere) + offset, 1.0f);
+      if (clip.w < near)
+        return false;
+      float x = (clip.x / clip.w * 0.5f + 0.5f) * WIDTH;
+      float y = (clip.y / clip.w * 0.5f + 0.5f) * HEIGHT;
+      lo[0] = std::min(lo[0], x);
+      lo[1] = std::min(lo[1], y);
+      hi[0] = std::max(hi[0], x);
+      hi[1] = std::max(hi[1], y);
+      rect.depth = std::max(rect.depth, 1.0f / clip.w);
+    }
+    // every pixel the rect touches, empty if it is off screen
+    auto pixel = [](float v, int size) {
+      return (int)std::floor(std::min(std::max(v, -1.0f), (float)size));
+    };
+    rect.x0 = std::max(pixel(lo[0], WIDTH), 0);
+    rect.y0 = std::max(pixel(lo[1], HEIGHT), 0);
+    rect.x1 = std::min(pixel(hi[0], WIDTH), WIDTH - 1);
+    rect.y1 = std::min(pixel(hi[1], HEIGHT), HEIGHT - 1);
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef TEXTURE_ARRAYS_H
+#define TEXTURE_ARRAYS_H
+
+#include "../glm/glm.hpp"
+#include "../stb_image.h"
+#include "memory_tracker.hpp"
+#include <glad/glad.h>
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+// Packs textures into GL_TEXTURE_2D_ARRAY layers so a whole scene binds a
+// handful of arrays instead of one texture per material map. Images are
+// resized at load time to the next power of two square (clamped to
+// MAX_SIZE), which puts most of them into the same size/format bucket.
+// Every bucket is a list of fixed capacity arrays with a free list of
+// layers; materials refer to a texture by the packed (array << 16 | layer)
+// value returned from `load`.
+class TextureArrays {
+public:
+  static const int MAX_ARRAYS = 4;
+  static const int LAYERS_PER_ARRAY = 16;
+  static const int MAX_SIZE = 2048;
+  // arrays are bound to units FIRST_UNIT .. FIRST_UNIT + MAX_ARRAYS - 1
+  static const int FIRST_UNIT = 5;
+  static const unsigned int INVALID = 0xffffffffu;
+
+  // textures that had to be resized to fit their bucket
+  int resizedCount = 0;
+
+  // Loads an image into a free layer, returns INVALID on failure.
+  unsigned int load(const char *path) {
+    MemoryTagScope tag(MemoryTag::Textures);
+    stbi_set_flip_vertically_on_load(true);
+    int width, height, channels;
+    unsigned char *data = stbi_load(path, &width, &height, &channels, 4);
+    if (!data) {
+      std::cout << "ERROR::TEXTURE::LOAD_FAILED: " << path << std::endl;
+      return INVALID;
+    }
+    int size = bucketSize(width, height);
+    std::vector<unsigned char> pixels;
+    if (width != size || height != size) {
+      pixels = resize(data, width, height, size);
+      resizedCount++;
+    } else {
+      pixels.assign(data, data + width * height * 4);
+    }
+    stbi_image_free(data);
+    return add(pixels.data(), size, GL_RGBA8);
+  }
+
+  // Uploads `size`x`size` RGBA pixels (one byte per channel) into a free
+  // layer of an array with the given internal format.
+  unsigned int add(const unsigned char *pixels, int size,
+                   GLenum internalFormat) {
+    int index = arrayWithFreeLayer(size, internalFormat);
+    if (index < 0)
+      return INVALID;
+    Array &array = arrays[index];
+    int layer = array.freeLayers.back();
+    array.freeLayers.pop_back();
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, size, size, 1,
+                    GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    return pack(index, layer);
+  }
+
+  void release(unsigned int texture) {
+    if (texture == INVALID)
+      return;
+    arrays[texture >> 16].freeLayers.push_back(texture & 0xffff);
+  }
+
+  void bind() const {
+    for (size_t i = 0; i < arrays.size(); i++) {
+      glActiveTexture(GL_TEXTURE0 + FIRST_UNIT + i);
+      glBindTexture(GL_TEXTURE_2D_ARRAY, arrays[i].texture);
+    }
+  }
+
+  int arrayCount() const { return arrays.size(); }
+  int layersUsed() const {
+    int used = 0;
+    for (const Array &array : arrays)
+      used += LAYERS_PER_ARRAY - array.freeLayers.size();
+    return used;
+  }
+
+  void destroy() {
+    for (Array &array : arrays) {
+      glDeleteTextures(1, &array.texture);
+      MemoryTracker::gpuRelease(MemoryTag::Textures, gpuBytes(array.size));
+    }
+    arrays.clear();
+  }
+
+  static unsigned int pack(int array, int layer) {
+    return ((unsigned int)array << 16) | (unsigned int)layer;
+  }
+
+private:
+  struct Array {
+    unsigned int texture;
+    int size;
+    GLenum internalFormat;
+    std::vector<int> freeLayers;
+  };
+  std::vector<Array> arrays;
+
+  // RGBA8 layers with full mip chains
+  static size_t gpuBytes(int size) {
+    return MemoryTracker::textureBytes(size, size, LAYERS_PER_ARRAY, 4, true);
+  }
+
+  static int bucketSize(int width, int height) {
+    int size = 1;
+    while (size < width || size < height)
+      size *= 2;
+    return size < MAX_SIZE ? size : MAX_SIZE;
+  }
+
+  int arrayWithFreeLayer(int size, GLenum internalFormat) {
+    for (size_t i = 0; i < arrays.size(); i++)
+      if (arrays[i].size == size &&
+          arrays[i].internalFormat == internalFormat &&
+          !arrays[i].freeLayers.empty())
+        return i;
+    if ((int)arrays.size() == MAX_ARRAYS) {
+      std::cout << "ERROR::TEXTURE::OUT_OF_ARRAYS: " << size << "x" << size
+                << std::endl;
+      return -1;
+    }
+
+    Array array;
+    array.size = size;
+    array.internalFormat = internalFormat;
+    // hand out the lowest layers first
+    for (int layer = LAYERS_PER_ARRAY - 1; layer >= 0; layer--)
+      array.freeLayers.push_back(layer);
+    int levels = (int)std::log2((float)size) + 1;
+    glGenTextures(1, &array.texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, internalFormat, size, size,
+                   LAYERS_PER_ARRAY);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    MemoryTracker::gpuAllocate(MemoryTag::Textures, gpuBytes(size));
+    arrays.push_back(array);
+    return arrays.size() - 1;
+  }
+
+  // bilinear resample of RGBA8 pixels to a `size`x`size` square
+  static std::vector<unsigned char> resize(const unsigned char *src, int width,
+                                           int height, int size) {
+    std::vector<unsigned char> dst(size * size * 4);
+    for (int y = 0; y < size; y++) {
+      float fy = glm::clamp((y + 0.5f) * height / size - 0.5f, 0.0f,
+                            height - 1.0f);
+      int y0 = (int)fy;
+      int y1 = glm::min(y0 + 1, height - 1);
+      float ty = fy - y0;
+      for (int x = 0; x < size; x++) {
+        float fx = glm::clamp((x + 0.5f) * width / size - 0.5f, 0.0f,
+                              width - 1.0f);
+        int x0 = (int)fx;
+        int x1 = glm::min(x0 + 1, width - 1);
+        float tx = fx - x0;
+        for (int c = 0; c < 4; c++) {
+          float top = src[(y0 * width + x0) * 4 + c] * (1.0f - tx) +
+                      src[(y0 * width + x1) * 4 + c] * tx;
+          float bottom = src[(y1 * width + x0) * 4 + c] * (1.0f - tx) +
+                         src[(y1 * width + x1) * 4 + c] * tx;
+          dst[(y * size + x) * 4 + c] =
+              (unsigned char)(top * (1.0f - ty) + bottom * ty + 0.5f);
+        }
+      }
+    }
+    return dst;
+  }
+};
+
+#endif
@@ -0,0 +1,439 @@
+#ifndef TEXTURE_STREAMING_H
+#define TEXTURE_STREAMING_H
+
+#include "../stb_image.h"
+#include "memory_tracker.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// one decoded mip level, RGBA8
+struct TextureMip {
+  int width = 0;
+  int height = 0;
+  std::vector<unsigned char> pixels;
+};
+
+// Keeps the mip levels of textures resident that the frame samples. Every
+// frame the caller `request`s the finest level each texture needs, for
+// example from its projected size with `levelFor`, and `update` makes that
+// level and the coarser ones resident. A worker thread decodes the image
+// file and filters the missing levels; the caller's thread hands them to
+// `upload` and takes levels back through `evict`. Both replace the texture
+// by one whose finest level is the new one, so sampling is always clamped
+// to what is resident.
+//
+// The levels of at most TAIL_SIZE texels are loaded when a texture is added
+// and stay resident. Finer levels count against budget.memoryBytes; to make
+// room, textures not requested this frame give up theirs, least recently
+// used first, and requested ones the levels finer than the request. At most
+// budget.uploadBytes are uploaded per frame, loads bigger than that are
+// split into one level per frame.
+class TextureStreamer {
+public:
+  static const unsigned int NONE = 0xffffffffu;
+  static const int TAIL_SIZE = 64;
+  // loads waiting for the worker at most, so the queue follows the requests
+  static const unsigned int MAX_QUEUED = 4;
+
+  struct Budget {
+    size_t memoryBytes = 128 << 20;
+    size_t uploadBytes = 8 << 20;
+  };
+
+  // what the last update did
+  struct FrameStats {
+    size_t uploadedBytes = 0;
+    unsigned int uploadedLevels = 0;
+    unsigned int evictedLevels = 0;
+  };
+
+  Budget budget;
+  // added to the levels from `levelFor`, positive values save memory
+  float lodBias = 0.0f;
+
+  FrameStats lastFrame;
+
+  TextureStreamer() = default;
+  TextureStreamer(const TextureStreamer &) = delete;
+  TextureStreamer &operator=(const TextureStreamer &) = delete;
+  ~TextureStreamer() { close(); }
+
+  // Registers an image file, reading only its header. Nothing of it is
+  // resident before the next update. Returns NONE if it can not be read.
+  unsigned int add(const char *path) {
+    MemoryTagScope tag(MemoryTag::Textures);
+    int width, height, channels;
+    if (!stbi_info(path, &width, &height, &channels)) {
+      std::cout << "ERROR::TEXTURE::LOAD_FAILED: " << path << std::endl;
+      return NONE;
+    }
+    Texture texture;
+    texture.path = path;
+    texture.width = width;
+    texture.height = height;
+    texture.levels = 1;
+    while ((std::max(width, height) >> texture.levels) > 0)
+      texture.levels++;
+    texture.tail = 0;
+    while (std::max(width, height) >> texture.tail > TAIL_SIZE)
+      texture.tail++;
+    texture.resident = texture.levels;
+    texture.wanted = texture.levels;
+    std::lock_guard<std::mutex> lock(mutex);
+    textures.push_back(std::move(texture));
+    candidates.reserve(textures.size());
+    victims.reserve(textures.size());
+    evictions.reserve(textures.size());
+    ready.reserve(textures.size());
+    finished.reserve(textures.size());
+    queue.reserve(MAX_QUEUED);
+    if (!worker.joinable()) {
+      stopping = false;
+      worker = std::thread([this] { work(); });
+    }
+    return textures.size() - 1;
+  }
+
+  // Forgets every texture, the caller's copies stay.
+  void close() {
+    if (worker.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      wake.notify_all();
+      worker.join();
+    }
+    textures.clear();
+    textures.shrink_to_fit();
+    queue.clear();
+    ready.clear();
+    finished.clear();
+    used = 0;
+  }
+
+  unsigned int textureCount() const { return textures.size(); }
+  int width(unsigned int texture) const { return textures[texture].width; }
+  int height(unsigned int texture) const { return textures[texture].height; }
+  int levelCount(unsigned int texture) const {
+    return textures[texture].levels;
+  }
+  int tailLevel(unsigned int texture) const { return textures[texture].tail; }
+  // finest resident level, levelCount before the tail is in
+  int residentLevel(unsigned int texture) const {
+    return textures[texture].resident;
+  }
+
+  // bytes counted against budget.memoryBytes right now, loads included
+  size_t usedBytes() const { return used; }
+
+  // textures being loaded or waiting to be uploaded
+  unsigned int pendingLoads() const {
+    unsigned int count = 0;
+    for (const Texture &texture : textures)
+      count += texture.state != Idle;
+    return count;
+  }
+
+  // bytes of `level` of a `width`x`height` texture
+  static size_t levelBytes(int width, int height, int level) {
+    return (size_t)std::max(width >> level, 1) * std::max(height >> level, 1) *
+           4;
+  }
+
+  // the finest level worth sampling where the texture's width spans
+  // `pixels` pixels on screen
+  int levelFor(unsigned int texture, float pixels) const {
+    const Texture &t = textures[texture];
+    float texels = (float)std::max(t.width, t.height);
+    float level = std::log2(texels / std::max(pixels, 1.0f)) + lodBias;
+    return std::min(std::max((int)std::floor(level), 0), t.levels - 1);
+  }
+
+  // the texture is sampled at `level` this frame
+  void request(unsigned int texture, int level) {
+    if (texture >= textures.size())
+      return;
+    Texture &t = textures[texture];
+    level = std::min(std::max(level, 0), t.levels - 1);
+    if (t.lastUsed != frame) {
+      t.lastUsed = frame;
+      t.wanted = level;
+    } else {
+      t.wanted = std::min(t.wanted, level);
+    }
+  }
+
+  // One frame of streaming for this frame's requests. Calls
+  // evict(texture, level, previous) to drop the levels finer than `level`
+  // and upload(texture, level, mips, count) to add `count` new levels from
+  // `level` on; `previous` and level + count are the old finest level.
+  template <typename Upload, typename Evict>
+  void update(Upload upload, Evict evict) {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (unsigned int index : finished) {
+      textures[index].state = Ready;
+      ready.push_back(index);
+    }
+    finished.clear();
+
+    // textures missing levels they need, the most missing first, and
+    // textures holding levels they do not, least recently used first
+    candidates.clear();
+    victims.clear();
+    size_t evictable = 0;
+    for (unsigned int i = 0; i < textures.size(); i++) {
+      const Texture &t = textures[i];
+      if (t.state != Idle || t.failed)
+        continue;
+      int level = target(t);
+      if (t.resident > level)
+        candidates.push_back(i);
+      if (t.resident < level) {
+        victims.push_back(i);
+        evictable += rangeBytes(t, t.resident, level);
+      }
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [&](unsigned int a, unsigned int b) {
+                const Texture &ta = textures[a];
+                const Texture &tb = textures[b];
+                return ta.resident - target(ta) > tb.resident - target(tb);
+              });
+    std::sort(victims.begin(), victims.end(),
+              [&](unsigned int a, unsigned int b) {
+                return textures[a].lastUsed < textures[b].lastUsed;
+              });
+
+    evictions.clear();
+    unsigned int victim = 0;
+    for (unsigned int index : candidates) {
+      if (queue.size() >= MAX_QUEUED)
+        break;
+      Texture &t = textures[index];
+      // the tail first, then one level at a time while a load would
+      // not fit into a frame's uploads
+      int level = target(t);
+      if (t.resident == t.levels)
+        level = t.tail;
+      while (level < t.resident - 1 &&
+             rangeBytes(t, level, t.resident) > budget.uploadBytes)
+        level++;
+      size_t bytes = cost(t, level);
+      if (used + bytes > budget.memoryBytes + evictable)
+        continue;
+      while (used + bytes > budget.memoryBytes) {
+        Texture &v = textures[victims[victim++]];
+        int floor = target(v);
+        size_t freed = rangeBytes(v, v.resident, floor);
+        evictions.push_back({(unsigned int)(&v - textures.data()), floor,
+                             v.resident});
+        used -= freed;
+        evictable -= freed;
+        v.resident = floor;
+      }
+      used += bytes;
+      t.loading = level;
+      t.state = Loading;
+      queue.push_back(index);
+    }
+    lock.unlock();
+    wake.notify_all();
+
+    // evictions first, they made room for the loads
+    lastFrame = FrameStats();
+    for (const Eviction &e : evictions) {
+      evict(e.texture, e.level, e.previous);
+      lastFrame.evictedLevels += e.level - e.previous;
+    }
+    for (unsigned int index : ready) {
+      Texture &t = textures[index];
+      size_t bytes = rangeBytes(t, t.loading, t.resident);
+      if (lastFrame.uploadedBytes > 0 &&
+          lastFrame.uploadedBytes + bytes > budget.uploadBytes)
+        continue;
+      if (t.mips.empty()) {
+        // could not be decoded, do not try again
+        used -= cost(t, t.loading);
+        t.failed = true;
+      } else {
+        upload(index, t.loading, t.mips.data(), (int)t.mips.size());
+        lastFrame.uploadedBytes += bytes;
+        lastFrame.uploadedLevels += t.mips.size();
+        t.resident = t.loading;
+        std::vector<TextureMip>().swap(t.mips);
+      }
+      t.state = Idle;
+    }
+    ready.erase(std::remove_if(ready.begin(), ready.end(),
+                               [&](unsigned int index) {
+                                 return textures[index].state != Ready;
+                               }),
+                ready.end());
+    frame++;
+  }
+
+  // Waits until the worker has decoded everything queued, for runs that
+  // need the same result whatever the disk's speed.
+  void sync() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return stopping || (!busy && queue.empty()); });
+  }
+
+private:
+  enum State { Idle, Loading, Ready };
+
+  struct Texture {
+    std::string path;
+    int width = 0;
+    int height = 0;
+    int levels = 0;
+    // levels from here on are the tail
+    int tail = 0;
+    int resident = 0;
+    // the finest level requested in frame lastUsed
+    int wanted = 0;
+    unsigned int lastUsed = 0;
+    State state = Idle;
+    bool failed = false;
+    // the level a load goes down to, and its decoded levels once Ready
+    int loading = 0;
+    std::vector<TextureMip> mips;
+  };
+
+  struct Eviction {
+    unsigned int texture;
+    int level;
+    int previous;
+  };
+
+  std::vector<Texture> textures;
+  std::vector<unsigned int> candidates;
+  std::vector<unsigned int> victims;
+  std::vector<Eviction> evictions;
+  std::vector<unsigned int> ready;
+  size_t used = 0;
+  // starts past every texture's lastUsed
+  unsigned int frame = 1;
+
+  // shared with the worker
+  std::thread worker;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable idle;
+  std::vector<unsigned int> queue;
+  std::vector<unsigned int> finished;
+  // the worker is between taking a load and handing it back
+  bool busy = false;
+  bool stopping = false;
+
+  // the finest level the texture should have, its tail if it was not
+  // requested this frame
+  int target(const Texture &t) const {
+    return t.lastUsed == frame ? std::min(t.wanted, t.tail) : t.tail;
+  }
+
+  static size_t rangeBytes(const Texture &t, int first, int last) {
+    size_t bytes = 0;
+    for (int level = first; level < last; level++)
+      bytes += levelBytes(t.width, t.height, level);
+    return bytes;
+  }
+
+  // what loading down to `level` adds to the used bytes, tails are free
+  size_t cost(const Texture &t, int level) const {
+    return t.resident == t.levels ? 0 : rangeBytes(t, level, t.resident);
+  }
+
+  void work() {
+    MemoryTagScope tag(MemoryTag::Textures);
+    stbi_set_flip_vertically_on_load_thread(true);
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      busy = false;
+      if (queue.empty())
+        idle.notify_all();
+      wake.wait(lock, [this] { return stopping || !queue.empty(); });
+      if (stopping)
+        return;
+      busy = true;
+      unsigned int index = queue.front();
+      queue.erase(queue.begin());
+      // `textures` only grows on the caller's thread with the mutex held
+      const Texture &t = textures[index];
+      std::string path = t.path;
+      int width = t.width;
+      int height = t.height;
+      int first = t.loading;
+      int last = t.resident;
+      lock.unlock();
+      std::vector<TextureMip> mips = decode(path, width, height, first, last);
+      lock.lock();
+      textures[index].mips = std::move(mips);
+      finished.push_back(index);
+    }
+  }
+
+  // levels first .. last - 1 of the image at `path`, none if it can not be
+  // loaded or is no longer `width`x`height`
+  static std::vector<TextureMip> decode(const std::string &path, int width,
+                                        int height, int first, int last) {
+    std::vector<TextureMip> mips;
+    int w, h, channels;
+    unsigned char *data = stbi_load(path.c_str(), &w, &h, &channels, 4);
+    if (!data || w != width || h != height) {
+      std::cout << "ERROR::TEXTURE::LOAD_FAILED: " << path << std::endl;
+      stbi_image_free(data);
+      return mips;
+    }
+    TextureMip level;
+    level.width = w;
+    level.height = h;
+    level.pixels.assign(data, data + (size_t)w * h * 4);
+    stbi_image_free(data);
+    mips.reserve(last - first);
+    for (int i = 0; i < last - 1; i++) {
+      if (i >= first)
+        mips.push_back(level);
+      level = downsample(level);
+    }
+    mips.push_back(std::move(level));
+    return mips;
+  }
+
+  // the next level of a mip chain, 2x2 box filtered; odd rows and columns
+  // repeat the last texel
+  static TextureMip downsample(const TextureMip &src) {
+    TextureMip dst;
+    dst.width = std::max(src.width / 2, 1);
+    dst.height = std::max(src.height / 2, 1);
+    dst.pixels.resize((size_t)dst.width * dst.height * 4);
+    for (int y = 0; y < dst.height; y++) {
+      const unsigned char *row0 =
+          src.pixels.data() + (size_t)std::min(2 * y, src.height - 1) *
+                                  src.width * 4;
+      const unsigned char *row1 =
+          src.pixels.data() + (size_t)std::min(2 * y + 1, src.height - 1) *
+                                  src.width * 4;
+      unsigned char *out = dst.pixels.data() + (size_t)y * dst.width * 4;
+      for (int x = 0; x < dst.width; x++) {
+        int x0 = std::min(2 * x, src.width - 1) * 4;
+        int x1 = std::min(2 * x + 1, src.width - 1) * 4;
+        for (int c = 0; c < 4; c++)
+          out[x * 4 + c] = (unsigned char)((row0[x0 + c] + row0[x1 + c] +
+                                            row1[x0 + c] + row1[x1 + c] + 2) /
+                                           4);
+      }
+    }
+    return dst;
+  }
+};
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Worker threads for data parallel loops. `parallelFor` hands out chunks of
+// [0, count) to the workers and the calling thread and returns once all of
+// them ran. Jobs are passed as a function pointer and context instead of a
+// std::function, so dispatching one does not allocate.
+class ThreadPool {
+public:
+  // one worker less than there are cores, the caller is the last one
+  ThreadPool()
+      : ThreadPool(std::max(std::thread::hardware_concurrency(), 1u) - 1) {}
+
+  explicit ThreadPool(unsigned int workerCount) {
+    for (unsigned int i = 0; i < workerCount; i++)
+      workers.emplace_back([this] { work(); });
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &worker : workers)
+      worker.join();
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  unsigned int threadCount() const { return workers.size() + 1; }
+
+  // Calls fn(begin, end) for chunks of at most `chunk` indices covering
+  // [0, count). Runs on the calling thread alone if it is a single chunk.
+  template <typename Fn>
+  void parallelFor(unsigned int count, unsigned int chunk, Fn fn) {
+    if (workers.empty() || count <= chunk) {
+      fn(0u, count);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      job.run = [](void *context, unsigned int begin, unsigned int end) {
+        (*(Fn *)context)(begin, end);
+      };
+      job.context = &fn;
+      job.count = count;
+      job.chunk = chunk;
+      next = 0;
+      busy = workers.size();
+      generation++;
+    }
+    wake.notify_all();
+    runChunks();
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this] { return busy == 0; });
+  }
+
+private:
+  struct Job {
+    void (*run)(void *context, unsigned int begin, unsigned int end);
+    void *context;
+    unsigned int count;
+    unsigned int chunk;
+  };
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable finished;
+  Job job = {};
+  std::atomic<unsigned int> next{0};
+  unsigned int busy = 0;
+  unsigned long long generation = 0;
+  bool stopping = false;
+
+  void runChunks() {
+    for (;;) {
+      unsigned int begin = next.fetch_add(job.chunk);
+      if (begin >= job.count)
+        return;
+      job.run(job.context, begin, std::min(begin + job.chunk, job.count));
+    }
+  }
+
+  void work() {
+    unsigned long long seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&] { return stopping || generation != seen; });
+        if (stopping)
+          return;
+        seen = generation;
+      }
+      runChunks();
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--busy == 0)
+        finished.notify_one();
+    }
+  }
+};
+
+#endif
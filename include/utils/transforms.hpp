@@ -0,0 +1,348 @@
+#ifndef TRANSFORMS_H
+#define TRANSFORMS_H
+
+#include "../glm/glm.hpp"
+#include "../glm/gtc/quaternion.hpp"
+#include "cpu_features.hpp"
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+enum class TransformKernel { Scalar, Sse, Avx2 };
+
+// Positions, rotations and scales of many objects, stored as one array per
+// component so `compute` can build model and normal matrices for 8 (AVX2) or
+// 4 (SSE) objects per iteration. The kernel is picked at runtime from what
+// the CPU supports. All kernels do the same float operations in the same
+// order and avoid FMA, so they agree bit for bit unless the compiler
+// contracts the scalar path. Rotations are expected to be unit quaternions.
+class TransformArray {
+public:
+  // kernel used by `compute`, the fastest supported one by default
+  TransformKernel kernel = bestKernel();
+
+  unsigned int add(glm::vec3 position, glm::quat rotation,
+                   glm::vec3 scale = glm::vec3(1.0f)) {
+    for (std::vector<float> *component : components())
+      component->push_back(0.0f);
+    unsigned int id = px.size() - 1;
+    setPosition(id, position);
+    setRotation(id, rotation);
+    setScale(id, scale);
+    return id;
+  }
+
+  void setPosition(unsigned int id, glm::vec3 position) {
+    px[id] = position.x;
+    py[id] = position.y;
+    pz[id] = position.z;
+  }
+  void setRotation(unsigned int id, glm::quat rotation) {
+    qx[id] = rotation.x;
+    qy[id] = rotation.y;
+    qz[id] = rotation.z;
+    qw[id] = rotation.w;
+  }
+  void setScale(unsigned int id, glm::vec3 scale) {
+    sx[id] = scale.x;
+    sy[id] = scale.y;
+    sz[id] = scale.z;
+  }
+
+  glm::vec3 position(unsigned int id) const {
+    return glm::vec3(px[id], py[id], pz[id]);
+  }
+  glm::quat rotation(unsigned int id) const {
+    return glm::quat(qw[id], qx[id], qy[id], qz[id]);
+  }
+  glm::vec3 scale(unsigned int id) const {
+    return glm::vec3(sx[id], sy[id], sz[id]);
+  }
+  unsigned int size() const { return px.size(); }
+
+  // moves the last object into `id`, so ids past it are not stable
+  void swapRemove(unsigned int id) {
+    for (std::vector<float> *component : components()) {
+      (*component)[id] = component->back();
+      component->pop_back();
+    }
+  }
+
+  void reserve(size_t count) {
+    for (std::vector<float> *component : components())
+      component->reserve(count);
+  }
+  void clear() {
+    for (std::vector<float> *component : components())
+      component->clear();
+  }
+
+  // Writes the model matrix (translate * rotate * scale) of objects
+  // [first, first + count) to `models` and, if `normals` is not null, the
+  // inverse transpose of its upper 3x3 as three vec4 columns to `normals`.
+  // Both advance by `stride` bytes per object, so they can point straight
+  // into an interleaved instance buffer.
+  void compute(unsigned int first, unsigned int count, void *models,
+               void *normals, size_t stride) const {
+    Output out = {(unsigned char *)models, (unsigned char *)normals, stride,
+                  first};
+    unsigned int i = first, end = first + count;
+#if CPU_X86
+    if (kernel == TransformKernel::Avx2)
+      i = computeAvx2(i, end, out);
+    if (kernel != TransformKernel::Scalar)
+      i = computeSse(i, end, out);
+#endif
+    computeScalar(i, end, out);
+  }
+
+  static TransformKernel bestKernel() {
+#if CPU_X86
+    return CpuFeatures::avx2() ? TransformKernel::Avx2 : TransformKernel::Sse;
+#else
+    return TransformKernel::Scalar;
+#endif
+  }
+
+  static const char *kernelName(TransformKernel kernel) {
+    switch (kernel) {
+    case TransformKernel::Avx2:
+      return "AVX2";
+    case TransformKernel::Sse:
+      return "SSE";
+    default:
+      return "Scalar";
+    }
+  }
+
+private:
+  std::vector<float> px, py, pz;
+  std::vector<float> qx, qy, qz, qw;
+  std::vector<float> sx, sy, sz;
+
+  struct Output {
+    unsigned char *models;
+    unsigned char *normals;
+    size_t stride;
+    unsigned int first;
+
+    float *model(unsigned int i) const {
+      return (float *)(models + (i - first) * stride);
+    }
+    float *normal(unsigned int i) const {
+      return (float *)(normals + (i - first) * stride);
+    }
+  };
+
+  std::array<std::vector<float> *, 10> components() {
+    return {&px, &py, &pz, &qx, &qy, &qz, &qw, &sx, &sy, &sz};
+  }
+
+  void computeScalar(unsigned int i, unsigned int end,
+                     const Output &out) const {
+    for (; i < end; i++) {
+      float x = qx[i], y = qy[i], z = qz[i], w = qw[i];
+      float xx = x * x, yy = y * y, zz = z * z;
+      float xy = x * y, xz = x * z, yz = y * z;
+      float wx = w * x, wy = w * y, wz = w * z;
+      // rotation columns, as in glm::mat3_cast
+      float r[9] = {1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz),
+                    2.0f * (xz - wy),        2.0f * (xy - wz),
+                    1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx),
+                    2.0f * (xz + wy),        2.0f * (yz - wx),
+                    1.0f - 2.0f * (xx + yy)};
+      float s[3] = {sx[i], sy[i], sz[i]};
+      float *m = out.model(i);
+      for (int c = 0; c < 3; c++) {
+        for (int row = 0; row < 3; row++)
+          m[c * 4 + row] = r[c * 3 + row] * s[c];
+        m[c * 4 + 3] = 0.0f;
+      }
+      m[12] = px[i];
+      m[13] = py[i];
+      m[14] = pz[i];
+      m[15] = 1.0f;
+      if (!out.normals)
+        continue;
+      float *n = out.normal(i);
+      for (int c = 0; c < 3; c++) {
+        float inverseScale = 1.0f / s[c];
+        for (int row = 0; row < 3; row++)
+          n[c * 4 + row] = r[c * 3 + row] * inverseScale;
+        n[c * 4 + 3] = 0.0f;
+      }
+    }
+  }
+
+#if CPU_X86
+  // Transposes c0-c3 (element k of 4 objects in ck) and stores the 4
+  // elements of object j to `dst` + j * stride.
+  static void storeTransposed(unsigned char *dst, size_t stride, __m128 c0,
+                              __m128 c1, __m128 c2, __m128 c3) {
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+    _mm_storeu_ps((float *)dst, c0);
+    _mm_storeu_ps((float *)(dst + stride), c1);
+    _mm_storeu_ps((float *)(dst + 2 * stride), c2);
+    _mm_storeu_ps((float *)(dst + 3 * stride), c3);
+  }
+
+  unsigned int computeSse(unsigned int i, unsigned int end,
+                          const Output &out) const {
+    const __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f);
+    const __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= end; i += 4) {
+      __m128 x = _mm_loadu_ps(&qx[i]), y = _mm_loadu_ps(&qy[i]);
+      __m128 z = _mm_loadu_ps(&qz[i]), w = _mm_loadu_ps(&qw[i]);
+      __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y);
+      __m128 zz = _mm_mul_ps(z, z), xy = _mm_mul_ps(x, y);
+      __m128 xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+      __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y);
+      __m128 wz = _mm_mul_ps(w, z);
+      __m128 r00 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz)));
+      __m128 r01 = _mm_mul_ps(two, _mm_add_ps(xy, wz));
+      __m128 r02 = _mm_mul_ps(two, _mm_sub_ps(xz, wy));
+      __m128 r10 = _mm_mul_ps(two, _mm_sub_ps(xy, wz));
+      __m128 r11 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz)));
+      __m128 r12 = _mm_mul_ps(two, _mm_add_ps(yz, wx));
+      __m128 r20 = _mm_mul_ps(two, _mm_add_ps(xz, wy));
+      __m128 r21 = _mm_mul_ps(two, _mm_sub_ps(yz, wx));
+      __m128 r22 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy)));
+      __m128 s0 = _mm_loadu_ps(&sx[i]), s1 = _mm_loadu_ps(&sy[i]);
+      __m128 s2 = _mm_loadu_ps(&sz[i]);
+
+      // one register per matrix element across the 4 objects, transposed
+      // to one column per object
+      unsigned char *model = out.models + (i - out.first) * out.stride;
+      storeTransposed(model, out.stride, _mm_mul_ps(r00, s0),
+                      _mm_mul_ps(r01, s0), _mm_mul_ps(r02, s0), zero);
+      storeTransposed(model + 4 * sizeof(float), out.stride,
+                      _mm_mul_ps(r10, s1), _mm_mul_ps(r11, s1),
+                      _mm_mul_ps(r12, s1), zero);
+      storeTransposed(model + 8 * sizeof(float), out.stride,
+                      _mm_mul_ps(r20, s2), _mm_mul_ps(r21, s2),
+                      _mm_mul_ps(r22, s2), zero);
+      storeTransposed(model + 12 * sizeof(float), out.stride,
+                      _mm_loadu_ps(&px[i]), _mm_loadu_ps(&py[i]),
+                      _mm_loadu_ps(&pz[i]), one);
+
+      if (!out.normals)
+        continue;
+      s0 = _mm_div_ps(one, s0);
+      s1 = _mm_div_ps(one, s1);
+      s2 = _mm_div_ps(one, s2);
+      unsigned char *normal = out.normals + (i - out.first) * out.stride;
+      storeTransposed(normal, out.stride, _mm_mul_ps(r00, s0),
+                      _mm_mul_ps(r01, s0), _mm_mul_ps(r02, s0), zero);
+      storeTransposed(normal + 4 * sizeof(float), out.stride,
+                      _mm_mul_ps(r10, s1), _mm_mul_ps(r11, s1),
+                      _mm_mul_ps(r12, s1), zero);
+      storeTransposed(normal + 8 * sizeof(float), out.stride,
+                      _mm_mul_ps(r20, s2), _mm_mul_ps(r21, s2),
+                      _mm_mul_ps(r22, s2), zero);
+    }
+    return i;
+  }
+
+  // a0-a3 hold 4 elements of objects 0-3 in their low lanes and of objects
+  // 4-7 in their high lanes
+  CPU_TARGET_AVX2 static void storeLanes(unsigned char *dst,
+                                                size_t stride, __m256 a0,
+                                                __m256 a1, __m256 a2,
+                                                __m256 a3) {
+    _mm_storeu_ps((float *)dst, _mm256_castps256_ps128(a0));
+    _mm_storeu_ps((float *)(dst + stride), _mm256_castps256_ps128(a1));
+    _mm_storeu_ps((float *)(dst + 2 * stride), _mm256_castps256_ps128(a2));
+    _mm_storeu_ps((float *)(dst + 3 * stride), _mm256_castps256_ps128(a3));
+    _mm_storeu_ps((float *)(dst + 4 * stride), _mm256_extractf128_ps(a0, 1));
+    _mm_storeu_ps((float *)(dst + 5 * stride), _mm256_extractf128_ps(a1, 1));
+    _mm_storeu_ps((float *)(dst + 6 * stride), _mm256_extractf128_ps(a2, 1));
+    _mm_storeu_ps((float *)(dst + 7 * stride), _mm256_extractf128_ps(a3, 1));
+  }
+
+  // Transposes r0-r7 (element k of 8 objects in rk) and stores elements
+  // 0-7 of object j to `dst` + j * stride, only elements 0-3 if `half`.
+  CPU_TARGET_AVX2 static void storeTransposed(
+      unsigned char *dst, size_t stride, bool half, __m256 r0, __m256 r1,
+      __m256 r2, __m256 r3, __m256 r4, __m256 r5, __m256 r6, __m256 r7) {
+    __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+    __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+    __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+    __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+    storeLanes(dst, stride,
+               _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0)),
+               _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2)),
+               _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0)),
+               _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2)));
+    if (half)
+      return;
+    __m256 t4 = _mm256_unpacklo_ps(r4, r5);
+    __m256 t5 = _mm256_unpackhi_ps(r4, r5);
+    __m256 t6 = _mm256_unpacklo_ps(r6, r7);
+    __m256 t7 = _mm256_unpackhi_ps(r6, r7);
+    storeLanes(dst + 4 * sizeof(float), stride,
+               _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0)),
+               _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2)),
+               _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0)),
+               _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2)));
+  }
+
+  CPU_TARGET_AVX2 unsigned int
+  computeAvx2(unsigned int i, unsigned int end, const Output &out) const {
+    const __m256 one = _mm256_set1_ps(1.0f), two = _mm256_set1_ps(2.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    for (; i + 8 <= end; i += 8) {
+      __m256 x = _mm256_loadu_ps(&qx[i]), y = _mm256_loadu_ps(&qy[i]);
+      __m256 z = _mm256_loadu_ps(&qz[i]), w = _mm256_loadu_ps(&qw[i]);
+      __m256 xx = _mm256_mul_ps(x, x), yy = _mm256_mul_ps(y, y);
+      __m256 zz = _mm256_mul_ps(z, z), xy = _mm256_mul_ps(x, y);
+      __m256 xz = _mm256_mul_ps(x, z), yz = _mm256_mul_ps(y, z);
+      __m256 wx = _mm256_mul_ps(w, x), wy = _mm256_mul_ps(w, y);
+      __m256 wz = _mm256_mul_ps(w, z);
+      __m256 r00 =
+          _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(yy, zz)));
+      __m256 r01 = _mm256_mul_ps(two, _mm256_add_ps(xy, wz));
+      __m256 r02 = _mm256_mul_ps(two, _mm256_sub_ps(xz, wy));
+      __m256 r10 = _mm256_mul_ps(two, _mm256_sub_ps(xy, wz));
+      __m256 r11 =
+          _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, zz)));
+      __m256 r12 = _mm256_mul_ps(two, _mm256_add_ps(yz, wx));
+      __m256 r20 = _mm256_mul_ps(two, _mm256_add_ps(xz, wy));
+      __m256 r21 = _mm256_mul_ps(two, _mm256_sub_ps(yz, wx));
+      __m256 r22 =
+          _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, yy)));
+      __m256 s0 = _mm256_loadu_ps(&sx[i]), s1 = _mm256_loadu_ps(&sy[i]);
+      __m256 s2 = _mm256_loadu_ps(&sz[i]);
+
+      // one register per matrix element across the 8 objects, columns 0-1
+      // and 2-3 are transposed and stored as two blocks
+      unsigned char *model = out.models + (i - out.first) * out.stride;
+      storeTransposed(model, out.stride, false, _mm256_mul_ps(r00, s0),
+                      _mm256_mul_ps(r01, s0), _mm256_mul_ps(r02, s0), zero,
+                      _mm256_mul_ps(r10, s1), _mm256_mul_ps(r11, s1),
+                      _mm256_mul_ps(r12, s1), zero);
+      storeTransposed(model + 8 * sizeof(float), out.stride, false,
+                      _mm256_mul_ps(r20, s2), _mm256_mul_ps(r21, s2),
+                      _mm256_mul_ps(r22, s2), zero, _mm256_loadu_ps(&px[i]),
+                      _mm256_loadu_ps(&py[i]), _mm256_loadu_ps(&pz[i]), one);
+
+      if (!out.normals)
+        continue;
+      s0 = _mm256_div_ps(one, s0);
+      s1 = _mm256_div_ps(one, s1);
+      s2 = _mm256_div_ps(one, s2);
+      unsigned char *normal = out.normals + (i - out.first) * out.stride;
+      storeTransposed(normal, out.stride, false, _mm256_mul_ps(r00, s0),
+                      _mm256_mul_ps(r01, s0), _mm256_mul_ps(r02, s0), zero,
+                      _mm256_mul_ps(r10, s1), _mm256_mul_ps(r11, s1),
+                      _mm256_mul_ps(r12, s1), zero);
+      storeTransposed(normal + 8 * sizeof(float), out.stride, true,
+                      _mm256_mul_ps(r20, s2), _mm256_mul_ps(r21, s2),
+                      _mm256_mul_ps(r22, s2), zero, zero, zero, zero, zero);
+    }
+    return i;
+  }
+#endif
+};
+
+#endif
@@ -0,0 +1,659 @@
+#ifndef WORLD_STREAMING_H
+#define WORLD_STREAMING_H
+
+#include "../glm/glm.hpp"
+#include "memory_tracker.hpp"
+#include "scene_file.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A world too big to keep in memory, cut into square sectors on the xz
+// plane that are loaded around the camera. A .world file is a WorldHeader,
+// a WorldSector per sector (x major) and then every sector's instances.
+// An instance takes 28 bytes or so: mesh and material as LEB128 varints,
+// the position quantized to 16 bits inside its sector's box, the rotation
+// as a 16 bit snorm quaternion and the scale as floats.
+
+const char WORLD_MAGIC[8] = {'L', 'O', 'G', 'L', 'W', 'R', 'L', 'D'};
+const uint32_t WORLD_VERSION = 1;
+
+struct WorldHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t sectorsX;
+  uint32_t sectorsZ;
+  float origin[3]; // min corner, y is the bottom of the height range
+  float sectorSize;
+  float height;
+};
+
+struct WorldSector {
+  uint64_t offset; // from the start of the file
+  uint32_t bytes;
+  uint32_t instanceCount;
+};
+
+inline void encodeWorldInstance(const SceneInstance &instance,
+                                glm::vec3 sectorMin, glm::vec3 sectorSize,
+                                std::vector<uint8_t> &out) {
+  auto varint = [&](uint32_t value) {
+    do {
+      out.push_back((value & 0x7f) | (value > 0x7f ? 0x80 : 0));
+      value >>= 7;
+    } while (value);
+  };
+  auto u16 = [&](uint16_t value) {
+    out.push_back(value & 0xff);
+    out.push_back(value >> 8);
+  };
+  varint(instance.mesh);
+  varint(instance.material);
+  for (int c = 0; c < 3; c++) {
+    float t = (instance.position[c] - sectorMin[c]) / sectorSize[c];
+    u16((uint16_t)std::lround(glm::clamp(t, 0.0f, 1.0f) * 65535.0f));
+  }
+  const float *r = instance.rotation;
+  float length = std::sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2] +
+                           r[3] * r[3]);
+  for (int c = 0; c < 4; c++) {
+    float q = length > 0.0f ? r[c] / length : (c == 3 ? 1.0f : 0.0f);
+    q = glm::clamp(q, -1.0f, 1.0f);
+    u16((uint16_t)(int16_t)std::lround(q * 32767.0f));
+  }
+  const uint8_t *scale = (const uint8_t *)instance.scale;
+  out.insert(out.end(), scale, scale + sizeof(instance.scale));
+}
+
+// Advances `at`; returns false if the data ends inside the instance.
+inline bool decodeWorldInstance(const uint8_t *&at, const uint8_t *end,
+                                glm::vec3 sectorMin, glm::vec3 sectorSize,
+                                SceneInstance &instance) {
+  auto varint = [&](uint32_t &value) {
+    value = 0;
+    for (int shift = 0;; shift += 7) {
+      if (at == end || shift > 28)
+        return false;
+      uint8_t byte = *at++;
+      value |= (uint32_t)(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return true;
+    }
+  };
+  if (!varint(instance.mesh) || !varint(instance.material) ||
+      end - at < 7 * 2 + (long)sizeof(instance.scale))
+    return false;
+  auto u16 = [&]() {
+    uint16_t value = at[0] | at[1] << 8;
+    at += 2;
+    return value;
+  };
+  for (int c = 0; c < 3; c++)
+    instance.position[c] = sectorMin[c] + u16() / 65535.0f * sectorSize[c];
+  for (int c = 0; c < 4; c++)
+    instance.rotation[c] = std::max((int16_t)u16() / 32767.0f, -1.0f);
+  std::memcpy(instance.scale, at, sizeof(instance.scale));
+  at += sizeof(instance.scale);
+  return true;
+}
+
+// Sorts instances into sectors and writes them out as a .world file. The
+// grid covers the instances' positions.
+class WorldWriter {
+public:
+  float sectorSize = 32.0f;
+  std::vector<SceneInstance> instances;
+
+  bool write(const char *path) const {
+    WorldHeader header = {};
+    std::memcpy(header.magic, WORLD_MAGIC, sizeof(WORLD_MAGIC));
+    header.version = WORLD_VERSION;
+    header.sectorSize = sectorSize;
+    glm::vec3 low(0.0f), high(0.0f);
+    for (size_t i = 0; i < instances.size(); i++) {
+      glm::vec3 p(instances[i].position[0], instances[i].position[1],
+                  instances[i].position[2]);
+      low = i ? glm::min(low, p) : p;
+      high = i ? glm::max(high, p) : p;
+    }
+    header.sectorsX = (uint32_t)((high.x - low.x) / sectorSize) + 1;
+    header.sectorsZ = (uint32_t)((high.z - low.z) / sectorSize) + 1;
+    header.origin[0] = low.x;
+    header.origin[1] = low.y;
+    header.origin[2] = low.z;
+    header.height = std::max(high.y - low.y, 1e-3f);
+
+    // counting sort by sector, then each sector's bytes in turn
+    uint32_t sectorCount = header.sectorsX * header.sectorsZ;
+    std::vector<uint32_t> first(sectorCount + 1, 0);
+    std::vector<uint32_t> sectorOf(instances.size());
+    for (size_t i = 0; i < instances.size(); i++) {
+      uint32_t x = std::min(
+          (uint32_t)((instances[i].position[0] - low.x) / sectorSize),
+          header.sectorsX - 1);
+      uint32_t z = std::min(
+          (uint32_t)((instances[i].position[2] - low.z) / sectorSize),
+          header.sectorsZ - 1);
+      sectorOf[i] = x * header.sectorsZ + z;
+      first[sectorOf[i] + 1]++;
+    }
+    for (uint32_t s = 0; s < sectorCount; s++)
+      first[s + 1] += first[s];
+    std::vector<uint32_t> order(instances.size());
+    std::vector<uint32_t> next(first.begin(), first.end() - 1);
+    for (size_t i = 0; i < instances.size(); i++)
+      order[next[sectorOf[i]]++] = i;
+
+    std::vector<WorldSector> table(sectorCount);
+    std::vector<uint8_t> data;
+    uint64_t offset = sizeof(WorldHeader) + sectorCount * sizeof(WorldSector);
+    glm::vec3 size(sectorSize, header.height, sectorSize);
+    for (uint32_t s = 0; s < sectorCount; s++) {
+      glm::vec3 sectorMin(low.x + s / header.sectorsZ * sectorSize, low.y,
+                          low.z + s % header.sectorsZ * sectorSize);
+      size_t start = data.size();
+      for (uint32_t i = first[s]; i < first[s + 1]; i++)
+        encodeWorldInstance(instances[order[i]], sectorMin, size, data);
+      table[s] = {offset + start, (uint32_t)(data.size() - start),
+                  first[s + 1] - first[s]};
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    file.write((const char *)&header, sizeof(header));
+    file.write((const char *)table.data(), table.size() * sizeof(WorldSector));
+    file.write((const char *)data.data(), data.size());
+    if (!file) {
+      std::cout << "ERROR::WORLD::WRITE_FAILED: " << path << std::endl;
+      return false;
+    }
+    return true;
+  }
+};
+
+// Streams the sectors of a .world file around a moving point. Every frame
+// `update` wants the sectors within loadRadius of the point and of where
+// its velocity takes it in `lookahead` seconds, nearest first, and lets go
+// of those beyond unloadRadius of both. A worker thread reads and decodes
+// the wanted sectors; the caller's thread hands the decoded instances over
+// through `commit` and takes them back through `release`.
+//
+// All of it is budgeted. Per frame the worker reads at most budget.ioBytes
+// and decodes at most budget.decodeInstances, and `update` commits and
+// releases at most budget.uploadInstances. A sector is only queued if its
+// file bytes, its decoded instances and residentBytesPerInstance for each
+// committed one fit into budget.memoryBytes next to everything loaded;
+// if not, the farthest loaded sector behind it is released first.
+class WorldStreamer {
+public:
+  static const uint32_t NONE = 0xffffffffu;
+  // sectors waiting for the worker at most, so the queue follows the camera
+  static const unsigned int MAX_QUEUED = 16;
+
+  enum SectorState : uint8_t {
+    Unloaded,
+    Queued,    // memory reserved, waiting for or loading on the worker
+    Ready,     // decoded, being committed
+    Resident,  // every instance committed
+    Releasing, // being released
+  };
+
+  struct Budget {
+    size_t ioBytes = 1 << 20;
+    unsigned int decodeInstances = 16384;
+    unsigned int uploadInstances = 4096;
+    size_t memoryBytes = 64 << 20;
+  };
+
+  // what the last frame did, each at most its budget
+  struct FrameStats {
+    size_t ioBytes = 0;
+    unsigned int decodedInstances = 0;
+    unsigned int committedInstances = 0;
+    unsigned int releasedInstances = 0;
+  };
+
+  Budget budget;
+  float loadRadius = 96.0f;
+  float unloadRadius = 128.0f;
+  float lookahead = 1.0f;
+  // what a committed instance costs the caller, counted against the budget
+  size_t residentBytesPerInstance = sizeof(SceneInstance);
+
+  FrameStats lastFrame;
+
+  WorldStreamer() = default;
+  WorldStreamer(const WorldStreamer &) = delete;
+  WorldStreamer &operator=(const WorldStreamer &) = delete;
+  ~WorldStreamer() { close(); }
+
+  bool open(const char *path) {
+    close();
+    MemoryTagScope tag(MemoryTag::Streaming);
+    // sectors are read in large chunks straight into their buffers
+    file.rdbuf()->pubsetbuf(nullptr, 0);
+    file.open(path, std::ios::binary);
+    file.seekg(0, std::ios::end);
+    uint64_t length = file ? (uint64_t)file.tellg() : 0;
+    file.seekg(0);
+    bool valid = file && length >= sizeof(WorldHeader) &&
+                 file.read((char *)&header, sizeof(header)) &&
+                 std::memcmp(header.magic, WORLD_MAGIC,
+                             sizeof(WORLD_MAGIC)) == 0 &&
+                 header.version == WORLD_VERSION && header.sectorSize > 0.0f &&
+                 header.sectorsX > 0 && header.sectorsZ > 0 &&
+                 (uint64_t)header.sectorsX * header.sectorsZ *
+                         sizeof(WorldSector) <=
+                     length - sizeof(WorldHeader);
+    if (valid) {
+      table.resize(header.sectorsX * header.sectorsZ);
+      valid = (bool)file.read((char *)table.data(),
+                              table.size() * sizeof(WorldSector));
+    }
+    for (size_t i = 0; i < table.size() && valid; i++)
+      valid = table[i].offset <= length &&
+              table[i].bytes <= length - table[i].offset;
+    if (!valid) {
+      std::cout << "ERROR::WORLD::INVALID_FILE: " << path << std::endl;
+      file.close();
+      table.clear();
+      return false;
+    }
+    sectors.resize(table.size());
+    live.reserve(table.size());
+    candidates.reserve(table.size());
+    ready.reserve(table.size());
+    finished.reserve(table.size());
+    queue.reserve(MAX_QUEUED);
+    stopping = false;
+    worker = std::thread([this] { work(); });
+    return true;
+  }
+
+  // Drops every sector without releasing it, the caller's copies stay.
+  void close() {
+    if (worker.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      wake.notify_all();
+      worker.join();
+    }
+    file.close();
+    table.clear();
+    table.shrink_to_fit();
+    sectors.clear();
+    sectors.shrink_to_fit();
+    live.clear();
+    queue.clear();
+    ready.clear();
+    finished.clear();
+    active = NONE;
+    used = 0;
+  }
+
+  bool isOpen() const { return !table.empty(); }
+  uint32_t sectorCount() const { return table.size(); }
+  const WorldHeader &worldHeader() const { return header; }
+  const WorldSector &sector(uint32_t index) const { return table[index]; }
+  SectorState state(uint32_t index) const { return sectors[index].state; }
+
+  // the sector under `position`, NONE outside the grid
+  uint32_t sectorAt(glm::vec3 position) const {
+    float x = (position.x - header.origin[0]) / header.sectorSize;
+    float z = (position.z - header.origin[2]) / header.sectorSize;
+    if (!isOpen() || x < 0.0f || z < 0.0f || x >= header.sectorsX ||
+        z >= header.sectorsZ)
+      return NONE;
+    return (uint32_t)x * header.sectorsZ + (uint32_t)z;
+  }
+
+  // bytes counted against budget.memoryBytes right now
+  size_t usedBytes() const { return used; }
+
+  unsigned int residentSectors() const {
+    unsigned int count = 0;
+    for (uint32_t index : live)
+      count += sectors[index].state == Resident;
+    return count;
+  }
+
+  // sectors between being wanted and being resident
+  unsigned int pendingSectors() const {
+    unsigned int count = 0;
+    for (uint32_t index : live)
+      count += sectors[index].state != Resident &&
+               sectors[index].state != Releasing;
+    return count;
+  }
+
+  // One frame of streaming for a point at `position` moving at `velocity`
+  // per second. Calls commit(sector, instances, count) for decoded
+  // instances and release(sector, count) to take back committed ones, the
+  // last committed first.
+  template <typename Commit, typename Release>
+  void update(glm::vec3 position, glm::vec3 velocity, Commit commit,
+              Release release) {
+    if (!isOpen())
+      return;
+    std::unique_lock<std::mutex> lock(mutex);
+    lastFrame.ioBytes = ioGranted - ioQuota;
+    lastFrame.decodedInstances = decodeGranted - decodeQuota;
+    lastFrame.committedInstances = 0;
+    lastFrame.releasedInstances = 0;
+    for (uint32_t index : finished) {
+      used -= table[index].bytes;
+      sectors[index].state = Ready;
+      ready.push_back(index);
+    }
+    finished.clear();
+    glm::vec3 predicted = position + velocity * lookahead;
+    auto distance = [&](uint32_t index) {
+      return std::min(sectorDistance(index, position),
+                      sectorDistance(index, predicted));
+    };
+
+    // let go of what is out of range of both points
+    for (uint32_t index : live) {
+      Sector &s = sectors[index];
+      s.distance = distance(index);
+      if (s.distance <= unloadRadius)
+        continue;
+      if (s.state == Queued)
+        unqueue(index);
+      else if (s.state == Ready || s.state == Resident)
+        startRelease(index);
+    }
+
+    // the unloaded sectors in range, nearest first
+    candidates.clear();
+    glm::vec3 low = glm::min(position, predicted) - loadRadius;
+    glm::vec3 high = glm::max(position, predicted) + loadRadius;
+    int x0 = std::max(cellX(low.x), 0);
+    int x1 = std::min(cellX(high.x), (int)header.sectorsX - 1);
+    int z0 = std::max(cellZ(low.z), 0);
+    int z1 = std::min(cellZ(high.z), (int)header.sectorsZ - 1);
+    for (int x = x0; x <= x1; x++) {
+      for (int z = z0; z <= z1; z++) {
+        uint32_t index = x * header.sectorsZ + z;
+        Sector &s = sectors[index];
+        if (s.state != Unloaded)
+          continue;
+        s.distance = distance(index);
+        if (s.distance <= loadRadius)
+          candidates.push_back(index);
+      }
+    }
+    auto nearer = [&](uint32_t a, uint32_t b) {
+      return sectors[a].distance < sectors[b].distance;
+    };
+    std::sort(candidates.begin(), candidates.end(), nearer);
+    for (uint32_t index : candidates) {
+      if (queue.size() >= MAX_QUEUED)
+        break;
+      size_t bytes = cost(index);
+      if (used + bytes > budget.memoryBytes) {
+        evictBeyond(sectors[index].distance);
+        break;
+      }
+      used += bytes;
+      sectors[index].state = Queued;
+      queue.push_back(index);
+      live.push_back(index);
+    }
+    // the worker takes the nearest from the back
+    std::sort(queue.begin(), queue.end(),
+              [&](uint32_t a, uint32_t b) { return nearer(b, a); });
+    ioQuota = ioGranted = budget.ioBytes;
+    decodeQuota = decodeGranted = budget.decodeInstances;
+    lock.unlock();
+    wake.notify_all();
+
+    // releases first, they make room for the commits
+    unsigned int upload = budget.uploadInstances;
+    for (uint32_t index : live) {
+      Sector &s = sectors[index];
+      if (s.state != Releasing || upload == 0)
+        continue;
+      unsigned int count = std::min(s.committed, upload);
+      if (count)
+        release(index, count);
+      s.committed -= count;
+      upload -= count;
+      lastFrame.releasedInstances += count;
+      if (s.committed == 0) {
+        used -= table[index].instanceCount * residentBytesPerInstance;
+        s.state = Unloaded;
+      }
+    }
+    std::sort(ready.begin(), ready.end(), nearer);
+    for (uint32_t index : ready) {
+      Sector &s = sectors[index];
+      if (s.state != Ready || upload == 0)
+        continue;
+      unsigned int count =
+          std::min((unsigned int)s.instances.size() - s.committed, upload);
+      if (count)
+        commit(index, s.instances.data() + s.committed, count);
+      s.committed += count;
+      upload -= count;
+      lastFrame.committedInstances += count;
+      if (s.committed == s.instances.size()) {
+        freeDecoded(index);
+        s.state = Resident;
+      }
+    }
+    ready.erase(std::remove_if(ready.begin(), ready.end(),
+                               [&](uint32_t index) {
+                                 return sectors[index].state != Ready;
+                               }),
+                ready.end());
+    live.erase(std::remove_if(live.begin(), live.end(),
+                              [&](uint32_t index) {
+                                return sectors[index].state == Unloaded;
+                              }),
+               live.end());
+  }
+
+  // Waits until the worker has used up this frame's budget or run out of
+  // work, for runs that need the same result whatever the disk's speed.
+  void sync() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return stopping || (!busy && !canWork()); });
+  }
+
+private:
+  struct Sector {
+    SectorState state = Unloaded;
+    float distance = 0.0f;
+    // instances handed to the caller
+    unsigned int committed = 0;
+    // worker progress
+    size_t read = 0;
+    size_t cursor = 0;
+    unsigned int decoded = 0;
+    std::vector<uint8_t> data;
+    std::vector<SceneInstance> instances;
+  };
+
+  std::ifstream file;
+  WorldHeader header = {};
+  std::vector<WorldSector> table;
+  std::vector<Sector> sectors;
+  // every sector that is not Unloaded
+  std::vector<uint32_t> live;
+  std::vector<uint32_t> candidates;
+  std::vector<uint32_t> ready;
+  size_t used = 0;
+
+  // shared with the worker
+  std::thread worker;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable idle;
+  std::vector<uint32_t> queue;
+  std::vector<uint32_t> finished;
+  uint32_t active = NONE;
+  size_t ioQuota = 0;
+  size_t ioGranted = 0;
+  unsigned int decodeQuota = 0;
+  unsigned int decodeGranted = 0;
+  // the worker is between taking a quota and handing back its work
+  bool busy = false;
+  bool stopping = false;
+
+  int cellX(float x) const {
+    return (int)std::floor((x - header.origin[0]) / header.sectorSize);
+  }
+  int cellZ(float z) const {
+    return (int)std::floor((z - header.origin[2]) / header.sectorSize);
+  }
+
+  glm::vec3 sectorMin(uint32_t index) const {
+    return glm::vec3(
+        header.origin[0] + index / header.sectorsZ * header.sectorSize,
+        header.origin[1],
+        header.origin[2] + index % header.sectorsZ * header.sectorSize);
+  }
+
+  // from `point` to the sector's square on the xz plane
+  float sectorDistance(uint32_t index, glm::vec3 point) const {
+    glm::vec3 low = sectorMin(index);
+    float dx = std::max(std::max(low.x - point.x, 0.0f),
+                        point.x - (low.x + header.sectorSize));
+    float dz = std::max(std::max(low.z - point.z, 0.0f),
+                        point.z - (low.z + header.sectorSize));
+    return std::sqrt(dx * dx + dz * dz);
+  }
+
+  size_t cost(uint32_t index) const {
+    const WorldSector &s = table[index];
+    return s.bytes + s.instanceCount * (sizeof(SceneInstance) +
+                                        residentBytesPerInstance);
+  }
+
+  // these run with the mutex held
+  void unqueue(uint32_t index) {
+    auto it = std::find(queue.begin(), queue.end(), index);
+    if (it == queue.end())
+      return; // the worker took it meanwhile
+    queue.erase(it);
+    used -= cost(index);
+    sectors[index].state = Unloaded;
+  }
+
+  void startRelease(uint32_t index) {
+    freeDecoded(index);
+    sectors[index].state = Releasing;
+  }
+
+  void freeDecoded(uint32_t index) {
+    Sector &s = sectors[index];
+    if (s.instances.empty() && s.state != Ready)
+      return;
+    used -= table[index].instanceCount * sizeof(SceneInstance);
+    std::vector<SceneInstance>().swap(s.instances);
+  }
+
+  // makes room by releasing the farthest loaded sector beyond `distance`
+  void evictBeyond(float distance) {
+    uint32_t farthest = NONE;
+    for (uint32_t index : live) {
+      const Sector &s = sectors[index];
+      if ((s.state == Ready || s.state == Resident) && s.distance > distance &&
+          (farthest == NONE || s.distance > sectors[farthest].distance))
+        farthest = index;
+    }
+    if (farthest != NONE)
+      startRelease(farthest);
+  }
+
+  // with the mutex held
+  bool canWork() const {
+    if (active == NONE)
+      return !queue.empty() && ioQuota > 0;
+    const Sector &s = sectors[active];
+    return s.read < table[active].bytes ? ioQuota > 0 : decodeQuota > 0;
+  }
+
+  void work() {
+    MemoryTagScope tag(MemoryTag::Streaming);
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      busy = false;
+      if (!canWork())
+        idle.notify_all();
+      wake.wait(lock, [this] { return stopping || canWork(); });
+      if (stopping)
+        return;
+      busy = true;
+      if (active == NONE) {
+        active = queue.back();
+        queue.pop_back();
+      }
+      uint32_t index = active;
+      Sector &s = sectors[index];
+      const WorldSector &entry = table[index];
+      if (s.read < entry.bytes) {
+        size_t count = std::min(entry.bytes - s.read, ioQuota);
+        ioQuota -= count;
+        lock.unlock();
+        s.data.resize(entry.bytes);
+        file.seekg(entry.offset + s.read);
+        if (!file.read((char *)s.data.data() + s.read, count)) {
+          std::cout << "ERROR::WORLD::READ_FAILED: sector " << index
+                    << std::endl;
+          file.clear();
+          s.data.clear();
+          count = entry.bytes - s.read;
+        }
+        lock.lock();
+        s.read += count;
+        continue;
+      }
+
+      unsigned int count =
+          std::min(entry.instanceCount - s.decoded, decodeQuota);
+      decodeQuota -= count;
+      lock.unlock();
+      decode(index, count);
+      lock.lock();
+      if (s.decoded == entry.instanceCount) {
+        std::vector<uint8_t>().swap(s.data);
+        s.read = s.cursor = s.decoded = 0;
+        finished.push_back(index);
+        active = NONE;
+      }
+    }
+  }
+
+  // decodes the sector's next `count` instances, without the mutex
+  void decode(uint32_t index, unsigned int count) {
+    Sector &s = sectors[index];
+    const WorldSector &entry = table[index];
+    s.instances.resize(entry.instanceCount);
+    glm::vec3 low = sectorMin(index);
+    glm::vec3 size(header.sectorSize, header.height, header.sectorSize);
+    const uint8_t *at = s.data.data() + s.cursor;
+    const uint8_t *end = s.data.data() + s.data.size();
+    for (unsigned int i = 0; i < count; i++, s.decoded++) {
+      if (!decodeWorldInstance(at, end, low, size, s.instances[s.decoded])) {
+        std::cout << "ERROR::WORLD::BAD_SECTOR: " << index << std::endl;
+        s.instances.resize(s.decoded);
+        s.decoded = entry.instanceCount;
+        return;
+      }
+    }
+    s.cursor = at - s.data.data();
+  }
+};
+
+#endif
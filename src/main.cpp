@@ -7,8 +7,41 @@
 #include "glm/ext/matrix_clip_space.hpp"
 #include "glm/ext/matrix_transform.hpp"
 #include "glm/trigonometric.hpp"
+#include "utils/benchmark.hpp"
+#include "utils/bindless.hpp"
 #include "utils/camera.hpp"
+#include "utils/clusters.hpp"
+#include "utils/cpu_features.hpp"
+#include "utils/entities.hpp"
+#include "utils/frame_arena.hpp"
+#include "utils/frustum.hpp"
+#include "utils/gbuffer.hpp"
+#include "utils/hiz.hpp"
+#include "utils/lights.hpp"
+#include "utils/materials.hpp"
+#define MEMORY_TRACKER_IMPLEMENTATION
+#include "utils/memory_tracker.hpp"
+#include "utils/mesh_import.hpp"
+#include "utils/mesh_lod.hpp"
+#include "utils/meshlets.hpp"
+#include "utils/occlusion.hpp"
+#include "utils/profiler.hpp"
+#include "utils/pvs.hpp"
+#include "utils/scene_file.hpp"
+#include "utils/scene_graph.hpp"
 #include "utils/shader.hpp"
+#include "utils/shader_cache.hpp"
+#include "utils/shadows.hpp"
+#include "utils/software_occlusion.hpp"
+#include "utils/texture_arrays.hpp"
+#include "utils/texture_streaming.hpp"
+#include "utils/thread_pool.hpp"
+#include "utils/transforms.hpp"
+#include "utils/world_streaming.hpp"
+// decoded images are attributed to the Textures tag
+#define STBI_MALLOC(size) MemoryTracker::allocate(size, MemoryTag::Textures)
+#define STBI_REALLOC(p, size) MemoryTracker::reallocate(p, size)
+#define STBI_FREE(p) MemoryTracker::release(p)
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #include <glm/glm.hpp>
@@ -17,7 +50,16 @@
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
 #include <iostream>
+#include <numeric>
+#include <random>
+#include <vector>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
 
 // Global Variables
 bool debugWindow = false;
@@ -26,10 +68,13 @@ float debugWindowShowTime = 0.0f;
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
+glm::vec2 framebufferSize(WIDTH, HEIGHT);
+
 Camera camera;
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
   glViewport(0, 0, width, height);
+  framebufferSize = glm::vec2(width, height);
 }
 
 void handleMovement(GLFWwindow *window) {
@@ -86,7 +131,8 @@ void scroll_callback(GLFWwindow *window, double xoffset, double yoffset) {
 
 GLFWwindow *initalizeWindowContext() {
   glfwInit();
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  // 4.3 for shader storage buffers and compute shaders
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
@@ -115,81 +161,1949 @@ GLFWwindow *initalizeWindowContext() {
   return window;
 };
 
-unsigned int setupTexture(const char *path) {
-  stbi_set_flip_vertically_on_load(true);
-  unsigned int texture;
-  glGenTextures(1, &texture);
-  glBindTexture(GL_TEXTURE_2D, texture);
-
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                  GL_LINEAR_MIPMAP_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-  int width, height, nrChannels;
-  unsigned char *data = stbi_load(path, &width, &height, &nrChannels, 0);
-  if (data) {
-    GLenum type;
-    if (nrChannels == 1)
-      type = GL_RED;
-    else if (nrChannels == 3)
-      type = GL_RGB;
-    else if (nrChannels == 4)
-      type = GL_RGBA;
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, type,
-                 GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-  } else {
-    std::cout << "Failed to load texture" << std::endl;
+// Times building model matrices for 1k, 100k and 1M objects with the
+// per-object glm calls the scene used to make against the TransformArray
+// kernels (which also build the normal matrix), and records how far the
+// kernel results are from glm.
+void benchmarkTransforms(Benchmark &benchmark) {
+  struct Instance {
+    glm::mat4 model;
+    glm::vec4 normal[3];
+  };
+  const unsigned int counts[] = {1000, 100000, 1000000};
+  for (unsigned int count : counts) {
+    std::vector<glm::vec3> positions(count), axes(count), scales(count);
+    std::vector<float> angles(count);
+    TransformArray transforms;
+    transforms.reserve(count);
+    for (unsigned int i = 0; i < count; i++) {
+      positions[i] = glm::vec3(i % 100, (i / 100) % 100, i / 10000);
+      axes[i] = glm::normalize(glm::vec3(1.0f, 0.3f + i % 7, 0.5f));
+      angles[i] = glm::radians(float(i % 360));
+      scales[i] = glm::vec3(1.0f + i % 3, 1.0f, 0.5f + i % 5);
+      transforms.add(positions[i], glm::angleAxis(angles[i], axes[i]),
+                     scales[i]);
+    }
+    std::vector<Instance> reference(count), output(count);
+    // enough repetitions that every size runs for a comparable time
+    unsigned int repetitions = 10000000 / count;
+    std::string prefix = std::to_string(count) + " objects ";
+
+    auto start = BenchmarkClock::now();
+    for (unsigned int r = 0; r < repetitions; r++) {
+      for (unsigned int i = 0; i < count; i++) {
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), positions[i]);
+        model = glm::rotate(model, angles[i], axes[i]);
+        reference[i].model = glm::scale(model, scales[i]);
+      }
+    }
+    benchmark.record(prefix + "glm", millisecondsSince(start) / repetitions,
+                     "ms");
+
+    for (TransformKernel kernel : {TransformKernel::Scalar,
+                                   TransformKernel::Sse,
+                                   TransformKernel::Avx2}) {
+      if (kernel > TransformArray::bestKernel())
+        continue;
+      transforms.kernel = kernel;
+      start = BenchmarkClock::now();
+      for (unsigned int r = 0; r < repetitions; r++)
+        transforms.compute(0, count, &output[0].model, output[0].normal,
+                           sizeof(Instance));
+      benchmark.record(prefix + TransformArray::kernelName(kernel),
+                       millisecondsSince(start) / repetitions, "ms");
+    }
+
+    float maxError = 0.0f;
+    for (unsigned int i = 0; i < count; i++)
+      for (int c = 0; c < 4; c++)
+        for (int row = 0; row < 4; row++)
+          maxError = glm::max(maxError, std::abs(output[i].model[c][row] -
+                                                 reference[i].model[c][row]));
+    benchmark.record(prefix + "max error vs glm", maxError, "abs");
+  }
+}
+
+struct MathResult {
+  const char *operation;
+  std::vector<float> values;
+};
+
+// Runs the glm operations the renderer leans on with qualifier Q over
+// `count` inputs, `repetitions` times. Records the time per pass as
+// "<operation> <mode>" and appends every result component to `results` so
+// the scalar and SIMD runs can be compared.
+template <glm::qualifier Q>
+void benchmarkMathMode(Benchmark &benchmark, const char *mode,
+                       unsigned int count, unsigned int repetitions,
+                       std::vector<MathResult> &results) {
+  using Vec3 = glm::vec<3, float, Q>;
+  using Vec4 = glm::vec<4, float, Q>;
+  using Mat4 = glm::mat<4, 4, float, Q>;
+  // well conditioned TRS matrices and vectors, the same in every mode
+  std::vector<Mat4> matrices(count);
+  std::vector<Vec4> vectors(count);
+  for (unsigned int i = 0; i < count; i++) {
+    Vec3 axis = glm::normalize(Vec3(1.0f, 0.3f + i % 7, 0.5f));
+    Mat4 model = glm::translate(Mat4(1.0f), Vec3(i % 10, i % 3, -(i % 5)));
+    model = glm::rotate(model, glm::radians(float(i % 360)), axis);
+    matrices[i] = glm::scale(model, Vec3(0.5f + i % 4, 1.0f, 2.0f));
+    vectors[i] = Vec4(i % 11 - 5.0f, i % 3 + 0.5f, i % 7 - 3.0f, 1.0f);
+  }
+
+  auto run = [&](const char *name, size_t components, auto operation) {
+    std::vector<float> out(count * components);
+    auto start = BenchmarkClock::now();
+    for (unsigned int r = 0; r < repetitions; r++)
+      for (unsigned int i = 0; i < count; i++)
+        operation(i, &out[i * components]);
+    benchmark.record(std::string(name) + " " + mode,
+                     millisecondsSince(start) / repetitions, "ms");
+    results.push_back({name, std::move(out)});
+  };
+  auto store = [](float *out, const float *value, size_t components) {
+    std::memcpy(out, value, components * sizeof(float));
+  };
+
+  run("mat4 * mat4", 16, [&](unsigned int i, float *out) {
+    Mat4 m = matrices[i] * matrices[(i + 1) % count];
+    store(out, glm::value_ptr(m), 16);
+  });
+  run("mat4 * vec4", 4, [&](unsigned int i, float *out) {
+    Vec4 v = matrices[i] * vectors[i];
+    store(out, glm::value_ptr(v), 4);
+  });
+  run("inverse", 16, [&](unsigned int i, float *out) {
+    Mat4 m = glm::inverse(matrices[i]);
+    store(out, glm::value_ptr(m), 16);
+  });
+  run("transpose", 16, [&](unsigned int i, float *out) {
+    Mat4 m = glm::transpose(matrices[i]);
+    store(out, glm::value_ptr(m), 16);
+  });
+  run("normalize vec3", 3, [&](unsigned int i, float *out) {
+    Vec3 v = glm::normalize(Vec3(vectors[i]));
+    store(out, glm::value_ptr(v), 3);
+  });
+  run("normalize vec4", 4, [&](unsigned int i, float *out) {
+    Vec4 v = glm::normalize(vectors[i]);
+    store(out, glm::value_ptr(v), 4);
+  });
+  run("dot", 1, [&](unsigned int i, float *out) {
+    *out = glm::dot(vectors[i], vectors[(i + 1) % count]);
+  });
+  run("cross", 3, [&](unsigned int i, float *out) {
+    Vec3 v = glm::cross(Vec3(vectors[i]), Vec3(vectors[(i + 1) % count]));
+    store(out, glm::value_ptr(v), 3);
+  });
+  run("lookAt", 16, [&](unsigned int i, float *out) {
+    Mat4 m = glm::lookAt(Vec3(vectors[i]) + Vec3(0.0f, 0.0f, 10.0f),
+                         Vec3(0.0f), Vec3(0.0f, 1.0f, 0.0f));
+    store(out, glm::value_ptr(m), 16);
+  });
+}
+
+// Times glm on its packed types, which always run the scalar code, and on
+// its aligned types, which run the SSE code in LEARNOPENGL_GLM_SIMD builds
+// (GLM_FORCE_INTRINSICS). Both must agree to within a small relative error;
+// returns false otherwise.
+bool benchmarkMath(Benchmark &benchmark) {
+  const unsigned int count = 10000, repetitions = 200;
+  benchmark.record("glm simd", GLM_CONFIG_SIMD == GLM_ENABLE, "bool");
+  std::vector<MathResult> scalar;
+  benchmarkMathMode<glm::packed_highp>(benchmark, "scalar", count,
+                                       repetitions, scalar);
+#if GLM_CONFIG_ALIGNED_GENTYPES == GLM_ENABLE
+  std::vector<MathResult> simd;
+  benchmarkMathMode<glm::aligned_highp>(benchmark, "simd", count, repetitions,
+                                        simd);
+  // SIMD paths may sum in a different order, errors are relative to the
+  // magnitude of the result (or 1 near zero). glm normalizes aligned vec4s
+  // with _mm_rsqrt_ps, which is only good to about 12 bits; the renderer
+  // only normalizes vec3s, which stay on the exact path.
+  const float tolerance = 1e-5f, rsqrtTolerance = 4e-4f;
+  bool exact = true;
+  for (size_t op = 0; op < scalar.size(); op++) {
+    const std::vector<float> &expected = scalar[op].values;
+    float maxError = 0.0f;
+    for (size_t i = 0; i < expected.size(); i++) {
+      float error = std::abs(expected[i] - simd[op].values[i]) /
+                    glm::max(1.0f, std::abs(expected[i]));
+      maxError = glm::max(maxError, error);
+    }
+    std::string name = scalar[op].operation;
+    benchmark.record(name + " max error", maxError, "relative");
+    if (maxError > (name == "normalize vec4" ? rsqrtTolerance : tolerance)) {
+      std::cout << "ERROR::BENCHMARK::GLM_SIMD_MISMATCH: " << name
+                << " off by " << maxError << std::endl;
+      exact = false;
+    }
+  }
+  return exact;
+#else
+  std::cout << "glm SIMD is disabled, configure with -DLEARNOPENGL_GLM_SIMD=ON "
+               "to compare against it"
+            << std::endl;
+  return true;
+#endif
+}
+
+// World space bounding sphere (xyz center, w radius) of an entity's local
+// bounds, the radius grows with the largest axis scale.
+glm::vec4 worldSphere(const glm::mat4 &model, const Bounds &bounds) {
+  glm::vec3 center = glm::vec3(model * glm::vec4(bounds.center, 1.0f));
+  float scale = glm::max(glm::max(glm::dot(model[0], model[0]),
+                                  glm::dot(model[1], model[1])),
+                         glm::dot(model[2], model[2]));
+  return glm::vec4(center, bounds.radius * std::sqrt(scale));
+}
+
+// Times creating 1M renderable entities, the transform and culling systems
+// over them, and destroying half of them in random order and creating them
+// again. Returns false if a handle or a component ended up wrong.
+bool benchmarkEntities(Benchmark &benchmark) {
+  struct Instance {
+    glm::mat4 model;
+    glm::vec4 normal[3];
+  };
+  const unsigned int count = 1000000, repetitions = 10;
+  const unsigned int renderable =
+      HasTransform | HasBounds | HasMesh | HasMaterial;
+  auto positionOf = [](unsigned int i) {
+    return glm::vec3(i % 100, (i / 100) % 100, i / 10000);
+  };
+  EntityStore store;
+  std::vector<Entity> entities(count);
+  auto create = [&](unsigned int i) {
+    Entity entity = store.create(renderable);
+    store.setTransform(entity, positionOf(i),
+                       glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+    store.bounds(entity) = {glm::vec3(0.0f), 0.87f};
+    store.mesh(entity) = {0, 36};
+    store.material(entity) = i % 3;
+    entities[i] = entity;
+  };
+
+  auto start = BenchmarkClock::now();
+  for (unsigned int i = 0; i < count; i++)
+    create(i);
+  benchmark.record("create", millisecondsSince(start), "ms");
+
+  std::vector<Instance> instances(count);
+  start = BenchmarkClock::now();
+  for (unsigned int r = 0; r < repetitions; r++) {
+    unsigned int first = 0;
+    store.each(renderable, [&](Archetype &archetype) {
+      archetype.transforms.compute(0, archetype.size(),
+                                   &instances[first].model,
+                                   instances[first].normal, sizeof(Instance));
+      first += archetype.size();
+    });
+  }
+  benchmark.record("transform system", millisecondsSince(start) / repetitions,
+                   "ms");
+
+  // looking into the middle of the 100x100x100 block
+  Frustum frustum(glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f,
+                                   100.0f) *
+                  glm::lookAt(glm::vec3(50.0f, 50.0f, -20.0f),
+                              glm::vec3(50.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+  unsigned int visible = 0;
+  start = BenchmarkClock::now();
+  for (unsigned int r = 0; r < repetitions; r++) {
+    unsigned int instance = 0;
+    visible = 0;
+    store.each(renderable, [&](Archetype &archetype) {
+      for (unsigned int i = 0; i < archetype.size(); i++, instance++) {
+        glm::vec4 sphere =
+            worldSphere(instances[instance].model, archetype.bounds[i]);
+        visible += frustum.sphereVisible(glm::vec3(sphere), sphere.w);
+      }
+    });
+  }
+  benchmark.record("culling system", millisecondsSince(start) / repetitions,
+                   "ms");
+  benchmark.record("visible", visible, "count");
+
+  std::vector<unsigned int> order(count);
+  std::iota(order.begin(), order.end(), 0);
+  std::shuffle(order.begin(), order.end(), std::mt19937(1337));
+  std::vector<Entity> destroyed(count / 2);
+  start = BenchmarkClock::now();
+  for (unsigned int k = 0; k < count / 2; k++) {
+    destroyed[k] = entities[order[k]];
+    store.destroy(destroyed[k]);
+  }
+  benchmark.record("destroy half", millisecondsSince(start), "ms");
+
+  start = BenchmarkClock::now();
+  for (unsigned int k = 0; k < count / 2; k++)
+    create(order[k]);
+  benchmark.record("recreate half", millisecondsSince(start), "ms");
+
+  // every slot was reused, so this catches generations that did not move
+  bool valid = store.size() == count;
+  for (const Entity &entity : destroyed)
+    valid = valid && !store.valid(entity);
+  for (unsigned int i = 0; i < count && valid; i++)
+    valid = store.valid(entities[i]) &&
+            store.position(entities[i]) == positionOf(i) &&
+            store.material(entities[i]) == i % 3;
+  benchmark.record("handles valid", valid, "bool");
+  if (!valid)
+    std::cout << "ERROR::BENCHMARK::ENTITY_HANDLES_BROKEN" << std::endl;
+  return valid;
+}
+
+// Times SceneGraph updates of a deep hierarchy (100 chains of 10000 nodes)
+// and a wide one (10 roots with 99999 children each), serially and on the
+// thread pool: everything dirty, nothing dirty, one root moved and one leaf
+// moved. World matrices are then compared against a reference built by
+// walking the parents; returns false if any differs.
+bool benchmarkHierarchy(Benchmark &benchmark, ThreadPool &pool) {
+  struct Shape {
+    const char *name;
+    unsigned int roots;
+    unsigned int chains;
+    unsigned int depth;
+  };
+  // every root has `chains` chains of `depth` nodes below it
+  const Shape shapes[] = {{"deep", 100, 1, 10000}, {"wide", 10, 99999, 1}};
+  const unsigned int repetitions = 10;
+  benchmark.record("threads", pool.threadCount(), "count");
+  bool exact = true;
+  for (const Shape &shape : shapes) {
+    for (ThreadPool *threads : {(ThreadPool *)nullptr, &pool}) {
+      std::string prefix = std::string(shape.name) +
+                           (threads ? " parallel " : " serial ");
+      SceneGraph graph;
+      std::vector<unsigned int> roots;
+      unsigned int leaf = 0;
+      glm::quat twist = glm::angleAxis(0.01f, glm::vec3(0.0f, 1.0f, 0.0f));
+      for (unsigned int r = 0; r < shape.roots; r++) {
+        roots.push_back(graph.add(SceneGraph::NONE,
+                                  glm::vec3(r * 10.0f, 0.0f, 0.0f),
+                                  glm::quat(1.0f, 0.0f, 0.0f, 0.0f)));
+        for (unsigned int c = 0; c < shape.chains; c++) {
+          unsigned int parent = roots.back();
+          for (unsigned int d = 0; d < shape.depth; d++)
+            parent = leaf = graph.add(parent, glm::vec3(0.0f, 0.01f, 0.0f),
+                                      twist, glm::vec3(0.9999f));
+        }
+      }
+      auto start = BenchmarkClock::now();
+      graph.update(threads);
+      benchmark.record(prefix + "sort and update", millisecondsSince(start),
+                       "ms");
+
+      double full = 0.0, clean = 0.0, root = 0.0, single = 0.0;
+      for (unsigned int r = 0; r < repetitions; r++) {
+        glm::vec3 offset(0.0f, r * 0.1f, 0.0f);
+        for (unsigned int i = 0; i < roots.size(); i++)
+          graph.setPosition(roots[i], glm::vec3(i * 10.0f, 0.0f, 0.0f) +
+                                          offset);
+        start = BenchmarkClock::now();
+        graph.update(threads);
+        full += millisecondsSince(start);
+
+        start = BenchmarkClock::now();
+        graph.update(threads);
+        clean += millisecondsSince(start);
+
+        graph.setRotation(roots[0], glm::angleAxis(r * 0.1f, glm::vec3(1.0f)));
+        start = BenchmarkClock::now();
+        graph.update(threads);
+        root += millisecondsSince(start);
+
+        graph.setPosition(leaf, glm::vec3(0.0f, 0.01f * r, 0.0f));
+        start = BenchmarkClock::now();
+        graph.update(threads);
+        single += millisecondsSince(start);
+      }
+      benchmark.record(prefix + "all dirty", full / repetitions, "ms");
+      benchmark.record(prefix + "none dirty", clean / repetitions, "ms");
+      benchmark.record(prefix + "root moved", root / repetitions, "ms");
+      benchmark.record(prefix + "leaf moved", single / repetitions, "ms");
+
+      // ids were handed out parents first
+      std::vector<glm::mat4> reference(graph.size());
+      float maxError = 0.0f;
+      for (unsigned int id = 0; id < graph.size(); id++) {
+        glm::mat4 local = SceneGraph::compose(
+            graph.position(id), graph.rotation(id), graph.scale(id));
+        unsigned int parent = graph.parent(id);
+        reference[id] =
+            parent == SceneGraph::NONE ? local : reference[parent] * local;
+        for (int c = 0; c < 4; c++)
+          for (int row = 0; row < 4; row++)
+            maxError = glm::max(maxError, std::abs(graph.world(id)[c][row] -
+                                                   reference[id][c][row]));
+      }
+      benchmark.record(prefix + "max error", maxError, "abs");
+      if (maxError > 0.0f) {
+        std::cout << "ERROR::BENCHMARK::HIERARCHY_MISMATCH: " << prefix
+                  << "off by " << maxError << std::endl;
+        exact = false;
+      }
+    }
+  }
+  return exact;
+}
+
+// page faults of the process so far, 0 where getrusage is missing
+long pageFaults() {
+#ifndef _WIN32
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_minflt + usage.ru_majflt;
+#else
+  return 0;
+#endif
+}
+
+// Writes a scene with 1M instances, then times mapping it, reading 1000
+// instances from its middle and reading all of it, with the page faults
+// each step caused. Returns false if the instances read back differ from
+// the written ones.
+bool benchmarkSceneFile(Benchmark &benchmark) {
+  const unsigned int count = 1000000;
+  const char *path = "benchmark.scene";
+  auto positionOf = [](unsigned int i) {
+    return glm::vec3(i % 100, (i / 100) % 100, i / 10000);
+  };
+
+  SceneWriter writer;
+  writer.vertices.resize(24, SceneVertex());
+  writer.indices.resize(36, 0);
+  writer.meshes.push_back(
+      {0, 24, 0, 36, {0.0f, 0.0f, 0.0f}, 0.87f, 0, 0, 0, 0});
+  writer.materials.push_back({writer.addString("Grid"),
+                              SCENE_NONE,
+                              SCENE_NONE,
+                              {1.0f, 1.0f, 1.0f},
+                              {1.0f, 1.0f, 1.0f},
+                              32.0f});
+  writer.instances.resize(count);
+  for (unsigned int i = 0; i < count; i++) {
+    glm::vec3 position = positionOf(i);
+    writer.instances[i] = {{position.x, position.y, position.z},
+                           {0.0f, 0.0f, 0.0f, 1.0f},
+                           {1.0f, 1.0f, 1.0f},
+                           0,
+                           0};
+  }
+  auto start = BenchmarkClock::now();
+  if (!writer.write(path))
+    return false;
+  benchmark.record("write", millisecondsSince(start), "ms");
+
+  SceneFile file;
+  long faults = pageFaults();
+  start = BenchmarkClock::now();
+  if (!file.open(path))
+    return false;
+  benchmark.record("open", millisecondsSince(start), "ms");
+  benchmark.record("open page faults", pageFaults() - faults, "count");
+  benchmark.record("file size", file.size() / (1024.0 * 1024.0), "MB");
+
+  SceneSpan<SceneInstance> instances = file.instances();
+  bool valid = instances.count == count;
+  auto readRange = [&](unsigned int begin, unsigned int end) {
+    for (unsigned int i = begin; i < end && valid; i++)
+      valid = glm::make_vec3(instances[i].position) == positionOf(i) &&
+              instances[i].mesh == 0 && instances[i].material == 0;
+  };
+  faults = pageFaults();
+  start = BenchmarkClock::now();
+  readRange(count / 2, count / 2 + 1000);
+  benchmark.record("read 1000 instances", millisecondsSince(start), "ms");
+  benchmark.record("read 1000 page faults", pageFaults() - faults, "count");
+
+  faults = pageFaults();
+  start = BenchmarkClock::now();
+  readRange(0, count);
+  benchmark.record("read all instances", millisecondsSince(start), "ms");
+  benchmark.record("read all page faults", pageFaults() - faults, "count");
+
+  valid = valid && std::strcmp(file.string(file.materials()[0].name),
+                               "Grid") == 0;
+  benchmark.record("instances valid", valid, "bool");
+  if (!valid)
+    std::cout << "ERROR::BENCHMARK::SCENE_MISMATCH" << std::endl;
+  file.close();
+  std::remove(path);
+  return valid;
+}
+
+// Imports `path` with and without the thread pool and records throughput,
+// stage timings and vertex cache efficiency. Without a path the same flat
+// grid of GRID x GRID quads (2M triangles) is written as an OBJ and as a
+// glTF and both are imported. Returns false if an import fails, if the
+// serial and parallel imports differ or if a grid comes back wrong.
+bool benchmarkImport(Benchmark &benchmark, ThreadPool &pool,
+                     const char *path) {
+  benchmark.record("threads", pool.threadCount(), "count");
+  auto import = [&](const std::string &file, const std::string &prefix,
+                    ImportedMesh &mesh) {
+    ImportedMesh serial;
+    MeshImporter serialImporter;
+    auto start = BenchmarkClock::now();
+    if (!serialImporter.load(file, serial))
+      return false;
+    double serialMs = millisecondsSince(start);
+
+    MeshImporter importer(&pool);
+    start = BenchmarkClock::now();
+    if (!importer.load(file, mesh))
+      return false;
+    double parallelMs = millisecondsSince(start);
+    const ImportStats &stats = importer.stats;
+    double megabytes = stats.bytes / (1024.0 * 1024.0);
+    benchmark.record(prefix + "file size", megabytes, "MB");
+    benchmark.record(prefix + "triangles", stats.triangles, "count");
+    benchmark.record(prefix + "vertices", mesh.vertices.size(), "count");
+    benchmark.record(prefix + "serial import", serialMs, "ms");
+    benchmark.record(prefix + "parallel import", parallelMs, "ms");
+    benchmark.record(prefix + "throughput", megabytes / parallelMs * 1000.0,
+                     "MB/s");
+    benchmark.record(prefix + "triangle rate",
+                     stats.triangles / parallelMs / 1000.0, "Mtriangles/s");
+    benchmark.record(prefix + "parse", stats.parseMs, "ms");
+    benchmark.record(prefix + "weld", stats.weldMs, "ms");
+    benchmark.record(prefix + "normals and tangents", stats.tangentMs, "ms");
+    benchmark.record(prefix + "cache optimization", stats.optimizeMs, "ms");
+    benchmark.record(prefix + "ACMR before", stats.acmrBefore, "ratio");
+    benchmark.record(prefix + "ACMR after", stats.acmrAfter, "ratio");
+
+    bool same =
+        serial.vertices.size() == mesh.vertices.size() &&
+        serial.indices == mesh.indices &&
+        std::memcmp(serial.vertices.data(), mesh.vertices.data(),
+                    mesh.vertices.size() * sizeof(SceneVertex)) == 0;
+    benchmark.record(prefix + "parallel matches serial", same, "bool");
+    if (!same)
+      std::cout << "ERROR::BENCHMARK::IMPORT_MISMATCH: " << file << std::endl;
+    return same;
+  };
+  if (path) {
+    ImportedMesh mesh;
+    return import(path, "", mesh);
+  }
+
+  const unsigned int GRID = 1024;
+  const unsigned int side = GRID + 1;
+  const char *objPath = "benchmark_import.obj";
+  const char *gltfPath = "benchmark_import.gltf";
+  const char *binPath = "benchmark_import.bin";
+  auto start = BenchmarkClock::now();
+  // x and z on a quarter unit grid, uv in 1/GRID steps: all exact in both
+  // decimal and binary, so both files hold the same floats
+  FILE *obj = std::fopen(objPath, "w");
+  if (!obj)
+    return false;
+  std::fprintf(obj, "# %u x %u quad grid\n", GRID, GRID);
+  for (unsigned int z = 0; z < side; z++)
+    for (unsigned int x = 0; x < side; x++)
+      std::fprintf(obj, "v %g 0 %g\n", x * 0.25f, z * 0.25f);
+  for (unsigned int z = 0; z < side; z++)
+    for (unsigned int x = 0; x < side; x++)
+      std::fprintf(obj, "vt %.10g %.10g\n", (double)x / GRID,
+                   (double)z / GRID);
+  std::fprintf(obj, "vn 0 1 0\n");
+  for (unsigned int z = 0; z < GRID; z++) {
+    for (unsigned int x = 0; x < GRID; x++) {
+      unsigned int v = z * side + x + 1;
+      std::fprintf(obj, "f %u/%u/1 %u/%u/1 %u/%u/1 %u/%u/1\n", v, v,
+                   v + side, v + side, v + side + 1, v + side + 1, v + 1,
+                   v + 1);
+    }
+  }
+  bool written = std::fclose(obj) == 0;
+
+  std::vector<float> attributes;
+  for (unsigned int z = 0; z < side; z++)
+    for (unsigned int x = 0; x < side; x++)
+      attributes.insert(attributes.end(), {x * 0.25f, 0.0f, z * 0.25f});
+  for (unsigned int i = 0; i < side * side; i++)
+    attributes.insert(attributes.end(), {0.0f, 1.0f, 0.0f});
+  for (unsigned int z = 0; z < side; z++)
+    for (unsigned int x = 0; x < side; x++)
+      attributes.insert(attributes.end(),
+                        {(float)x / GRID, (float)z / GRID});
+  std::vector<uint32_t> indices;
+  for (unsigned int z = 0; z < GRID; z++) {
+    for (unsigned int x = 0; x < GRID; x++) {
+      uint32_t v = z * side + x;
+      indices.insert(indices.end(), {v, v + side, v + side + 1,
+                                     v + side + 1, v + 1, v});
+    }
+  }
+  size_t vertexCount = side * side;
+  size_t positionBytes = vertexCount * 3 * sizeof(float);
+  size_t attributeBytes = attributes.size() * sizeof(float);
+  size_t indexBytes = indices.size() * sizeof(uint32_t);
+  FILE *bin = std::fopen(binPath, "wb");
+  FILE *gltf = std::fopen(gltfPath, "w");
+  written = written && bin && gltf &&
+            std::fwrite(attributes.data(), 1, attributeBytes, bin) ==
+                attributeBytes &&
+            std::fwrite(indices.data(), 1, indexBytes, bin) == indexBytes;
+  if (gltf)
+    std::fprintf(
+        gltf,
+        "{\"asset\": {\"version\": \"2.0\"},\n"
+        " \"buffers\": [{\"uri\": \"%s\", \"byteLength\": %zu}],\n"
+        " \"bufferViews\": [\n"
+        "  {\"buffer\": 0, \"byteOffset\": 0, \"byteLength\": %zu},\n"
+        "  {\"buffer\": 0, \"byteOffset\": %zu, \"byteLength\": %zu}],\n"
+        " \"accessors\": [\n"
+        "  {\"bufferView\": 0, \"componentType\": 5126, \"count\": %zu, "
+        "\"type\": \"VEC3\"},\n"
+        "  {\"bufferView\": 0, \"byteOffset\": %zu, \"componentType\": "
+        "5126, \"count\": %zu, \"type\": \"VEC3\"},\n"
+        "  {\"bufferView\": 0, \"byteOffset\": %zu, \"componentType\": "
+        "5126, \"count\": %zu, \"type\": \"VEC2\"},\n"
+        "  {\"bufferView\": 1, \"componentType\": 5125, \"count\": %zu, "
+        "\"type\": \"SCALAR\"}],\n"
+        " \"meshes\": [{\"primitives\": [{\"attributes\": "
+        "{\"POSITION\": 0, \"NORMAL\": 1, \"TEXCOORD_0\": 2}, "
+        "\"indices\": 3}]}]}\n",
+        binPath, attributeBytes + indexBytes, attributeBytes, attributeBytes,
+        indexBytes, vertexCount, positionBytes, vertexCount,
+        positionBytes * 2, vertexCount, indices.size());
+  written = (bin && std::fclose(bin) == 0) && written;
+  written = (gltf && std::fclose(gltf) == 0) && written;
+  if (!written) {
+    std::cout << "ERROR::BENCHMARK::WRITE_FAILED: benchmark_import"
+              << std::endl;
+    return false;
+  }
+  benchmark.record("write grid files", millisecondsSince(start), "ms");
+
+  // the grid's vertices and triangles, flat with tangents along +x
+  auto check = [&](const ImportedMesh &mesh, const char *format) {
+    bool valid = mesh.vertices.size() == vertexCount &&
+                 mesh.indices.size() == indices.size();
+    for (uint32_t index : mesh.indices)
+      valid = valid && index < mesh.vertices.size();
+    double area = 0.0;
+    for (size_t i = 0; valid && i < mesh.indices.size(); i += 3) {
+      glm::vec3 corners[3];
+      for (int k = 0; k < 3; k++) {
+        const SceneVertex &vertex = mesh.vertices[mesh.indices[i + k]];
+        corners[k] = glm::make_vec3(vertex.position);
+      }
+      area += glm::length(glm::cross(corners[1] - corners[0],
+                                     corners[2] - corners[0])) * 0.5;
+    }
+    for (const SceneVertex &vertex : mesh.vertices)
+      valid = valid && glm::make_vec3(vertex.normal) == glm::vec3(0, 1, 0) &&
+              glm::make_vec3(vertex.tangent) == glm::vec3(1, 0, 0) &&
+              std::fabs(vertex.tangent[3]) == 1.0f;
+    double expected = GRID * 0.25 * GRID * 0.25;
+    valid = valid && std::fabs(area - expected) < expected * 1e-6;
+    if (!valid)
+      std::cout << "ERROR::BENCHMARK::IMPORT_WRONG_GRID: " << format
+                << std::endl;
+    return valid;
+  };
+  ImportedMesh objMesh, gltfMesh;
+  bool valid = import(objPath, "obj ", objMesh) && check(objMesh, "obj");
+  valid = import(gltfPath, "gltf ", gltfMesh) && check(gltfMesh, "gltf") &&
+          valid;
+  std::remove(objPath);
+  std::remove(gltfPath);
+  std::remove(binPath);
+  return valid;
+}
+
+// Splits a SLICES x STACKS UV sphere (262k triangles) into meshlets and
+// culls a grid of 1000 rotated and scaled copies of it in front of the
+// camera. Returns false if a meshlet breaks the vertex or triangle limit or
+// does not lie inside its sphere and cone, or if a culled meshlet of one of
+// the checked copies holds a triangle that faces the camera with a vertex
+// inside the frustum.
+bool benchmarkMeshlets(Benchmark &benchmark, ThreadPool &pool) {
+  benchmark.record("threads", pool.threadCount(), "count");
+  const unsigned int SLICES = 512;
+  const unsigned int STACKS = 256;
+  const float PI = 3.14159265358979f;
+  auto spherePoint = [&](unsigned int slice, unsigned int stack) {
+    float theta = PI * stack / STACKS, phi = 2.0f * PI * slice / SLICES;
+    SceneVertex vertex = {};
+    glm::vec3 p(std::sin(theta) * std::cos(phi), std::cos(theta),
+                std::sin(theta) * std::sin(phi));
+    for (int c = 0; c < 3; c++)
+      vertex.position[c] = vertex.normal[c] = p[c];
+    vertex.uv[0] = (float)slice / SLICES;
+    vertex.uv[1] = (float)stack / STACKS;
+    return vertex;
+  };
+  std::vector<SceneVertex> triangles;
+  for (unsigned int stack = 0; stack < STACKS; stack++) {
+    for (unsigned int slice = 0; slice < SLICES; slice++) {
+      SceneVertex a = spherePoint(slice, stack),
+                  b = spherePoint(slice + 1, stack),
+                  c = spherePoint(slice + 1, stack + 1),
+                  d = spherePoint(slice, stack + 1);
+      // counter-clockwise seen from outside, the quads at the poles are
+      // triangles
+      if (stack != 0)
+        triangles.insert(triangles.end(), {a, b, c});
+      if (stack != STACKS - 1)
+        triangles.insert(triangles.end(), {a, c, d});
+    }
+  }
+  ImportedMesh mesh;
+  MeshImporter importer(&pool);
+  importer.finish(triangles, mesh, true);
+  auto position = [&](uint32_t index) {
+    return glm::make_vec3(mesh.vertices[mesh.indices[index]].position);
+  };
+
+  MeshletBuilder builder;
+  auto start = BenchmarkClock::now();
+  builder.build(mesh.vertices.data(), mesh.vertices.size(),
+                mesh.indices.data(), mesh.indices.size(), 0);
+  benchmark.record("build", millisecondsSince(start), "ms");
+  const std::vector<SceneMeshlet> &meshlets = builder.meshlets;
+  benchmark.record("triangles", mesh.indices.size() / 3, "count");
+  benchmark.record("meshlets", meshlets.size(), "count");
+
+  bool valid = true;
+  uint32_t next = 0;
+  size_t vertexTotal = 0;
+  for (const SceneMeshlet &meshlet : meshlets) {
+    std::vector<uint32_t> used(mesh.indices.begin() + meshlet.firstIndex,
+                               mesh.indices.begin() + meshlet.firstIndex +
+                                   meshlet.indexCount);
+    std::sort(used.begin(), used.end());
+    used.erase(std::unique(used.begin(), used.end()), used.end());
+    vertexTotal += used.size();
+    bool fits = meshlet.firstIndex == next && meshlet.indexCount % 3 == 0 &&
+                meshlet.indexCount <= MeshletBuilder::MAX_TRIANGLES * 3 &&
+                used.size() <= MeshletBuilder::MAX_VERTICES;
+    next = meshlet.firstIndex + meshlet.indexCount;
+    glm::vec3 center = glm::make_vec3(meshlet.center);
+    glm::vec3 axis = glm::make_vec3(meshlet.coneAxis);
+    float coneCos = std::sqrt(1.0f - meshlet.coneCutoff * meshlet.coneCutoff);
+    for (uint32_t i = meshlet.firstIndex; i < next && fits; i += 3) {
+      glm::vec3 normal = glm::cross(position(i + 1) - position(i),
+                                    position(i + 2) - position(i));
+      float area = glm::length(normal);
+      for (int k = 0; k < 3; k++)
+        fits = fits && glm::length(position(i + k) - center) <=
+                           meshlet.radius * 1.0001f + 1e-6f;
+      if (meshlet.coneCutoff < 1.0f && area > 0.0f)
+        fits = fits && glm::dot(normal / area, axis) >= coneCos - 1e-3f;
+    }
+    if (!fits) {
+      std::cout << "ERROR::BENCHMARK::MESHLET_INVALID: "
+                << &meshlet - meshlets.data() << std::endl;
+      valid = false;
+      break;
+    }
+  }
+  if (next != mesh.indices.size()) {
+    std::cout << "ERROR::BENCHMARK::MESHLETS_INCOMPLETE" << std::endl;
+    valid = false;
+  }
+  benchmark.record("vertices per meshlet",
+                   (double)vertexTotal / meshlets.size(), "count");
+  benchmark.record("triangles per meshlet",
+                   mesh.indices.size() / 3.0 / meshlets.size(), "count");
+
+  // a 10 x 10 x 10 grid from 5 to 32 units in front of the camera, every
+  // seventh copy scaled unevenly so it skips the cone test
+  const unsigned int GRID = 10;
+  const unsigned int count = GRID * GRID * GRID;
+  std::vector<glm::mat4> models(count);
+  std::mt19937 random(1337);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  for (unsigned int i = 0; i < count; i++) {
+    glm::vec3 cell(i % GRID, i / GRID % GRID, i / (GRID * GRID));
+    glm::vec3 axis = glm::normalize(
+        glm::vec3(unit(random), unit(random), unit(random)) + 0.01f);
+    float scale = 0.5f + unit(random);
+    glm::vec3 scales(scale);
+    if (i % 7 == 0)
+      scales.y *= 1.5f;
+    models[i] = glm::scale(
+        glm::rotate(glm::translate(glm::mat4(1.0f),
+                                   glm::vec3(cell.x * 3.0f - 13.5f,
+                                             cell.y * 3.0f - 13.5f,
+                                             -5.0f - cell.z * 3.0f)),
+                    unit(random) * 2.0f * PI, axis),
+        scales);
   }
-  stbi_image_free(data);
+  glm::vec3 eye(0.0f);
+  glm::mat4 viewProjection =
+      glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 100.0f) *
+      glm::lookAt(eye, glm::vec3(0.0f, 0.0f, -1.0f),
+                  glm::vec3(0.0f, 1.0f, 0.0f));
+  Frustum frustum(viewProjection);
 
-  return texture;
+  std::vector<unsigned char> visible((size_t)count * meshlets.size());
+  std::vector<unsigned int> kept(count);
+  const int repetitions = 10;
+  start = BenchmarkClock::now();
+  for (int r = 0; r < repetitions; r++) {
+    pool.parallelFor(count, 16, [&](unsigned int begin, unsigned int end) {
+      for (unsigned int i = begin; i < end; i++)
+        kept[i] = cullMeshlets(meshlets.data(), meshlets.size(), models[i],
+                               frustum, eye,
+                               visible.data() + (size_t)i * meshlets.size());
+    });
+  }
+  double cullMs = millisecondsSince(start) / repetitions;
+  benchmark.record("cull", cullMs, "ms");
+  benchmark.record("meshlet rate", count * meshlets.size() / cullMs / 1000.0,
+                   "Mmeshlets/s");
+  size_t keptTotal = std::accumulate(kept.begin(), kept.end(), (size_t)0);
+  benchmark.record("meshlets kept", (double)keptTotal / visible.size(),
+                   "ratio");
+
+  // the culled meshlets of every 20th copy, triangle by triangle
+  size_t violations = 0;
+  for (unsigned int i = 0; i < count; i += 20) {
+    const unsigned char *meshletVisible =
+        visible.data() + (size_t)i * meshlets.size();
+    for (size_t m = 0; m < meshlets.size(); m++) {
+      if (meshletVisible[m])
+        continue;
+      const SceneMeshlet &meshlet = meshlets[m];
+      for (uint32_t t = meshlet.firstIndex;
+           t < meshlet.firstIndex + meshlet.indexCount; t += 3) {
+        glm::vec3 p[3];
+        bool inside = false;
+        for (int k = 0; k < 3; k++) {
+          p[k] = glm::vec3(models[i] * glm::vec4(position(t + k), 1.0f));
+          bool vertexInside = true;
+          for (const glm::vec4 &plane : frustum.planes)
+            vertexInside = vertexInside &&
+                           glm::dot(glm::vec3(plane), p[k]) + plane.w >= 0.0f;
+          inside = inside || vertexInside;
+        }
+        glm::vec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+        glm::vec3 toEye = eye - p[0];
+        bool facing = glm::dot(normal, toEye) >
+                      1e-5f * glm::length(normal) * glm::length(toEye);
+        violations += inside && facing;
+      }
+    }
+  }
+  benchmark.record("culled visible triangles", violations, "count");
+  if (violations) {
+    std::cout << "ERROR::BENCHMARK::MESHLET_CULLED_VISIBLE: " << violations
+              << " triangles" << std::endl;
+    valid = false;
+  }
+  return valid;
 }
 
-int main() {
+// Rasterizes a field of 48 box buildings with SoftwareOcclusion, with each
+// kernel and with and without the thread pool, and tests 20000 spheres in
+// the frustum scattered among and behind them. Returns false if the runs
+// disagree on a tile, if a sphere is culled that the per pixel reference
+// rasterization of the same triangles shows in front, or if nothing is
+// culled at all.
+bool benchmarkOcclusion(Benchmark &benchmark, ThreadPool &pool) {
+  benchmark.record("threads", pool.threadCount(), "count");
+  SceneVertex corners[8] = {};
+  for (int v = 0; v < 8; v++)
+    std::copy_n(CUBE_CORNERS + 3 * v, 3, corners[v].position);
+
+  std::mt19937 random(1337);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  const unsigned int BUILDINGS = 48;
+  std::vector<glm::mat4> buildings(BUILDINGS);
+  for (glm::mat4 &model : buildings) {
+    // half extents
+    glm::vec3 size(0.5f + 1.5f * unit(random), 1.0f + 3.0f * unit(random),
+                   0.5f + unit(random));
+    glm::vec3 position((unit(random) - 0.5f) * 40.0f, size.y - 2.0f,
+                       -6.0f - 30.0f * unit(random));
+    model = glm::scale(
+        glm::rotate(glm::translate(glm::mat4(1.0f), position),
+                    unit(random) * 0.5f, glm::vec3(0.0f, 1.0f, 0.0f)),
+        size);
+  }
+  glm::mat4 viewProjection =
+      glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 100.0f) *
+      glm::lookAt(glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 1.0f, -1.0f),
+                  glm::vec3(0.0f, 1.0f, 0.0f));
+  // only spheres in the frustum reach the occlusion test in the renderer
+  Frustum frustum(viewProjection);
+  const unsigned int SPHERES = 20000;
+  std::vector<glm::vec4> spheres;
+  while (spheres.size() < SPHERES) {
+    glm::vec4 sphere((unit(random) - 0.5f) * 50.0f, unit(random) * 8.0f - 2.0f,
+                     -5.0f - 75.0f * unit(random), 0.2f + 0.4f * unit(random));
+    if (frustum.sphereVisible(glm::vec3(sphere), sphere.w))
+      spheres.push_back(sphere);
+  }
+
+  bool valid = true;
+  const int repetitions = 100;
+  std::vector<float> tiles;
+  std::vector<unsigned char> culled(SPHERES);
+  SoftwareOcclusion culler;
+  for (RasterKernel kernel : {RasterKernel::Scalar, RasterKernel::Avx2}) {
+    if (kernel == RasterKernel::Avx2 && !CpuFeatures::avx2())
+      continue;
+    const char *name = kernel == RasterKernel::Avx2 ? "avx2" : "scalar";
+    culler.kernel = kernel;
+    for (ThreadPool *workers : {(ThreadPool *)nullptr, &pool}) {
+      auto start = BenchmarkClock::now();
+      for (int r = 0; r < repetitions; r++) {
+        culler.clear();
+        for (const glm::mat4 &model : buildings)
+          culler.addOccluder(viewProjection * model, corners, CUBE_FACES, 36,
+                             0.1f);
+        culler.rasterize(workers);
+      }
+      benchmark.record(std::string("rasterize ") + name +
+                           (workers ? " threaded" : ""),
+                       millisecondsSince(start) / repetitions, "ms");
+      if (tiles.empty()) {
+        tiles = culler.tileDepths();
+      } else if (tiles != culler.tileDepths()) {
+        std::cout << "ERROR::BENCHMARK::OCCLUSION_KERNELS_DIFFER: " << name
+                  << std::endl;
+        valid = false;
+      }
+    }
+  }
+  benchmark.record("occluder triangles", culler.triangleCount(), "count");
+
+  auto start = BenchmarkClock::now();
+  unsigned int culledCount = 0;
+  for (int r = 0; r < repetitions; r++) {
+    culledCount = 0;
+    for (unsigned int i = 0; i < SPHERES; i++) {
+      culled[i] = !culler.visible(viewProjection, spheres[i], 0.1f);
+      culledCount += culled[i];
+    }
+  }
+  benchmark.record("test", millisecondsSince(start) / repetitions, "ms");
+
+  std::vector<float> pixels;
+  culler.rasterizeReference(pixels);
+  unsigned int hidden = 0, violations = 0;
+  for (unsigned int i = 0; i < SPHERES; i++) {
+    bool visible =
+        culler.visibleReference(pixels, viewProjection, spheres[i], 0.1f);
+    hidden += !visible;
+    violations += culled[i] && visible;
+  }
+  benchmark.record("spheres", SPHERES, "count");
+  benchmark.record("culled", culledCount, "count");
+  benchmark.record("reference hidden", hidden, "count");
+  benchmark.record("culled of hidden",
+                   hidden ? 100.0 * culledCount / hidden : 0.0, "%");
+  benchmark.record("culled visible", violations, "count");
+  if (violations) {
+    std::cout << "ERROR::BENCHMARK::OCCLUSION_CULLED_VISIBLE: " << violations
+              << " spheres" << std::endl;
+    valid = false;
+  }
+  if (culledCount == 0) {
+    std::cout << "ERROR::BENCHMARK::OCCLUSION_CULLED_NOTHING" << std::endl;
+    valid = false;
+  }
+  return valid;
+}
+
+// Bakes potentially visible sets for a 12 x 12 city block grid of buildings
+// with props on the streets between them, writes and maps them as a scene
+// file and walks a camera through 500 street level positions. Reports
+// frustum draws with and without the sets. Returns false if a mapped set
+// differs from the baked one, or if more than 1% of the instances that
+// fresh rays from the camera positions hit are missing from their cell's
+// set.
+bool benchmarkPvs(Benchmark &benchmark, ThreadPool &pool) {
+  benchmark.record("threads", pool.threadCount(), "count");
+  const char *path = "pvs_benchmark.scene";
+  SceneWriter writer;
+  writer.vertices.resize(8, SceneVertex());
+  for (int v = 0; v < 8; v++)
+    std::copy_n(CUBE_CORNERS + 3 * v, 3, writer.vertices[v].position);
+  writer.indices.assign(CUBE_FACES, CUBE_FACES + 36);
+  writer.meshes.push_back(
+      {0, 8, 0, 36, {0.0f, 0.0f, 0.0f}, 1.7321f, 0, 0, 0, 0});
+  writer.materials.push_back({writer.addString("City"),
+                              SCENE_NONE,
+                              SCENE_NONE,
+                              {1.0f, 1.0f, 1.0f},
+                              {1.0f, 1.0f, 1.0f},
+                              32.0f});
+  std::mt19937 random(1337);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  auto addBox = [&](glm::vec3 position, glm::vec3 halfExtents) {
+    writer.instances.push_back({{position.x, position.y, position.z},
+                                {0.0f, 0.0f, 0.0f, 1.0f},
+                                {halfExtents.x, halfExtents.y, halfExtents.z},
+                                0,
+                                0});
+  };
+  // blocks 8 units apart, 6 wide, so the streets are 2 wide
+  const int BLOCKS = 12;
+  const float SPACING = 8.0f;
+  for (int x = 0; x < BLOCKS; x++) {
+    for (int z = 0; z < BLOCKS; z++) {
+      float height = 3.0f + 9.0f * unit(random);
+      addBox(glm::vec3(x * SPACING, height, z * SPACING),
+             glm::vec3(3.0f, height, 3.0f));
+      // props on the street along the block's +x side
+      for (int p = 0; p < 4; p++)
+        addBox(glm::vec3(x * SPACING + 4.0f,
+                         0.25f, z * SPACING + (unit(random) - 0.5f) * 6.0f),
+               glm::vec3(0.25f));
+    }
+  }
+  PvsBaker baker;
+  auto start = BenchmarkClock::now();
+  baker.bake(writer.vertices.data(), writer.indices.data(),
+             writer.meshes.data(), writer.instances.data(),
+             writer.instances.size(), 8.0f, pool);
+  benchmark.record("bake", millisecondsSince(start), "ms");
+  writer.pvsGrids.push_back(baker.grid);
+  writer.pvsCells = baker.cells;
+  writer.pvsSets = baker.sets;
+  writer.pvsData = baker.data;
+  uint32_t instanceCount = writer.instances.size();
+  benchmark.record("instances", instanceCount, "count");
+  benchmark.record("cells", baker.cells.size(), "count");
+  benchmark.record("distinct sets", baker.sets.size(), "count");
+  benchmark.record("rays", (double)baker.cells.size() * PvsBaker::SAMPLES *
+                               PvsBaker::RAYS,
+                   "count");
+  benchmark.record("pvs bytes", baker.data.size(), "bytes");
+  benchmark.record("pvs bytes as bits",
+                   baker.cells.size() * ((instanceCount + 7) / 8), "bytes");
+
+  SceneFile file;
+  PotentiallyVisibleSets pvs;
+  bool valid = writer.write(path) && file.open(path) && pvs.load(file) &&
+               pvs.loaded();
+  if (!valid) {
+    std::cout << "ERROR::BENCHMARK::PVS_LOAD_FAILED" << std::endl;
+    std::remove(path);
+    return false;
+  }
+  for (uint32_t cell = 0; cell < pvs.cellCount() && valid; cell++) {
+    const unsigned char *visible = pvs.select(cell);
+    valid = std::equal(visible, visible + instanceCount,
+                       baker.visibility.begin() + (size_t)cell * instanceCount);
+    if (!valid)
+      std::cout << "ERROR::BENCHMARK::PVS_DECODE_MISMATCH: " << cell
+                << std::endl;
+  }
+
+  // camera positions on the streets, looking along them or across
+  std::vector<glm::mat4> models(instanceCount);
+  for (uint32_t i = 0; i < instanceCount; i++)
+    models[i] = instanceModel(writer.instances[i]);
+  glm::mat4 projection =
+      glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 100.0f);
+  const int POSITIONS = 500;
+  const int RAYS = 1000;
+  double frustumDraws = 0.0, pvsDraws = 0.0, pvsMs = 0.0;
+  unsigned int hits = 0, missed = 0;
+  for (int p = 0; p < POSITIONS; p++) {
+    glm::vec3 eye(std::floor(unit(random) * BLOCKS) * SPACING + 4.0f, 1.7f,
+                  unit(random) * (BLOCKS - 1) * SPACING);
+    if (p % 2)
+      std::swap(eye.x, eye.z);
+    float yaw = unit(random) * 6.28318530718f;
+    glm::vec3 front(std::cos(yaw), 0.0f, std::sin(yaw));
+    Frustum frustum(projection *
+                    glm::lookAt(eye, eye + front, glm::vec3(0.0f, 1.0f, 0.0f)));
+    start = BenchmarkClock::now();
+    int cell = pvs.cellAt(eye);
+    const unsigned char *visible = cell >= 0 ? pvs.select(cell) : nullptr;
+    for (uint32_t i = 0; i < instanceCount; i++) {
+      const float *s = writer.instances[i].scale;
+      float radius = 1.7321f * std::max(std::max(s[0], s[1]), s[2]);
+      if (!frustum.sphereVisible(glm::vec3(models[i][3]), radius))
+        continue;
+      frustumDraws++;
+      pvsDraws += !visible || visible[i];
+    }
+    pvsMs += millisecondsSince(start);
+    // what the eye actually sees should be in the set
+    for (int r = 0; r < RAYS && visible; r++) {
+      float z = 2.0f * unit(random) - 1.0f;
+      float phi = 6.28318530718f * unit(random);
+      float planar = std::sqrt(std::max(1.0f - z * z, 0.0f));
+      uint32_t hit = baker.bvh.intersect(
+          eye, glm::vec3(planar * std::cos(phi), planar * std::sin(phi), z));
+      if (hit == SCENE_NONE)
+        continue;
+      hits++;
+      missed += !visible[hit];
+    }
+  }
+  benchmark.record("frustum draws", frustumDraws / POSITIONS, "count");
+  benchmark.record("pvs draws", pvsDraws / POSITIONS, "count");
+  benchmark.record("lookup and cull", pvsMs / POSITIONS, "ms");
+  benchmark.record("missed hits", hits ? 100.0 * missed / hits : 0.0, "%");
+  if (missed * 100 > hits) {
+    std::cout << "ERROR::BENCHMARK::PVS_MISSED_VISIBLE: " << missed << " of "
+              << hits << " hits" << std::endl;
+    valid = false;
+  }
+  file.close();
+  std::remove(path);
+  return valid;
+}
+
+// Writes a world of 64 x 64 sectors with 256 instances each (1M in all) and
+// flies a camera over it for 3600 frames with WorldStreamer on a 1 MB
+// budget, keeping what it commits like the renderer does. Returns false if
+// a frame goes over a budget or the frame time, if the camera's sector is
+// missing after the first second, if the tracked Streaming peak goes over
+// the budget plus what was live before, or if an instance arrives wrong.
+bool benchmarkStreaming(Benchmark &benchmark) {
+  const char *path = "streaming.world";
+  // 64 x 64 sectors of 32 units, 256 instances each
+  const int SECTORS = 64;
+  const float SECTOR_SIZE = 32.0f;
+  const int PER_SECTOR = 256;
+  const int FRAMES = 3600;
+  const float DT = 1.0f / 60.0f;
+  // a frame's streaming work on the calling thread may not take longer
+  const double FRAME_BUDGET_MS = 1000.0 / 60.0;
+  WorldWriter writer;
+  writer.sectorSize = SECTOR_SIZE;
+  std::mt19937 random(7);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  writer.instances.resize(SECTORS * SECTORS * PER_SECTOR);
+  for (SceneInstance &instance : writer.instances) {
+    float yaw = unit(random) * 6.28318530718f;
+    float scale = 0.5f + 1.5f * unit(random);
+    instance = {{unit(random) * SECTORS * SECTOR_SIZE, unit(random) * 8.0f,
+                 unit(random) * SECTORS * SECTOR_SIZE},
+                {0.0f, std::sin(yaw * 0.5f), 0.0f, std::cos(yaw * 0.5f)},
+                {scale, scale, scale},
+                0,
+                0};
+  }
+  auto start = BenchmarkClock::now();
+  if (!writer.write(path))
+    return false;
+  benchmark.record("write", millisecondsSince(start), "ms");
+  benchmark.record("world instances", writer.instances.size(), "count");
+
+  WorldStreamer streamer;
+  streamer.budget.ioBytes = 32 << 10;
+  streamer.budget.decodeInstances = 2048;
+  streamer.budget.uploadInstances = 1024;
+  streamer.budget.memoryBytes = 1 << 20;
+  if (!streamer.open(path)) {
+    std::remove(path);
+    return false;
+  }
+  const WorldHeader &header = streamer.worldHeader();
+  uint64_t fileBytes = 0;
+  for (uint32_t i = 0; i < streamer.sectorCount(); i++)
+    fileBytes += streamer.sector(i).bytes;
+  benchmark.record("world bytes", fileBytes, "bytes");
+  benchmark.record("world decoded bytes",
+                   writer.instances.size() * sizeof(SceneInstance), "bytes");
+
+  // the instances of each sector in file order, to check what arrives
+  std::vector<std::vector<uint32_t>> expected(streamer.sectorCount());
+  for (uint32_t i = 0; i < writer.instances.size(); i++) {
+    const float *p = writer.instances[i].position;
+    uint32_t x = std::min(
+        (uint32_t)((p[0] - header.origin[0]) / header.sectorSize),
+        header.sectorsX - 1);
+    uint32_t z = std::min(
+        (uint32_t)((p[2] - header.origin[2]) / header.sectorSize),
+        header.sectorsZ - 1);
+    expected[x * header.sectorsZ + z].push_back(i);
+  }
+
+  // what the caller keeps counts against the budget too
+  MemoryTagScope tag(MemoryTag::Streaming);
+  std::vector<std::vector<SceneInstance>> resident(streamer.sectorCount());
+  size_t ceiling = MemoryTracker::cpu[(unsigned int)MemoryTag::Streaming].live +
+                   streamer.budget.memoryBytes;
+  unsigned int wrong = 0;
+  auto commit = [&](uint32_t sector, const SceneInstance *instances,
+                    unsigned int count) {
+    std::vector<SceneInstance> &kept = resident[sector];
+    if (kept.empty())
+      kept.reserve(streamer.sector(sector).instanceCount);
+    for (unsigned int i = 0; i < count; i++) {
+      const SceneInstance &a = instances[i];
+      const SceneInstance &b = writer.instances[expected[sector][kept.size()]];
+      bool same = a.mesh == b.mesh && a.material == b.material;
+      for (int c = 0; c < 3; c++)
+        same = same && std::abs(a.position[c] - b.position[c]) < 1e-3f &&
+               a.scale[c] == b.scale[c];
+      for (int c = 0; c < 4; c++)
+        same = same && std::abs(a.rotation[c] - b.rotation[c]) < 1e-4f;
+      wrong += !same;
+      kept.push_back(a);
+    }
+  };
+  auto release = [&](uint32_t sector, unsigned int count) {
+    std::vector<SceneInstance> &kept = resident[sector];
+    kept.resize(kept.size() - count);
+    if (kept.empty())
+      std::vector<SceneInstance>().swap(kept);
+  };
+
+  // a scripted flight over the world, speeding up to ~150 units/s and
+  // turning, which the streaming has to keep ahead of
+  glm::vec3 center(SECTORS * SECTOR_SIZE * 0.5f, 20.0f,
+                   SECTORS * SECTOR_SIZE * 0.5f);
+  auto flight = [&](float t) {
+    float radius = SECTORS * SECTOR_SIZE * 0.4f;
+    return center + glm::vec3(radius * std::sin(t * 0.11f), 0.0f,
+                              radius * std::sin(t * 0.17f + 1.0f));
+  };
+  const int WARMUP = 60;
+  double maxFrameMs = 0.0, totalMs = 0.0;
+  size_t maxUsed = 0;
+  unsigned int stalls = 0, overBudget = 0, maxResident = 0;
+  WorldStreamer::FrameStats peak;
+  glm::vec3 previous = flight(0.0f);
+  for (int frame = 0; frame < FRAMES; frame++) {
+    glm::vec3 position = flight(frame * DT);
+    glm::vec3 velocity = (position - previous) / DT;
+    previous = position;
+    start = BenchmarkClock::now();
+    streamer.update(position, velocity, commit, release);
+    double ms = millisecondsSince(start);
+    // the worker gets the rest of the frame
+    streamer.sync();
+    const WorldStreamer::FrameStats &stats = streamer.lastFrame;
+    const WorldStreamer::Budget &budget = streamer.budget;
+    bool over = ms > FRAME_BUDGET_MS || stats.ioBytes > budget.ioBytes ||
+                stats.decodedInstances > budget.decodeInstances ||
+                stats.committedInstances + stats.releasedInstances >
+                    budget.uploadInstances ||
+                streamer.usedBytes() > budget.memoryBytes;
+    overBudget += over;
+    if (over)
+      std::cout << "ERROR::BENCHMARK::STREAMING_OVER_BUDGET: frame " << frame
+                << ", " << ms << " ms" << std::endl;
+    maxFrameMs = std::max(maxFrameMs, ms);
+    totalMs += ms;
+    maxUsed = std::max(maxUsed, streamer.usedBytes());
+    maxResident = std::max(maxResident, streamer.residentSectors());
+    peak.ioBytes = std::max(peak.ioBytes, stats.ioBytes);
+    peak.decodedInstances =
+        std::max(peak.decodedInstances, stats.decodedInstances);
+    peak.committedInstances =
+        std::max(peak.committedInstances, stats.committedInstances);
+    peak.releasedInstances =
+        std::max(peak.releasedInstances, stats.releasedInstances);
+    // after the first second, the ground under the camera must be there
+    uint32_t under = streamer.sectorAt(position);
+    if (frame >= WARMUP && under != WorldStreamer::NONE &&
+        streamer.state(under) != WorldStreamer::Resident)
+      stalls++;
+  }
+  size_t peakBytes =
+      MemoryTracker::cpu[(unsigned int)MemoryTag::Streaming].peak;
+  benchmark.record("update", totalMs / FRAMES, "ms");
+  benchmark.record("max update", maxFrameMs, "ms");
+  benchmark.record("max io per frame", peak.ioBytes, "bytes");
+  benchmark.record("max decoded per frame", peak.decodedInstances, "count");
+  benchmark.record("max committed per frame", peak.committedInstances,
+                   "count");
+  benchmark.record("max released per frame", peak.releasedInstances,
+                   "count");
+  benchmark.record("max resident sectors", maxResident, "count");
+  benchmark.record("max budgeted bytes", maxUsed, "bytes");
+  benchmark.record("peak streaming bytes", peakBytes, "bytes");
+  benchmark.record("memory ceiling", ceiling, "bytes");
+  benchmark.record("stalled frames", stalls, "count");
+  bool valid = true;
+  if (overBudget) {
+    std::cout << "ERROR::BENCHMARK::STREAMING_FRAMES_OVER_BUDGET: "
+              << overBudget << std::endl;
+    valid = false;
+  }
+  if (peakBytes > ceiling) {
+    std::cout << "ERROR::BENCHMARK::STREAMING_OVER_MEMORY_CEILING: "
+              << peakBytes << " > " << ceiling << std::endl;
+    valid = false;
+  }
+  if (stalls) {
+    std::cout << "ERROR::BENCHMARK::STREAMING_STALLED: " << stalls
+              << " frames without the camera's sector" << std::endl;
+    valid = false;
+  }
+  if (wrong) {
+    std::cout << "ERROR::BENCHMARK::STREAMING_WRONG_INSTANCES: " << wrong
+              << std::endl;
+    valid = false;
+  }
+  streamer.close();
+  std::remove(path);
+  return valid;
+}
+
+// Writes 48 textures of 512x512 along a road and drives a camera down it
+// and stops, requesting from a TextureStreamer on a 4 MB budget the level
+// each quad in view needs. Every upload and eviction is checked against
+// hashes of a box filtered mip chain. Returns false if a frame goes over a
+// budget or the frame time, if a level arrives wrong, if a level requested
+// that frame is evicted, if a mip tail goes missing, or if a texture in
+// view is still coarser than requested a second after the camera stopped.
+bool benchmarkTextures(Benchmark &benchmark) {
+  // 48 textures of 512x512 on quads two units wide along a 190 unit road,
+  // every fourth unit on alternating sides
+  const int TEXTURES = 48;
+  const int SIZE = 512;
+  const int FLIGHT_FRAMES = 1500;
+  const int HOLD_FRAMES = 300;
+  const float VIEW_DISTANCE = 40.0f;
+  const float PIXELS_PER_UNIT = 1000.0f;
+  // a frame's streaming work on the calling thread may not take longer
+  const double FRAME_BUDGET_MS = 1000.0 / 60.0;
+  std::vector<std::string> paths;
+  for (int i = 0; i < TEXTURES; i++) {
+    paths.push_back("streaming_" + std::to_string(i) + ".ppm");
+    std::ofstream file(paths.back(), std::ios::binary);
+    file << "P6\n" << SIZE << " " << SIZE << "\n255\n";
+    std::vector<unsigned char> row(SIZE * 3);
+    for (int y = 0; y < SIZE; y++) {
+      for (int x = 0; x < SIZE; x++) {
+        row[x * 3 + 0] = (unsigned char)(x * 7 + i * 13);
+        row[x * 3 + 1] = (unsigned char)(y * 5 + x * y);
+        row[x * 3 + 2] = (unsigned char)(i * 5 + (x ^ y));
+      }
+      file.write((const char *)row.data(), row.size());
+    }
+  }
+
+  // what every level must hold: hashes of a plain 2x2 box filtered chain
+  auto hash = [](const std::vector<unsigned char> &pixels) {
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : pixels)
+      h = (h ^ c) * 1099511628211ull;
+    return h;
+  };
+  stbi_set_flip_vertically_on_load_thread(true);
+  std::vector<std::vector<uint64_t>> expected(TEXTURES);
+  for (int i = 0; i < TEXTURES; i++) {
+    int w, h, channels;
+    unsigned char *data = stbi_load(paths[i].c_str(), &w, &h, &channels, 4);
+    if (!data || w != SIZE || h != SIZE) {
+      std::cout << "ERROR::BENCHMARK::TEXTURE_WRITE_FAILED: " << paths[i]
+                << std::endl;
+      stbi_image_free(data);
+      return false;
+    }
+    std::vector<unsigned char> level(data, data + SIZE * SIZE * 4);
+    stbi_image_free(data);
+    for (int size = SIZE; size >= 1; size /= 2) {
+      expected[i].push_back(hash(level));
+      int half = std::max(size / 2, 1);
+      std::vector<unsigned char> next(half * half * 4);
+      for (int y = 0; y < half; y++)
+        for (int x = 0; x < half; x++)
+          for (int c = 0; c < 4; c++) {
+            auto at = [&](int tx, int ty) {
+              return level[(std::min(ty, size - 1) * size +
+                            std::min(tx, size - 1)) *
+                               4 +
+                           c];
+            };
+            next[(y * half + x) * 4 + c] =
+                (unsigned char)((at(2 * x, 2 * y) + at(2 * x + 1, 2 * y) +
+                                 at(2 * x, 2 * y + 1) +
+                                 at(2 * x + 1, 2 * y + 1) + 2) /
+                                4);
+          }
+      level.swap(next);
+    }
+  }
+
+  TextureStreamer streamer;
+  streamer.budget.memoryBytes = 4 << 20;
+  streamer.budget.uploadBytes = 1 << 20;
+  for (const std::string &path : paths)
+    streamer.add(path.c_str());
+  size_t fullBytes = 0;
+  for (int level = 0; level < streamer.levelCount(0); level++)
+    fullBytes += TextureStreamer::levelBytes(SIZE, SIZE, level);
+  benchmark.record("textures", TEXTURES, "count");
+  benchmark.record("all levels", fullBytes * TEXTURES, "bytes");
+
+  // what a GPU would hold: the finest level of each texture; uploads and
+  // evictions have to fit onto it and bring the right pixels
+  std::vector<int> gpuLevel(TEXTURES, streamer.levelCount(0));
+  std::vector<int> requested(TEXTURES);
+  std::vector<int> requestFrame(TEXTURES, -1);
+  int frame = 0;
+  unsigned int wrong = 0;
+  auto upload = [&](unsigned int texture, int level, const TextureMip *mips,
+                    int count) {
+    bool valid = level + count == gpuLevel[texture];
+    for (int i = 0; i < count && valid; i++)
+      valid = mips[i].width == std::max(SIZE >> (level + i), 1) &&
+              hash(mips[i].pixels) == expected[texture][level + i];
+    wrong += !valid;
+    gpuLevel[texture] = level;
+  };
+  unsigned int lruViolations = 0;
+  auto evict = [&](unsigned int texture, int level, int previous) {
+    wrong += previous != gpuLevel[texture] || level <= previous ||
+             level > streamer.tailLevel(texture);
+    // levels requested this frame are never taken
+    lruViolations +=
+        requestFrame[texture] == frame && level > requested[texture];
+    gpuLevel[texture] = level;
+  };
+  auto streamedBytes = [&] {
+    size_t bytes = 0;
+    for (int i = 0; i < TEXTURES; i++)
+      for (int level = gpuLevel[i]; level < streamer.tailLevel(i); level++)
+        bytes += TextureStreamer::levelBytes(SIZE, SIZE, level);
+    return bytes;
+  };
+
+  // the tails go in first, like the renderer does before its first frame
+  do {
+    streamer.update(upload, evict);
+    streamer.sync();
+  } while (streamer.pendingLoads() > 0);
+
+  // the camera drives down the road and stops; quads ahead of it within
+  // VIEW_DISTANCE are drawn
+  double maxFrameMs = 0.0, totalMs = 0.0;
+  size_t maxStreamed = 0, maxUploaded = 0, evicted = 0;
+  unsigned int overBudget = 0, blurry = 0, missingTail = 0, unsettled = 0;
+  for (frame = 0; frame < FLIGHT_FRAMES + HOLD_FRAMES; frame++) {
+    float z = std::min(frame, FLIGHT_FRAMES) * 0.12f - 10.0f;
+    for (int i = 0; i < TEXTURES; i++) {
+      glm::vec2 quad((i % 2 ? 3.0f : -3.0f), i * 4.0f);
+      float distance = glm::length(quad - glm::vec2(0.0f, z));
+      if (quad.y < z || distance > VIEW_DISTANCE)
+        continue;
+      float pixels = 2.0f * PIXELS_PER_UNIT / std::max(distance, 0.1f);
+      requested[i] = streamer.levelFor(i, pixels);
+      requestFrame[i] = frame;
+      streamer.request(i, requested[i]);
+    }
+    auto start = BenchmarkClock::now();
+    streamer.update(upload, evict);
+    double ms = millisecondsSince(start);
+    // the worker gets the rest of the frame
+    streamer.sync();
+    const TextureStreamer::FrameStats &stats = streamer.lastFrame;
+    size_t streamed = streamedBytes();
+    bool over = ms > FRAME_BUDGET_MS ||
+                (stats.uploadedBytes > streamer.budget.uploadBytes &&
+                 stats.uploadedLevels > 1) ||
+                streamed > streamer.budget.memoryBytes;
+    overBudget += over;
+    if (over)
+      std::cout << "ERROR::BENCHMARK::TEXTURES_OVER_BUDGET: frame " << frame
+                << ", " << ms << " ms" << std::endl;
+    maxFrameMs = std::max(maxFrameMs, ms);
+    totalMs += ms;
+    maxStreamed = std::max(maxStreamed, streamed);
+    maxUploaded = std::max(maxUploaded, stats.uploadedBytes);
+    evicted += stats.evictedLevels;
+    for (int i = 0; i < TEXTURES; i++) {
+      missingTail += gpuLevel[i] > streamer.tailLevel(i);
+      if (requestFrame[i] != frame || gpuLevel[i] <= requested[i])
+        continue;
+      blurry++;
+      // once the camera has stood still for a second, everything it sees
+      // must be as sharp as requested
+      unsettled += frame >= FLIGHT_FRAMES + 60;
+    }
+  }
+  benchmark.record("update", totalMs / (FLIGHT_FRAMES + HOLD_FRAMES), "ms");
+  benchmark.record("max update", maxFrameMs, "ms");
+  benchmark.record("max uploaded per frame", maxUploaded, "bytes");
+  benchmark.record("max streamed bytes", maxStreamed, "bytes");
+  benchmark.record("memory budget", streamer.budget.memoryBytes, "bytes");
+  benchmark.record("evicted levels", evicted, "count");
+  benchmark.record("blurry texture frames", blurry, "count");
+  bool valid = true;
+  if (overBudget) {
+    std::cout << "ERROR::BENCHMARK::TEXTURES_FRAMES_OVER_BUDGET: "
+              << overBudget << std::endl;
+    valid = false;
+  }
+  if (wrong) {
+    std::cout << "ERROR::BENCHMARK::TEXTURES_WRONG_LEVELS: " << wrong
+              << std::endl;
+    valid = false;
+  }
+  if (lruViolations) {
+    std::cout << "ERROR::BENCHMARK::TEXTURES_EVICTED_IN_USE: "
+              << lruViolations << std::endl;
+    valid = false;
+  }
+  if (missingTail) {
+    std::cout << "ERROR::BENCHMARK::TEXTURES_MISSING_TAIL: " << missingTail
+              << std::endl;
+    valid = false;
+  }
+  if (unsettled) {
+    std::cout << "ERROR::BENCHMARK::TEXTURES_NOT_SETTLED: " << unsettled
+              << " texture frames coarser than requested" << std::endl;
+    valid = false;
+  }
+  streamer.close();
+  for (const std::string &path : paths)
+    std::remove(path.c_str());
+  return valid;
+}
+
+// The benchmarks that time CPU work and run without a window. `argument` is
+// what follows the name on the command line, null if nothing does.
+struct CpuBenchmark {
+  const char *name;
+  bool (*run)(Benchmark &benchmark, const char *argument);
+};
+const CpuBenchmark cpuBenchmarks[] = {
+    {"transforms",
+     [](Benchmark &benchmark, const char *) {
+       benchmarkTransforms(benchmark);
+       return true;
+     }},
+    {"math",
+     [](Benchmark &benchmark, const char *) {
+       return benchmarkMath(benchmark);
+     }},
+    {"entities",
+     [](Benchmark &benchmark, const char *) {
+       return benchmarkEntities(benchmark);
+     }},
+    {"hierarchy",
+     [](Benchmark &benchmark, const char *) {
+       ThreadPool pool;
+       return benchmarkHierarchy(benchmark, pool);
+     }},
+    {"scene",
+     [](Benchmark &benchmark, const char *) {
+       return benchmarkSceneFile(benchmark);
+     }},
+    {"import",
+     [](Benchmark &benchmark, const char *model) {
+       ThreadPool pool;
+       return benchmarkImport(benchmark, pool, model);
+     }},
+    {"meshlets",
+     [](Benchmark &benchmark, const char *) {
+       ThreadPool pool;
+       return benchmarkMeshlets(benchmark, pool);
+     }},
+    {"occlusion",
+     [](Benchmark &benchmark, const char *) {
+       ThreadPool pool;
+       return benchmarkOcclusion(benchmark, pool);
+     }},
+    {"pvs",
+     [](Benchmark &benchmark, const char *) {
+       ThreadPool pool;
+       return benchmarkPvs(benchmark, pool);
+     }},
+    {"streaming",
+     [](Benchmark &benchmark, const char *) {
+       return benchmarkStreaming(benchmark);
+     }},
+    {"textures",
+     [](Benchmark &benchmark, const char *) {
+       return benchmarkTextures(benchmark);
+     }},
+};
+
+// Draws an index range of the scene's element buffer, which the bound VAO
+// must have.
+void drawMesh(const Mesh &mesh) {
+  glDrawElementsBaseVertex(GL_TRIANGLES, mesh.count, GL_UNSIGNED_INT,
+                           (void *)(mesh.first * sizeof(uint32_t)),
+                           mesh.baseVertex);
+}
+// `instances` rows of the instance buffer from `baseInstance` on
+void drawMeshInstanced(const Mesh &mesh, unsigned int instances,
+                       unsigned int baseInstance) {
+  glDrawElementsInstancedBaseVertexBaseInstance(
+      GL_TRIANGLES, mesh.count, GL_UNSIGNED_INT,
+      (void *)(mesh.first * sizeof(uint32_t)), instances, mesh.baseVertex,
+      baseInstance);
+}
+
+// Flies the camera on a fixed orbit so benchmark runs are comparable.
+void benchmarkCamera(float t) {
+  camera.position = glm::vec3(std::sin(t * 0.3f) * 12.0f, 3.0f,
+                              std::cos(t * 0.3f) * 12.0f);
+  camera.frontFace = glm::normalize(glm::vec3(0.0f, -1.0f, 0.0f) -
+                                    camera.position);
+}
+
+int main(int argc, char **argv) {
+  // `learnopengl --benchmark lights [frames]` runs the light benchmark scene
+  // for 1000 frames unless told otherwise and writes benchmark.json. The
+  // other benchmarks time CPU work and run without a window: `transforms`,
+  // `math`, `entities`, `hierarchy`, `scene`, `import [model]`, `meshlets`,
+  // `occlusion`, `pvs`, `streaming` and `textures`.
+  // `--deferred` starts on the deferred renderer and `--prepass` with the
+  // depth pre-pass enabled. `--hiz` starts with instanced draws culled
+  // against the Hi-Z pyramid. `--world <file>` streams the sectors of a world
+  // file around the camera. `--no-bindless` forces the texture array path
+  // even when bindless textures are supported, which leaves textures
+  // unstreamed.
+  const char *benchmarkName = nullptr;
+  const char *benchmarkArgument = nullptr;
+  int benchmarkFrames = 1000;
+  bool startDeferred = false;
+  bool startPrepass = false;
+  bool startHiz = false;
+  bool allowBindless = true;
+  const char *worldPath = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--deferred") == 0)
+      startDeferred = true;
+    if (std::strcmp(argv[i], "--prepass") == 0)
+      startPrepass = true;
+    if (std::strcmp(argv[i], "--hiz") == 0)
+      startHiz = true;
+    if (std::strcmp(argv[i], "--no-bindless") == 0)
+      allowBindless = false;
+    if (std::strcmp(argv[i], "--world") == 0 && i + 1 < argc)
+      worldPath = argv[++i];
+    if (std::strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc) {
+      benchmarkName = argv[++i];
+      // the optional argument, a flag after the name is not one
+      if (i + 1 < argc && std::strncmp(argv[i + 1], "--", 2) != 0) {
+        benchmarkArgument = argv[++i];
+        benchmarkFrames = std::atoi(benchmarkArgument);
+      }
+    }
+  }
+  for (const CpuBenchmark &cpu : cpuBenchmarks) {
+    if (!benchmarkName || std::strcmp(benchmarkName, cpu.name) != 0)
+      continue;
+    Benchmark benchmark(benchmarkName);
+    bool valid = cpu.run(benchmark, benchmarkArgument);
+    if (!benchmark.write("benchmark.json"))
+      return -1;
+    return valid ? 0 : 1;
+  }
+  if (benchmarkName && std::strcmp(benchmarkName, "lights") != 0) {
+    std::cout << "Unknown benchmark: " << benchmarkName << std::endl;
+    return -1;
+  }
+  if (benchmarkName && benchmarkFrames <= 0) {
+    std::cout << "ERROR::BENCHMARK::INVALID_FRAME_COUNT: " << benchmarkArgument
+              << std::endl;
+    return -1;
+  }
+
   GLFWwindow *window = initalizeWindowContext();
   if (!window) {
     return -1;
   }
+  if (!GLAD_GL_VERSION_4_3) {
+    std::cout << "OpenGL 4.3 is required for clustered lighting" << std::endl;
+    glfwTerminate();
+    return -1;
+  }
+
+  // every program comes out of the variant cache; the limits the C++ side
+  // relies on are injected into all of them so they cannot drift apart
+  ShaderCache shaderCache;
+  shaderCache.globalDefines["MAX_LIGHTS_PER_CLUSTER"] =
+      std::to_string(ClusterGrid::MAX_LIGHTS_PER_CLUSTER) + "u";
+  shaderCache.globalDefines["CLUSTER_WORKGROUP_SIZE"] =
+      std::to_string(ClusterGrid::WORKGROUP_SIZE);
+  shaderCache.globalDefines["HIZ_WORKGROUP_SIZE"] =
+      std::to_string(HiZCulling::WORKGROUP_SIZE);
+  shaderCache.globalDefines["HIZ_PYRAMID_TILE"] =
+      std::to_string(HiZCulling::PYRAMID_TILE);
+  shaderCache.globalDefines["MAX_CASCADES"] =
+      std::to_string(ShadowMaps::MAX_CASCADES);
+  shaderCache.globalDefines["MAX_SPOT_SHADOWS"] =
+      std::to_string(ShadowMaps::MAX_SPOT_SHADOWS);
+
+  // material textures are sampled through bindless handles where the driver
+  // supports them and through texture arrays otherwise
+  BindlessTextures bindlessTextures;
+  bool bindless =
+      allowBindless && bindlessTextures.init((GLADloadproc)glfwGetProcAddress);
+  shaderCache.globalDefines["BINDLESS"] = bindless ? "1" : "0";
+  if (bindless)
+    shaderCache.extensions.push_back("GL_ARB_bindless_texture");
 
-  Shader cubeShader("../src/shaders/cube.vert", "../src/shaders/cube.frag");
-  Shader lightShader("../src/shaders/light.vert", "../src/shaders/light.frag");
-  glActiveTexture(GL_TEXTURE0);
-  unsigned int diffuseMap = setupTexture("../assets/container2.png");
-  glActiveTexture(GL_TEXTURE1);
-  unsigned int specularMap = setupTexture("../assets/specularMap.png");
+  // the flashlight's attenuation and cone only change from the debug UI, so
+  // the lighting shaders get a variant with them baked in
+  glm::vec3 flashlightAttenuation(1.0f, 0.09f, 0.032f);
+  float flashlightCutOff = 12.5f;
+  float flashlightOuterCutOff = 17.5f;
+  SpecializationConstants lightConstants;
+  auto setLightConstants = [&]() {
+    lightConstants.set("LIGHT_CONSTANT", flashlightAttenuation.x);
+    lightConstants.set("LIGHT_LINEAR", flashlightAttenuation.y);
+    lightConstants.set("LIGHT_QUADRATIC", flashlightAttenuation.z);
+    lightConstants.set("SPOT_CUT_OFF",
+                       glm::cos(glm::radians(flashlightCutOff)));
+    lightConstants.set("SPOT_OUTER_CUT_OFF",
+                       glm::cos(glm::radians(flashlightOuterCutOff)));
+  };
+  setLightConstants();
+  lightConstants.bake();
+  unsigned int prewarmedVariants =
+      shaderCache.prewarm("variants.txt", lightConstants.bakedValues());
+  // without bindless every material texture lives in a layer of a few
+  // shared arrays
+  TextureArrays textureArrays;
+  // with bindless every texture is its own, and the streamer keeps the mip
+  // levels resident that the frame samples; streamedTextures holds the
+  // current handle of each streamed texture
+  TextureStreamer textureStreamer;
+  std::vector<glm::uvec2> streamedTextures;
+  auto uploadMips = [&](unsigned int texture, int, const TextureMip *mips,
+                        int count) {
+    streamedTextures[texture] = bindlessTextures.replace(
+        streamedTextures[texture], mips[0].width, mips[0].height, count,
+        mips, count);
+  };
+  auto evictMips = [&](unsigned int texture, int level, int previous) {
+    streamedTextures[texture] = bindlessTextures.replace(
+        streamedTextures[texture],
+        std::max(textureStreamer.width(texture) >> level, 1),
+        std::max(textureStreamer.height(texture) >> level, 1),
+        previous - level, nullptr, 0);
+  };
+
+  // meshes, materials, instances and lights come from default.scene, which
+  // scene_converter builds from assets/scenes/default.txt; the file is
+  // mapped and its tables used in place
+  SceneFile sceneFile;
+  if (!sceneFile.open("default.scene") || sceneFile.meshes().count == 0) {
+    std::cout << "ERROR::SCENE::NO_MESHES: default.scene" << std::endl;
+    glfwTerminate();
+    return -1;
+  }
+  SceneSpan<SceneLod> fileLods = sceneFile.lods();
+  SceneSpan<SceneMeshlet> fileMeshlets = sceneFile.meshlets();
+  for (const SceneMesh &mesh : sceneFile.meshes()) {
+    bool valid = (uint64_t)mesh.firstVertex + mesh.vertexCount <=
+                     sceneFile.vertices().count &&
+                 (uint64_t)mesh.firstIndex + mesh.indexCount <=
+                     sceneFile.indices().count &&
+                 (uint64_t)mesh.firstLod + mesh.lodCount <= fileLods.count &&
+                 (uint64_t)mesh.firstMeshlet + mesh.meshletCount <=
+                     fileMeshlets.count;
+    for (uint32_t i = 0; valid && i < mesh.lodCount; i++) {
+      const SceneLod &lod = fileLods[mesh.firstLod + i];
+      valid = (uint64_t)lod.firstIndex + lod.indexCount <=
+              sceneFile.indices().count;
+    }
+    for (uint32_t i = 0; valid && i < mesh.meshletCount; i++) {
+      const SceneMeshlet &meshlet = fileMeshlets[mesh.firstMeshlet + i];
+      valid = (uint64_t)meshlet.firstIndex + meshlet.indexCount <=
+              sceneFile.indices().count;
+    }
+    if (!valid) {
+      std::cout << "ERROR::SCENE::BAD_MESH: "
+                << &mesh - sceneFile.meshes().data << std::endl;
+      glfwTerminate();
+      return -1;
+    }
+  }
+  // the streamed texture behind each scene texture, NONE without bindless
+  std::vector<unsigned int> sceneTextureStreams;
+  std::vector<glm::uvec2> sceneTextures;
+  for (const SceneTexture &texture : sceneFile.textures()) {
+    const char *path = sceneFile.string(texture.path);
+    sceneTextureStreams.push_back(bindless ? textureStreamer.add(path)
+                                           : TextureStreamer::NONE);
+    if (!bindless)
+      sceneTextures.push_back(glm::uvec2(textureArrays.load(path), 0u));
+  }
+  // every texture's tail is in before the first frame; benchmarks load
+  // every level up front, so nothing streams while they are timed
+  streamedTextures.resize(textureStreamer.textureCount(), glm::uvec2(0u));
+  do {
+    if (benchmarkName)
+      for (unsigned int i = 0; i < textureStreamer.textureCount(); i++)
+        textureStreamer.request(i, 0);
+    textureStreamer.update(uploadMips, evictMips);
+    textureStreamer.sync();
+  } while (textureStreamer.pendingLoads() > 0);
+  for (unsigned int stream : sceneTextureStreams)
+    if (bindless)
+      sceneTextures.push_back(stream != TextureStreamer::NONE
+                                  ? streamedTextures[stream]
+                                  : glm::uvec2(0u));
+  auto sceneTexture = [&](uint32_t index) {
+    return index < sceneTextures.size() ? sceneTextures[index]
+                                        : glm::uvec2(0u);
+  };
 
   unsigned int cubeVAO;
   unsigned int lightVAO;
   unsigned int VBO;
+  unsigned int EBO;
 
   glGenVertexArrays(1, &cubeVAO);
   glGenBuffers(1, &VBO);
+  glGenBuffers(1, &EBO);
+
+  // straight from the mapped file, the format is the engine's vertex format
+  SceneSpan<SceneVertex> sceneVertices = sceneFile.vertices();
+  SceneSpan<uint32_t> sceneIndices = sceneFile.indices();
+
+  // levels of detail and meshlets: the file's, plus those built now for
+  // meshes that were converted without any. Built levels' indices follow
+  // the file's in the element buffer. meshLods and meshMeshlets hold every
+  // scene mesh's ranges of lodTable and meshletTable.
+  std::vector<SceneLod> lodTable;
+  std::vector<Lod> meshLods;
+  std::vector<uint32_t> lodIndices;
+  std::vector<SceneMeshlet> meshletTable;
+  std::vector<glm::uvec2> meshMeshlets;
+  {
+    MemoryTagScope tag(MemoryTag::Geometry);
+    meshletTable.assign(fileMeshlets.begin(), fileMeshlets.end());
+    MeshletBuilder meshletBuilder;
+    for (const SceneMesh &mesh : sceneFile.meshes()) {
+      if (mesh.meshletCount || mesh.indexCount == 0) {
+        meshMeshlets.push_back({mesh.firstMeshlet, mesh.meshletCount});
+        continue;
+      }
+      meshletBuilder.build(sceneVertices.data + mesh.firstVertex,
+                           mesh.vertexCount,
+                           sceneIndices.data + mesh.firstIndex,
+                           mesh.indexCount, mesh.firstIndex);
+      meshMeshlets.push_back({(unsigned int)meshletTable.size(),
+                              (unsigned int)meshletBuilder.meshlets.size()});
+      meshletTable.insert(meshletTable.end(),
+                          meshletBuilder.meshlets.begin(),
+                          meshletBuilder.meshlets.end());
+    }
+
+    lodTable.assign(fileLods.begin(), fileLods.end());
+    MeshLodBuilder lodBuilder;
+    for (const SceneMesh &mesh : sceneFile.meshes()) {
+      if (mesh.lodCount) {
+        meshLods.push_back({mesh.firstLod, mesh.lodCount, 0});
+        continue;
+      }
+      lodBuilder.build(sceneVertices.data + mesh.firstVertex,
+                       mesh.vertexCount, sceneIndices.data + mesh.firstIndex,
+                       mesh.indexCount);
+      meshLods.push_back({(unsigned int)lodTable.size(),
+                          lodBuilder.levelCount, 0});
+      lodTable.push_back({mesh.firstIndex, mesh.indexCount, 0.0f});
+      for (unsigned int level = 1; level < lodBuilder.levelCount; level++) {
+        const std::vector<uint32_t> &indices = lodBuilder.levels[level];
+        lodTable.push_back(
+            {(uint32_t)(sceneIndices.count + lodIndices.size()),
+             (uint32_t)indices.size(), lodBuilder.errors[level]});
+        lodIndices.insert(lodIndices.end(), indices.begin(), indices.end());
+      }
+    }
+  }
 
+  size_t indexCount = sceneIndices.count + lodIndices.size();
+  size_t vertexBytes = sceneVertices.count * sizeof(SceneVertex) +
+                       indexCount * sizeof(uint32_t);
   glBindBuffer(GL_ARRAY_BUFFER, VBO);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+  glBufferData(GL_ARRAY_BUFFER, sceneVertices.count * sizeof(SceneVertex),
+               sceneVertices.data, GL_STATIC_DRAW);
+  MemoryTracker::gpuAllocate(MemoryTag::Geometry, vertexBytes);
 
   glBindVertexArray(cubeVAO);
+  // the element buffer binding is VAO state
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(uint32_t),
+               nullptr, GL_STATIC_DRAW);
+  glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0,
+                  sceneIndices.count * sizeof(uint32_t), sceneIndices.data);
+  glBufferSubData(GL_ELEMENT_ARRAY_BUFFER,
+                  sceneIndices.count * sizeof(uint32_t),
+                  lodIndices.size() * sizeof(uint32_t), lodIndices.data());
 
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void *)0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(SceneVertex),
+                        (void *)offsetof(SceneVertex, position));
   glEnableVertexAttribArray(0);
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float),
-                        (void *)(3 * sizeof(float)));
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(SceneVertex),
+                        (void *)offsetof(SceneVertex, normal));
   glEnableVertexAttribArray(1);
-  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float),
-                        (void *)(6 * sizeof(float)));
+  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(SceneVertex),
+                        (void *)offsetof(SceneVertex, uv));
   glEnableVertexAttribArray(2);
+  // tangent with the bitangent's sign in w (location 11), for normal maps
+  glVertexAttribPointer(11, 4, GL_FLOAT, GL_FALSE, sizeof(SceneVertex),
+                        (void *)offsetof(SceneVertex, tangent));
+  glEnableVertexAttribArray(11);
+
+  // per instance model matrix (locations 3-6), material index (location 7)
+  // and normal matrix (locations 8-10) for the INSTANCING variants
+  struct InstanceData {
+    glm::mat4 model;
+    glm::vec4 normal[3];
+    unsigned int material;
+  };
+  // glMultiDrawElementsIndirect's command layout
+  struct DrawCommand {
+    unsigned int count;
+    unsigned int instanceCount;
+    unsigned int firstIndex;
+    int baseVertex;
+    unsigned int baseInstance;
+  };
+  unsigned int indirectBuffer;
+  size_t indirectBytes = 0;
+  glGenBuffers(1, &indirectBuffer);
+  unsigned int instanceVBO;
+  size_t instanceBytes = 0;
+  glGenBuffers(1, &instanceVBO);
+  glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+  for (unsigned int i = 0; i < 4; i++) {
+    glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                          (void *)(i * sizeof(glm::vec4)));
+    glEnableVertexAttribArray(3 + i);
+    glVertexAttribDivisor(3 + i, 1);
+  }
+  glVertexAttribIPointer(7, 1, GL_UNSIGNED_INT, sizeof(InstanceData),
+                         (void *)offsetof(InstanceData, material));
+  glEnableVertexAttribArray(7);
+  glVertexAttribDivisor(7, 1);
+  for (unsigned int i = 0; i < 3; i++) {
+    glVertexAttribPointer(8 + i, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                          (void *)(offsetof(InstanceData, normal) +
+                                   i * sizeof(glm::vec4)));
+    glEnableVertexAttribArray(8 + i);
+    glVertexAttribDivisor(8 + i, 1);
+  }
 
   glGenVertexArrays(1, &lightVAO);
   glBindVertexArray(lightVAO);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
   glBindBuffer(GL_ARRAY_BUFFER, VBO);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void *)0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(SceneVertex),
+                        (void *)offsetof(SceneVertex, position));
   glEnableVertexAttribArray(0);
 
+  // the fullscreen triangle is generated from gl_VertexID, but core profile
+  // still needs some VAO bound to draw
+  unsigned int fullscreenVAO;
+  glGenVertexArrays(1, &fullscreenVAO);
+
   // Setup Dear ImGui context
   IMGUI_CHECKVERSION();
+  ImGui::SetAllocatorFunctions(
+      [](size_t size, void *) {
+        return MemoryTracker::allocate(size, MemoryTag::UI);
+      },
+      [](void *p, void *) { MemoryTracker::release(p); });
   ImGui::CreateContext();
   ImGuiIO &io = ImGui::GetIO();
   io.ConfigFlags |=
@@ -205,16 +2119,303 @@ int main() {
   // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
   glEnable(GL_DEPTH_TEST);
-  glm::vec3 lightPos(1.2f, 1.0f, 2.0f);
+
+  Profiler profiler;
+  profiler.init();
+
+  // scene objects and lights are entities, the systems in the frame loop
+  // walk the store archetype by archetype
+  EntityStore sceneEntities;
+
+  // the flashlight follows the camera, the benchmark scene adds more lights
+  LightManager lightManager;
+  lightManager.init();
+  Entity flashlightEntity = sceneEntities.create(HasLight);
+  sceneEntities.light(flashlightEntity).type = Spot;
+  std::vector<Entity> benchmarkLights;
+
+  ClusterGrid clusters;
+  clusters.init(&shaderCache.getCompute("clusters.comp"));
+  HiZCulling hiz;
+  hiz.init(&shaderCache.getCompute("hiz_cull.comp"),
+           &shaderCache.getCompute("hiz_pyramid.comp"));
+  OcclusionQueries occlusion;
+  occlusion.init();
+  // occlusion results and visibility bits are kept per entity slot, a new
+  // renderable must not inherit those of the slot's last entity
+  auto createRenderable = [&](unsigned int components) {
+    Entity entity = sceneEntities.create(components);
+    occlusion.reset(entity.index);
+    hiz.reset(entity.index);
+    return entity;
+  };
+
+  ShadowMaps shadows;
+  shadows.init();
+  sceneEntities.light(flashlightEntity).castShadows = true;
+
+  bool benchmarkScene = false;
+  int benchmarkLightCount = 1000;
+  int sceneLightCount = -1;
+
+  // deferred shading lights every pixel once, so overdraw only costs the
+  // cheap G-buffer writes
+  bool deferredShading = startDeferred;
+  GBuffer gbuffer;
+
+  // a depth-only pass first means the expensive shading pass runs at most
+  // once per pixel, front-to-back sorting helps early-Z either way
+  bool depthPrepass = startPrepass;
+  bool sortFrontToBack = true;
+  QueryCounter fragmentInvocations;
+  bool pipelineStatistics = GLAD_GL_VERSION_4_6;
+  if (pipelineStatistics)
+    fragmentInvocations.init(GL_FRAGMENT_SHADER_INVOCATIONS);
+
+  MaterialTable materials;
+  materials.init();
+  std::vector<unsigned int> sceneMaterials;
+  // the streamed diffuse and specular texture of each material
+  std::vector<glm::uvec2> materialStreams;
+  auto sceneTextureStream = [&](uint32_t index) {
+    return index < sceneTextureStreams.size() ? sceneTextureStreams[index]
+                                              : TextureStreamer::NONE;
+  };
+  for (const SceneMaterial &material : sceneFile.materials()) {
+    sceneMaterials.push_back(materials.add(
+        sceneFile.string(material.name),
+        sceneTexture(material.diffuseTexture),
+        sceneTexture(material.specularTexture),
+        glm::make_vec3(material.diffuse), glm::make_vec3(material.specular),
+        material.shininess));
+    materialStreams.resize(materials.count(),
+                           glm::uvec2(TextureStreamer::NONE));
+    materialStreams[sceneMaterials.back()] =
+        glm::uvec2(sceneTextureStream(material.diffuseTexture),
+                   sceneTextureStream(material.specularTexture));
+  }
+  uint32_t floorIndex = sceneFile.findMaterial("Floor");
+  unsigned int floorMaterial =
+      floorIndex != SCENE_NONE ? sceneMaterials[floorIndex] : 0;
+  int selectedMaterial = 0;
+
+  // entities with all of these are drawn by the scene passes
+  const unsigned int renderable =
+      HasTransform | HasBounds | HasMesh | HasMaterial;
+  // glm::quat takes w first
+  const glm::quat noRotation(1.0f, 0.0f, 0.0f, 0.0f);
+  SceneSpan<SceneMesh> sceneMeshes = sceneFile.meshes();
+  auto sceneMesh = [&](uint32_t index) {
+    const SceneMesh &mesh = sceneMeshes[index];
+    // a single meshlet culls no better than the whole object
+    glm::uvec2 meshlets = meshMeshlets[index];
+    return Mesh{(int)mesh.firstIndex, (int)mesh.indexCount,
+                (int)mesh.firstVertex, meshlets.x,
+                meshlets.y > 1 ? meshlets.y : 0};
+  };
+  auto sceneBounds = [&](uint32_t index) {
+    const SceneMesh &mesh = sceneMeshes[index];
+    return Bounds{glm::make_vec3(mesh.center), mesh.radius};
+  };
+  // the floor and the lamp use the scene's first mesh
+  const Mesh cubeMesh = sceneMesh(0);
+  const Bounds cubeBounds = sceneBounds(0);
+
+  SceneSpan<SceneInstance> instances = sceneFile.instances();
+  sceneEntities.reserve(renderable | HasLod, instances.count);
+  // the scene instance behind each entity slot, SCENE_NONE for entities
+  // that do not come from the file
+  std::vector<uint32_t> entityInstance;
+  // a renderable for a scene or world instance, the null entity if the
+  // instance refers to a mesh or material the scene does not have
+  auto createInstance = [&](const SceneInstance &instance) {
+    if (instance.mesh >= sceneMeshes.count ||
+        instance.material >= sceneMaterials.size())
+      return Entity();
+    const float *r = instance.rotation;
+    Entity entity = createRenderable(renderable | HasLod);
+    sceneEntities.setTransform(entity, glm::make_vec3(instance.position),
+                               glm::quat(r[3], r[0], r[1], r[2]),
+                               glm::make_vec3(instance.scale));
+    sceneEntities.bounds(entity) = sceneBounds(instance.mesh);
+    sceneEntities.mesh(entity) = sceneMesh(instance.mesh);
+    sceneEntities.lod(entity) = meshLods[instance.mesh];
+    sceneEntities.material(entity) = sceneMaterials[instance.material];
+    return entity;
+  };
+  for (const SceneInstance &instance : instances) {
+    Entity entity = createInstance(instance);
+    if (!sceneEntities.valid(entity)) {
+      std::cout << "ERROR::SCENE::BAD_INSTANCE: " << &instance - instances.data
+                << std::endl;
+      continue;
+    }
+    if (entity.index >= entityInstance.size()) {
+      MemoryTagScope tag(MemoryTag::Scene);
+      entityInstance.resize(entity.index + 1, SCENE_NONE);
+    }
+    entityInstance[entity.index] = &instance - instances.data;
+  }
+  // While the camera is inside their grid, the scene's potentially visible
+  // sets replace occlusion culling for the instances they were baked for.
+  // Other entities, like the benchmark floor, still go through it.
+  PotentiallyVisibleSets pvs;
+  bool pvsCulling = pvs.load(sceneFile) && pvs.loaded();
+  unsigned int pvsCulled = 0;
+  unsigned int pvsBaseline = 0;
+  const unsigned char *pvsVisible = nullptr;
+  auto pvsInstance = [&](unsigned int object) {
+    return pvsVisible && object < entityInstance.size()
+               ? entityInstance[object]
+               : SCENE_NONE;
+  };
+  // Sectors of a world file load around the camera on a worker thread and
+  // turn into entities a budgeted number per frame; the entities of each
+  // sector are kept to destroy them again when it is released.
+  WorldStreamer world;
+  std::vector<std::vector<Entity>> worldEntities;
+  glm::vec3 cameraVelocity(0.0f);
+  glm::vec3 lastCameraPosition = camera.position;
+  if (worldPath && world.open(worldPath)) {
+    MemoryTagScope tag(MemoryTag::Streaming);
+    worldEntities.resize(world.sectorCount());
+    // a row of the archetype (ten transform floats), its slot and the
+    // entity kept here, plus its entry in the frame's instance array
+    world.residentBytesPerInstance =
+        10 * sizeof(float) + sizeof(Bounds) + sizeof(Mesh) +
+        sizeof(unsigned int) + sizeof(Lod) + 3 * sizeof(Entity) +
+        sizeof(InstanceData);
+  }
+  auto commitWorld = [&](uint32_t sector, const SceneInstance *instances,
+                         unsigned int count) {
+    MemoryTagScope tag(MemoryTag::Streaming);
+    std::vector<Entity> &entities = worldEntities[sector];
+    for (unsigned int i = 0; i < count; i++) {
+      Entity entity = createInstance(instances[i]);
+      if (!sceneEntities.valid(entity)) {
+        std::cout << "ERROR::WORLD::BAD_INSTANCE: sector " << sector
+                  << std::endl;
+        continue;
+      }
+      entities.push_back(entity);
+    }
+  };
+  auto releaseWorld = [&](uint32_t sector, unsigned int count) {
+    std::vector<Entity> &entities = worldEntities[sector];
+    for (unsigned int i = 0; i < count && !entities.empty(); i++) {
+      sceneEntities.destroy(entities.back());
+      entities.pop_back();
+    }
+    if (entities.empty())
+      std::vector<Entity>().swap(entities);
+  };
+  for (const SceneLight &sceneLight : sceneFile.lights()) {
+    Entity entity = sceneEntities.create(HasLight);
+    Light &light = sceneEntities.light(entity);
+    light.type = sceneLight.type == Spot ? Spot : Point;
+    light.castShadows = sceneLight.castShadows;
+    light.position = glm::make_vec3(sceneLight.position);
+    light.direction = glm::make_vec3(sceneLight.direction);
+    light.ambient = glm::make_vec3(sceneLight.ambient);
+    light.diffuse = glm::make_vec3(sceneLight.diffuse);
+    light.specular = glm::make_vec3(sceneLight.specular);
+    light.constant = sceneLight.attenuation[0];
+    light.linear = sceneLight.attenuation[1];
+    light.quadratic = sceneLight.attenuation[2];
+    light.cutOff = sceneLight.cutOff;
+    light.outerCutOff = sceneLight.outerCutOff;
+  }
+  // The lamp has its own shader, so it is not a renderable. It hangs off a
+  // pivot on the first cube in the scene graph and can orbit it.
+  ThreadPool threadPool;
+  SceneGraph sceneGraph;
+  unsigned int lampPivot =
+      sceneGraph.add(SceneGraph::NONE,
+                     instances.count ? glm::make_vec3(instances[0].position)
+                                     : glm::vec3(0.0f),
+                     noRotation);
+  unsigned int lampNode = sceneGraph.add(
+      lampPivot, glm::vec3(1.2f, 1.0f, 2.0f), noRotation, glm::vec3(0.2f));
+  Entity lampEntity = sceneEntities.create(HasMesh);
+  sceneEntities.mesh(lampEntity) = cubeMesh;
+  float lampOrbitSpeed = 0.0f;
+  float lampOrbit = 0.0f;
+  // the floor of cubes only exists in the benchmark scene
+  std::vector<Entity> floorEntities;
+
+  // draws refer to their instance in the frame's transform output, and to
+  // their entity's slot for occlusion queries
+  struct DrawItem {
+    unsigned int instance;
+    float distance;
+    Mesh mesh;
+    unsigned int object;
+    glm::vec4 sphere;
+  };
+  bool instancedDraws = startHiz;
+  bool shadowsEnabled = true;
+  // a level of detail is drawn while its error covers at most lodThreshold
+  // pixels, see selectLod
+  float lodThreshold = 1.0f;
+  float lodHysteresis = 0.25f;
+  unsigned int lodTriangles = 0;
+  unsigned int lodFullTriangles = 0;
+  // with instanced draws, visible objects with meshlets only draw the
+  // meshlets in the frustum that face the camera
+  bool meshletCulling = true;
+  unsigned int meshletsTested = 0;
+  unsigned int meshletsCulled = 0;
+  // with instanced draws, the GPU culls the objects in the frustum against
+  // a depth pyramid and writes their indirect draws itself
+  bool hizCulling = startHiz;
+  // with bindless textures, only the mip levels visible objects sample are
+  // resident; benchmarks keep every level
+  bool textureStreaming = !benchmarkName;
+  // objects whose bounding box was hidden by the depth buffer of an earlier
+  // frame are not drawn
+  bool occlusionCulling = true;
+  // the nearest visible objects are rasterized on the CPU as occluders,
+  // the other visible objects are drawn only if they are not behind them
+  bool softwareCulling = false;
+  SoftwareOcclusion softwareOcclusion;
+  const unsigned int maxOccluders = 64;
+  const unsigned int maxOccluderTriangles = 1024;
+  unsigned int softwareOccluded = 0;
+
+  // per frame lists live in the frame arena, so a steady state frame does
+  // not touch the heap; debug builds fail benchmarks with frames that still do
+  FrameArena frameArena = [] {
+    MemoryTagScope tag(MemoryTag::Frame);
+    return FrameArena();
+  }();
+  size_t frameAllocations = 0;
+  int allocatingFrames = 0;
+
+  // shader variants are looked up again only when a permutation changes,
+  // building the variant keys allocates
+  int shaderPermutation = -1;
+  Shader *gbufferVariant = nullptr;
+  Shader *depthVariant = nullptr;
+  Shader *lightVariant = nullptr;
+  Shader *cubeVariant = nullptr;
+  Shader *deferredVariant = nullptr;
+  Shader *occlusionVariant = nullptr;
+
+  Benchmark benchmark(benchmarkName ? benchmarkName : "");
+  int frameIndex = 0;
+  float benchmarkFrameMs = 0.0f;
+  if (benchmarkName) {
+    benchmarkScene = true;
+    glfwSwapInterval(0);
+  }
+
   glm::vec3 lightDir(-0.2f, -1.0f, -0.3f);
+  float sunIntensity = 0.4f;
+  bool shadowCasterScene = benchmarkScene;
   glm::vec3 lightColor(1.0f);
   float lightDiffuseIntensity = 0.5f;
   float lightAmbientIntensity = 0.2f;
   float lightSpecularIntensity = 1.0f;
-  glm::vec3 cubeAmbientColor(1.0f, 0.5f, 0.31f);
-  glm::vec3 cubeDiffuseColor(1.0f, 0.5f, 0.31f);
-  glm::vec3 cubeSpecularColor(0.5f);
-  float cubeShininess = 32.0f;
   while (!glfwWindowShouldClose(window)) {
     float currentFrame = glfwGetTime();
     deltaTime = currentFrame - lastFrame;
@@ -222,6 +2423,20 @@ int main() {
 
     glfwPollEvents();
     handleMovement(window);
+    size_t allocationsAtFrameStart = MemoryTracker::threadAllocationCount();
+    MemoryTracker::update(deltaTime);
+    frameArena.beginFrame();
+    profiler.beginFrame();
+    profiler.begin("Frame");
+
+    if (benchmarkName) {
+      benchmarkCamera(frameIndex / 60.0f);
+      // skip warmup frames so shader compilation does not skew the result
+      if (frameIndex >= 100)
+        benchmarkFrameMs += deltaTime * 1000.0f;
+      if (++frameIndex == benchmarkFrames + 100)
+        glfwSetWindowShouldClose(window, true);
+    }
 
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
@@ -237,54 +2452,655 @@ int main() {
     projection = glm::perspective(glm::radians(camera.fov), WIDTH / HEIGHT,
                                   0.1f, 100.0f);
 
+    if (benchmarkScene != (floorEntities.size() > 0)) {
+      for (Entity tile : floorEntities)
+        sceneEntities.destroy(tile);
+      floorEntities.clear();
+      for (int x = -16; x < 16 && benchmarkScene; x++) {
+        for (int z = -16; z < 16; z++) {
+          Entity tile = createRenderable(renderable);
+          sceneEntities.setTransform(tile, glm::vec3(x, -4.0f, z), noRotation);
+          sceneEntities.bounds(tile) = cubeBounds;
+          sceneEntities.mesh(tile) = cubeMesh;
+          sceneEntities.material(tile) = floorMaterial;
+          floorEntities.push_back(tile);
+        }
+      }
+    }
+
+    if (lampOrbitSpeed != 0.0f) {
+      lampOrbit += lampOrbitSpeed * deltaTime;
+      sceneGraph.setRotation(
+          lampPivot, glm::angleAxis(lampOrbit, glm::vec3(0.0f, 1.0f, 0.0f)));
+    }
+    sceneGraph.update(&threadPool);
+    profiler.setCounter("Scene Nodes Updated", sceneGraph.updatedNodes);
+
+    // world streaming system: sectors ahead of the camera load first
+    if (world.isOpen()) {
+      profiler.begin("World Streaming");
+      if (deltaTime > 0.0f)
+        cameraVelocity = glm::mix(
+            cameraVelocity,
+            (camera.position - lastCameraPosition) / deltaTime, 0.2f);
+      lastCameraPosition = camera.position;
+      world.update(camera.position, cameraVelocity, commitWorld,
+                   releaseWorld);
+      // committed and released instances add and remove shadow casters
+      const WorldStreamer::FrameStats &streamed = world.lastFrame;
+      if (streamed.committedInstances + streamed.releasedInstances > 0)
+        shadows.casterRevision++;
+      profiler.end();
+      profiler.setCounter("Streamed Sectors", world.residentSectors());
+      profiler.setCounter("Streaming KB", world.usedBytes() / 1024);
+    }
+
+    // transform system: matrices of every renderable, archetype after
+    // archetype, straight into the frame's instance array
+    FrameVector<InstanceData> sceneInstances(sceneEntities.count(renderable),
+                                             frameArena.resource());
+    unsigned int instanceCount = 0;
+    sceneEntities.each(renderable, [&](Archetype &archetype) {
+      InstanceData *out = sceneInstances.data() + instanceCount;
+      archetype.transforms.compute(0, archetype.size(), &out->model,
+                                   out->normal, sizeof(InstanceData));
+      for (unsigned int i = 0; i < archetype.size(); i++)
+        out[i].material = archetype.materials[i];
+      instanceCount += archetype.size();
+    });
+
+    // culling system: bounding spheres against the view frustum. Culled
+    // objects can still cast shadows, so their draws go after the visible
+    // ones instead of being dropped. Entities with levels of detail draw
+    // the coarsest level whose error stays under lodThreshold pixels.
+    Frustum frustum(projection * view);
+    // pixels covered by one unit at distance 1
+    float pixelsPerUnit = projection[1][1] * 0.5f * framebufferSize.y;
+    lodTriangles = 0;
+    lodFullTriangles = 0;
+    occlusion.beginFrame();
+    bool hizDraws = instancedDraws && hizCulling && hiz.computeAvailable;
+    int pvsCell = pvsCulling ? pvs.cellAt(camera.position) : -1;
+    pvsVisible = pvsCell >= 0 ? pvs.select(pvsCell) : nullptr;
+    pvsCulled = 0;
+    FrameVector<DrawItem> opaqueDraws(frameArena.resource());
+    FrameVector<DrawItem> culledDraws(frameArena.resource());
+    opaqueDraws.reserve(instanceCount);
+    culledDraws.reserve(instanceCount);
+    unsigned int nextInstance = 0;
+    // a level switch changes what the shadow maps draw of an object
+    bool lodSwitched = false;
+    sceneEntities.each(renderable, [&](Archetype &archetype) {
+      for (unsigned int i = 0; i < archetype.size(); i++, nextInstance++) {
+        glm::vec4 sphere = worldSphere(sceneInstances[nextInstance].model,
+                                       archetype.bounds[i]);
+        glm::vec3 offset = glm::vec3(sphere) - camera.position;
+        DrawItem draw = {nextInstance, glm::dot(offset, offset),
+                         archetype.meshes[i], archetype.entities[i].index,
+                         sphere};
+        bool visible = frustum.sphereVisible(glm::vec3(sphere), sphere.w);
+        uint32_t baked = pvsInstance(draw.object);
+        if (visible && baked != SCENE_NONE) {
+          visible = pvsVisible[baked];
+          pvsCulled += !visible;
+        } else if (visible && occlusionCulling && !hizDraws) {
+          visible = !occlusion.cull(draw.object,
+                                    sceneInstances[nextInstance].model,
+                                    archetype.bounds[i], sphere,
+                                    camera.position, 0.1f);
+        }
+        if (archetype.components & HasLod) {
+          Lod &lod = archetype.lods[i];
+          float radius = archetype.bounds[i].radius;
+          float scale = radius > 0.0f ? sphere.w / radius : 1.0f;
+          float distance =
+              std::max(std::sqrt(draw.distance) - sphere.w, 0.1f);
+          const SceneLod *levels = lodTable.data() + lod.first;
+          unsigned int level = selectLod(levels, lod.count, lod.level,
+                                         pixelsPerUnit * scale / distance,
+                                         lodThreshold, lodHysteresis);
+          lodSwitched |= level != lod.level;
+          lod.level = level;
+          draw.mesh.first = levels[lod.level].firstIndex;
+          draw.mesh.count = levels[lod.level].indexCount;
+          // meshlets split level 0 only
+          if (lod.level != 0)
+            draw.mesh.meshletCount = 0;
+        }
+        if (visible) {
+          lodTriangles += draw.mesh.count / 3;
+          lodFullTriangles += archetype.meshes[i].count / 3;
+          opaqueDraws.push_back(draw);
+        } else {
+          culledDraws.push_back(draw);
+        }
+      }
+    });
+    if (lodSwitched)
+      shadows.casterRevision++;
+
+    // software occlusion culling system: the occluders are the nearest
+    // visible draws of small enough meshes, at the level of detail they are
+    // drawn with. Hidden draws join the culled ones before anything is
+    // submitted.
+    softwareOccluded = 0;
+    if (softwareCulling) {
+      profiler.begin("Software Occlusion");
+      softwareOcclusion.clear();
+      FrameVector<unsigned int> occluders(frameArena.resource());
+      occluders.reserve(opaqueDraws.size());
+      for (unsigned int i = 0; i < opaqueDraws.size(); i++)
+        if ((unsigned int)opaqueDraws[i].mesh.count / 3 <= maxOccluderTriangles)
+          occluders.push_back(i);
+      auto nearer = [&](unsigned int a, unsigned int b) {
+        return opaqueDraws[a].distance < opaqueDraws[b].distance;
+      };
+      if (occluders.size() > maxOccluders) {
+        std::nth_element(occluders.begin(), occluders.begin() + maxOccluders,
+                         occluders.end(), nearer);
+        occluders.resize(maxOccluders);
+      }
+      // front to back, so farther triangles find their tiles already filled
+      std::sort(occluders.begin(), occluders.end(), nearer);
+      FrameVector<unsigned char> isOccluder(opaqueDraws.size(), 0,
+                                            frameArena.resource());
+      glm::mat4 viewProjection = projection * view;
+      for (unsigned int i : occluders) {
+        const DrawItem &draw = opaqueDraws[i];
+        // built levels of detail follow the file's indices
+        const uint32_t *indices =
+            (size_t)draw.mesh.first < sceneIndices.count
+                ? sceneIndices.data + draw.mesh.first
+                : lodIndices.data() + (draw.mesh.first - sceneIndices.count);
+        softwareOcclusion.addOccluder(
+            viewProjection * sceneInstances[draw.instance].model,
+            sceneVertices.data + draw.mesh.baseVertex, indices,
+            draw.mesh.count, 0.1f);
+        isOccluder[i] = 1;
+      }
+      softwareOcclusion.rasterize(&threadPool);
+      unsigned int kept = 0;
+      for (unsigned int i = 0; i < opaqueDraws.size(); i++) {
+        const DrawItem &draw = opaqueDraws[i];
+        if (isOccluder[i] || pvsInstance(draw.object) != SCENE_NONE ||
+            softwareOcclusion.visible(viewProjection, draw.sphere, 0.1f))
+          opaqueDraws[kept++] = draw;
+        else
+          culledDraws.push_back(draw);
+      }
+      softwareOccluded = opaqueDraws.size() - kept;
+      opaqueDraws.resize(kept);
+      profiler.end();
+    }
+    profiler.setCounter("Software Occluded", softwareOccluded);
+    profiler.setCounter("Occluder Triangles",
+                        softwareCulling ? softwareOcclusion.triangleCount()
+                                        : 0);
+    unsigned int visibleDraws = opaqueDraws.size();
+    auto sameMesh = [](const Mesh &a, const Mesh &b) {
+      return a.first == b.first && a.baseVertex == b.baseVertex;
+    };
+    if (instancedDraws) {
+      // instanced draws need the draws of a mesh (and level) next to each
+      // other, they are sorted front to back within each mesh
+      auto byMesh = [&](const DrawItem &a, const DrawItem &b) {
+        if (!sameMesh(a.mesh, b.mesh))
+          return a.mesh.first != b.mesh.first
+                     ? a.mesh.first < b.mesh.first
+                     : a.mesh.baseVertex < b.mesh.baseVertex;
+        return sortFrontToBack && a.distance < b.distance;
+      };
+      std::sort(opaqueDraws.begin(), opaqueDraws.end(), byMesh);
+      std::sort(culledDraws.begin(), culledDraws.end(), byMesh);
+    } else if (sortFrontToBack) {
+      std::sort(opaqueDraws.begin(), opaqueDraws.end(),
+                [](const DrawItem &a, const DrawItem &b) {
+                  return a.distance < b.distance;
+                });
+    }
+    opaqueDraws.insert(opaqueDraws.end(), culledDraws.begin(),
+                       culledDraws.end());
+    profiler.setCounter("Culled Objects", culledDraws.size());
+    // what the draw count would be without the sets
+    pvsBaseline = visibleDraws + pvsCulled;
+    profiler.setCounter("PVS Culled", pvsCulled);
+    profiler.setCounter("LOD Triangles", lodTriangles);
+    profiler.setCounter("LOD Triangles Saved",
+                        lodFullTriangles - lodTriangles);
+
+    // meshlet culling system: the visible pass turns into one multi-draw,
+    // a command per run of the same mesh as below and, for objects with
+    // meshlets, a command per run of consecutive surviving meshlets
+    FrameVector<DrawCommand> drawCommands(frameArena.resource());
+    bool meshletDraws = instancedDraws && meshletCulling && !hizDraws;
+    meshletsTested = 0;
+    meshletsCulled = 0;
+    if (meshletDraws) {
+      FrameVector<unsigned int> meshletOffsets(visibleDraws + 1, 0,
+                                               frameArena.resource());
+      for (unsigned int i = 0; i < visibleDraws; i++)
+        meshletOffsets[i + 1] =
+            meshletOffsets[i] + opaqueDraws[i].mesh.meshletCount;
+      meshletsTested = meshletOffsets[visibleDraws];
+      FrameVector<unsigned char> meshletVisible(meshletsTested,
+                                                frameArena.resource());
+      threadPool.parallelFor(
+          visibleDraws, 64, [&](unsigned int begin, unsigned int end) {
+            for (unsigned int i = begin; i < end; i++) {
+              const DrawItem &draw = opaqueDraws[i];
+              if (draw.mesh.meshletCount)
+                cullMeshlets(meshletTable.data() + draw.mesh.firstMeshlet,
+                             draw.mesh.meshletCount,
+                             sceneInstances[draw.instance].model, frustum,
+                             camera.position,
+                             meshletVisible.data() + meshletOffsets[i]);
+            }
+          });
+
+      drawCommands.reserve(visibleDraws + meshletsTested);
+      unsigned int end;
+      for (unsigned int begin = 0; begin < visibleDraws; begin = end) {
+        const Mesh &mesh = opaqueDraws[begin].mesh;
+        if (mesh.meshletCount == 0) {
+          for (end = begin + 1; end < visibleDraws &&
+                                sameMesh(opaqueDraws[end].mesh, mesh);
+               end++)
+            ;
+          drawCommands.push_back({(unsigned int)mesh.count, end - begin,
+                                  (unsigned int)mesh.first, mesh.baseVertex,
+                                  begin});
+          continue;
+        }
+        end = begin + 1;
+        size_t objectCommands = drawCommands.size();
+        for (unsigned int m = 0; m < mesh.meshletCount; m++) {
+          if (!meshletVisible[meshletOffsets[begin] + m]) {
+            meshletsCulled++;
+            continue;
+          }
+          const SceneMeshlet &meshlet = meshletTable[mesh.firstMeshlet + m];
+          if (drawCommands.size() > objectCommands &&
+              drawCommands.back().firstIndex + drawCommands.back().count ==
+                  meshlet.firstIndex)
+            drawCommands.back().count += meshlet.indexCount;
+          else
+            drawCommands.push_back({meshlet.indexCount, 1,
+                                    meshlet.firstIndex, mesh.baseVertex,
+                                    begin});
+        }
+      }
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+      glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                   drawCommands.size() * sizeof(DrawCommand),
+                   drawCommands.data(), GL_STREAM_DRAW);
+      MemoryTracker::gpuRelease(MemoryTag::Geometry, indirectBytes);
+      indirectBytes = drawCommands.size() * sizeof(DrawCommand);
+      MemoryTracker::gpuAllocate(MemoryTag::Geometry, indirectBytes);
+    }
+    profiler.setCounter("Meshlets Tested", meshletsTested);
+    profiler.setCounter("Meshlets Culled", meshletsCulled);
+
+    // draw-building system: the first `count` draws of the list, instanced
+    // draws make one call per run of the same mesh. Camera passes draw
+    // objects whose occlusion result is not back yet `conditional`ly on it.
+    auto drawScene = [&](const Shader &shader, unsigned int count,
+                         bool conditional) {
+      if (instancedDraws) {
+        unsigned int end;
+        for (unsigned int begin = 0; begin < count; begin = end) {
+          const Mesh &mesh = opaqueDraws[begin].mesh;
+          for (end = begin + 1;
+               end < count && sameMesh(opaqueDraws[end].mesh, mesh); end++)
+            ;
+          drawMeshInstanced(mesh, end - begin, begin);
+        }
+        return;
+      }
+      for (unsigned int i = 0; i < count; i++) {
+        const DrawItem &draw = opaqueDraws[i];
+        const InstanceData &instance = sceneInstances[draw.instance];
+        shader.setMat4("model", instance.model);
+        shader.setUInt("materialIndex", instance.material);
+        // queries of objects the sets cover are stale, they are not read
+        GLuint query =
+            conditional && occlusionCulling &&
+                    pvsInstance(draw.object) == SCENE_NONE
+                ? occlusion.pending(draw.object)
+                : 0;
+        if (query)
+          glBeginConditionalRender(query, GL_QUERY_NO_WAIT);
+        drawMesh(draw.mesh);
+        if (query)
+          glEndConditionalRender();
+      }
+    };
+    auto drawVisible = [&](const Shader &shader) {
+      if (hizDraws) {
+        hiz.draw();
+        return;
+      }
+      if (!meshletDraws) {
+        drawScene(shader, visibleDraws, true);
+        return;
+      }
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+      glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr,
+                                  drawCommands.size(), 0);
+    };
+    auto drawCasters = [&](const Shader &shader) {
+      drawScene(shader, opaqueDraws.size(), false);
+    };
+
+    if (instancedDraws) {
+      // the kernel output already has the instance layout, it only needs
+      // gathering when culling or sorting reordered the draws
+      const InstanceData *instances = sceneInstances.data();
+      FrameVector<InstanceData> sorted(frameArena.resource());
+      bool reordered = false;
+      for (unsigned int i = 0; i < opaqueDraws.size() && !reordered; i++)
+        reordered = opaqueDraws[i].instance != i;
+      if (reordered) {
+        sorted.reserve(opaqueDraws.size());
+        for (const DrawItem &draw : opaqueDraws)
+          sorted.push_back(sceneInstances[draw.instance]);
+        instances = sorted.data();
+      }
+      glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+      glBufferData(GL_ARRAY_BUFFER, opaqueDraws.size() * sizeof(InstanceData),
+                   instances, GL_STREAM_DRAW);
+      MemoryTracker::gpuRelease(MemoryTag::Geometry, instanceBytes);
+      instanceBytes = opaqueDraws.size() * sizeof(InstanceData);
+      MemoryTracker::gpuAllocate(MemoryTag::Geometry, instanceBytes);
+    }
+    if (hizDraws) {
+      // the visible draws go to the GPU one per instance, in instance order
+      FrameVector<HiZCulling::Draw> hizList(frameArena.resource());
+      hizList.reserve(visibleDraws);
+      unsigned int objectCount = 0;
+      for (unsigned int i = 0; i < visibleDraws; i++) {
+        const DrawItem &draw = opaqueDraws[i];
+        hizList.push_back({draw.sphere, (unsigned int)draw.mesh.count,
+                           (unsigned int)draw.mesh.first,
+                           draw.mesh.baseVertex, draw.object});
+        objectCount = std::max(objectCount, draw.object + 1);
+      }
+      hiz.upload(hizList.data(), visibleDraws, objectCount);
+    } else {
+      hiz.candidates = 0;
+    }
+    profiler.setCounter("Hi-Z Candidates", hiz.candidates);
+
+    // texture streaming system: the finest level a visible object samples
+    // its textures at, from the size its bounding sphere projects to with
+    // the texture spread over the sphere's diameter. Materials pick up the
+    // handles of replaced textures before they are uploaded.
+    if (bindless) {
+      profiler.begin("Texture Streaming");
+      if (textureStreaming) {
+        for (const DrawItem &draw : opaqueDraws) {
+          glm::uvec2 streams =
+              materialStreams[sceneInstances[draw.instance].material];
+          float distance =
+              std::max(std::sqrt(draw.distance) - draw.sphere.w, 0.1f);
+          float pixels = 2.0f * draw.sphere.w * pixelsPerUnit / distance;
+          for (int i = 0; i < 2; i++)
+            if (streams[i] != TextureStreamer::NONE)
+              textureStreamer.request(
+                  streams[i], textureStreamer.levelFor(streams[i], pixels));
+        }
+      } else {
+        // every level of every texture, as far as the budget goes
+        for (unsigned int i = 0; i < textureStreamer.textureCount(); i++)
+          textureStreamer.request(i, 0);
+      }
+      textureStreamer.update(uploadMips, evictMips);
+      for (unsigned int i = 0; i < materials.count(); i++) {
+        glm::uvec2 streams = materialStreams[i];
+        glm::uvec4 textures = materials.get(i).textures;
+        if (streams.x != TextureStreamer::NONE)
+          textures = glm::uvec4(streamedTextures[streams.x], textures.z,
+                                textures.w);
+        if (streams.y != TextureStreamer::NONE)
+          textures = glm::uvec4(textures.x, textures.y,
+                                streamedTextures[streams.y]);
+        if (textures != materials.get(i).textures) {
+          materials.edit(i).textures = textures;
+          materials.markDirty(i);
+        }
+      }
+      profiler.end();
+      profiler.setCounter("Texture Streaming KB",
+                          textureStreamer.usedBytes() / 1024);
+      profiler.setCounter("Mip Levels Uploaded",
+                          textureStreamer.lastFrame.uploadedLevels);
+    }
+    materials.upload();
+    profiler.setCounter("Materials Uploaded", materials.uploadedLastFrame);
+
+    if (bindless) {
+      // only the handles of materials drawn this frame need to be resident
+      bindlessTextures.update();
+      FrameVector<bool> usedMaterials(materials.count(), false,
+                                      frameArena.resource());
+      for (const InstanceData &instance : sceneInstances)
+        usedMaterials[instance.material] = true;
+      for (unsigned int i = 0; i < materials.count(); i++) {
+        if (!usedMaterials[i])
+          continue;
+        const GpuMaterial &material = materials.get(i);
+        bindlessTextures.touch(
+            glm::uvec2(material.textures.x, material.textures.y));
+        bindlessTextures.touch(
+            glm::uvec2(material.textures.z, material.textures.w));
+      }
+      profiler.setCounter("Resident Textures",
+                          bindlessTextures.residentCount());
+    }
+
     glm::vec3 lightDiffuseColor = lightColor * lightDiffuseIntensity;
     glm::vec3 lightAmbientColor = lightDiffuseColor * lightAmbientIntensity;
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, diffuseMap);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, specularMap);
+
+    int wantedLights = benchmarkScene ? benchmarkLightCount : 0;
+    if (wantedLights != sceneLightCount) {
+      for (Entity light : benchmarkLights)
+        sceneEntities.destroy(light);
+      benchmarkLights.clear();
+      for (const Light &light : LightManager::scatter(
+               wantedLights, glm::vec3(-16.0f, -3.0f, -16.0f),
+               glm::vec3(16.0f, 1.0f, 16.0f))) {
+        Entity entity = sceneEntities.create(HasLight);
+        sceneEntities.light(entity) = light;
+        benchmarkLights.push_back(entity);
+      }
+      sceneLightCount = wantedLights;
+    }
+    Light &flashlight = sceneEntities.light(flashlightEntity);
+    flashlight.position = camera.position;
+    flashlight.direction = camera.frontFace;
+    flashlight.ambient = lightAmbientColor;
+    flashlight.diffuse = lightDiffuseColor;
+    flashlight.specular = glm::vec3(lightSpecularIntensity);
+    flashlight.constant = flashlightAttenuation.x;
+    flashlight.linear = flashlightAttenuation.y;
+    flashlight.quadratic = flashlightAttenuation.z;
+    flashlight.cutOff = glm::cos(glm::radians(flashlightCutOff));
+    flashlight.outerCutOff = glm::cos(glm::radians(flashlightOuterCutOff));
+
+    // light system: the frame's light list is every light entity
+    lightManager.lights.clear();
+    sceneEntities.each(HasLight, [&](Archetype &archetype) {
+      lightManager.lights.insert(lightManager.lights.end(),
+                                 archetype.lights.begin(),
+                                 archetype.lights.end());
+    });
+
+    // the baked variant only holds while the flashlight is the only light
+    // with its parameters and they still match what was baked
+    lightConstants.beginFrame(lightManager.sharedParameters());
+    setLightConstants();
+    bool specializedLighting = lightConstants.specialized();
+    profiler.setCounter("Specialized Lighting", specializedLighting);
+    profiler.setCounter("Specialization Switches", lightConstants.switches);
+
+    // pick this frame's permutations, all of them were prewarmed
+    int permutation =
+        instancedDraws | shadowsEnabled << 1 | specializedLighting << 2;
+    if (permutation != shaderPermutation) {
+      shaderPermutation = permutation;
+      ShaderDefines instancing = {{"INSTANCING", instancedDraws ? "1" : "0"}};
+      ShaderDefines shadowDefines = {{"SHADOWS", shadowsEnabled ? "1" : "0"}};
+      ShaderDefines lightDefines = lightConstants.defines();
+      ShaderDefines shadingDefines = instancing;
+      shadingDefines.insert(shadowDefines.begin(), shadowDefines.end());
+      shadingDefines.insert(lightDefines.begin(), lightDefines.end());
+      ShaderDefines deferredDefines = shadowDefines;
+      deferredDefines.insert(lightDefines.begin(), lightDefines.end());
+
+      gbufferVariant =
+          &shaderCache.get("cube.vert", "gbuffer.frag", instancing);
+      depthVariant = &shaderCache.get("light.vert", "depth.frag", instancing);
+      lightVariant =
+          &shaderCache.get("light.vert", "light.frag", {{"INSTANCING", "0"}});
+      cubeVariant = &shaderCache.get("cube.vert", "cube.frag", shadingDefines);
+      deferredVariant = &shaderCache.get("fullscreen.vert", "deferred.frag",
+                                         deferredDefines);
+      occlusionVariant =
+          &shaderCache.get("light.vert", "depth.frag", {{"INSTANCING", "0"}});
+    }
+    Shader &gbufferShader = *gbufferVariant;
+    Shader &depthShader = *depthVariant;
+    Shader &lightShader = *lightVariant;
+    Shader &cubeShader = *cubeVariant;
+    Shader &deferredShader = *deferredVariant;
+
+    // the sun uses lightDir and shares the flashlight's color
+    auto setSunUniforms = [&](const Shader &shader) {
+      shader.setVec3("sun.direction", lightDir);
+      shader.setVec3("sun.ambient", lightColor * sunIntensity * 0.2f);
+      shader.setVec3("sun.diffuse", lightColor * sunIntensity);
+      shader.setVec3("sun.specular", lightColor * sunIntensity * 0.5f);
+      shadows.setUniforms(shader);
+    };
+
+    profiler.setCounter("Late Shader Compiles", shaderCache.lateCompiles);
+
+    profiler.begin("Shadow Pass");
+    if (benchmarkScene != shadowCasterScene) {
+      shadows.casterRevision++;
+      shadowCasterScene = benchmarkScene;
+    }
+    if (shadowsEnabled) {
+      glBindVertexArray(cubeVAO);
+      shadows.update(view, glm::radians(camera.fov), WIDTH / HEIGHT, 0.1f,
+                     lightDir, lightManager.lights, depthShader, drawCasters);
+    }
+    profiler.setCounter("Shadow Maps Rendered",
+                        shadowsEnabled ? shadows.cascadesRendered +
+                                             shadows.spotsRendered
+                                       : 0);
+    profiler.end();
+
+    profiler.begin("Light Culling");
+    lightManager.upload();
+    clusters.setProjection(projection, 0.1f, 100.0f, framebufferSize);
+    clusters.cull(view, lightManager);
+    profiler.end();
+
+    if (hizDraws) {
+      profiler.begin("Hi-Z Culling");
+      hiz.resize(framebufferSize.x, framebufferSize.y);
+      glBindVertexArray(cubeVAO);
+      hiz.cull(depthShader, view, projection);
+      profiler.end();
+    }
+
+    profiler.begin("Shading");
+    if (!bindless)
+      textureArrays.bind();
+    shadows.bindTextures();
     glBindVertexArray(cubeVAO);
-    cubeShader.use();
-    cubeShader.setVec3("viewPos", camera.position);
-    cubeShader.setMat4("view", view);
-    cubeShader.setMat4("projection", projection);
-    cubeShader.setVec3("material.ambient", cubeAmbientColor);
-    cubeShader.setInt("material.diffuse", 0);
-    cubeShader.setInt("material.specular", 1);
-    cubeShader.setFloat("material.shininess", cubeShininess);
-    cubeShader.setVec3("light.position", camera.position);
-    cubeShader.setVec3("light.direction", camera.frontFace);
-    cubeShader.setVec3("light.ambient", lightAmbientColor);
-    cubeShader.setVec3("light.diffuse", lightDiffuseColor);
-    cubeShader.setVec3("light.specular", glm::vec3(lightSpecularIntensity));
-    cubeShader.setFloat("light.constant", 1.0f);
-    cubeShader.setFloat("light.linear", 0.09f);
-    cubeShader.setFloat("light.quadratic", 0.032f);
-    cubeShader.setFloat("light.cutOff", glm::cos(glm::radians(12.5f)));
-    cubeShader.setFloat("light.outerCutOff", glm::cos(glm::radians(17.5f)));
-
-    for (unsigned int i = 0; i < 10; i++) {
-      glm::mat4 model = glm::mat4(1.0f);
-      model = glm::translate(model, cubePositions[i]);
-      float angle = 20.0f * i;
-      model =
-          glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-      cubeShader.setMat4("model", model);
-
-      glDrawArrays(GL_TRIANGLES, 0, 36);
+    if (deferredShading) {
+      gbuffer.resize(framebufferSize.x, framebufferSize.y);
+      glBindFramebuffer(GL_FRAMEBUFFER, gbuffer.fbo);
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+    if (depthPrepass) {
+      profiler.begin("Depth Pre-pass");
+      glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+      depthShader.use();
+      depthShader.setMat4("view", view);
+      depthShader.setMat4("projection", projection);
+      drawVisible(depthShader);
+      glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+      // only the fragment that won the pre-pass gets shaded
+      glDepthFunc(GL_EQUAL);
+      glDepthMask(GL_FALSE);
+      profiler.end();
+    }
+
+    Shader &sceneShader = deferredShading ? gbufferShader : cubeShader;
+    sceneShader.use();
+    sceneShader.setMat4("view", view);
+    sceneShader.setMat4("projection", projection);
+
+    if (pipelineStatistics)
+      fragmentInvocations.begin();
+    if (!deferredShading) {
+      cubeShader.setVec3("viewPos", camera.position);
+      clusters.setUniforms(cubeShader);
+      setSunUniforms(cubeShader);
+      drawVisible(cubeShader);
+    } else {
+      profiler.begin("Geometry Pass");
+      drawVisible(gbufferShader);
+      profiler.end();
+    }
+    if (pipelineStatistics) {
+      fragmentInvocations.end();
+      profiler.setCounter("Shading FS Invocations",
+                          fragmentInvocations.value());
+    }
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+
+    if (deferredShading) {
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+      profiler.begin("Lighting Pass");
+      gbuffer.bindTextures();
+      deferredShader.use();
+      deferredShader.setVec3("viewPos", camera.position);
+      deferredShader.setMat4("inverseViewProjection",
+                             glm::inverse(projection * view));
+      clusters.setUniforms(deferredShader);
+      setSunUniforms(deferredShader);
+      // the lighting pass writes the G-buffer depth back out so the forward
+      // drawn light cube still depth tests against the scene
+      glDepthFunc(GL_ALWAYS);
+      glBindVertexArray(fullscreenVAO);
+      glDrawArrays(GL_TRIANGLES, 0, 3);
+      glDepthFunc(GL_LESS);
+      profiler.end();
+    }
+    profiler.end();
+
+    // the scene's depth is complete, test the boxes for the next frames
+    if (occlusionCulling) {
+      profiler.begin("Occlusion Queries");
+      occlusion.test(*occlusionVariant, view, projection);
+      profiler.end();
     }
+    profiler.setCounter("Occlusion Tested", occlusion.tested);
+    profiler.setCounter("Occlusion Occluded", occlusion.occluded);
 
     glBindVertexArray(lightVAO);
     lightShader.use();
-    glm::mat4 model = glm::mat4(1.0f);
-    model = glm::translate(model, lightPos);
-    model = glm::scale(model, glm::vec3(0.2f));
-
+    const Mesh &lampMesh = sceneEntities.mesh(lampEntity);
     lightShader.setMat4("view", view);
     lightShader.setMat4("projection", projection);
-    lightShader.setMat4("model", model);
-    lightShader.setVec3("light.color", lightColor);
-    glDrawArrays(GL_TRIANGLES, 0, sizeof(vertices));
+    lightShader.setMat4("model", sceneGraph.world(lampNode));
+    lightShader.setVec3("lightColor", lightColor);
+    drawMesh(lampMesh);
 
     if (debugWindow) {
       ImGui::SetNextWindowSize(ImVec2(WIDTH / 3, HEIGHT));
@@ -301,8 +3117,8 @@ int main() {
           camera.lookSens = 0.1f;
           camera.look(camera.lastX, camera.lastY);
         }
-        ImGui::SliderFloat3("Camera Position", (float *)&camera.position, -5.0f,
-                            5.0f);
+        ImGui::SliderFloat3("Camera Position", glm::value_ptr(camera.position),
+                            -5.0f, 5.0f);
         ImGui::SliderFloat("Camera Yaw", &camera.yaw, -360.0f, 360.0f);
         ImGui::SliderFloat("Camera Pitch", &camera.pitch, -89.0f, 89.0f);
         ImGui::SliderFloat("Camera FOV", &camera.fov, 1.0f, 120.0f);
@@ -315,28 +3131,165 @@ int main() {
           lightDiffuseIntensity = 0.5f;
           lightAmbientIntensity = 0.2f;
           lightSpecularIntensity = 1.0f;
-          cubeAmbientColor = glm::vec3(1.0f, 0.5f, 0.31f);
-          cubeDiffuseColor = glm::vec3(1.0f, 0.5f, 0.31f);
-          cubeSpecularColor = glm::vec3(0.5f);
-          cubeShininess = 32.0f;
+          flashlightAttenuation = glm::vec3(1.0f, 0.09f, 0.032f);
+          flashlightCutOff = 12.5f;
+          flashlightOuterCutOff = 17.5f;
         }
-        ImGui::ColorEdit3("Light Color", (float *)&lightColor);
+        ImGui::ColorEdit3("Light Color", glm::value_ptr(lightColor));
         ImGui::SliderFloat("Light Ambient Intensity", &lightAmbientIntensity, 0,
                            1);
         ImGui::SliderFloat("Light Diffuse Intensity", &lightDiffuseIntensity, 0,
                            1);
         ImGui::SliderFloat("Light Specular Intensity", &lightSpecularIntensity,
                            0, 1);
+        ImGui::SliderFloat3("Flashlight Attenuation",
+                            glm::value_ptr(flashlightAttenuation), 0, 2);
+        ImGui::SliderFloat("Flashlight Cut Off", &flashlightCutOff, 0, 90);
+        ImGui::SliderFloat("Flashlight Outer Cut Off", &flashlightOuterCutOff,
+                           0, 90);
+        ImGui::Text("Lighting shaders: %s",
+                    specializedLighting ? "specialized" : "generic");
 
-        ImGui::SliderFloat3("Cube Ambient Color", (float *)&cubeAmbientColor, 0,
-                            1);
-        ImGui::SliderFloat3("Cube Diffuse Color", (float *)&cubeDiffuseColor, 0,
+        glm::vec3 lampPosition = sceneGraph.position(lampNode);
+        if (ImGui::SliderFloat3("Light Position", glm::value_ptr(lampPosition),
+                                0, 1))
+          sceneGraph.setPosition(lampNode, lampPosition);
+        ImGui::SliderFloat("Light Orbit Speed", &lampOrbitSpeed, -2, 2);
+        ImGui::SliderFloat3("Light Direction", glm::value_ptr(lightDir), -1,
                             1);
-        ImGui::SliderFloat3("Cube Specular Color", (float *)&cubeSpecularColor,
-                            0, 1);
-        ImGui::SliderFloat("Cube Shininess", &cubeShininess, 0, 512);
-        ImGui::SliderFloat3("Light Position", (float *)&lightPos, 0, 1);
-        ImGui::SliderFloat3("Light Direction", (float *)&lightDir, 0, 1);
+        ImGui::SliderFloat("Sun Intensity", &sunIntensity, 0, 1);
+      }
+      if (ImGui::CollapsingHeader("Materials")) {
+        ImGui::SliderInt("Material", &selectedMaterial, 0,
+                         materials.count() - 1);
+        ImGui::Text("%s", materials.name(selectedMaterial).c_str());
+        GpuMaterial &material = materials.edit(selectedMaterial);
+        bool edited = false;
+        edited |= ImGui::ColorEdit3(
+            "Diffuse Tint", glm::value_ptr(material.diffuseShininess));
+        edited |= ImGui::SliderFloat3(
+            "Specular Tint", glm::value_ptr(material.specular), 0, 2);
+        edited |= ImGui::SliderFloat("Shininess", &material.diffuseShininess.w,
+                                     1, 512);
+        if (edited)
+          materials.markDirty(selectedMaterial);
+        if (bindless) {
+          ImGui::Text("Bindless textures: %u resident of %u",
+                      bindlessTextures.residentCount(),
+                      bindlessTextures.textureCount());
+          ImGui::Checkbox("Texture Streaming", &textureStreaming);
+          ImGui::SliderFloat("Mip Bias", &textureStreamer.lodBias, -2.0f,
+                             4.0f);
+          ImGui::Text("Streamed mips: %.1f of %.1f KB, %u loading",
+                      textureStreamer.usedBytes() / 1024.0,
+                      textureStreamer.budget.memoryBytes / 1024.0,
+                      textureStreamer.pendingLoads());
+        } else
+          ImGui::Text("Texture arrays: %d (%d layers, %d resized on load)",
+                      textureArrays.arrayCount(), textureArrays.layersUsed(),
+                      textureArrays.resizedCount);
+      }
+      if (ImGui::CollapsingHeader("Shadows")) {
+        ImGui::Checkbox("Enable Shadows", &shadowsEnabled);
+        ImGui::SliderInt("Cascades", &shadows.cascadeCount, 2,
+                         ShadowMaps::MAX_CASCADES);
+        ImGui::SliderFloat("Shadow Distance", &shadows.shadowDistance, 5.0f,
+                           100.0f);
+        ImGui::SliderFloat("Split Lambda", &shadows.splitLambda, 0.0f, 1.0f);
+        ImGui::Checkbox("Cache Shadow Maps", &shadows.caching);
+        ImGui::Checkbox("Flashlight Shadows",
+                        &sceneEntities.light(flashlightEntity).castShadows);
+        ImGui::Text("Rendered this frame: %d cascades, %d spot maps",
+                    shadows.cascadesRendered, shadows.spotsRendered);
+      }
+
+      if (ImGui::CollapsingHeader("Renderer")) {
+        if (ImGui::RadioButton("Forward", !deferredShading))
+          deferredShading = false;
+        ImGui::SameLine();
+        if (ImGui::RadioButton("Deferred", deferredShading))
+          deferredShading = true;
+        ImGui::Checkbox("Instanced Draws", &instancedDraws);
+        ImGui::SliderFloat("LOD Error (px)", &lodThreshold, 0.1f, 16.0f);
+        ImGui::SliderFloat("LOD Hysteresis", &lodHysteresis, 0.0f, 0.9f);
+        ImGui::Text("LOD triangles: %u of %u", lodTriangles,
+                    lodFullTriangles);
+        ImGui::Checkbox("Meshlet Culling (instanced)", &meshletCulling);
+        ImGui::Text("Meshlets culled: %u of %u", meshletsCulled,
+                    meshletsTested);
+        ImGui::Checkbox("Hi-Z Culling (instanced)", &hizCulling);
+        ImGui::Text("Hi-Z candidates: %u", hiz.candidates);
+        ImGui::Text("Shader variants: %zu (%u prewarmed, %u late compiles)",
+                    shaderCache.size(), prewarmedVariants,
+                    shaderCache.lateCompiles);
+      }
+      if (ImGui::CollapsingHeader("Depth Pre-pass")) {
+        ImGui::Checkbox("Depth Pre-pass", &depthPrepass);
+        ImGui::Checkbox("Sort Front To Back", &sortFrontToBack);
+        if (pipelineStatistics)
+          ImGui::Text("Shading pass FS invocations: %llu",
+                      (unsigned long long)fragmentInvocations.value());
+        else
+          ImGui::Text("FS invocation counts need OpenGL 4.6");
+      }
+      if (ImGui::CollapsingHeader("Occlusion Culling")) {
+        ImGui::Checkbox("Occlusion Queries", &occlusionCulling);
+        ImGui::Text("Occluded: %u, tested: %u", occlusion.occluded,
+                    occlusion.tested);
+        ImGui::Checkbox("Software Occlusion", &softwareCulling);
+        ImGui::Text("Occluded: %u, occluder triangles: %u (%s)",
+                    softwareOccluded, softwareOcclusion.triangleCount(),
+                    softwareOcclusion.kernel == RasterKernel::Avx2 ? "AVX2"
+                                                                   : "scalar");
+        ImGui::Checkbox("Potentially Visible Sets", &pvsCulling);
+        if (pvsVisible)
+          ImGui::Text("Draws: %u, without sets: %u", pvsBaseline - pvsCulled,
+                      pvsBaseline);
+        else
+          ImGui::Text("%s", pvs.loaded() ? "Camera outside the grid"
+                                         : "The scene has no sets");
+      }
+      if (ImGui::CollapsingHeader("Clustered Lighting")) {
+        ImGui::Checkbox("Benchmark Scene", &benchmarkScene);
+        ImGui::SliderInt("Benchmark Lights", &benchmarkLightCount, 0,
+                         LightManager::MAX_LIGHTS - 1);
+        if (clusters.computeAvailable)
+          ImGui::Checkbox("Cull In Compute Shader", &clusters.useCompute);
+        ImGui::Text("Lights: %u", lightManager.count());
+        if (!clusters.useCompute)
+          ImGui::Text("Lights per cluster: avg %.2f, max %u",
+                      clusters.averageLightsPerCluster,
+                      clusters.maxLightsInCluster);
+      }
+      if (world.isOpen() && ImGui::CollapsingHeader("World Streaming")) {
+        ImGui::SliderFloat("Load Radius", &world.loadRadius, 16.0f, 512.0f);
+        world.unloadRadius = std::max(world.unloadRadius, world.loadRadius);
+        ImGui::Text("Sectors: %u resident, %u pending of %u",
+                    world.residentSectors(), world.pendingSectors(),
+                    world.sectorCount());
+        ImGui::Text("Used: %.1f of %.1f KB", world.usedBytes() / 1024.0,
+                    world.budget.memoryBytes / 1024.0);
+        ImGui::Text("Last frame: %zu KB read, %u decoded, %u committed",
+                    world.lastFrame.ioBytes / 1024,
+                    world.lastFrame.decodedInstances,
+                    world.lastFrame.committedInstances);
+      }
+      if (ImGui::CollapsingHeader("Memory")) {
+        // GPU sizes are estimates from buffer and texture dimensions
+        ImGui::Text("%-10s %10s %10s %9s %10s %10s", "tag", "cpu KB",
+                    "peak KB", "allocs/s", "gpu KB", "peak KB");
+        for (unsigned int i = 0; i < MemoryTracker::TAG_COUNT; i++) {
+          const MemoryTracker::Stats &cpu = MemoryTracker::cpu[i];
+          const MemoryTracker::Stats &gpu = MemoryTracker::gpu[i];
+          ImGui::Text("%-10s %10.1f %10.1f %9.0f %10.1f %10.1f",
+                      MemoryTracker::tagName((MemoryTag)i),
+                      cpu.live.load() / 1024.0, cpu.peak.load() / 1024.0,
+                      MemoryTracker::cpuRate[i].allocations,
+                      gpu.live.load() / 1024.0, gpu.peak.load() / 1024.0);
+        }
+      }
+      if (ImGui::CollapsingHeader("Profiler")) {
+        profiler.draw();
       }
 
       ImGui::Text("Application average %.3f ms/frame (%.1f FPS)",
@@ -346,15 +3299,89 @@ int main() {
     ImGui::Render();
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
+    profiler.end();
     glfwSwapBuffers(window);
+
+    frameAllocations =
+        MemoryTracker::threadAllocationCount() - allocationsAtFrameStart;
+    profiler.setCounter("Heap Allocations", frameAllocations);
+    profiler.setCounter("Frame Arena KB", frameArena.arena().used() / 1024.0);
+    profiler.setCounter("Frame Arena Overflows", frameArena.arena().overflows);
+    if (benchmarkName && frameIndex > 100 && frameAllocations > 0)
+      allocatingFrames++;
   }
 
+  if (benchmarkName) {
+    benchmark.record("lights", lightManager.count(), "count");
+    benchmark.record("entities", sceneEntities.size(), "count");
+    benchmark.record("deferred", deferredShading, "bool");
+    benchmark.record("depth prepass", depthPrepass, "bool");
+    benchmark.record("hiz culling", instancedDraws && hizCulling, "bool");
+    if (pipelineStatistics)
+      benchmark.record("shading fs invocations", fragmentInvocations.value(),
+                       "count");
+    benchmark.record("frame", benchmarkFrameMs / benchmarkFrames, "ms");
+    benchmark.record("allocating frames", allocatingFrames, "count");
+    benchmark.record("lod triangles", lodTriangles, "count");
+    benchmark.record("lod triangles saved", lodFullTriangles - lodTriangles,
+                     "count");
+    benchmark.record("occlusion occluded", occlusion.occluded, "count");
+    benchmark.record("occlusion tested", occlusion.tested, "count");
+    benchmark.record("pvs culled", pvsCulled, "count");
+    benchmark.record("draws without pvs", pvsBaseline, "count");
+    for (unsigned int i = 0; i < MemoryTracker::TAG_COUNT; i++) {
+      std::string tag =
+          std::string("memory ") + MemoryTracker::tagName((MemoryTag)i);
+      benchmark.record(tag + " cpu live", MemoryTracker::cpu[i].live, "bytes");
+      benchmark.record(tag + " cpu peak", MemoryTracker::cpu[i].peak, "bytes");
+      benchmark.record(tag + " allocs", MemoryTracker::cpuRate[i].allocations,
+                       "per second");
+      benchmark.record(tag + " gpu live", MemoryTracker::gpu[i].live, "bytes");
+      benchmark.record(tag + " gpu peak", MemoryTracker::gpu[i].peak, "bytes");
+    }
+    for (const Profiler::Result &r : profiler.results()) {
+      benchmark.record(std::string(r.name) + " cpu", r.cpuMs, "ms");
+      benchmark.record(std::string(r.name) + " gpu", r.gpuMs, "ms");
+    }
+    benchmark.write("benchmark.json");
+  }
+
+  if (pipelineStatistics)
+    fragmentInvocations.destroy();
+  profiler.destroy();
+  world.close();
+  occlusion.destroy();
+  hiz.destroy();
+  shadows.destroy();
+  clusters.destroy();
+  shaderCache.destroy();
+  lightManager.destroy();
+  materials.destroy();
+  textureStreamer.close();
+  textureArrays.destroy();
+  bindlessTextures.destroy();
+  gbuffer.destroy();
+  glDeleteVertexArrays(1, &fullscreenVAO);
   glDeleteVertexArrays(1, &cubeVAO);
   glDeleteBuffers(1, &VBO);
+  glDeleteBuffers(1, &EBO);
+  glDeleteBuffers(1, &instanceVBO);
+  glDeleteBuffers(1, &indirectBuffer);
+  MemoryTracker::gpuRelease(MemoryTag::Geometry, vertexBytes);
+  MemoryTracker::gpuRelease(MemoryTag::Geometry, instanceBytes);
+  MemoryTracker::gpuRelease(MemoryTag::Geometry, indirectBytes);
   ImGui_ImplOpenGL3_Shutdown();
   ImGui_ImplGlfw_Shutdown();
   ImGui::DestroyContext();
   glfwTerminate();
 
+  // steady state frames must not allocate, debug benchmark runs enforce it
+#ifndef NDEBUG
+  if (allocatingFrames > 0) {
+    std::cout << "ERROR::BENCHMARK::HEAP_ALLOCATIONS_IN_FRAME_LOOP: "
+              << allocatingFrames << " frames allocated" << std::endl;
+    return 1;
+  }
+#endif
   return 0;
 }
@@ -1,55 +1,33 @@
-#version 330 core
+#version 430 core
 out vec4 FragColor;
 
 in vec3 Normal;
 in vec3 FragPos;
 in vec2 TexCoords;
+flat in uint MaterialIndex;
 
-struct Material {
-    sampler2D diffuse;
-    sampler2D specular;
-    float shininess;
-};
-
-struct Light {
-    vec3 position;
-    vec3 direction;
-    vec3 color;
-    float cutOff;
-    float outerCutOff;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-
-    float constant;
-    float linear;
-    float quadratic;
-};
+#include "include/material.glsl"
+#include "include/lighting.glsl"
+#include "include/clusters.glsl"
 
 uniform vec3 viewPos;
-uniform Material material;
-uniform Light light;
 
 void main() {
-    vec3 lightDir = normalize(light.position - FragPos);
-    float theta = dot(lightDir, normalize(-light.direction));
-    float epsilon = light.cutOff - light.outerCutOff;
-    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
-    float distance = length(light.position - FragPos);
-    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
-
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords)) * attenuation;
-
     vec3 norm = normalize(Normal);
-    float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords)) * attenuation * intensity;
-
     vec3 viewDir = normalize(viewPos - FragPos);
-    vec3 reflectDir = reflect(-lightDir, norm);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords)) * attenuation * intensity;
-
-    vec3 result = ambient + diffuse + specular;
+    Material material = materials[MaterialIndex];
+    vec2 dx = dFdx(TexCoords);
+    vec2 dy = dFdy(TexCoords);
+    vec3 diffuseColor = material.diffuseShininess.rgb * sampleMaterialTexture(material.textures.xy, TexCoords, dx, dy).rgb;
+    vec3 specularColor = material.specular.rgb * sampleMaterialTexture(material.textures.zw, TexCoords, dx, dy).rgb;
+    float shininess = material.diffuseShininess.a;
+
+    float viewDepth = linearDepth(gl_FragCoord.z);
+
+    uvec2 cell = lightGrid[clusterIndex(viewDepth)];
+    vec3 result = shadeSun(FragPos, viewDepth, norm, viewDir, diffuseColor, specularColor, shininess);
+    for (uint i = 0; i < min(cell.y, MAX_LIGHTS_PER_CLUSTER); i++) {
+        result += shadeLight(lights[lightIndices[cell.x + i]], FragPos, norm, viewDir, diffuseColor, specularColor, shininess);
+    }
     FragColor = vec4(result, 1.0);
 }
@@ -1,19 +1,26 @@
-#version 330 core
+#version 430 core
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoords;
 
-uniform mat4 model;
+#include "include/transform.glsl"
+
+// the depth pre-pass (light.vert) and the shading pass (cube.vert) must
+// produce bit identical depth for GL_EQUAL testing
+invariant gl_Position;
+
 uniform mat4 view;
 uniform mat4 projection;
 
 out vec3 Normal;
 out vec3 FragPos;
 out vec2 TexCoords;
+flat out uint MaterialIndex;
 
 void main() {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;
+    gl_Position = projection * view * MODEL_MATRIX * vec4(aPos, 1.0);
+    FragPos = vec3(MODEL_MATRIX * vec4(aPos, 1.0));
+    Normal = NORMAL_MATRIX * aNormal;
     TexCoords = aTexCoords;
+    MaterialIndex = MATERIAL_INDEX;
 }
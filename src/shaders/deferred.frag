@@ -0,0 +1,44 @@
+#version 430 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+#include "include/lighting.glsl"
+#include "include/clusters.glsl"
+#include "include/octahedral.glsl"
+
+layout(binding = 0) uniform sampler2D gNormal;
+layout(binding = 1) uniform sampler2D gAlbedoSpec;
+layout(binding = 2) uniform sampler2D gDepth;
+
+uniform vec3 viewPos;
+uniform mat4 inverseViewProjection;
+
+void main() {
+    float depth = texture(gDepth, TexCoords).r;
+    if (depth == 1.0) {
+        discard;
+    }
+    // forward passes drawn afterwards (light cube, ImGui) depth test against this
+    gl_FragDepth = depth;
+
+    vec4 ndc = vec4(TexCoords * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+    vec4 world = inverseViewProjection * ndc;
+    vec3 fragPos = world.xyz / world.w;
+
+    vec4 normalShininess = texture(gNormal, TexCoords);
+    vec4 albedoSpec = texture(gAlbedoSpec, TexCoords);
+    vec3 norm = decodeNormal(normalShininess.xy);
+    float shininess = normalShininess.z * 512.0;
+    vec3 specularColor = vec3(albedoSpec.a);
+    vec3 viewDir = normalize(viewPos - fragPos);
+
+    float viewDepth = linearDepth(depth);
+
+    uvec2 cell = lightGrid[clusterIndex(viewDepth)];
+    vec3 result = shadeSun(fragPos, viewDepth, norm, viewDir, albedoSpec.rgb, specularColor, shininess);
+    for (uint i = 0; i < min(cell.y, MAX_LIGHTS_PER_CLUSTER); i++) {
+        result += shadeLight(lights[lightIndices[cell.x + i]], fragPos, norm, viewDir, albedoSpec.rgb, specularColor, shininess);
+    }
+    FragColor = vec4(result, 1.0);
+}
@@ -0,0 +1,5 @@
+#version 330 core
+
+// depth only passes (shadow maps) write no color
+void main() {
+}
@@ -0,0 +1,21 @@
+#version 430 core
+layout(location = 0) out vec4 gNormal;
+layout(location = 1) out vec4 gAlbedoSpec;
+
+in vec3 Normal;
+in vec3 FragPos;
+in vec2 TexCoords;
+flat in uint MaterialIndex;
+
+#include "include/material.glsl"
+#include "include/octahedral.glsl"
+
+void main() {
+    Material material = materials[MaterialIndex];
+    vec2 dx = dFdx(TexCoords);
+    vec2 dy = dFdy(TexCoords);
+    vec3 specular = material.specular.rgb * sampleMaterialTexture(material.textures.zw, TexCoords, dx, dy).rgb;
+    gNormal = vec4(encodeNormal(normalize(Normal)), material.diffuseShininess.a / 512.0, 0.0);
+    gAlbedoSpec.rgb = material.diffuseShininess.rgb * sampleMaterialTexture(material.textures.xy, TexCoords, dx, dy).rgb;
+    gAlbedoSpec.a = dot(specular, vec3(0.2126, 0.7152, 0.0722));
+}
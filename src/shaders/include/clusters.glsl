@@ -0,0 +1,28 @@
+// Light lists built by clusters.comp or ClusterGrid::cullCpu
+layout(std430, binding = 2) readonly buffer LightGrid { uvec2 lightGrid[]; };
+layout(std430, binding = 3) readonly buffer LightIndices { uint lightIndices[]; };
+
+#ifndef MAX_LIGHTS_PER_CLUSTER
+#define MAX_LIGHTS_PER_CLUSTER 128u
+#endif
+
+uniform uvec3 clusterDims;
+uniform vec2 screenSize;
+uniform float zNear;
+uniform float zFar;
+uniform float sliceScale;
+uniform float sliceBias;
+
+float linearDepth(float depth) {
+    float ndcZ = depth * 2.0 - 1.0;
+    return 2.0 * zNear * zFar / (zFar + zNear - ndcZ * (zFar - zNear));
+}
+
+uint clusterIndex(float viewZ) {
+    // pick the exponential slice from the view space depth
+    uint slice = uint(max(log(viewZ) * sliceScale + sliceBias, 0.0));
+    uvec2 tile = uvec2(gl_FragCoord.xy / screenSize * vec2(clusterDims.xy));
+    tile = min(tile, clusterDims.xy - 1u);
+    slice = min(slice, clusterDims.z - 1u);
+    return tile.x + clusterDims.x * (tile.y + clusterDims.y * slice);
+}
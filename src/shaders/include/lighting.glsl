@@ -0,0 +1,68 @@
+// Phong shading shared by the forward and deferred paths
+#include "lights.glsl"
+#include "shadows.glsl"
+
+struct DirectionalLight {
+    vec3 direction;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+uniform DirectionalLight sun;
+
+// Specialized variants get the attenuation and spot cone shared by every
+// light as constants (see SpecializationConstants), generic ones read them
+// from the light buffer.
+#ifdef LIGHT_CONSTANT
+const vec3 lightAttenuation = vec3(LIGHT_CONSTANT, LIGHT_LINEAR, LIGHT_QUADRATIC);
+const vec2 spotCone = vec2(SPOT_CUT_OFF, SPOT_OUTER_CUT_OFF);
+#define ATTENUATION(light) lightAttenuation
+#define SPOT_CONE(light) spotCone
+#else
+#define ATTENUATION(light) light.attenuation.xyz
+#define SPOT_CONE(light) vec2(light.ambientCutOff.w, light.diffuseOuterCutOff.w)
+#endif
+
+vec3 shadeSun(vec3 fragPos, float viewDepth, vec3 norm, vec3 viewDir, vec3 diffuseColor, vec3 specularColor, float shininess) {
+    vec3 lightDir = normalize(-sun.direction);
+    float shadow = sunShadow(viewDepth, fragPos, norm, lightDir);
+
+    vec3 ambient = sun.ambient * diffuseColor;
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 diffuse = sun.diffuse * diff * diffuseColor;
+    vec3 reflectDir = reflect(-lightDir, norm);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+    vec3 specular = sun.specular * spec * specularColor;
+    return ambient + (diffuse + specular) * shadow;
+}
+
+vec3 shadeLight(Light light, vec3 fragPos, vec3 norm, vec3 viewDir, vec3 diffuseColor, vec3 specularColor, float shininess) {
+    vec3 toLight = light.positionRange.xyz - fragPos;
+    float distance = length(toLight);
+    vec3 lightDir = toLight / distance;
+
+    float intensity = 1.0;
+    if (light.directionType.w > 0.5) {
+        float theta = dot(lightDir, normalize(-light.directionType.xyz));
+        vec2 cone = SPOT_CONE(light);
+        intensity = clamp((theta - cone.y) / (cone.x - cone.y), 0.0, 1.0);
+    }
+    vec3 k = ATTENUATION(light);
+    float attenuation = 1.0 / (k.x + k.y * distance + k.z * (distance * distance));
+    // fade to zero at the culling range so cluster borders never show
+    float fade = clamp(1.0 - pow(distance / light.positionRange.w, 4.0), 0.0, 1.0);
+    attenuation *= fade * fade;
+    intensity *= spotShadow(light.specular.w, fragPos, norm, lightDir);
+
+    vec3 ambient = light.ambientCutOff.xyz * diffuseColor * attenuation;
+
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 diffuse = light.diffuseOuterCutOff.xyz * diff * diffuseColor * attenuation * intensity;
+
+    vec3 reflectDir = reflect(-lightDir, norm);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+    vec3 specular = light.specular.xyz * spec * specularColor * attenuation * intensity;
+
+    return ambient + diffuse + specular;
+}
@@ -0,0 +1,11 @@
+// Matches GpuLight in include/utils/lights.hpp
+struct Light {
+    vec4 positionRange;      // xyz position, w range
+    vec4 directionType;      // xyz direction, w 0 = point, 1 = spot
+    vec4 ambientCutOff;      // xyz ambient, w cutOff
+    vec4 diffuseOuterCutOff; // xyz diffuse, w outerCutOff
+    vec4 specular;           // xyz specular, w shadow map index or -1
+    vec4 attenuation;        // constant, linear, quadratic
+};
+
+layout(std430, binding = 0) readonly buffer LightBuffer { Light lights[]; };
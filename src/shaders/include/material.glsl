@@ -0,0 +1,38 @@
+// Matches GpuMaterial in include/utils/materials.hpp
+struct Material {
+    vec4 diffuseShininess; // rgb diffuse tint, a shininess
+    vec4 specular;         // rgb specular tint
+    uvec4 textures;        // xy diffuse, zw specular
+};
+
+layout(std430, binding = 4) readonly buffer MaterialBuffer { Material materials[]; };
+
+#ifndef BINDLESS
+#define BINDLESS 0
+#endif
+
+#if BINDLESS
+// textures hold 64-bit GL_ARB_bindless_texture handles, the extension
+// directive is added by the shader cache
+vec4 sampleMaterialTexture(uvec2 packedTexture, vec2 uv, vec2 dx, vec2 dy) {
+    return textureGrad(sampler2D(packedTexture), uv, dx, dy);
+}
+#else
+// TextureArrays::FIRST_UNIT onwards
+layout(binding = 5) uniform sampler2DArray textureArray0;
+layout(binding = 6) uniform sampler2DArray textureArray1;
+layout(binding = 7) uniform sampler2DArray textureArray2;
+layout(binding = 8) uniform sampler2DArray textureArray3;
+
+// x is (array << 16 | layer). The array is picked per fragment, so the
+// derivatives are taken up front where control flow is still uniform.
+vec4 sampleMaterialTexture(uvec2 packedTexture, vec2 uv, vec2 dx, vec2 dy) {
+    vec3 coord = vec3(uv, float(packedTexture.x & 0xffffu));
+    switch (packedTexture.x >> 16) {
+    case 0u: return textureGrad(textureArray0, coord, dx, dy);
+    case 1u: return textureGrad(textureArray1, coord, dx, dy);
+    case 2u: return textureGrad(textureArray2, coord, dx, dy);
+    default: return textureGrad(textureArray3, coord, dx, dy);
+    }
+}
+#endif
@@ -0,0 +1,61 @@
+#ifndef SHADOWS
+#define SHADOWS 1
+#endif
+#ifndef MAX_CASCADES
+#define MAX_CASCADES 4
+#endif
+#ifndef MAX_SPOT_SHADOWS
+#define MAX_SPOT_SHADOWS 4
+#endif
+
+#if SHADOWS
+layout(binding = 3) uniform sampler2DArrayShadow cascadeShadowMap;
+layout(binding = 4) uniform sampler2DArrayShadow spotShadowMap;
+uniform mat4 cascadeMatrices[MAX_CASCADES];
+uniform vec4 cascadeSplits;
+uniform int cascadeCount;
+uniform mat4 spotShadowMatrices[MAX_SPOT_SHADOWS];
+
+// 3x3 PCF on top of the hardware 2x2 comparison filter
+float shadowFactor(sampler2DArrayShadow map, mat4 matrix, float layer, vec3 worldPos, vec3 norm, vec3 lightDir) {
+    // normal offset keeps acne off surfaces at grazing angles
+    vec3 offsetPos = worldPos + norm * 0.02 * (1.0 - max(dot(norm, lightDir), 0.0));
+    vec4 p = matrix * vec4(offsetPos, 1.0);
+    p.xyz = p.xyz / p.w * 0.5 + 0.5;
+    if (p.z >= 1.0) {
+        return 1.0;
+    }
+    vec2 texel = 1.0 / vec2(textureSize(map, 0).xy);
+    float lit = 0.0;
+    for (int x = -1; x <= 1; x++) {
+        for (int y = -1; y <= 1; y++) {
+            lit += texture(map, vec4(p.xy + vec2(x, y) * texel, layer, p.z));
+        }
+    }
+    return lit / 9.0;
+}
+
+float sunShadow(float viewDepth, vec3 worldPos, vec3 norm, vec3 lightDir) {
+    for (int i = 0; i < cascadeCount; i++) {
+        if (viewDepth < cascadeSplits[i]) {
+            return shadowFactor(cascadeShadowMap, cascadeMatrices[i], float(i), worldPos, norm, lightDir);
+        }
+    }
+    return 1.0;
+}
+
+float spotShadow(float slot, vec3 worldPos, vec3 norm, vec3 lightDir) {
+    if (slot < 0.0) {
+        return 1.0;
+    }
+    return shadowFactor(spotShadowMap, spotShadowMatrices[int(slot)], slot, worldPos, norm, lightDir);
+}
+#else
+float sunShadow(float viewDepth, vec3 worldPos, vec3 norm, vec3 lightDir) {
+    return 1.0;
+}
+
+float spotShadow(float slot, vec3 worldPos, vec3 norm, vec3 lightDir) {
+    return 1.0;
+}
+#endif
@@ -0,0 +1,20 @@
+// Model matrix, normal matrix and material index either per draw (uniforms,
+// normal matrix derived here) or per instance (attributes 3-10)
+#ifndef INSTANCING
+#define INSTANCING 0
+#endif
+
+#if INSTANCING
+layout(location = 3) in mat4 aModel;
+layout(location = 7) in uint aMaterial;
+layout(location = 8) in mat3 aNormalMatrix;
+#define MODEL_MATRIX aModel
+#define NORMAL_MATRIX aNormalMatrix
+#define MATERIAL_INDEX aMaterial
+#else
+uniform mat4 model;
+uniform uint materialIndex;
+#define MODEL_MATRIX model
+#define NORMAL_MATRIX mat3(transpose(inverse(model)))
+#define MATERIAL_INDEX materialIndex
+#endif
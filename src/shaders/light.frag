@@ -1,16 +1,8 @@
-#version 330 core
+#version 430 core
 out vec4 FragColor;
-struct Light {
-    vec3 position;
-    vec3 color;
 
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-uniform Light light;
+uniform vec3 lightColor;
 
 void main() {
-    FragColor = vec4(light.color, 1.0);
+    FragColor = vec4(lightColor, 1.0);
 }
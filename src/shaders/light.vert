@@ -1,10 +1,15 @@
-#version 330 core
+#version 430 core
 layout(location = 0) in vec3 aPos;
 
-uniform mat4 model;
+#include "include/transform.glsl"
+
+// the depth pre-pass (light.vert) and the shading pass (cube.vert) must
+// produce bit identical depth for GL_EQUAL testing
+invariant gl_Position;
+
 uniform mat4 view;
 uniform mat4 projection;
 
 void main() {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = projection * view * MODEL_MATRIX * vec4(aPos, 1.0);
 }
@@ -0,0 +1,309 @@
+// Converts a text scene description (see assets/scenes/default.txt for the
+// format) into a binary .scene file the renderer maps in place. Meshes, inline
+// or imported from OBJ/glTF files, go through MeshImporter's pipeline and get
+// their levels of detail from MeshLodBuilder and meshlets from
+// MeshletBuilder. A `pvs` entry bakes potentially visible sets with
+// PvsBaker once the whole description is read.
+//
+//   scene_converter <input.txt> <output.scene>
+#include "utils/mesh_import.hpp"
+#include "utils/mesh_lod.hpp"
+#include "utils/meshlets.hpp"
+#include "utils/pvs.hpp"
+#include "utils/scene_file.hpp"
+#include "utils/thread_pool.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+namespace {
+
+const float PI = 3.14159265358979f;
+
+struct Parser {
+  SceneWriter scene;
+  std::unordered_map<std::string, uint32_t> textures, materials, meshes;
+  // imports are relative to the description file
+  std::string directory;
+  ThreadPool pool;
+  MeshImporter importer{&pool};
+  MeshLodBuilder lodBuilder;
+  MeshletBuilder meshletBuilder;
+  // cell size of the potentially visible sets, 0 for none
+  float pvsCellSize = 0.0f;
+  // the inline mesh being read, as a triangle list
+  std::string meshName;
+  std::vector<SceneVertex> meshVertices;
+  bool inMesh = false;
+  int line = 0;
+  bool failed = false;
+
+  void error(const std::string &message) {
+    std::cout << "ERROR::SCENE_CONVERTER::LINE_" << line << ": " << message
+              << std::endl;
+    failed = true;
+  }
+
+  uint32_t lookup(const std::unordered_map<std::string, uint32_t> &names,
+                  const std::string &name, const char *kind) {
+    if (name == "-")
+      return SCENE_NONE;
+    auto it = names.find(name);
+    if (it == names.end()) {
+      error(std::string("unknown ") + kind + " " + name);
+      return SCENE_NONE;
+    }
+    return it->second;
+  }
+
+  static bool read(std::istringstream &in, float *values, int count) {
+    for (int i = 0; i < count; i++)
+      if (!(in >> values[i]))
+        return false;
+    return true;
+  }
+
+  // Appends the mesh with a bounding sphere around the box of its vertices,
+  // its meshlets and its levels of detail, whose indices follow the mesh's
+  // own.
+  void addMesh(const std::string &name, const ImportedMesh &mesh) {
+    SceneMesh record = {(uint32_t)scene.vertices.size(),
+                        (uint32_t)mesh.vertices.size(),
+                        (uint32_t)scene.indices.size(),
+                        (uint32_t)mesh.indices.size(),
+                        {},
+                        0.0f,
+                        (uint32_t)scene.lods.size(),
+                        0,
+                        (uint32_t)scene.meshlets.size(),
+                        0};
+    float lo[3] = {1e30f, 1e30f, 1e30f}, hi[3] = {-1e30f, -1e30f, -1e30f};
+    for (const SceneVertex &vertex : mesh.vertices) {
+      for (int c = 0; c < 3; c++) {
+        lo[c] = std::fmin(lo[c], vertex.position[c]);
+        hi[c] = std::fmax(hi[c], vertex.position[c]);
+      }
+    }
+    for (int c = 0; c < 3; c++)
+      record.center[c] = mesh.vertices.empty() ? 0.0f : (lo[c] + hi[c]) * 0.5f;
+    for (const SceneVertex &vertex : mesh.vertices) {
+      float d2 = 0.0f;
+      for (int c = 0; c < 3; c++) {
+        float d = vertex.position[c] - record.center[c];
+        d2 += d * d;
+      }
+      record.radius = std::fmax(record.radius, std::sqrt(d2));
+    }
+    meshes[name] = scene.meshes.size();
+    scene.meshes.push_back(record);
+    scene.vertices.insert(scene.vertices.end(), mesh.vertices.begin(),
+                          mesh.vertices.end());
+    scene.indices.insert(scene.indices.end(), mesh.indices.begin(),
+                         mesh.indices.end());
+    const ImportStats &stats = importer.stats;
+    std::cout << name << ": " << mesh.vertices.size() << " vertices, "
+              << mesh.indices.size() / 3 << " triangles, ACMR "
+              << stats.acmrBefore << " -> " << stats.acmrAfter;
+
+    SceneMesh &added = scene.meshes.back();
+    meshletBuilder.build(mesh.vertices.data(), mesh.vertices.size(),
+                         mesh.indices.data(), mesh.indices.size(),
+                         added.firstIndex);
+    added.meshletCount = meshletBuilder.meshlets.size();
+    scene.meshlets.insert(scene.meshlets.end(),
+                          meshletBuilder.meshlets.begin(),
+                          meshletBuilder.meshlets.end());
+    std::cout << ", " << added.meshletCount << " meshlets";
+
+    lodBuilder.build(mesh.vertices.data(), mesh.vertices.size(),
+                     mesh.indices.data(), mesh.indices.size());
+    added.lodCount = lodBuilder.levelCount;
+    scene.lods.push_back({added.firstIndex, added.indexCount, 0.0f});
+    std::cout << ", LOD triangles " << mesh.indices.size() / 3;
+    for (unsigned int level = 1; level < lodBuilder.levelCount; level++) {
+      const std::vector<uint32_t> &indices = lodBuilder.levels[level];
+      scene.lods.push_back({(uint32_t)scene.indices.size(),
+                            (uint32_t)indices.size(),
+                            lodBuilder.errors[level]});
+      scene.indices.insert(scene.indices.end(), indices.begin(),
+                           indices.end());
+      std::cout << " " << indices.size() / 3 << " (error "
+                << lodBuilder.errors[level] << ")";
+    }
+    std::cout << std::endl;
+  }
+
+  void finishMesh() {
+    if (!inMesh)
+      return;
+    inMesh = false;
+    if (meshVertices.size() % 3 != 0)
+      return error("mesh " + meshName + " is not a triangle list");
+    ImportedMesh mesh;
+    importer.finish(meshVertices, mesh, true);
+    addMesh(meshName, mesh);
+    meshVertices.clear();
+  }
+
+  void parse(const std::string &text) {
+    std::istringstream in(text);
+    std::string kind;
+    if (!(in >> kind) || kind[0] == '#')
+      return;
+    if (kind != "v")
+      finishMesh();
+
+    if (kind == "texture") {
+      std::string name, path;
+      if (!(in >> name >> path))
+        return error("expected texture <name> <path>");
+      textures[name] = scene.textures.size();
+      scene.textures.push_back({scene.addString(path)});
+    } else if (kind == "material") {
+      std::string name, diffuse, specular;
+      SceneMaterial material;
+      if (!(in >> name >> diffuse >> specular) ||
+          !read(in, material.diffuse, 3) || !read(in, material.specular, 3) ||
+          !(in >> material.shininess))
+        return error("expected material <name> <diffuse texture> <specular "
+                     "texture> <diffuse rgb> <specular rgb> <shininess>");
+      material.name = scene.addString(name);
+      material.diffuseTexture = lookup(textures, diffuse, "texture");
+      material.specularTexture = lookup(textures, specular, "texture");
+      materials[name] = scene.materials.size();
+      scene.materials.push_back(material);
+    } else if (kind == "mesh") {
+      std::string name;
+      if (!(in >> name))
+        return error("expected mesh <name>");
+      meshName = name;
+      inMesh = true;
+    } else if (kind == "v") {
+      SceneVertex vertex = {};
+      if (!inMesh)
+        return error("vertex outside of a mesh");
+      if (!read(in, vertex.position, 3) || !read(in, vertex.normal, 3) ||
+          !read(in, vertex.uv, 2))
+        return error("expected v <position xyz> <normal xyz> <uv>");
+      meshVertices.push_back(vertex);
+    } else if (kind == "import") {
+      std::string name, path;
+      if (!(in >> name >> path))
+        return error("expected import <name> <path>");
+      ImportedMesh mesh;
+      if (!importer.load(directory + path, mesh))
+        return error("could not import " + path);
+      addMesh(name, mesh);
+    } else if (kind == "instance") {
+      std::string mesh, material;
+      float axis[3], degrees;
+      SceneInstance instance;
+      if (!(in >> mesh >> material) || !read(in, instance.position, 3) ||
+          !read(in, axis, 3) || !(in >> degrees))
+        return error("expected instance <mesh> <material> <position xyz> "
+                     "<rotation axis xyz> <degrees> [<scale xyz>]");
+      if (!read(in, instance.scale, 3))
+        instance.scale[0] = instance.scale[1] = instance.scale[2] = 1.0f;
+      float length =
+          std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+      if (length == 0.0f)
+        return error("rotation axis is zero");
+      // unit quaternion, as glm::angleAxis builds it
+      float half = degrees * PI / 360.0f;
+      for (int c = 0; c < 3; c++)
+        instance.rotation[c] = axis[c] / length * std::sin(half);
+      instance.rotation[3] = std::cos(half);
+      instance.mesh = lookup(meshes, mesh, "mesh");
+      instance.material = lookup(materials, material, "material");
+      scene.instances.push_back(instance);
+    } else if (kind == "pvs") {
+      if (!(in >> pvsCellSize) || pvsCellSize <= 0.0f)
+        return error("expected pvs <cell size>");
+    } else if (kind == "light") {
+      std::string type;
+      float attenuation[3], cutOff, outerCutOff;
+      int shadows;
+      SceneLight light;
+      if (!(in >> type) || (type != "point" && type != "spot") ||
+          !read(in, light.position, 3) || !read(in, light.direction, 3) ||
+          !read(in, light.ambient, 3) || !read(in, light.diffuse, 3) ||
+          !read(in, light.specular, 3) || !read(in, attenuation, 3) ||
+          !(in >> cutOff >> outerCutOff >> shadows))
+        return error("expected light point|spot <position xyz> <direction "
+                     "xyz> <ambient rgb> <diffuse rgb> <specular rgb> "
+                     "<constant linear quadratic> <cut off> <outer cut off> "
+                     "<casts shadows>");
+      // values of the LightType enum in lights.hpp
+      light.type = type == "spot" ? 1 : 0;
+      light.castShadows = shadows != 0;
+      for (int c = 0; c < 3; c++)
+        light.attenuation[c] = attenuation[c];
+      light.cutOff = std::cos(cutOff * PI / 180.0f);
+      light.outerCutOff = std::cos(outerCutOff * PI / 180.0f);
+      scene.lights.push_back(light);
+    } else {
+      error("unknown entry " + kind);
+    }
+  }
+
+  void bakePvs() {
+    if (pvsCellSize <= 0.0f || failed)
+      return;
+    auto start = std::chrono::steady_clock::now();
+    PvsBaker baker;
+    baker.bake(scene.vertices.data(), scene.indices.data(),
+               scene.meshes.data(), scene.instances.data(),
+               scene.instances.size(), pvsCellSize, pool);
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    scene.pvsGrids.push_back(baker.grid);
+    scene.pvsCells = baker.cells;
+    scene.pvsSets = baker.sets;
+    scene.pvsData = baker.data;
+    size_t rawBytes = baker.cells.size() * ((baker.grid.instanceCount + 7) / 8);
+    std::cout << "pvs: " << baker.grid.cells[0] << "x" << baker.grid.cells[1]
+              << "x" << baker.grid.cells[2] << " cells, "
+              << baker.sets.size() << " distinct sets, " << baker.data.size()
+              << " bytes (" << rawBytes << " as bits), " << seconds << " s"
+              << std::endl;
+  }
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    std::cout << "usage: scene_converter <input.txt> <output.scene>"
+              << std::endl;
+    return 1;
+  }
+  std::ifstream input(argv[1]);
+  if (!input) {
+    std::cout << "ERROR::SCENE_CONVERTER::OPEN_FAILED: " << argv[1]
+              << std::endl;
+    return 1;
+  }
+  Parser parser;
+  std::string inputPath = argv[1];
+  parser.directory = inputPath.substr(0, inputPath.find_last_of("/\\") + 1);
+  std::string text;
+  while (std::getline(input, text)) {
+    parser.line++;
+    parser.parse(text);
+  }
+  parser.finishMesh();
+  parser.bakePvs();
+  if (parser.failed || !parser.scene.write(argv[2]))
+    return 1;
+  std::cout << argv[2] << ": " << parser.scene.meshes.size() << " meshes, "
+            << parser.scene.instances.size() << " instances, "
+            << parser.scene.materials.size() << " materials, "
+            << parser.scene.lights.size() << " lights" << std::endl;
+  return 0;
+}